@@ -0,0 +1,101 @@
+"""
+Convert binary logs (.bin) written by the binlog component to csv.
+
+The output matches the text logs written by logging_csv, one line per record
+starting with the local time of the record as HH:MM:SS.mmm, so existing
+plotting scripts keep working. With --header a first line naming the
+columns is added, for csv.DictReader.
+
+usage: python3 binlog_to_csv.py [--header] [--utc] log.bin [out.csv]
+       python3 binlog_to_csv.py [--header] [--utc] logs/*.bin
+           (several files are each written next to the input as .csv)
+"""
+
+import struct
+import sys
+import time
+
+MAGIC = b"IRISCBL\0"
+HEADER = struct.Struct("8sIHHII")
+COLUMN = struct.Struct("24sc7x")
+
+
+def read_header(data):
+    magic, byte_order, version, n_cols, record_size, header_size = \
+        HEADER.unpack_from(data, 0)
+
+    # the file is written in the byte order of the flight computer
+    endian = "<"
+    if byte_order != 0x01020304:
+        endian = ">"
+        magic, byte_order, version, n_cols, record_size, header_size = \
+            struct.unpack_from(">8sIHHII", data, 0)
+
+    if magic != MAGIC or byte_order != 0x01020304:
+        raise ValueError("not a binary log")
+    if version != 1:
+        raise ValueError("unsupported binary log version %d" % version)
+
+    names = []
+    types = ""
+    for ii in range(n_cols):
+        name, col_type = COLUMN.unpack_from(data, HEADER.size + COLUMN.size*ii)
+        names.append(name.split(b"\0")[0].decode())
+        types += col_type.decode()
+
+    record = struct.Struct(endian + "q" + types)
+    if record.size != record_size:
+        raise ValueError("record size %d does not match columns" % record_size)
+
+    return names, types, record, header_size
+
+
+def convert(in_fn, out, header, utc):
+    with open(in_fn, "rb") as f:
+        data = f.read()
+
+    names, types, record, header_size = read_header(data)
+
+    if header:
+        out.write("time," + ",".join(names) + "\n")
+
+    to_time = time.gmtime if utc else time.localtime
+    n_records = (len(data) - header_size) // record.size
+
+    for values in record.iter_unpack(data[header_size:header_size + n_records*record.size]):
+        sec, ns = divmod(values[0], 1000000000)
+        t = to_time(sec)
+        fields = ["%02d:%02d:%02d.%03d" % (t.tm_hour, t.tm_min, t.tm_sec, ns // 1000000)]
+        for col_type, value in zip(types, values[1:]):
+            fields.append(repr(value) if col_type == "d" else str(value))
+        out.write(",".join(fields) + "\n")
+
+    return n_records
+
+
+def main(argv):
+    header = "--header" in argv
+    utc = "--utc" in argv
+    files = [arg for arg in argv if not arg.startswith("--")]
+
+    if not files:
+        print(__doc__)
+        return 1
+
+    if len(files) == 2 and not files[1].endswith(".bin"):
+        with open(files[1], "w") as out:
+            n = convert(files[0], out, header, utc)
+        print("%s: %d records" % (files[0], n))
+        return 0
+
+    for in_fn in files:
+        out_fn = in_fn[:-4] + ".csv" if in_fn.endswith(".bin") else in_fn + ".csv"
+        with open(out_fn, "w") as out:
+            n = convert(in_fn, out, header, utc)
+        print("%s: %d records" % (in_fn, n))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -9,6 +9,8 @@
 #include <string.h>
 
 #include "global_utils.h"
+#include "camera.h"
+#include "camera_utils.h"
 
 #include "sanity_camera.h"
 #include "guiding_camera.h"
@@ -25,6 +27,10 @@ static const module_init_t init_sequence[MODULE_COUNT] = {
 
 int init_camera(void* args){
 
+    #ifdef CAMERA_BENCH
+        bench_shift_flip();
+    #endif
+
     /* init whatever in this module */
     return init_submodules(init_sequence, MODULE_COUNT);
 }
@@ -70,6 +76,27 @@ int save_img_guiding(char* fn){
     return save_img_guiding_local(fn);
 }
 
+/* save_img_guiding_mem:
+ * Same as save_img_guiding, but the image is returned in memory as a
+ * complete FITS file. The frame must be handed to queue_frame or returned
+ * with release_img_frame.
+ *
+ * output:
+ *      frame: the captured image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_NOT_READY: exposure still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: calling save_img beore starting exposure
+ *      ENOMEM: no free frame left in the frame pool
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int save_img_guiding_mem(img_frame_t** frame){
+    return save_img_guiding_mem_l(frame);
+}
+
 /* abort_exp_guiding:
  * Abort an ongoing exposure of the guiding camera and save the image.
  *
@@ -88,6 +115,15 @@ int save_img_guiding(char* fn){
 int abort_exp_guiding(char* fn){
     return abort_exp_guiding_local(fn);
 }
+
+/* get_exp_window_guiding:
+ * Get the CLOCK_MONOTONIC start and end of the latest exposure of the
+ * guiding camera, readout not included.
+ */
+void get_exp_window_guiding(struct timespec* start, struct timespec* end){
+    get_exp_window_guiding_local(start, end);
+}
+
 /* expose_nir:
  * Start an exposure of the nir camera. Call save_img to store store
  * image after exposure
@@ -145,6 +181,28 @@ int abort_exp_nir(void){
     return abort_exp_nir_local();
 }
 
+/* release_img_frame:
+ * Return an image frame to the frame pool of its camera once it has been
+ * stored. The frame must not be used after this.
+ */
+void release_img_frame(img_frame_t* frame){
+    release_frame(frame);
+}
+
+/* get_guiding_pool_stats:
+ * Get the usage statistics of the frame buffer pool of the guiding camera.
+ */
+void get_guiding_pool_stats(frame_pool_stats_t* stats){
+    get_guiding_pool_stats_l(stats);
+}
+
+/* get_nir_pool_stats:
+ * Get the usage statistics of the frame buffer pool of the NIR camera.
+ */
+void get_nir_pool_stats(frame_pool_stats_t* stats){
+    get_nir_pool_stats_l(stats);
+}
+
 double get_guiding_temp(void){
     return get_guiding_temp_l();
 }
@@ -8,6 +8,36 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <time.h>
+
+/* FITS files are made up of 2880 byte blocks of 80 character header cards */
+#define FITS_BLOCK 2880
+#define FITS_CARD 80
+
+/* img_frame_t:
+ * An image kept in memory as a complete FITS file (header block, big-endian
+ * image data and padding) so that it can be compressed and stored without
+ * first being written to and read back from the file system.
+ */
+typedef struct{
+    unsigned char* fits;    /* the FITS file */
+    size_t size;            /* size of the FITS file in bytes */
+    int pool;               /* frame pool the frame belongs to */
+    int width, height;      /* size of the image in pixels */
+} img_frame_t;
+
+/* frame_pool_stats_t:
+ * Usage statistics of the frame buffer pool of a camera.
+ */
+typedef struct{
+    int size;                   /* number of frames in the pool */
+    int in_use;                 /* frames currently handed out */
+    int max_in_use;             /* highest number of frames handed out */
+    unsigned long acquired;     /* total number of frames handed out */
+    unsigned long exhausted;    /* captures failed due to an empty pool */
+} frame_pool_stats_t;
+
 /* initialise the camera component */
 int init_camera(void* args);
 
@@ -50,6 +80,25 @@ int expose_guiding(int exp, int gain);
  */
 int save_img_guiding(char* fn);
 
+/* save_img_guiding_mem:
+ * Same as save_img_guiding, but the image is returned in memory as a
+ * complete FITS file. The frame must be handed to queue_frame or returned
+ * with release_img_frame.
+ *
+ * output:
+ *      frame: the captured image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_NOT_READY: exposure still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: calling save_img beore starting exposure
+ *      ENOMEM: no free frame left in the frame pool
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int save_img_guiding_mem(img_frame_t** frame);
+
 /* abort_exp_guiding:
  * Abort an ongoing exposure of the guiding camera and save the image.
  *
@@ -67,6 +116,17 @@ int save_img_guiding(char* fn);
  */
 int abort_exp_guiding(char* fn);
 
+/* get_exp_window_guiding:
+ * Get the time span of the latest exposure of the guiding camera. The end is
+ * the start plus the set exposure time, or the time the exposure was aborted,
+ * readout not included.
+ *
+ * output:
+ *      start: CLOCK_MONOTONIC time the exposure was started
+ *      end: CLOCK_MONOTONIC time the exposure ended
+ */
+void get_exp_window_guiding(struct timespec* start, struct timespec* end);
+
 /* expose_nir:
  * Start an exposure of the nir camera. Call save_img to store store
  * image after exposure
@@ -118,6 +178,22 @@ int save_img_nir(void);
  */
 int abort_exp_nir(void);
 
+/* release_img_frame:
+ * Return an image frame to the frame pool of its camera once it has been
+ * stored. The frame must not be used after this.
+ */
+void release_img_frame(img_frame_t* frame);
+
+/* get_guiding_pool_stats:
+ * Get the usage statistics of the frame buffer pool of the guiding camera.
+ */
+void get_guiding_pool_stats(frame_pool_stats_t* stats);
+
+/* get_nir_pool_stats:
+ * Get the usage statistics of the frame buffer pool of the NIR camera.
+ */
+void get_nir_pool_stats(frame_pool_stats_t* stats);
+
 double get_guiding_temp(void);
 
 double get_nir_temp(void);
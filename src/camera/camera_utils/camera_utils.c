@@ -16,17 +16,73 @@
 #include <fitsio.h>
 #include <errno.h>
 #include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    #include <immintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
 
 #include "global_utils.h"
 #include "camera_utils.h"
 
+/* alignment of the frame buffers, FITS_BLOCK is a multiple of it so the
+ * image data following the header block is aligned as well
+ */
+#define FRAME_ALIGN 64
+
+#define MAX_POOL_SIZE (NIR_POOL_SIZE > GUIDE_POOL_SIZE ? \
+        NIR_POOL_SIZE : GUIDE_POOL_SIZE)
+
+/* frame_pool_t:
+ * Preallocated frames of one camera, free frames are kept on a stack.
+ */
+typedef struct{
+    pthread_mutex_t lock;
+    img_frame_t frames[MAX_POOL_SIZE];
+    img_frame_t* free[MAX_POOL_SIZE];
+    int free_cnt;
+    frame_pool_stats_t stats;
+} frame_pool_t;
+
 static struct timespec start_time[2];
 static char exp_start_datetime[2][20];
 static int timeref[2];
 
+/* CLOCK_MONOTONIC start and end of the latest exposure of each camera */
+static struct timespec exp_start_mono[2], exp_end_mono[2];
+
+static frame_pool_t pool[2] = {
+    {.lock = PTHREAD_MUTEX_INITIALIZER},
+    {.lock = PTHREAD_MUTEX_INITIALIZER}
+};
+
+static int pool_setup(int id, int width, int height, int pool_size,
+        char cam_name);
+static int acquire_frame(int id, char* cam_name, img_frame_t** frame);
+static int exp_status(int id, char* cam_name);
+static int fetch_img(ASI_CAMERA_INFO* cam_info, char* cam_name,
+        unsigned short* buffer);
+static void exp_params(ASI_CAMERA_INFO* cam_info, struct timespec* exp_time,
+        long* exposure, long* gain);
+static void stop_exp(ASI_CAMERA_INFO* cam_info, char* cam_name,
+        struct timespec* exp_time);
 static int write_img(unsigned short* buffer,
         ASI_CAMERA_INFO* cam_info, char* fn, struct timespec* exp_time);
-static void yflip(unsigned short* buffer, int width, int height);
+static void shift_flip(unsigned short* buffer, int width, int height);
+static void shift_swap_rows(unsigned short* top, unsigned short* bot,
+        int width);
+static void shift_swap_scalar(unsigned short* top, unsigned short* bot,
+        int start, int width);
+static void build_fits(img_frame_t* frame, ASI_CAMERA_INFO* cam_info,
+        struct timespec* exp_time);
+static void fits_card(char* card, const char* key, const char* value,
+        const char* comment);
+static uint32_t fits_sum(const unsigned char* buf, size_t len, uint32_t sum);
+static uint32_t fold_sum(uint64_t hi, uint64_t lo);
+static void fits_encode(uint32_t value, char* ascii);
 
 /* cam_setup:
  * Set up and initialize a given ZWO ASI camera.
@@ -47,16 +103,18 @@ static void yflip(unsigned short* buffer, int width, int height);
  */
 int cam_setup(ASI_CAMERA_INFO* cam_info, char cam_name){
 
-    int ret, height, width;
+    int ret, height, width, pool_size;
 
     switch(cam_name){
         case 'n':
             height = NIR_HEIGHT;
             width = NIR_WIDTH;
+            pool_size = NIR_POOL_SIZE;
             break;
         case 'g':
             height = GUIDE_HEIGHT;
             width = GUIDE_WIDTH;
+            pool_size = GUIDE_POOL_SIZE;
             break;
         default:
             logging(ERROR, "INIT", "Incorrect camera name: %c", cam_name);
@@ -105,9 +163,133 @@ int cam_setup(ASI_CAMERA_INFO* cam_info, char cam_name){
         return FAILURE;
     }
 
+    /* allocate all image buffers up front, while memory is locked */
+    ret = pool_setup(id, width, height, pool_size, cam_name);
+    if(ret != SUCCESS){
+        return FAILURE;
+    }
+
     return ASI_SUCCESS;
 }
 
+/* pool_setup:
+ * Allocate the frame pool of a camera. Every frame is large enough to hold
+ * a FITS file of a full image and is touched once so that it is faulted in
+ * and locked in memory before any capture.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *      width: pixel width of the camera images
+ *      height: pixel height of the camera images
+ *      pool_size: number of frames in the pool
+ *      cam_name: name of camera for logging
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOMEM: failed to allocate the frames
+ */
+static int pool_setup(int id, int width, int height, int pool_size,
+        char cam_name){
+
+    frame_pool_t* fp = &pool[id];
+
+    /* header block followed by the image data padded to a full block */
+    size_t data_size = (size_t)width * height * 2;
+    size_t data_blocks = (data_size + FITS_BLOCK - 1) / FITS_BLOCK;
+    size_t size = FITS_BLOCK + data_blocks * FITS_BLOCK;
+
+    pthread_mutex_lock(&fp->lock);
+    for(int ii=fp->stats.size; ii<pool_size; ++ii){
+        unsigned char* buffer = aligned_alloc(FRAME_ALIGN, size);
+        if(buffer == NULL){
+            pthread_mutex_unlock(&fp->lock);
+            logging(ERROR, "Camera",
+                    "Cannot allocate frame pool for camera: %c", cam_name);
+            return ENOMEM;
+        }
+        memset(buffer, 0, size);
+
+        fp->frames[ii].fits = buffer;
+        fp->frames[ii].size = size;
+        fp->frames[ii].pool = id;
+        fp->frames[ii].width = width;
+        fp->frames[ii].height = height;
+        fp->free[fp->free_cnt++] = &fp->frames[ii];
+        fp->stats.size++;
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    return SUCCESS;
+}
+
+/* acquire_frame:
+ * Take a free frame from the frame pool of a camera.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *      cam_name: name of camera for logging
+ *
+ * output:
+ *      frame: the acquired frame
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOMEM: all frames of the pool are in use
+ */
+static int acquire_frame(int id, char* cam_name, img_frame_t** frame){
+
+    frame_pool_t* fp = &pool[id];
+
+    pthread_mutex_lock(&fp->lock);
+    if(fp->free_cnt == 0){
+        unsigned long exhausted = ++fp->stats.exhausted;
+        pthread_mutex_unlock(&fp->lock);
+
+        logging(ERROR, "Camera", "Frame pool of %s camera exhausted, "
+                "times exhausted: %lu", cam_name, exhausted);
+        return ENOMEM;
+    }
+
+    *frame = fp->free[--fp->free_cnt];
+
+    fp->stats.acquired++;
+    if(++fp->stats.in_use > fp->stats.max_in_use){
+        fp->stats.max_in_use = fp->stats.in_use;
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    return SUCCESS;
+}
+
+/* release_frame:
+ * Return a frame from save_img_mem or abort_exp_mem to its frame pool.
+ */
+void release_frame(img_frame_t* frame){
+
+    frame_pool_t* fp = &pool[frame->pool];
+
+    pthread_mutex_lock(&fp->lock);
+    fp->free[fp->free_cnt++] = frame;
+    fp->stats.in_use--;
+    pthread_mutex_unlock(&fp->lock);
+}
+
+/* get_pool_stats:
+ * Get the usage statistics of the frame pool of a camera.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *
+ * output:
+ *      stats: statistics of the frame pool
+ */
+void get_pool_stats(int id, frame_pool_stats_t* stats){
+
+    pthread_mutex_lock(&pool[id].lock);
+    *stats = pool[id].stats;
+    pthread_mutex_unlock(&pool[id].lock);
+}
+
 /* expose:
  * Start an exposure of a ZWO ASI camera. Call save_img to store store
  * image after exposure
@@ -151,7 +333,16 @@ int expose(int id, int exp, int gain, char* cam_name){
 
     ffgstm(exp_start_datetime[id], &timeref[id], &ret);
     clock_gettime(CLOCK_REALTIME, &start_time[id]);
+    clock_gettime(CLOCK_MONOTONIC, &exp_start_mono[id]);
     ASIStartExposure(id, ASI_FALSE);
+
+    /* ends after the set exposure time unless aborted */
+    exp_end_mono[id].tv_sec = exp_start_mono[id].tv_sec + exp / 1000000;
+    exp_end_mono[id].tv_nsec = exp_start_mono[id].tv_nsec + (exp % 1000000) * 1000L;
+    if(exp_end_mono[id].tv_nsec >= 1000000000){
+        exp_end_mono[id].tv_sec++;
+        exp_end_mono[id].tv_nsec -= 1000000000;
+    }
     if(ret != ASI_SUCCESS){
         logging(ERROR, "Camera",
                 "Failed to start exposure of %s camera.", cam_name);
@@ -188,9 +379,106 @@ int expose(int id, int exp, int gain, char* cam_name){
 int save_img(ASI_CAMERA_INFO* cam_info, char* fn,
         char* cam_name, struct timespec* exp_time){
 
-    int id = cam_info->CameraID, ret;
+    int ret = exp_status(cam_info->CameraID, cam_name);
+    if(ret != SUCCESS){
+        return ret;
+    }
+
+    /* use the data part of a pool frame as buffer for the bitmap */
+    img_frame_t* frame;
+    ret = acquire_frame(cam_info->CameraID, cam_name, &frame);
+    if(ret != SUCCESS){
+        return ret;
+    }
+    unsigned short* buffer = (unsigned short*)&frame->fits[FITS_BLOCK];
+
+    ret = fetch_img(cam_info, cam_name, buffer);
+    if(ret == SUCCESS){
+        ret = write_img(buffer, cam_info, fn, exp_time);
+    }
+
+    release_frame(frame);
+    return ret;
+}
+
+/* save_img_mem:
+ * Same as save_img, but instead of writing a .fit file the image is returned
+ * in memory as a complete FITS file, header and checksums included.
+ * The frame is taken from the frame pool of the camera and must be returned
+ * with release_frame once it has been stored.
+ *
+ * input:
+ *      cam_info: info for relevant camera
+ *      cam_name: name of camera for logging
+ *      exp_time: calculated exposure time if the exposure was aborted,
+ *                NULL if not
+ *
+ * output:
+ *      frame: the captured image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_NOT_READY: exposure still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: calling save_img_mem beore starting exposure
+ *      ENOMEM: no free frame left in the frame pool
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int save_img_mem(ASI_CAMERA_INFO* cam_info, char* cam_name,
+        struct timespec* exp_time, img_frame_t** frame){
+
+    int ret = exp_status(cam_info->CameraID, cam_name);
+    if(ret != SUCCESS){
+        return ret;
+    }
+
+    ret = acquire_frame(cam_info->CameraID, cam_name, frame);
+    if(ret != SUCCESS){
+        return ret;
+    }
+
+    unsigned short* data = (unsigned short*)&(*frame)->fits[FITS_BLOCK];
+
+    ret = fetch_img(cam_info, cam_name, data);
+    if(ret != SUCCESS){
+        release_frame(*frame);
+        return ret;
+    }
+
+    build_fits(*frame, cam_info, exp_time);
+
+    return SUCCESS;
+}
+
+/* get_exp_window:
+ * Get the time span of the latest exposure of a camera, for matching the
+ * image with other sensor data. The end is the start plus the set exposure
+ * time, or the time the exposure was aborted, readout not included.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *
+ * output:
+ *      start: CLOCK_MONOTONIC time the exposure was started
+ *      end: CLOCK_MONOTONIC time the exposure ended
+ */
+void get_exp_window(int id, struct timespec* start, struct timespec* end){
+    *start = exp_start_mono[id];
+    *end = exp_end_mono[id];
+}
+
+/* exp_status:
+ * Check the current exposure status of a camera.
+ *
+ * return:
+ *      SUCCESS: exposure is finished and the image can be fetched
+ *      EXP_NOT_READY: exposure still ongoing
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: no exposure has been started
+ */
+static int exp_status(int id, char* cam_name){
 
-    /* check current exposure status */
     ASI_EXPOSURE_STATUS exp_stat;
     ASIGetExpStatus(id, &exp_stat);
     switch(exp_stat){
@@ -208,20 +496,33 @@ int save_img(ASI_CAMERA_INFO* cam_info, char* fn,
             break;
     }
 
-    /* buffer for bitmap */
+    return SUCCESS;
+}
+
+/* fetch_img:
+ * Fetch the image of a finished exposure from the camera into buffer,
+ * reduce it to the 12 significant bits, and flip it vertically.
+ *
+ * input:
+ *      cam_info: info for relevant camera
+ *      cam_name: name of camera for logging
+ *      buffer: bitmap of size [MaxHeight*MaxWidth]
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+static int fetch_img(ASI_CAMERA_INFO* cam_info, char* cam_name,
+        unsigned short* buffer){
+
     int width = cam_info->MaxWidth;
     int height = cam_info->MaxHeight;
-    int buffer_size = width*height*2;
-    unsigned char* buffer = (unsigned char*) malloc(buffer_size);
-
-    if(buffer == NULL){
-        logging(ERROR, "Camera",
-                "Cannot allocate memory for image buffer");
-        return ENOMEM;
-    }
+    long buffer_size = (long)width*height*2;
 
     /* fetch data */
-    ret = ASIGetDataAfterExp(id, buffer, buffer_size);
+    int ret = ASIGetDataAfterExp(cam_info->CameraID,
+            (unsigned char*)buffer, buffer_size);
     if(ret == ASI_ERROR_INVALID_ID){
         logging(ERROR, "Camera",
                 "Camera disconnected when fetching data: %s", cam_name);
@@ -233,18 +534,39 @@ int save_img(ASI_CAMERA_INFO* cam_info, char* fn,
         return EIO;
     }
 
-    unsigned short* buff = (unsigned short*)buffer;
+    shift_flip(buffer, width, height);
 
-    for(int ii=0; ii<buffer_size/2; ++ii){
-        buff[ii] = buff[ii]>>4;
-    }
+    return SUCCESS;
+}
 
-    yflip(buff, width, height);
+/* exp_params:
+ * Fetch the exposure time and gain of the latest exposure for the header.
+ *
+ * input:
+ *      cam_info: camera info object for camera capturing the image
+ *      exp_time: calculated exposure time if the exposure was aborted
+ *                NULL if not
+ *
+ * output:
+ *      exposure: exposure time in microseconds
+ *      gain: sensor gain
+ */
+static void exp_params(ASI_CAMERA_INFO* cam_info, struct timespec* exp_time,
+        long* exposure, long* gain){
 
-    ret = write_img(buff, cam_info, fn, exp_time);
+    ASI_BOOL pb_auto = ASI_FALSE;
+    if(exp_time != NULL){
+        *exposure = exp_time->tv_sec * 1000000 + exp_time->tv_nsec / 1000;
+        #ifdef CAMERA_DEBUG
+            logging(DEBUG, "Camera",
+                    "aborted after exposing for %ld microseconds", *exposure);
+        #endif
+    }
+    else{
+        ASIGetControlValue(cam_info->CameraID, ASI_EXPOSURE, exposure, &pb_auto);
+    }
 
-    free(buffer);
-    return ret;
+    ASIGetControlValue(cam_info->CameraID, ASI_GAIN, gain, &pb_auto);
 }
 
 /* write_img:
@@ -302,17 +624,8 @@ static int write_img(unsigned short* buffer,
         logging(DEBUG, "Camera", "updating header");
     #endif
     long exposure, gain;
-    ASI_BOOL pb_auto = ASI_FALSE;
-    if(exp_time != NULL){
-        exposure = exp_time->tv_sec * 1000000 + exp_time->tv_nsec / 1000;
-        #ifdef CAMERA_DEBUG
-            logging(DEBUG, "Camera",
-                    "aborted after exposing for %ld microseconds", exposure);
-        #endif
-    }
-    else{
-        ASIGetControlValue(cam_info->CameraID, ASI_EXPOSURE, &exposure, &pb_auto);
-    }
+    exp_params(cam_info, exp_time, &exposure, &gain);
+
     fits_update_key(fptr, TLONG, "EXPOINUS", &exposure,
             "Exposure time in us", &ret);
     if(ret != 0){
@@ -320,7 +633,6 @@ static int write_img(unsigned short* buffer,
         return FAILURE;
     }
 
-    ASIGetControlValue(cam_info->CameraID, ASI_GAIN, &gain, &pb_auto);
     fits_update_key(fptr, TLONG, "GAIN", &gain,
             "The ratio of output / input", &ret);
     if(ret != 0){
@@ -368,25 +680,370 @@ static int write_img(unsigned short* buffer,
     return SUCCESS;
 }
 
-/* yflip:
- * vertically flips a bitmap
+/* shift_flip:
+ * Reduce a bitmap to its 12 significant bits and flip it vertically, in a
+ * single pass where each row is shifted while being swapped with its
+ * mirrored row.
  *
  * input:
  *      width: pixel width of image
  *      height: pixel height of image
  *      buffer: a bitmap of size [height*width]
  */
-static void yflip(unsigned short* buffer, int width, int height){
-    unsigned short (*buff)[width] = (unsigned short (*)[width])buffer;
-    unsigned short tmp;
-
-    for(int ii=0; ii<height/2; ++ii){
-        for(int jj=0; jj<width; ++jj){
-            tmp = buff[ii][jj];
-            buff[ii][jj] = buff[height-1-ii][jj];
-            buff[height-1-ii][jj] = tmp;
+static void shift_flip(unsigned short* buffer, int width, int height){
+
+    /* the middle row of an odd height is swapped with itself */
+    for(int ii=0; ii<(height+1)/2; ++ii){
+        shift_swap_rows(&buffer[(long)ii*width],
+                &buffer[(long)(height-1-ii)*width], width);
+    }
+}
+
+/* shift_swap_rows:
+ * Swap two rows while shifting out the 4 unused bits of every pixel, using
+ * AVX2 or SSE2 on x86 and NEON on ARM when available. The remainder of
+ * the row, or all of it without SIMD support, is handled by
+ * shift_swap_scalar, giving identical results on all paths.
+ *
+ * input:
+ *      top, bot: the rows to swap, may be the same row
+ *      width: pixel width of the rows
+ */
+static void shift_swap_rows(unsigned short* top, unsigned short* bot,
+        int width){
+
+    int jj = 0;
+
+    #if defined(__AVX2__)
+        for(; jj+16<=width; jj+=16){
+            __m256i a = _mm256_loadu_si256((__m256i*)&top[jj]);
+            __m256i b = _mm256_loadu_si256((__m256i*)&bot[jj]);
+            _mm256_storeu_si256((__m256i*)&top[jj], _mm256_srli_epi16(b, 4));
+            _mm256_storeu_si256((__m256i*)&bot[jj], _mm256_srli_epi16(a, 4));
+        }
+    #elif defined(__SSE2__)
+        for(; jj+8<=width; jj+=8){
+            __m128i a = _mm_loadu_si128((__m128i*)&top[jj]);
+            __m128i b = _mm_loadu_si128((__m128i*)&bot[jj]);
+            _mm_storeu_si128((__m128i*)&top[jj], _mm_srli_epi16(b, 4));
+            _mm_storeu_si128((__m128i*)&bot[jj], _mm_srli_epi16(a, 4));
+        }
+    #elif defined(__ARM_NEON)
+        for(; jj+8<=width; jj+=8){
+            uint16x8_t a = vld1q_u16(&top[jj]);
+            uint16x8_t b = vld1q_u16(&bot[jj]);
+            vst1q_u16(&top[jj], vshrq_n_u16(b, 4));
+            vst1q_u16(&bot[jj], vshrq_n_u16(a, 4));
+        }
+    #endif
+
+    shift_swap_scalar(top, bot, jj, width);
+}
+
+/* shift_swap_scalar:
+ * Plain C version of shift_swap_rows, starting at pixel start.
+ */
+static void shift_swap_scalar(unsigned short* top, unsigned short* bot,
+        int start, int width){
+
+    for(int jj=start; jj<width; ++jj){
+        unsigned short tmp = top[jj];
+        top[jj] = bot[jj]>>4;
+        bot[jj] = tmp>>4;
+    }
+}
+
+#ifdef CAMERA_BENCH
+/* bench_shift_flip:
+ * Micro-benchmark of shift_flip on a full NIR image. The result is compared
+ * to the scalar version and the throughput of the previous two pass
+ * implementation, the scalar version and memcpy are logged for reference.
+ */
+void bench_shift_flip(void){
+
+    const int width = NIR_WIDTH, height = NIR_HEIGHT, runs = 10;
+    size_t size = (size_t)width * height * 2;
+    struct timespec start, stop;
+    double time[4] = {0};
+
+    unsigned short* img = malloc(size);
+    unsigned short* ref = malloc(size);
+    unsigned short* buffer = malloc(size);
+    if(img == NULL || ref == NULL || buffer == NULL){
+        logging(ERROR, "Camera", "Cannot allocate memory for benchmark");
+        free(img);
+        free(ref);
+        free(buffer);
+        return;
+    }
+
+    unsigned int seed = 1;
+    for(size_t ii=0; ii<size/2; ++ii){
+        seed = seed * 1103515245 + 12345;
+        img[ii] = seed >> 16;
+    }
+
+    for(int run=0; run<runs; ++run){
+
+        /* previous implementation: shift pass followed by flip pass */
+        memcpy(ref, img, size);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(size_t ii=0; ii<size/2; ++ii){
+            ref[ii] = ref[ii]>>4;
+        }
+        unsigned short (*rows)[width] = (unsigned short (*)[width])ref;
+        for(int ii=0; ii<height/2; ++ii){
+            for(int jj=0; jj<width; ++jj){
+                unsigned short tmp = rows[ii][jj];
+                rows[ii][jj] = rows[height-1-ii][jj];
+                rows[height-1-ii][jj] = tmp;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        time[0] += (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+        memcpy(buffer, img, size);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int ii=0; ii<(height+1)/2; ++ii){
+            shift_swap_scalar(&buffer[(long)ii*width],
+                    &buffer[(long)(height-1-ii)*width], 0, width);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        time[1] += (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+        if(memcmp(buffer, ref, size)){
+            logging(ERROR, "Camera", "Scalar shift_flip output differs");
+        }
+
+        memcpy(buffer, img, size);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        shift_flip(buffer, width, height);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        time[2] += (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+        if(memcmp(buffer, ref, size)){
+            logging(ERROR, "Camera", "shift_flip output differs");
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        memcpy(buffer, img, size);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        time[3] += (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) / 1e9;
+    }
+
+    double mb = (double)size * runs / 1e6;
+    logging(INFO, "Camera", "shift and flip, two pass: %.0f MB/s, "
+            "scalar: %.0f MB/s, fused: %.0f MB/s, memcpy: %.0f MB/s",
+            mb / time[0], mb / time[1], mb / time[2], mb / time[3]);
+
+    free(img);
+    free(ref);
+    free(buffer);
+}
+#endif
+
+/* build_fits:
+ * Turn a frame holding a fetched image into a complete FITS file: the image
+ * data is converted to big-endian in place and the header block, including
+ * the same keywords and checksums as written by write_img, is built in
+ * front of it.
+ *
+ * input:
+ *      frame: frame with the image data following the header block
+ *      cam_info: camera info object for camera capturing the image
+ *      exp_time: calculated exposure time if the exposure was aborted
+ *                NULL if not
+ */
+static void build_fits(img_frame_t* frame, ASI_CAMERA_INFO* cam_info,
+        struct timespec* exp_time){
+
+    char* header = (char*)frame->fits;
+    unsigned char* data = &frame->fits[FITS_BLOCK];
+    size_t data_size = (size_t)cam_info->MaxWidth * cam_info->MaxHeight * 2;
+    size_t pad_size = frame->size - FITS_BLOCK - data_size;
+
+    memset(&data[data_size], 0, pad_size);
+
+    /* convert to big-endian while summing up the data checksum, where the
+     * high and low half of each 32 bit word are two consecutive pixels
+     */
+    unsigned short* pix = (unsigned short*)data;
+    uint64_t hi = 0, lo = 0;
+    for(size_t ii=0; ii<data_size/2; ii+=2){
+        hi += pix[ii];
+        lo += pix[ii+1];
+        #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            pix[ii] = __builtin_bswap16(pix[ii]);
+            pix[ii+1] = __builtin_bswap16(pix[ii+1]);
+        #endif
+    }
+    uint32_t datasum = fold_sum(hi, lo);
+
+    long exposure, gain;
+    exp_params(cam_info, exp_time, &exposure, &gain);
+
+    char value[FITS_CARD];
+    int card = 0;
+
+    memset(header, ' ', FITS_BLOCK);
+
+    fits_card(&header[FITS_CARD * card++], "SIMPLE", "                   T",
+            "file does conform to FITS standard");
+    fits_card(&header[FITS_CARD * card++], "BITPIX", "                  16",
+            "number of bits per data pixel");
+    fits_card(&header[FITS_CARD * card++], "NAXIS", "                   2",
+            "number of data axes");
+    snprintf(value, FITS_CARD, "%20ld", cam_info->MaxWidth);
+    fits_card(&header[FITS_CARD * card++], "NAXIS1", value,
+            "length of data axis 1");
+    snprintf(value, FITS_CARD, "%20ld", cam_info->MaxHeight);
+    fits_card(&header[FITS_CARD * card++], "NAXIS2", value,
+            "length of data axis 2");
+    fits_card(&header[FITS_CARD * card++], "EXTEND", "                   T",
+            "FITS dataset may contain extensions");
+    snprintf(value, FITS_CARD, "%20ld", exposure);
+    fits_card(&header[FITS_CARD * card++], "EXPOINUS", value,
+            "Exposure time in us");
+    snprintf(value, FITS_CARD, "%20ld", gain);
+    fits_card(&header[FITS_CARD * card++], "GAIN", value,
+            "The ratio of output / input");
+    snprintf(value, FITS_CARD, "'%s'", exp_start_datetime[cam_info->CameraID]);
+    fits_card(&header[FITS_CARD * card++], "DATE", value,
+            "Exposure start time (YYYY-MM-DDThh:mm:ss UTC)");
+
+    int checksum_card = card;
+    fits_card(&header[FITS_CARD * card++], "CHECKSUM", "'0000000000000000'",
+            "HDU checksum");
+    snprintf(value, FITS_CARD, "'%u'", datasum);
+    fits_card(&header[FITS_CARD * card++], "DATASUM", value,
+            "data unit checksum");
+    memcpy(&header[FITS_CARD * card++], "END", 3);
+
+    /* the checksum is chosen so that the entire HDU sums up to -0 */
+    uint32_t sum = fits_sum(frame->fits, FITS_BLOCK, datasum);
+    fits_encode(~sum, &header[FITS_CARD * checksum_card + 11]);
+}
+
+/* fits_card:
+ * Write a header card, the value has to be formatted in advance.
+ *
+ * input:
+ *      key: keyword of at most 8 characters
+ *      value: fixed format value, numbers right justified to 20 characters
+ *             and strings within single quotes
+ *      comment: comment to follow the value
+ *
+ * output:
+ *      card: 80 character header card, not null terminated
+ */
+static void fits_card(char* card, const char* key, const char* value,
+        const char* comment){
+
+    char buffer[FITS_CARD + 1];
+    int len = snprintf(buffer, FITS_CARD + 1, "%-8.8s= %-20s / %s",
+            key, value, comment);
+    if(len > FITS_CARD){
+        len = FITS_CARD;
+    }
+
+    memcpy(card, buffer, len);
+    memset(&card[len], ' ', FITS_CARD - len);
+}
+
+/* fits_sum:
+ * Add a buffer to a 32 bit ones' complement sum, as used for the FITS
+ * CHECKSUM and DATASUM keywords.
+ *
+ * input:
+ *      buf: data to add, big-endian
+ *      len: length of buf in bytes, multiple of 4
+ *      sum: sum to add to
+ *
+ * return:
+ *      the resulting sum
+ */
+static uint32_t fits_sum(const unsigned char* buf, size_t len, uint32_t sum){
+
+    uint64_t hi = sum >> 16, lo = sum & 0xFFFF;
+
+    for(size_t ii=0; ii<len; ii+=4){
+        hi += (buf[ii] << 8) | buf[ii+1];
+        lo += (buf[ii+2] << 8) | buf[ii+3];
+    }
+
+    return fold_sum(hi, lo);
+}
+
+/* fold_sum:
+ * Fold separately accumulated high and low 16 bit halves into a 32 bit
+ * ones' complement sum by adding the carries around.
+ */
+static uint32_t fold_sum(uint64_t hi, uint64_t lo){
+
+    uint64_t hicarry = hi >> 16, locarry = lo >> 16;
+
+    while(hicarry || locarry){
+        hi = (hi & 0xFFFF) + locarry;
+        lo = (lo & 0xFFFF) + hicarry;
+        hicarry = hi >> 16;
+        locarry = lo >> 16;
+    }
+
+    return (uint32_t)(hi << 16 | lo);
+}
+
+/* fits_encode:
+ * Encode a checksum as the 16 character ASCII string used for the CHECKSUM
+ * keyword, avoiding punctuation characters.
+ *
+ * input:
+ *      value: the complement of the HDU sum
+ *
+ * output:
+ *      ascii: 16 characters, not null terminated
+ */
+static void fits_encode(uint32_t value, char* ascii){
+
+    const char exclude[13] = {0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x40,
+                              0x5b, 0x5c, 0x5d, 0x5e, 0x5f, 0x60};
+    char asc[16];
+    int ch[4];
+
+    for(int ii=0; ii<4; ++ii){
+        int byte = (value >> (8 * (3 - ii))) & 0xFF;
+
+        for(int jj=0; jj<4; ++jj){
+            ch[jj] = byte / 4 + '0';
+        }
+        ch[0] += byte % 4;
+
+        int check = 1;
+        while(check){
+            check = 0;
+            for(int kk=0; kk<13; ++kk){
+                for(int jj=0; jj<4; jj+=2){
+                    if(ch[jj] == exclude[kk] || ch[jj+1] == exclude[kk]){
+                        ch[jj]++;
+                        ch[jj+1]--;
+                        check = 1;
+                    }
+                }
+            }
+        }
+
+        for(int jj=0; jj<4; ++jj){
+            asc[4*jj+ii] = ch[jj];
         }
     }
+
+    /* rotate by one byte as the sum is taken over 32 bit words */
+    for(int ii=0; ii<16; ++ii){
+        ascii[ii] = asc[(ii+15)%16];
+    }
 }
 
 /* abort_exp:
@@ -408,10 +1065,56 @@ static void yflip(unsigned short* buffer, int width, int height){
  */
 int abort_exp(ASI_CAMERA_INFO* cam_info, char* fn, char* cam_name){
 
-    struct timespec stop_time, exp_time;
+    struct timespec exp_time;
+    stop_exp(cam_info, cam_name, &exp_time);
+
+    return save_img(cam_info, fn, cam_name, &exp_time);
+}
+
+/* abort_exp_mem:
+ * Abort an ongoing exposure and return the image in memory, see save_img_mem.
+ *
+ * input:
+ *      cam_info: info for relevant camera
+ *      cam_name: name of camera for logging
+ *
+ * output:
+ *      frame: the captured image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: calling save_img_mem beore starting exposure
+ *      ENOMEM: no free frame left in the frame pool
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int abort_exp_mem(ASI_CAMERA_INFO* cam_info, char* cam_name, img_frame_t** frame){
+
+    struct timespec exp_time;
+    stop_exp(cam_info, cam_name, &exp_time);
+
+    return save_img_mem(cam_info, cam_name, &exp_time, frame);
+}
+
+/* stop_exp:
+ * Stop an ongoing exposure and calculate for how long it was exposing.
+ *
+ * input:
+ *      cam_info: info for relevant camera
+ *      cam_name: name of camera for logging
+ *
+ * output:
+ *      exp_time: time from start of exposure until it was stopped
+ */
+static void stop_exp(ASI_CAMERA_INFO* cam_info, char* cam_name,
+        struct timespec* exp_time){
+
+    struct timespec stop_time;
     logging(WARN, "Camera", "Aborting exposure of %s camera", cam_name);
 
     clock_gettime(CLOCK_REALTIME, &stop_time);
+    clock_gettime(CLOCK_MONOTONIC, &exp_end_mono[cam_info->CameraID]);
     int ret = ASIStopExposure(cam_info->CameraID);
     if(ret == ASI_ERROR_INVALID_ID){
         logging(ERROR, "Camera",
@@ -422,15 +1125,13 @@ int abort_exp(ASI_CAMERA_INFO* cam_info, char* fn, char* cam_name){
     }
 
     if(stop_time.tv_nsec < start_time[cam_info->CameraID].tv_nsec){
-        exp_time.tv_sec = stop_time.tv_sec - start_time[cam_info->CameraID].tv_sec - 1;
-        exp_time.tv_nsec = stop_time.tv_nsec + 1000000000 - start_time[cam_info->CameraID].tv_nsec;
+        exp_time->tv_sec = stop_time.tv_sec - start_time[cam_info->CameraID].tv_sec - 1;
+        exp_time->tv_nsec = stop_time.tv_nsec + 1000000000 - start_time[cam_info->CameraID].tv_nsec;
     }
     else{
-        exp_time.tv_sec = stop_time.tv_sec - start_time[cam_info->CameraID].tv_sec;
-        exp_time.tv_nsec = stop_time.tv_nsec - start_time[cam_info->CameraID].tv_nsec;
+        exp_time->tv_sec = stop_time.tv_sec - start_time[cam_info->CameraID].tv_sec;
+        exp_time->tv_nsec = stop_time.tv_nsec - start_time[cam_info->CameraID].tv_nsec;
     }
-
-    return save_img(cam_info, fn, cam_name, &exp_time);
 }
 
 #if 0
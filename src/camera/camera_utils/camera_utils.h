@@ -9,7 +9,10 @@
 
 #pragma once
 
+#include <time.h>
+
 #include "ASICamera2.h"
+#include "camera.h"
 
 /* camera resolutions */
 #define NIR_WIDTH 5496
@@ -17,6 +20,15 @@
 #define GUIDE_WIDTH 1936
 #define GUIDE_HEIGHT 1096
 
+/* number of preallocated frame buffers per camera, NIR frames are held by
+ * the image handler while being compressed so a new one can be captured
+ * in the meantime. Each frame holds a FITS file of the full sensor, which
+ * in total locks about 81 MB for the NIR camera and 8.5 MB for the
+ * guiding camera.
+ */
+#define NIR_POOL_SIZE 2
+#define GUIDE_POOL_SIZE 2
+
 /* cam_setup:
  * Set up and initialize a given ZWO ASI camera.
  *
@@ -79,6 +91,33 @@ int expose(int id, int exp, int gain, char* cam_name);
  */
 int save_img(ASI_CAMERA_INFO* cam_info, char* fn, char* cam_name, struct timespec* exp_time);
 
+/* save_img_mem:
+ * Same as save_img, but instead of writing a .fit file the image is returned
+ * in memory as a complete FITS file, header and checksums included.
+ * The frame is taken from the frame pool of the camera and must be returned
+ * with release_frame once it has been stored.
+ *
+ * input:
+ *      cam_info: info for relevant camera
+ *      cam_name: name of camera for logging
+ *      exp_time: calculated exposure time if the exposure was aborted,
+ *                NULL if not
+ *
+ * output:
+ *      frame: the captured image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_NOT_READY: exposure still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: calling save_img_mem beore starting exposure
+ *      ENOMEM: no free frame left in the frame pool
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int save_img_mem(ASI_CAMERA_INFO* cam_info, char* cam_name,
+        struct timespec* exp_time, img_frame_t** frame);
+
 /* abort_exp:
  * Abort an ongoing exposure and save the image.
  *
@@ -98,4 +137,62 @@ int save_img(ASI_CAMERA_INFO* cam_info, char* fn, char* cam_name, struct timespe
  */
 int abort_exp(ASI_CAMERA_INFO* cam_info, char* fn, char* cam_name);
 
+/* abort_exp_mem:
+ * Abort an ongoing exposure and return the image in memory, see save_img_mem.
+ *
+ * input:
+ *      cam_info: info for relevant camera
+ *      cam_name: name of camera for logging
+ *
+ * output:
+ *      frame: the captured image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: calling save_img_mem beore starting exposure
+ *      ENOMEM: no free frame left in the frame pool
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int abort_exp_mem(ASI_CAMERA_INFO* cam_info, char* cam_name, img_frame_t** frame);
+
+/* release_frame:
+ * Return a frame from save_img_mem or abort_exp_mem to its frame pool.
+ */
+void release_frame(img_frame_t* frame);
+
+/* get_exp_window:
+ * Get the time span of the latest exposure of a camera, for matching the
+ * image with other sensor data. The end is the start plus the set exposure
+ * time, or the time the exposure was aborted, readout not included.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *
+ * output:
+ *      start: CLOCK_MONOTONIC time the exposure was started
+ *      end: CLOCK_MONOTONIC time the exposure ended
+ */
+void get_exp_window(int id, struct timespec* start, struct timespec* end);
+
+/* get_pool_stats:
+ * Get the usage statistics of the frame pool of a camera.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *
+ * output:
+ *      stats: statistics of the frame pool
+ */
+void get_pool_stats(int id, frame_pool_stats_t* stats);
+
 double get_cam_temp(int id, char* cam_name);
+
+#ifdef CAMERA_BENCH
+/* bench_shift_flip:
+ * Micro-benchmark of the shift and flip of fetched images, results are
+ * logged.
+ */
+void bench_shift_flip(void);
+#endif
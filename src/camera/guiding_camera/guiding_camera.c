@@ -74,6 +74,26 @@ int save_img_guiding_local(char* fn){
     return save_img(&cam_info, fn, "guiding", NULL);
 }
 
+/* save_img_guiding_mem_l:
+ * Same as save_img_guiding, but the image is returned in memory as a
+ * complete FITS file, see save_img_mem.
+ *
+ * output:
+ *      frame: the captured image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_NOT_READY: exposure still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: calling save_img beore starting exposure
+ *      ENOMEM: no free frame left in the frame pool
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int save_img_guiding_mem_l(img_frame_t** frame){
+    return save_img_mem(&cam_info, "guiding", NULL, frame);
+}
+
 /* abort_exp_guiding_local:
  * Abort an ongoing exposure of the guiding camera and save the image.
  *
@@ -93,6 +113,14 @@ int abort_exp_guiding_local(char* fn){
     return abort_exp(&cam_info, fn, "guiding");
 }
 
+void get_exp_window_guiding_local(struct timespec* start, struct timespec* end){
+    get_exp_window(cam_info.CameraID, start, end);
+}
+
+void get_guiding_pool_stats_l(frame_pool_stats_t* stats){
+    get_pool_stats(cam_info.CameraID, stats);
+}
+
 double get_guiding_temp_l(void){
     return get_cam_temp(cam_info.CameraID, "guiding");
 }
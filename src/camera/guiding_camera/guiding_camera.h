@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include "camera.h"
+
 /* init_guiding_camera:
  * Set up and initialise the guiding camera.
  *
@@ -55,6 +57,24 @@ int expose_guiding_local(int exp, int gain);
  */
 int save_img_guiding_local(char* fn);
 
+/* save_img_guiding_mem_l:
+ * Same as save_img_guiding, but the image is returned in memory as a
+ * complete FITS file, see save_img_mem.
+ *
+ * output:
+ *      frame: the captured image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_NOT_READY: exposure still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: calling save_img beore starting exposure
+ *      ENOMEM: no free frame left in the frame pool
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int save_img_guiding_mem_l(img_frame_t** frame);
+
 /* abort_exp_guiding_local:
  * Abort an ongoing exposure of the guiding camera and save the image.
  *
@@ -72,4 +92,8 @@ int save_img_guiding_local(char* fn);
  */
 int abort_exp_guiding_local(char* fn);
 
+void get_exp_window_guiding_local(struct timespec* start, struct timespec* end);
+
+void get_guiding_pool_stats_l(frame_pool_stats_t* stats);
+
 double get_guiding_temp_l(void);
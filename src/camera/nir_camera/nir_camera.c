@@ -17,7 +17,9 @@
 
 static ASI_CAMERA_INFO cam_info;
 
-static char out_fn[100], out_fp[100], tmp_fn[100];
+#ifdef NIR_TMP_FILE
+    static char out_fn[100], out_fp[100], tmp_fn[100];
+#endif
 
 /* init_nir_camera:
  * Set up and initialise the nir camera.
@@ -28,11 +30,13 @@ static char out_fn[100], out_fp[100], tmp_fn[100];
  */
 int init_nir_camera(void* args){
 
-    strcpy(out_fp, get_top_dir());
-    strcat(out_fp, "output/compression/");
+    #ifdef NIR_TMP_FILE
+        strcpy(out_fp, get_top_dir());
+        strcat(out_fp, "output/compression/");
 
-    strcpy(tmp_fn, get_top_dir());
-    strcat(tmp_fn, "output/compression/nir_tmp.fit");
+        strcpy(tmp_fn, get_top_dir());
+        strcat(tmp_fn, "output/compression/nir_tmp.fit");
+    #endif
 
     int ret = cam_setup(&cam_info, 'n');
     if(ret == ENODEV){
@@ -62,7 +66,9 @@ int expose_nir_local(int exp, int gain){
     return expose(cam_info.CameraID, exp, gain, "NIR");
 }
 
-static int img_cntr = 0;
+#ifdef NIR_TMP_FILE
+    static int img_cntr = 0;
+#endif
 
 /* save_img_nir:
  * save_img_nir will first check if exposure is still ongoing or has failed
@@ -82,17 +88,29 @@ static int img_cntr = 0;
  */
 int save_img_nir_local(void){
 
-
-    int ret = save_img(&cam_info, tmp_fn, "NIR", NULL);
-    if(ret){
-        return ret;
-    }
-
-    /* make temporary file name for nir images */
-    snprintf(out_fn, 100, "%snir%04d.fit", out_fp, img_cntr++);
-    rename(tmp_fn, out_fn);
-
-    queue_image(out_fn, IMAGE_MAIN);
+    #ifdef NIR_TMP_FILE
+        int ret = save_img(&cam_info, tmp_fn, "NIR", NULL);
+        if(ret){
+            return ret;
+        }
+
+        /* make temporary file name for nir images */
+        snprintf(out_fn, 100, "%snir%04d.fit", out_fp, img_cntr++);
+        rename(tmp_fn, out_fn);
+
+        queue_image(out_fn, IMAGE_MAIN);
+    #else
+        /* hand the image over to the image handler in memory */
+        img_frame_t* frame;
+        int ret = save_img_mem(&cam_info, "NIR", NULL, &frame);
+        if(ret){
+            return ret;
+        }
+
+        if(queue_frame(frame, IMAGE_MAIN)){
+            release_img_frame(frame);
+        }
+    #endif
     return SUCCESS;
 }
 
@@ -112,17 +130,34 @@ int save_img_nir_local(void){
  *      ENODEV: camera disconnected
  */
 int abort_exp_nir_local(void){
-    snprintf(out_fn, 100, "%snir%04d.fit", out_fp, img_cntr++);
 
-    int ret = abort_exp(&cam_info, out_fn, "NIR");
-    if(ret){
-        return ret;
-    }
-
-    queue_image(out_fn, IMAGE_MAIN);
+    #ifdef NIR_TMP_FILE
+        snprintf(out_fn, 100, "%snir%04d.fit", out_fp, img_cntr++);
+
+        int ret = abort_exp(&cam_info, out_fn, "NIR");
+        if(ret){
+            return ret;
+        }
+
+        queue_image(out_fn, IMAGE_MAIN);
+    #else
+        img_frame_t* frame;
+        int ret = abort_exp_mem(&cam_info, "NIR", &frame);
+        if(ret){
+            return ret;
+        }
+
+        if(queue_frame(frame, IMAGE_MAIN)){
+            release_img_frame(frame);
+        }
+    #endif
     return SUCCESS;
 }
 
+void get_nir_pool_stats_l(frame_pool_stats_t* stats){
+    get_pool_stats(cam_info.CameraID, stats);
+}
+
 double get_nir_temp_l(void){
     return get_cam_temp(cam_info.CameraID, "nir");
 }
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include "camera.h"
+
 /* init_nir_camera:
  * Set up and initialise the nir camera.
  *
@@ -69,4 +71,6 @@ int save_img_nir_local(void);
  */
 int abort_exp_nir_local(void);
 
+void get_nir_pool_stats_l(frame_pool_stats_t* stats);
+
 double get_nir_temp_l(void);
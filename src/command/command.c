@@ -24,6 +24,9 @@
 #include "gpio.h"
 #include "current_target.h"
 #include "pid.h"
+#include "img_processing.h"
+#include "seq_store.h"
+#include "sample_ring.h"
 
 static void* thread_command(void* param);
 static int handle_command(char command);
@@ -80,6 +83,16 @@ static int handle_command(char command){
             send_telemetry_local("Pong", 1, 0, 0);
             break;
 
+        case CMD_STORE_STATS:
+            send_seq_store_stats();
+            send_sample_ring_stats();
+            break;
+
+        case CMD_ST_STATS:
+            send_centroid_stats();
+            send_st_stats();
+            break;
+
         case CMD_DATARATE:
 
             read_elink(buffer, 2);
@@ -237,6 +250,57 @@ static int handle_command(char command){
             }
             break;
 
+        case CMD_IMG_FORMAT:
+
+            read_elink(buffer, 1);
+
+            if(buffer[0]==FORMAT_ZSTD || buffer[0]==FORMAT_RICE){
+                set_img_format(buffer[0]);
+
+                snprintf(buffer, 1400, "Image format set to: %d", buffer[0]);
+                send_telemetry_local(buffer, 1, 0, 0);
+            } else {
+                snprintf(buffer, 1400, "Image format NOT set, unknown input: %d",
+                        buffer[0]);
+                send_telemetry_local(buffer, 1, 0, 0);
+            }
+
+            break;
+
+        case CMD_CUTOUT:
+            {
+                /* image name (32 chars), shorts x, y, width, height and
+                 * binning as a single byte
+                 */
+                read_elink(buffer, 41);
+
+                char name[32];
+                memcpy(name, buffer, 31);
+                name[31] = '\0';
+
+                img_roi_t roi;
+                roi.x = *(unsigned short*)&buffer[32];
+                roi.y = *(unsigned short*)&buffer[34];
+                roi.width = *(unsigned short*)&buffer[36];
+                roi.height = *(unsigned short*)&buffer[38];
+                roi.binning = (unsigned char)buffer[40];
+
+                if(request_cutout(name, &roi) == SUCCESS){
+                    snprintf(buffer, 1400, "Cutout of %s requested", name);
+                } else {
+                    snprintf(buffer, 1400, "Cutout of %s NOT requested", name);
+                }
+                send_telemetry_local(buffer, 1, 0, 0);
+            }
+            break;
+
+        case CMD_CTL_STATS:
+
+            /* a non zero byte clears the histograms after sending */
+            read_elink(buffer, 1);
+            send_control_stats(buffer[0]);
+            break;
+
         default : /*  Default  */
             logging(ERROR, "downlink", "Unknown command");
 
@@ -15,18 +15,23 @@
 #define CMD_DATARATE 20
 #define CMD_MODE 30
 #define CMD_PING 40
+#define CMD_STORE_STATS 45
 #define CMD_STAR 50
+#define CMD_ST_STATS 55
 #define CMD_NIR_EXP 60
 #define CMD_NIR_GAI 65
 #define CMD_ST_EXP 70
 #define CMD_ST_GAI 75
 #define CMD_STP_AZ 80
 #define CMD_STP_ALT 85
+#define CMD_CTL_STATS 90
 #define CMD_CENTER 95
 #define CMD_AZ_ERR 100
 #define CMD_ALT_ERR 105
 #define CMD_STOP_MOTORS 110
 #define CMD_START_MOTORS 115
+#define CMD_IMG_FORMAT 120
+#define CMD_CUTOUT 125
 
 
 /* initialise the command component */
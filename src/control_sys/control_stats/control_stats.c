@@ -0,0 +1,206 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Control Stats
+ * Parent Component: Control System
+ * Author(s): 
+ * Purpose: Keep execution time histograms of the stages of the control loop,
+ *          the wake up lateness and the number of missed periods. Send a
+ *          summary as telemetry and the full histograms on command.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global_utils.h"
+#include "telemetry.h"
+#include "control_stats.h"
+
+/* telemetry messages are cut at the size of a downlink node */
+#define STATS_MSG_SIZE 100
+
+/* only the control thread writes, the atomics let the command thread read
+ * without stalling the loop, a read may mix two periods
+ */
+typedef struct{
+    atomic_ulong hist[CONTROL_STATS_BUCKETS];
+    atomic_ulong count;
+    atomic_ullong sum;      /* unit: nanoseconds */
+    atomic_llong max;       /* unit: nanoseconds */
+} stage_stats_t;
+
+/* summary since the last telemetry record, control thread only */
+typedef struct{
+    long long sum;          /* unit: nanoseconds */
+    long long max;          /* unit: nanoseconds */
+} window_t;
+
+static int bucket(long long ns);
+static void send_window(void);
+static void clear_stats(void);
+
+static const char* stage_names[CONTROL_STAGES] = {
+    "wake", "kf", "pid", "step", "total"
+};
+
+static stage_stats_t stages[CONTROL_STAGES];
+static atomic_ulong periods, missed_periods;
+static atomic_int reset_request;
+
+static window_t window[CONTROL_STAGES];
+static unsigned long window_periods, window_missed;
+
+void control_stats_add(int stage, long long ns){
+
+    if(ns < 0){
+        ns = 0;
+    }
+
+    stage_stats_t* s = &stages[stage];
+
+    atomic_fetch_add_explicit(&s->hist[bucket(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->sum, ns, memory_order_relaxed);
+    if(ns > atomic_load_explicit(&s->max, memory_order_relaxed)){
+        atomic_store_explicit(&s->max, ns, memory_order_relaxed);
+    }
+
+    window[stage].sum += ns;
+    if(ns > window[stage].max){
+        window[stage].max = ns;
+    }
+}
+
+void control_stats_period(int missed){
+
+    atomic_fetch_add_explicit(&periods, 1, memory_order_relaxed);
+    window_periods++;
+
+    if(missed){
+        atomic_fetch_add_explicit(&missed_periods, 1, memory_order_relaxed);
+        window_missed++;
+    }
+
+    /* only the control thread clears, so no add is lost half way */
+    if(atomic_exchange_explicit(&reset_request, 0, memory_order_relaxed)){
+        clear_stats();
+    }
+
+    if(window_periods >= CONTROL_STATS_PERIODS){
+        send_window();
+    }
+}
+
+void send_control_stats_l(int reset){
+
+    char msg[STATS_MSG_SIZE];
+
+    snprintf(msg, STATS_MSG_SIZE, "ctl periods: %lu, missed: %lu",
+            atomic_load_explicit(&periods, memory_order_relaxed),
+            atomic_load_explicit(&missed_periods, memory_order_relaxed));
+    send_telemetry(msg, 1, 0, 0);
+
+    for(int ii=0; ii<CONTROL_STAGES; ++ii){
+        stage_stats_t* s = &stages[ii];
+
+        unsigned long count = atomic_load_explicit(&s->count, memory_order_relaxed);
+        unsigned long long sum = atomic_load_explicit(&s->sum, memory_order_relaxed);
+
+        snprintf(msg, STATS_MSG_SIZE, "ctl %s n: %lu, mean: %llu us, max: %lld us",
+                stage_names[ii], count, count ? sum / count / 1000 : 0,
+                atomic_load_explicit(&s->max, memory_order_relaxed) / 1000);
+        send_telemetry(msg, 1, 0, 0);
+
+        /* the non empty buckets as lower bound in us:count, split over as
+         * many messages as needed
+         */
+        int len = snprintf(msg, STATS_MSG_SIZE, "ctl %s us", stage_names[ii]);
+        int head = len;
+
+        for(int jj=0; jj<CONTROL_STATS_BUCKETS; ++jj){
+            unsigned long n = atomic_load_explicit(&s->hist[jj], memory_order_relaxed);
+            if(n == 0){
+                continue;
+            }
+
+            char entry[32];
+            int entry_len = snprintf(entry, sizeof(entry), " %ld:%lu",
+                    jj ? 1L << (jj - 1) : 0, n);
+
+            if(len + entry_len >= STATS_MSG_SIZE){
+                send_telemetry(msg, 1, 0, 0);
+                len = head;
+            }
+            memcpy(&msg[len], entry, entry_len + 1);
+            len += entry_len;
+        }
+
+        if(len > head){
+            send_telemetry(msg, 1, 0, 0);
+        }
+    }
+
+    if(reset){
+        atomic_store_explicit(&reset_request, 1, memory_order_relaxed);
+    }
+}
+
+/* bucket:
+ * Find the histogram bucket of a time.
+ *
+ * input:
+ *      ns: the time, unit: nanoseconds
+ *
+ * return:
+ *      the index of the bucket
+ */
+static int bucket(long long ns){
+
+    unsigned long long us = ns / 1000;
+    if(us == 0){
+        return 0;
+    }
+
+    int b = 64 - __builtin_clzll(us);
+    return b < CONTROL_STATS_BUCKETS ? b : CONTROL_STATS_BUCKETS - 1;
+}
+
+/* send_window:
+ * Send the mean and max of every stage since the last summary as a single
+ * telemetry message, and start a new window.
+ */
+static void send_window(void){
+
+    char msg[STATS_MSG_SIZE];
+    int len = snprintf(msg, STATS_MSG_SIZE, "ctl miss: %lu", window_missed);
+
+    /* mean/max in us */
+    for(int ii=0; ii<CONTROL_STAGES && len < STATS_MSG_SIZE; ++ii){
+        len += snprintf(&msg[len], STATS_MSG_SIZE - len, " %s: %lld/%lld",
+                stage_names[ii], window[ii].sum / window_periods / 1000,
+                window[ii].max / 1000);
+    }
+
+    send_telemetry(msg, 1, 0, 0);
+
+    memset(window, 0, sizeof(window));
+    window_periods = 0;
+    window_missed = 0;
+}
+
+/* clear_stats:
+ * Clear the histograms and counters since start or the last reset.
+ */
+static void clear_stats(void){
+
+    for(int ii=0; ii<CONTROL_STAGES; ++ii){
+        for(int jj=0; jj<CONTROL_STATS_BUCKETS; ++jj){
+            atomic_store_explicit(&stages[ii].hist[jj], 0, memory_order_relaxed);
+        }
+        atomic_store_explicit(&stages[ii].count, 0, memory_order_relaxed);
+        atomic_store_explicit(&stages[ii].sum, 0, memory_order_relaxed);
+        atomic_store_explicit(&stages[ii].max, 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&periods, 0, memory_order_relaxed);
+    atomic_store_explicit(&missed_periods, 0, memory_order_relaxed);
+}
@@ -0,0 +1,43 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Control Stats
+ * Parent Component: Control System
+ * Author(s): 
+ * Purpose: Keep execution time histograms of the stages of the control loop,
+ *          the wake up lateness and the number of missed periods. Send a
+ *          summary as telemetry and the full histograms on command.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+/* log2 buckets, bucket 0 holds times below 1 us and bucket ii times from
+ * 2^(ii-1) us up to 2^ii us, the last one everything above
+ */
+#define CONTROL_STATS_BUCKETS 16
+
+/* control periods between summaries sent as telemetry, 10 s */
+#define CONTROL_STATS_PERIODS 1000
+
+enum {
+    STAGE_WAKE,     /* lateness of the wake up */
+    STAGE_KF,
+    STAGE_PID,
+    STAGE_STEP,
+    STAGE_TOTAL,    /* the whole period, from wake up to done */
+    CONTROL_STAGES
+};
+
+/* add the time of a stage of the current period, only called by the control
+ * thread
+ */
+void control_stats_add(int stage, long long ns);
+
+/* end the current period, missed is 1 if it ended after the next wake up
+ * time, only called by the control thread
+ */
+void control_stats_period(int missed);
+
+/* send the histograms of all stages as telemetry, and clear them after if
+ * reset is set
+ */
+void send_control_stats_l(int reset);
@@ -20,6 +20,7 @@
 #include "target_selection.h"
 #include "kalman_filter.h"
 #include "pid.h"
+#include "control_stats.h"
 
 #define MODULE_COUNT 6
 
@@ -92,3 +93,7 @@ void set_nir_exp(int exp){
 void set_nir_gain(int gain){
     set_nir_gain_l(gain);
 }
+
+void send_control_stats(int reset){
+    send_control_stats_l(reset);
+}
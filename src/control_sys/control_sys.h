@@ -56,3 +56,8 @@ void set_error_thresholds_alt(double alt_ang);
 
 void set_nir_exp(int exp);
 void set_nir_gain(int gain);
+
+/* Send the timing histograms of the control loop as telemetry, and clear
+ * them after if reset is set
+ */
+void send_control_stats(int reset);
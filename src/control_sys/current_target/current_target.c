@@ -10,60 +10,55 @@
 #include <pthread.h>
 
 #include "global_utils.h"
+#include "seq_store.h"
 #include "control_sys.h"
 #include "current_target.h"
 #include "target_selection.h"
 #include "telemetry.h"
 
-static pthread_mutex_t mutex_telescope_att, mutex_track_ang;
-static telescope_att_t telescope_att_local;
-static target_t current_target;
+#ifdef REPLAY
+    #include "replay.h"
+#endif
 
-int init_current_target(void* args){
+static telescope_att_t telescope_att_local[2] = {{.out_of_date = 1}, {.out_of_date = 1}};
+static target_t current_target[2];
 
-    int ret = pthread_mutex_init( &mutex_telescope_att, NULL );
-    if( ret ){
-        logging(ERROR, "Cur Target",
-                "The initialisation of the telescope attitude"
-                "mutex failed with code %d.\n", ret);
-        return FAILURE;
-    }
+static seq_store_t store_telescope_att =
+    SEQ_STORE_INITIALIZER("telescope_att", telescope_att_local, sizeof(telescope_att_t));
 
-    ret = pthread_mutex_init( &mutex_track_ang, NULL );
-    if( ret ){
-        logging(ERROR, "Cur Target",
-                "The initialisation of the tracking angles"
-                "mutex failed with code %d.\n", ret);
-        return FAILURE;
-    }
+/* written by target selection, and by the kalman filter on a star tracker
+ * fix
+ */
+static seq_store_t store_track_ang =
+    SEQ_STORE_INITIALIZER("track_ang", current_target, sizeof(target_t));
 
-    telescope_att_local.az = 0;
-    telescope_att_local.alt = 0;
-    telescope_att_local.out_of_date = 1;
+static void now(struct timespec* t);
 
-    return SUCCESS;
+int init_current_target(void* args){
+
+    int ret = seq_store_register(&store_telescope_att);
+    if(ret != SUCCESS){
+        return ret;
+    }
+
+    return seq_store_register(&store_track_ang);
 }
 
 static int freq_count = 0;
 
 void get_telescope_att(telescope_att_t* telescope_att){
-
-    pthread_mutex_lock(&mutex_telescope_att);
-
-    telescope_att->az = telescope_att_local.az;
-    telescope_att->alt = telescope_att_local.alt;
-    telescope_att->out_of_date = telescope_att_local.out_of_date;
-
-    pthread_mutex_unlock(&mutex_telescope_att);
+    seq_store_read(&store_telescope_att, telescope_att, NULL);
 }
 
 void set_telescope_att(telescope_att_t* telescope_att){
 
-    pthread_mutex_lock(&mutex_telescope_att);
+    struct timespec t;
+    now(&t);
 
-    telescope_att_local.az = telescope_att->az;
-    telescope_att_local.alt = telescope_att->alt;
-    telescope_att_local.out_of_date = 0;
+    telescope_att_t new = *telescope_att;
+    new.out_of_date = 0;
+
+    seq_store_write(&store_telescope_att, &new, &t);
 
     if(freq_count++ == 10){
         char buffer[100];
@@ -71,35 +66,44 @@ void set_telescope_att(telescope_att_t* telescope_att){
         send_telemetry(buffer, 1, 0, 0);
         freq_count = 0;
     }
-
-    pthread_mutex_unlock(&mutex_telescope_att);
 }
 
 void telescope_att_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_telescope_att);
+    telescope_att_t telescope_att;
+    seq_store_read(&store_telescope_att, &telescope_att, NULL);
 
-    telescope_att_local.out_of_date = 1;
+    telescope_att.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_telescope_att);
+    seq_store_write(&store_telescope_att, &telescope_att, NULL);
 }
 
 void get_tracking_angles(double* az, double* alt){
 
-    pthread_mutex_lock(&mutex_telescope_att);
+    target_t target;
+    seq_store_read(&store_track_ang, &target, NULL);
 
-    *az = current_target.az;
-    *alt = current_target.alt;
-
-    pthread_mutex_unlock(&mutex_telescope_att);
+    *az = target.az;
+    *alt = target.alt;
 }
 
 void set_tracking_angles(double az, double alt){
 
-    pthread_mutex_lock(&mutex_telescope_att);
+    struct timespec t;
+    now(&t);
+
+    target_t target = {az, alt, 0};
 
-    current_target.az = az;
-    current_target.alt = alt;
+    seq_store_write(&store_track_ang, &target, &t);
+}
 
-    pthread_mutex_unlock(&mutex_telescope_att);
+/* now:
+ * Time stamp for a new value, the replay time in irisc-replay.
+ */
+static void now(struct timespec* t){
+    #ifdef REPLAY
+        replay_time(t);
+    #else
+        clock_gettime(CLOCK_MONOTONIC, t);
+    #endif
 }
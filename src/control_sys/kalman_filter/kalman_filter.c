@@ -18,6 +18,7 @@
 #include <unistd.h>
 
 #include "global_utils.h"
+#include "binlog.h"
 #include "mode.h"
 #include "current_target.h"
 #include "kalman_filter.h"
@@ -25,168 +26,249 @@
 #include "control_sys.h"
 #include "target_selection.h"
 
-/* Kalman filter
- *  double x_prev[2][1], x_upd[2][1], x_next[2][1];
- *  double w_meas[1][1];
- *  double Phi[2][2], Gamma[2][1], Upsilon[2][1], Upsilon2[2][1], H[1][2];
- *  double Q[1][1], Q2[1][1], R[1][1];
- *  double P_prev[2][2], P_upd[2][2], P_next[2][2], nu_next[1][1], S_next[1][1], K[2][1];
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    #include <arm_neon.h>
+#endif
+
+/* Kalman filter, per axis with the angle and the gyro bias as states
+ *
+ *  x_next = Phi*x_prev + Gamma*w_meas;
+ *  P_next = Phi*P_prev*Phi' + Upsilon*Q*Upsilon' + Upsilon2*Q2*Upsilon2';
+ *
+ *  nu_next = meas - H*x_next;
+ *  S_next = H*P_next*H' + R;
+ *  K = P_next*H'/S_next;
+ *  x_upd = x_next + K*nu_next;
+ *  P_upd = (eye(2)-K*H)*P_next;
+ *
+ * All matrices are fixed size values and the products are written out in
+ * the order of operations of general matrix multiplication, so the results
+ * are the same as with the matrix routines they replace.
+ *
+ * The equations are the same for both axes, so the filter runs them once
+ * with alt and az in the two lanes of a SIMD register (SSE2 or 64 bit
+ * NEON, plain pairs of doubles otherwise). The per axis scalar functions
+ * are kept as reference for the benchmark. The az rate depends on the alt
+ * angle, which is taken after propagation and before a star tracker fix is
+ * fused.
+ *
+ * Every gyro sample is taken from the ring of the gyroscope exactly once
+ * and propagated with the time since the previous sample as dt, so Phi,
+ * Gamma and Qd are set for each sample. The history holds the estimate
+ * after each sample.
+ *
+ * A star tracker fix is for the middle of its exposure, some time back,
+ * taken from the exposure time stamps that come with the fix. It is fused
+ * with the history sample nearest to that time, and the correction is
+ * carried forward to the current estimate in one step, see
+ * kf_correct_delayed.
  */
-#define X_PREV_ROWS 2
-#define X_PREV_COLS 1
-#define X_UPD_ROWS 2
-#define X_UPD_COLS 1
-#define X_NEXT_ROWS 2
-#define X_NEXT_COLS 1
-#define W_MEAS_ROWS 1
-#define W_MEAS_COLS 1
-#define PHI_ROWS 2
-#define PHI_COLS 2
-#define GAMMA_ROWS 2
-#define GAMMA_COLS 1
-#define UPSILON_ROWS 2
-#define UPSILON_COLS 1
-#define UPSILON2_ROWS 2
-#define UPSILON2_COLS 1
-#define H_ROWS 1
-#define H_COLS 2
-#define Q_ROWS 1
-#define Q_COLS 1
-#define R_ROWS 1
-#define R_COLS 1
-#define Q2_ROWS 1
-#define Q2_COLS 1
-#define P_PREV_ROWS 2
-#define P_PREV_COLS 2
-#define P_UPD_ROWS 2
-#define P_UPD_COLS 2
-#define P_NEXT_ROWS 2
-#define P_NEXT_COLS 2
-#define NU_NEXT_ROWS 1
-#define NU_NEXT_COLS 1
-#define S_NEXT_ROWS 1
-#define S_NEXT_COLS 1
-#define K_ROWS 2
-#define K_COLS 1
 
 #define AZ_AXIS_FLAG 0
 #define ALT_AXIS_FLAG 1
 
-#define HIST_LENGTH_S 180 //unit: seconds
 #define SENS_FREQ 100
 
+/* samples of history, a power of 2, 163 s at SENS_FREQ */
+#define HIST_SIZE 16384
+#define HIST_MASK (HIST_SIZE - 1)
 
+/* the most gyro samples and star tracker fixes taken in one update */
+#define KF_MAX_SAMPLES 64
+#define KF_MAX_FIXES 8
+
+/* 2x1 column vector, also used for the 1x2 H */
 typedef struct{
-    double*** var;
-    int rows;
-    int cols;
-} arr_t;
+    double v[2];
+} vec2_t;
 
 typedef struct{
-    arr_t mem[18];
+    double m[2][2];
+} mat2_t;
 
-    double** x_prev;
-    double** x_upd;
-    double** x_next;
-    double** w_meas;
-    double** Phi;
-    double** Gamma;
-    double** Upsilon;
-    double** Upsilon2;
-    double** H;
-    double** Q;
-    double** R;
-    double** Q2;
-    double** P_prev;
-    double** P_upd;
-    double** P_next;
-    double** nu_next;
-    double** S_next;
-    double** K;
+typedef struct{
+    mat2_t Phi;
+    vec2_t Gamma;
+    mat2_t Qd;      /* Upsilon*Q*Upsilon' + Upsilon2*Q2*Upsilon2' */
+    vec2_t H;
+    double R;
+} kf_model_t;
+
+/* a value of each axis */
+#if defined(__SSE2__)
+    typedef __m128d lanes_t;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    typedef float64x2_t lanes_t;
+#else
+    typedef struct{
+        double d[2];
+    } lanes_t;
+#endif
+
+#define ALT_LANE 0
+#define AZ_LANE 1
 
-    double* gyro_hist;
-    double** x_hist;
-    double*** p_hist;
+static inline lanes_t lanes_set(double alt_val, double az_val){
+    #if defined(__SSE2__)
+        return _mm_set_pd(az_val, alt_val);
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+        double d[2] = {alt_val, az_val};
+        return vld1q_f64(d);
+    #else
+        return (lanes_t){{alt_val, az_val}};
+    #endif
+}
+
+static inline double lanes_get(lanes_t a, int lane){
+    #if defined(__SSE2__)
+        double d[2];
+        _mm_storeu_pd(d, a);
+        return d[lane];
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+        double d[2];
+        vst1q_f64(d, a);
+        return d[lane];
+    #else
+        return a.d[lane];
+    #endif
+}
+
+static inline lanes_t lanes_dup(double val){
+    return lanes_set(val, val);
+}
+
+static inline lanes_t lanes_add(lanes_t a, lanes_t b){
+    #if defined(__SSE2__)
+        return _mm_add_pd(a, b);
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+        return vaddq_f64(a, b);
+    #else
+        return (lanes_t){{a.d[0] + b.d[0], a.d[1] + b.d[1]}};
+    #endif
+}
+
+static inline lanes_t lanes_sub(lanes_t a, lanes_t b){
+    #if defined(__SSE2__)
+        return _mm_sub_pd(a, b);
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+        return vsubq_f64(a, b);
+    #else
+        return (lanes_t){{a.d[0] - b.d[0], a.d[1] - b.d[1]}};
+    #endif
+}
+
+static inline lanes_t lanes_mul(lanes_t a, lanes_t b){
+    #if defined(__SSE2__)
+        return _mm_mul_pd(a, b);
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+        return vmulq_f64(a, b);
+    #else
+        return (lanes_t){{a.d[0] * b.d[0], a.d[1] * b.d[1]}};
+    #endif
+}
+
+static inline lanes_t lanes_div(lanes_t a, lanes_t b){
+    #if defined(__SSE2__)
+        return _mm_div_pd(a, b);
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+        return vdivq_f64(a, b);
+    #else
+        return (lanes_t){{a.d[0] / b.d[0], a.d[1] / b.d[1]}};
+    #endif
+}
+
+typedef struct{
+    lanes_t v[2];
+} vec2_l_t;
+
+typedef struct{
+    lanes_t m[2][2];
+} mat2_l_t;
+
+typedef struct{
+    mat2_l_t Phi;
+    vec2_l_t Gamma;
+    mat2_l_t Qd;
+    vec2_l_t H;
+    lanes_t R;
+} kf_model_l_t;
+
+/* history of both axes for fusing star tracker fixes at the time of their
+ * exposure, indexed like hist_time
+ */
+typedef struct{
+    vec2_l_t x[HIST_SIZE];
+    mat2_l_t P[HIST_SIZE];
+} kf_hist_t;
+
+typedef struct{
+    kf_model_t model;
 
     /* innovative logs */
-    FILE* x_log;
-    FILE* p_log;
-    FILE* nu_log;
-    FILE* s_log;
+    binlog_t* x_log;
+    binlog_t* p_log;
+    binlog_t* nu_log;
+    binlog_t* s_log;
 
     /* propagation logs */
-    FILE* x_prop_log;
-    FILE* p_prop_log;
+    binlog_t* x_prop_log;
+    binlog_t* p_prop_log;
 } axis_context_t;
 
 static int open_logs(void);
 static void init_kalman_vars(double az_init, double alt_init);
-static int kf_axis(axis_context_t axis, double gyro_data, double* st_data);
+static void model_dt(double dt);
+static void kf_gyro_sample(const gyro_t* gyro);
+static void kf_st_fix(const star_tracker_t* st);
+static unsigned int hist_age(long long time);
+
+#ifdef KF_BENCH
+static void kf_propagate(const kf_model_t* model, vec2_t* x, mat2_t* P, double w_meas);
+static void kf_innovate(const kf_model_t* model, const vec2_t* x, const mat2_t* P,
+        double meas, double* nu_next, double* S_next);
+static void kf_correct_delayed(const kf_model_t* model, vec2_t* x, mat2_t* P,
+        const mat2_t* P_exp, unsigned int age, double nu_next, double S_next);
+#endif
+static void kf_propagate_l(const kf_model_l_t* model, vec2_l_t* x, mat2_l_t* P,
+        lanes_t w_meas);
+static void kf_innovate_l(const kf_model_l_t* model, const vec2_l_t* x,
+        const mat2_l_t* P, lanes_t meas, lanes_t* nu_next, lanes_t* S_next);
+static void kf_correct_delayed_l(const kf_model_l_t* model, const mat2_t* Phi_age,
+        vec2_l_t* x, mat2_l_t* P, const mat2_l_t* P_exp, lanes_t nu_next,
+        lanes_t S_next);
+static void log_state(binlog_t* x_log, binlog_t* p_log, const vec2_t* x, const mat2_t* P);
+static void log_state_l(const vec2_l_t* x, const mat2_l_t* P, int prop);
+
+#ifdef KF_BENCH
+static void bench_kalman_filter(void);
+#endif
 
-static void eye(int m, double** mat);
-static void madd(double** matA, double** matB, double** matC, int rows, int cols);
-static void msub(double** matA, double** matB, double** matC, int rows, int cols);
-static void transpose(double** mat, double** mat2, int rows, int cols);
-static void mdiv(double** matA, double scal, double** matB, int rows, int cols);
-static void mmult(double** matA, double** matB, double** matC, int rows1, int cols1, int rows2, int cols2);
+static axis_context_t az;
+static axis_context_t alt;
 
-#if 0
-static void printarray2D(double** array, int rows, int cols);
-#endif
+/* the filter state of both axes, the propagation of model_l is for the
+ * dt of the last gyro sample
+ */
+static kf_model_l_t model_l;
+static vec2_l_t x_prev;
+static mat2_l_t P_prev;
+static kf_hist_t hist;
+
+/* The history is a ring of the samples since the last star tracker fix,
+ * hist_head is the newest sample. Both axes share the time stamps and
+ * indices.
+ */
+static long long hist_time[HIST_SIZE]; /* CLOCK_MONOTONIC, unit: nanoseconds */
+static unsigned int hist_head = 0;
+static unsigned int hist_count = 0;
 
-static void prop_state_vec(axis_context_t axis);
-static void prop_p_next(axis_context_t axis);
-static void innovate_nu_next(axis_context_t axis, double* st_data);
-static void update_s_next(axis_context_t axis);
-static void comp_k_gain(axis_context_t axis);
-static void update_state(axis_context_t axis);
-static void update_covar(axis_context_t axis);
-
-static axis_context_t az = {
-    {
-        {&az.x_prev,       X_PREV_ROWS,    X_PREV_COLS     },
-        {&az.x_upd,        X_UPD_ROWS,     X_UPD_COLS      },
-        {&az.x_next,       X_NEXT_ROWS,    X_NEXT_COLS     },
-        {&az.w_meas,       W_MEAS_ROWS,    W_MEAS_COLS     },
-        {&az.Phi,          PHI_ROWS,       PHI_COLS        },
-        {&az.Gamma,        GAMMA_ROWS,     GAMMA_COLS      },
-        {&az.Upsilon,      UPSILON_ROWS,   UPSILON_COLS    },
-        {&az.Upsilon2,     UPSILON2_ROWS,  UPSILON2_COLS   },
-        {&az.H,            H_ROWS,         H_COLS          },
-        {&az.Q,            Q_ROWS,         Q_COLS          },
-        {&az.R,            R_ROWS,         R_COLS          },
-        {&az.Q2,           Q2_ROWS,        Q2_COLS         },
-        {&az.P_prev,       P_PREV_ROWS,    P_PREV_COLS     },
-        {&az.P_upd,        P_UPD_ROWS,     P_UPD_COLS      },
-        {&az.P_next,       P_NEXT_ROWS,    P_NEXT_COLS     },
-        {&az.nu_next,      NU_NEXT_ROWS,   NU_NEXT_COLS    },
-        {&az.S_next,       S_NEXT_ROWS,    S_NEXT_COLS     },
-        {&az.K,            K_ROWS,         K_COLS          }
-    }
-};
-
-static axis_context_t alt = {
-    {
-        {&alt.x_prev,       X_PREV_ROWS,    X_PREV_COLS     },
-        {&alt.x_upd,        X_UPD_ROWS,     X_UPD_COLS      },
-        {&alt.x_next,       X_NEXT_ROWS,    X_NEXT_COLS     },
-        {&alt.w_meas,       W_MEAS_ROWS,    W_MEAS_COLS     },
-        {&alt.Phi,          PHI_ROWS,       PHI_COLS        },
-        {&alt.Gamma,        GAMMA_ROWS,     GAMMA_COLS      },
-        {&alt.Upsilon,      UPSILON_ROWS,   UPSILON_COLS    },
-        {&alt.Upsilon2,     UPSILON2_ROWS,  UPSILON2_COLS   },
-        {&alt.H,            H_ROWS,         H_COLS          },
-        {&alt.Q,            Q_ROWS,         Q_COLS          },
-        {&alt.R,            R_ROWS,         R_COLS          },
-        {&alt.Q2,           Q2_ROWS,        Q2_COLS         },
-        {&alt.P_prev,       P_PREV_ROWS,    P_PREV_COLS     },
-        {&alt.P_upd,        P_UPD_ROWS,     P_UPD_COLS      },
-        {&alt.P_next,       P_NEXT_ROWS,    P_NEXT_COLS     },
-        {&alt.nu_next,      NU_NEXT_ROWS,   NU_NEXT_COLS    },
-        {&alt.S_next,       S_NEXT_ROWS,    S_NEXT_COLS     },
-        {&alt.K,            K_ROWS,         K_COLS          }
-    }
-};
+/* time of the last gyro sample propagated, 0 before the first */
+static long long last_gyro_ns = 0;  /* unit: nanoseconds */
+
+/* gyro noise densities, the process noise of a sample grows with its dt */
+static double arw, rrw;
 
 #ifdef KF_TEST
     //initial mode position
@@ -202,78 +284,6 @@ int init_kalman_filter(void* args){
         return errno;
     }
 
-    // allocate memory
-    axis_context_t* arr[2] = {&az, &alt};
-    for(int ii=0; ii<2; ++ii){
-        for(int jj=0; jj<18; ++jj){
-            int rows = arr[ii]->mem[jj].rows;
-            int cols = arr[ii]->mem[jj].cols;
-
-            *arr[ii]->mem[jj].var = malloc(rows * sizeof **arr[ii]->mem[jj].var);
-
-            if(*arr[ii]->mem[jj].var == NULL){
-                logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-                return ENOMEM;
-            }
-
-            for(int kk=0; kk < rows; ++kk){
-                (*arr[ii]->mem[jj].var)[kk] = malloc(cols * sizeof **arr[ii]->mem[jj].var[kk]);
-
-                if(*arr[ii]->mem[jj].var == NULL){
-                    logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-                    return ENOMEM;
-                }
-            }
-        }
-
-        /* gyro history */
-        size_t hist_elements = (long)HIST_LENGTH_S * SENS_FREQ;
-        arr[ii]->gyro_hist = malloc(hist_elements * sizeof(*arr[ii]->gyro_hist));
-        if(arr[ii]->gyro_hist == NULL){
-            logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-            return ENOMEM;
-        }
-
-        /* estimated state history */
-        arr[ii]->x_hist = malloc(hist_elements * sizeof(*arr[ii]->x_hist));
-        if(arr[ii]->x_hist == NULL){
-            logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-            return ENOMEM;
-        }
-
-        for(int jj=0; jj < hist_elements; ++jj){
-            arr[ii]->x_hist[jj] = malloc(X_PREV_ROWS * sizeof(*arr[ii]->x_hist[jj]));
-            if(arr[ii]->x_hist[jj] == NULL){
-                logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-                return ENOMEM;
-            }
-        }
-
-        /* P matrix history */
-        arr[ii]->p_hist = malloc(hist_elements * sizeof(*arr[ii]->p_hist));
-        if(arr[ii]->p_hist == NULL){
-            logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-            return ENOMEM;
-        }
-
-        for(int jj=0; jj < hist_elements; ++jj){
-            arr[ii]->p_hist[jj] = malloc(P_PREV_ROWS * sizeof(*arr[ii]->p_hist[jj]));
-            if(arr[ii]->p_hist[jj] == NULL){
-                logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-                return ENOMEM;
-            }
-
-            for(int kk=0; kk<P_PREV_ROWS; ++kk){
-                arr[ii]->p_hist[jj][kk] = malloc(P_PREV_COLS * sizeof(*arr[ii]->p_hist[jj][kk]));
-                if(arr[ii]->p_hist[jj][kk] == NULL){
-                    logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-                    return ENOMEM;
-                }
-
-            }
-        }
-    }
-
     // initialise Kalman filter
     #ifdef KF_TEST
         init_kalman_vars(0, 0);
@@ -281,6 +291,10 @@ int init_kalman_filter(void* args){
         init_kalman_vars(0, 45);
     #endif
 
+    #ifdef KF_BENCH
+        bench_kalman_filter();
+    #endif
+
     return SUCCESS;
 }
 
@@ -296,6 +310,8 @@ static void init_kalman_vars(double az_init, double alt_init){
     gyro_bias_0 = 10./180*M_PI/3600;
     //gyro_bias_0 = M_PI*10/180;
     RRW = (1./180*M_PI/3600/sqrt(3600))*(1./180*M_PI/3600/sqrt(3600));      // rate random walk of gyro
+    arw = ARW;
+    rrw = RRW;
 
     // initialisation mode parameters
     #ifdef KF_TEST
@@ -306,40 +322,61 @@ static void init_kalman_vars(double az_init, double alt_init){
 
     axis_context_t* arr[2] = {&az, &alt};
 
-    az.x_prev[0][0] = az_init;  // starting position
-    alt.x_prev[0][0] = alt_init;
+    mat2_t P_init = {{
+        {s_init*s_init, 0},
+        {0, gyro_bias_0*gyro_bias_0}
+    }};
+
+    // starting position, no bias
+    x_prev.v[0] = lanes_set(alt_init, az_init);
+    x_prev.v[1] = lanes_dup(0);
 
     for(int ii=0; ii<2; ++ii){
-        arr[ii]->x_prev[1][0] = 0;
+        for(int jj=0; jj<2; ++jj){
+            P_prev.m[ii][jj] = lanes_dup(P_init.m[ii][jj]);
+        }
+    }
 
-        arr[ii]->P_prev[0][0] = s_init*s_init;
-        arr[ii]->P_prev[0][1] = 0;
-        arr[ii]->P_prev[1][0] = 0;
-        arr[ii]->P_prev[1][1] = gyro_bias_0*gyro_bias_0;
+    for(int ii=0; ii<2; ++ii){
+        kf_model_t* model = &arr[ii]->model;
 
         // propagation matrices
-        arr[ii]->Phi[0][0] = 1;
-        arr[ii]->Phi[0][1] = -dt;
-        arr[ii]->Phi[1][0] = 0;
-        arr[ii]->Phi[1][1] = 1;
-
-        arr[ii]->Gamma[0][0] = dt;
-        arr[ii]->Gamma[1][0] = 0;
+        model->Phi = (mat2_t){{
+            {1, -dt},
+            {0, 1}
+        }};
+        model->Gamma = (vec2_t){{dt, 0}};
 
-        arr[ii]->Upsilon[0][0] = dt;
-        arr[ii]->Upsilon[1][0] = 0;
-        arr[ii]->Upsilon2[0][0] = 0;
-        arr[ii]->Upsilon2[1][0] = dt;
+        vec2_t Upsilon = {{dt, 0}};
+        vec2_t Upsilon2 = {{0, dt}};
 
         // measurement matrix
-        arr[ii]->H[0][0] = 1;
-        arr[ii]->H[0][1] = 0;
+        model->H = (vec2_t){{1, 0}};
 
         // tuning values
-        arr[ii]->Q[0][0] = ARW/dt;
-        arr[ii]->Q2[0][0] = RRW/dt;
-        arr[ii]->R[0][0] = s_init*s_init;
+        double Q = ARW/dt;
+        double Q2 = RRW/dt;
+        model->R = s_init*s_init;
+
+        /* process noise at the nominal dt, see model_dt */
+        for(int jj=0; jj<2; ++jj){
+            for(int kk=0; kk<2; ++kk){
+                model->Qd.m[jj][kk] = Upsilon.v[jj]*Q*Upsilon.v[kk] +
+                    Upsilon2.v[jj]*Q2*Upsilon2.v[kk];
+            }
+        }
+    }
+
+    /* the models of both axes in lanes */
+    for(int ii=0; ii<2; ++ii){
+        for(int jj=0; jj<2; ++jj){
+            model_l.Phi.m[ii][jj] = lanes_set(alt.model.Phi.m[ii][jj], az.model.Phi.m[ii][jj]);
+            model_l.Qd.m[ii][jj] = lanes_set(alt.model.Qd.m[ii][jj], az.model.Qd.m[ii][jj]);
+        }
+        model_l.Gamma.v[ii] = lanes_set(alt.model.Gamma.v[ii], az.model.Gamma.v[ii]);
+        model_l.H.v[ii] = lanes_set(alt.model.H.v[ii], az.model.H.v[ii]);
     }
+    model_l.R = lanes_set(alt.model.R, az.model.R);
 }
 
 static int open_logs(void){
@@ -348,21 +385,30 @@ static int open_logs(void){
     char* vars[] = {"x", "p", "nu", "s", "x_prop", "p_prop"};
     axis_context_t* arr[2] = {&az, &alt};
 
+    /* columns of the logs of each variable */
+    const binlog_col_t x_cols[] = {{"x0", BINLOG_DOUBLE}, {"x1", BINLOG_DOUBLE}};
+    const binlog_col_t p_cols[] = {{"p00", BINLOG_DOUBLE}, {"p01", BINLOG_DOUBLE},
+            {"p10", BINLOG_DOUBLE}, {"p11", BINLOG_DOUBLE}};
+    const binlog_col_t nu_cols[] = {{"nu", BINLOG_DOUBLE}};
+    const binlog_col_t s_cols[] = {{"s", BINLOG_DOUBLE}};
+    const binlog_col_t* cols[6] = {x_cols, p_cols, nu_cols, s_cols, x_cols, p_cols};
+    int n_cols[6] = {2, 4, 1, 1, 2, 4};
+
     char log_fn[100];
     strcpy(log_fn, get_top_dir());
     /* dirlen is the index in log_fn where local paths start */
     int dirlen = strlen(log_fn);
 
     for(int ii=0; ii<2; ++ii){
-        FILE** logs[6] = {&arr[ii]->x_log, &arr[ii]->p_log, &arr[ii]->nu_log,
+        binlog_t** logs[6] = {&arr[ii]->x_log, &arr[ii]->p_log, &arr[ii]->nu_log,
                 &arr[ii]->s_log, &arr[ii]->x_prop_log, &arr[ii]->p_prop_log};
 
         for(int jj=0; jj<6; ++jj){
 
-            snprintf(&log_fn[dirlen], 100-dirlen, "output/logs/kf/%s/%s.log", axes[ii], vars[jj]);
-            *logs[jj] = fopen(log_fn, "a");
+            snprintf(&log_fn[dirlen], 100-dirlen, "output/logs/kf/%s/%s.bin", axes[ii], vars[jj]);
+            *logs[jj] = binlog_open(log_fn, cols[jj], n_cols[jj]);
             if(*logs[jj] == NULL){
-                logging(ERROR, "Kalman F", "Failed to open %s log for axis %c: %m",
+                logging(ERROR, "Kalman F", "Failed to open %s log for axis %s: %m",
                         vars[jj], axes[ii]);
                 return errno;
             }
@@ -373,76 +419,67 @@ static int open_logs(void){
 }
 
 static char first_st_flag = 1;
-static size_t hist_index = 0;
 int kf_update(telescope_att_t* cur_att){
 
-    gyro_t gyro;
-    get_gyro(&gyro);
+    gyro_t gyro[KF_MAX_SAMPLES];
+    int n_gyro = drain_gyro(gyro, KF_MAX_SAMPLES);
 
-    star_tracker_t st;
+    star_tracker_t st[KF_MAX_FIXES];
+    int n_st = 0;
     #ifdef KF_TEST
         if(l % 1000 == 0){
         //if(l<init_steps){
-            st.ra = 0;
-            st.dec = 0;
-            st.roll = 0;
-            st.new_data = 1;
-            st.out_of_date = 0;
-        }
-        else{
-            st.new_data = 0;
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            st[0].ra = 0;
+            st[0].dec = 0;
+            st[0].roll = 0;
+            st[0].new_data = 1;
+            st[0].out_of_date = 0;
+            st[0].exp_start = now;
+            st[0].exp_end = now;
+            n_st = 1;
         }
     #else
-        get_star_tracker(&st);
+        n_st = drain_star_tracker(st, KF_MAX_FIXES);
     #endif
 
-    if(st.new_data){
+    if(n_st && first_st_flag){
 
+        /* convert ra & dec to az & alt, the star tracker ra is in degrees */
         double az_ang = 0, alt_ang = 0;
-        /* convert ra & dec to az & alt */
         #ifndef KF_TEST
-            rd_to_aa(st.ra, st.dec, &az_ang, &alt_ang);
+            rd_to_aa(st[0].ra / 15, st[0].dec, &az_ang, &alt_ang);
         #endif
 
-        if(first_st_flag){
-            init_kalman_vars(az_ang, alt_ang);
-            set_tracking_angles(az_ang, alt_ang);
-
-            logging(INFO, "MODE", "Waking selection and tracking");
-            pthread_mutex_lock(&mutex_cond_sel_track);
-            pthread_cond_signal(&cond_sel_track);
-            pthread_mutex_unlock(&mutex_cond_sel_track);
-
-            first_st_flag = 0;
-        }
-
-        kf_axis(alt, gyro.z, &alt_ang);
+        init_kalman_vars(az_ang, alt_ang);
+        set_tracking_angles(az_ang, alt_ang);
 
-        double sin_alt = sin(alt.x_prev[0][0] * M_PI / 180);
-        double cos_alt = cos(alt.x_prev[0][0] * M_PI / 180);
+        /* the history is of the uninitialised filter */
+        hist_count = 0;
 
-        double gyro_az = gyro.x * cos_alt - gyro.y * sin_alt;
+        logging(INFO, "MODE", "Waking selection and tracking");
+        pthread_mutex_lock(&mutex_cond_sel_track);
+        pthread_cond_signal(&cond_sel_track);
+        pthread_mutex_unlock(&mutex_cond_sel_track);
 
-        kf_axis(az, gyro_az, &az_ang);
-
-        hist_index = 0;
+        first_st_flag = 0;
     }
-    else{
-
-        kf_axis(alt, gyro.z, NULL);
-
-        double sin_alt = sin(alt.x_prev[0][0] * M_PI / 180);
-        double cos_alt = cos(alt.x_prev[0][0] * M_PI / 180);
 
-        double gyro_az = gyro.x * cos_alt - gyro.y * sin_alt;
-
-        kf_axis(az, gyro_az, NULL);
+    for(int ii=0; ii<n_gyro; ++ii){
+        kf_gyro_sample(&gyro[ii]);
+    }
 
-        hist_index++;
+    /* the fixes are fused at the time of their exposure, after the
+     * samples up to now are in the history
+     */
+    for(int ii=0; ii<n_st; ++ii){
+        kf_st_fix(&st[ii]);
     }
 
-    cur_att->az = az.x_prev[0][0];
-    cur_att->alt = alt.x_prev[0][0];
+    cur_att->az = lanes_get(x_prev.v[0], AZ_LANE);
+    cur_att->alt = lanes_get(x_prev.v[0], ALT_LANE);
 
     set_telescope_att(cur_att);
 
@@ -456,189 +493,241 @@ int kf_update(telescope_att_t* cur_att){
     return SUCCESS;
 }
 
-static int kf_axis(axis_context_t axis, double gyro_data, double* st_data){
+/* model_dt:
+ * Set the propagation of model_l for a gyro sample dt after the previous
+ * one. Phi and Gamma are linear in dt, and with Q = ARW/dt the process
+ * noise Upsilon*Q*Upsilon' is ARW*dt, the same for the bias with RRW.
+ *
+ * input:
+ *      dt: unit: seconds
+ */
+static void model_dt(double dt){
 
-    axis.w_meas[0][0] = gyro_data;
+    model_l.Phi.m[0][1] = lanes_dup(-dt);
+    model_l.Gamma.v[0] = lanes_dup(dt);
+    model_l.Qd.m[0][0] = lanes_dup(arw*dt);
+    model_l.Qd.m[1][1] = lanes_dup(rrw*dt);
+}
 
-    // propagate state vector
-    prop_state_vec(axis);
+/* kf_gyro_sample:
+ * Propagate both axes with a gyro sample over the time since the previous
+ * one and store them as the newest history sample. A sample not after the
+ * previous one is skipped.
+ */
+static void kf_gyro_sample(const gyro_t* gyro){
 
-    prop_p_next(axis);
+    long long t = gyro->time.tv_sec * 1000000000LL + gyro->time.tv_nsec;
 
-    if (st_data != NULL){
+    /* the first sample has nothing before it, it gets the nominal dt */
+    double dt = (double)GYRO_SAMPLE_TIME/1000000000;
+    if(last_gyro_ns){
+        if(t <= last_gyro_ns){
+            return;
+        }
+        dt = (double)(t - last_gyro_ns)/1000000000;
+    }
+    last_gyro_ns = t;
 
-        if(hist_index == (long)HIST_LENGTH_S * SENS_FREQ){
-            int hist_len = (long)HIST_LENGTH_S * SENS_FREQ;
-            int save_len = 90L * SENS_FREQ;
-            /* reset history and keep latest 90 seconds */
-            for(int ii=0; ii<save_len; ++ii){
-                int prev_index = hist_len - save_len + ii;
+    model_dt(dt);
 
-                /* save x_prev */
-                axis.gyro_hist[ii] = axis.gyro_hist[prev_index];
+    /* the az rate needs the alt angle after propagation, the same as
+     * kf_propagate_l gives in its alt lane
+     */
+    double alt_next = lanes_get(x_prev.v[0], ALT_LANE) -
+        dt*lanes_get(x_prev.v[1], ALT_LANE) + dt*gyro->z;
 
-                for(int jj=0; jj<X_PREV_ROWS; ++jj){
-                    axis.x_hist[ii][jj] = axis.x_hist[prev_index][jj];
-                }
+    double sin_alt = sin(alt_next * M_PI / 180);
+    double cos_alt = cos(alt_next * M_PI / 180);
 
-                for(int jj=0; jj<P_PREV_ROWS; ++jj){
-                    for(int kk=0; kk<P_PREV_COLS; ++kk){
-                        axis.p_hist[ii][jj][kk] = axis.p_hist[prev_index][jj][kk];
-                    }
-                }
-            }
-            hist_index = save_len;
-        }
+    double gyro_az = gyro->x * cos_alt - gyro->y * sin_alt;
 
-        /* go back to middle of exposure and re-propagate */
-        int prop_from_index = (get_st_exp() * 1000) / (2 * GYRO_SAMPLE_TIME);
+    // propagate state vector and covariance
+    kf_propagate_l(&model_l, &x_prev, &P_prev, lanes_set(gyro->z, gyro_az));
 
-        for(int ii=0; ii<X_PREV_ROWS; ++ii){
-            axis.x_next[ii][0] = axis.x_hist[prop_from_index][ii];
-        }
+    /* Save estimated state and P matrix in history */
+    hist_head = (hist_head + 1) & HIST_MASK;
+    hist_time[hist_head] = t;
+    hist.x[hist_head] = x_prev;
+    hist.P[hist_head] = P_prev;
+    if(hist_count < HIST_SIZE){
+        hist_count++;
+    }
 
-        for(int ii=0; ii<P_PREV_ROWS; ++ii){
-            for(int jj=0; jj<P_PREV_COLS; ++jj){
-                axis.P_next[ii][jj] = axis.p_hist[prop_from_index][ii][jj];
-            }
+    /* TODO: if we dont get any ST measurements for 10 min
+     *       call set_mode(RESET);
+     *       and send message as telemetry & log
+     */
+
+    // save estimates
+    log_state_l(&x_prev, &P_prev, 1);
+
+    #ifdef KF_DEBUG
+        logging(DEBUG, "Kalman F", "step number: %d, dt: %.6f", l, dt);
+        for(int ii=0; ii<2; ++ii){
+            logging(DEBUG, "Kalman F", "%s x_prev:", ii == ALT_LANE ? "alt" : "az");
+            logging(DEBUG, "Kalman F", "%+.6e", lanes_get(x_prev.v[0], ii));
+            logging(DEBUG, "Kalman F", "%+.6e", lanes_get(x_prev.v[1], ii));
+
+            logging(DEBUG, "Kalman F", "%s P_prev:", ii == ALT_LANE ? "alt" : "az");
+            logging(DEBUG, "Kalman F", "%+.6e\t%+.6e",
+                    lanes_get(P_prev.m[0][0], ii), lanes_get(P_prev.m[0][1], ii));
+            logging(DEBUG, "Kalman F", "%+.6e\t%+.6e",
+                    lanes_get(P_prev.m[1][0], ii), lanes_get(P_prev.m[1][1], ii));
         }
+    #endif
+}
 
-        // innovation
-        innovate_nu_next(axis, st_data);
-        update_s_next(axis);
+/* kf_st_fix:
+ * Fuse a star tracker fix with the history sample nearest to the middle of
+ * its exposure, and carry the correction forward to the newest.
+ */
+static void kf_st_fix(const star_tracker_t* st){
 
-        //          log(nu_next);
-        //          log(S_next);
-        logging_csv(axis.nu_log, "%+.10e", **axis.nu_next);
-        logging_csv(axis.s_log, "%+.10e", **axis.S_next);
+    /* fuse at the middle of the exposure */
+    long long mid_ns = (st->exp_start.tv_sec + st->exp_end.tv_sec) * 500000000LL +
+        (st->exp_start.tv_nsec + st->exp_end.tv_nsec) / 2;
 
-        #ifdef KF_DEBUG
-            logging(DEBUG, "Kalman F", "nu_next:");
-            logging(DEBUG, "Kalman F", "%+.6e", axis.nu_next[0][0]);
+    /* no gyro sample since the filter was initialised, the fix is for the
+     * current estimate
+     */
+    if(hist_count == 0){
+        hist_head = (hist_head + 1) & HIST_MASK;
+        hist_time[hist_head] = mid_ns;
+        hist.x[hist_head] = x_prev;
+        hist.P[hist_head] = P_prev;
+        hist_count = 1;
+    }
 
-            logging(DEBUG, "Kalman F", "S_next:");
-            logging(DEBUG, "Kalman F", "%+.6e", axis.S_next[0][0]);
-        #endif
+    unsigned int st_age = hist_age(mid_ns);
 
-        // compute the Kalman gain
-        comp_k_gain(axis);
+    long long oldest_ns = hist_time[(hist_head - (hist_count - 1)) & HIST_MASK];
+    if(hist_count > 1 && mid_ns < oldest_ns - 1000000000LL / SENS_FREQ){
+        logging(WARN, "Kalman F", "Star tracker fix %.3f s older than the "
+                "history, fused at the oldest sample",
+                (oldest_ns - mid_ns) / 1e9);
+    }
 
-        // update of states and covariance
-        update_state(axis);
-        update_covar(axis);
+    /* estimate at the middle of the exposure */
+    unsigned int idx = (hist_head - st_age) & HIST_MASK;
+    vec2_l_t x_exp = hist.x[idx];
+    mat2_l_t P_exp = hist.P[idx];
 
-        // save estimates (and log)
-        //x_prev = x_upd;
-        for(int i = 0; i < X_PREV_ROWS; i++) {
-            for(int j = 0; j < X_PREV_COLS; j++) {
-                axis.x_prev[i][j] = axis.x_upd[i][j];
-            }
-        }
+    lanes_t meas;
+    #ifdef KF_TEST
+        meas = lanes_dup(ang_init);
+    #else
+        /* convert ra & dec to az & alt, the star tracker ra is in degrees */
+        double az_ang, alt_ang;
+        rd_to_aa(st->ra / 15, st->dec, &az_ang, &alt_ang);
+        meas = lanes_set(alt_ang, az_ang);
+    #endif
 
-        // propagate with initialisation measurement
-        //P_prev = P_upd;
-        for(int i = 0; i < P_PREV_ROWS; i++) {
-            for(int j = 0; j < P_PREV_COLS; j++) {
-                axis.P_prev[i][j] = axis.P_upd[i][j];
-            }
-        }
-        //          log(x_prev);
-        //          log(P_prev);
-        logging_csv(axis.x_log, "%+.10e,%+.10e", axis.x_prev[0][0], axis.x_prev[1][0]);
+    // innovation
+    lanes_t nu_next, S_next;
+    kf_innovate_l(&model_l, &x_exp, &P_exp, meas, &nu_next, &S_next);
 
-        logging_csv(axis.p_log, "%+.10e,%+.10e,%+.10e,%+.10e",
-            axis.P_prev[0][0], axis.P_prev[0][1], axis.P_prev[1][0], axis.P_prev[1][1]);
+    binlog_write(alt.nu_log, lanes_get(nu_next, ALT_LANE));
+    binlog_write(alt.s_log, lanes_get(S_next, ALT_LANE));
+    binlog_write(az.nu_log, lanes_get(nu_next, AZ_LANE));
+    binlog_write(az.s_log, lanes_get(S_next, AZ_LANE));
 
-        /* re-propagation loop */
-        for(int ii = prop_from_index; ii < hist_index; ++ii){
+    #ifdef KF_DEBUG
+        logging(DEBUG, "Kalman F", "nu_next:");
+        logging(DEBUG, "Kalman F", "%+.6e\t%+.6e",
+                lanes_get(nu_next, ALT_LANE), lanes_get(nu_next, AZ_LANE));
 
-            /* load gyro measurements */
-            axis.w_meas[0][0] = axis.gyro_hist[ii];
+        logging(DEBUG, "Kalman F", "S_next:");
+        logging(DEBUG, "Kalman F", "%+.6e\t%+.6e",
+                lanes_get(S_next, ALT_LANE), lanes_get(S_next, AZ_LANE));
+    #endif
 
-            prop_state_vec(axis);
-            prop_p_next(axis);
+    /* the transition over the samples since the exposure is the one over
+     * their total time, as Phi is linear in dt
+     */
+    double elapsed = (double)(hist_time[hist_head] - hist_time[idx])/1000000000;
+    mat2_t Phi_age = {{
+        {1, -elapsed},
+        {0, 1}
+    }};
 
-            //x_prev = x_next;
-            for(int i = 0; i < X_PREV_ROWS; i++) {
-                for(int j = 0; j < X_PREV_COLS; j++) {
-                    axis.x_prev[i][j] = axis.x_next[i][j];
-                }
-            }
-            //P_prev = P_next;
-            for(int i = 0; i < P_PREV_ROWS; i++) {
-                for(int j = 0; j < P_PREV_COLS; j++) {
-                    axis.P_prev[i][j] = axis.P_next[i][j];
-                }
-            }
-            //          log(x_prev);
-            //          log(P_prev);
-            logging_csv(axis.x_log, "%+.10e,%+.10e", axis.x_prev[0][0], axis.x_prev[1][0]);
+    // update of states and covariance
+    kf_correct_delayed_l(&model_l, &Phi_age, &x_prev, &P_prev, &P_exp,
+            nu_next, S_next);
 
-            logging_csv(axis.p_log, "%+.10e,%+.10e,%+.10e,%+.10e",
-                axis.P_prev[0][0], axis.P_prev[0][1], axis.P_prev[1][0], axis.P_prev[1][1]);
-        }
-    }
-    // new ST data not available
-    else {
-
-        /* TODO: if we dont get any ST measurements for 10 min
-         *       call set_mode(RESET);
-         *       and send message as telemetry & log
-         */
-
-        //x_prev = x_next;
-        for(int i = 0; i < X_PREV_ROWS; i++) {
-            for(int j = 0; j < X_PREV_COLS; j++) {
-                axis.x_prev[i][j] = axis.x_next[i][j];
-            }
-        }
-        //P_prev = P_next;
-        for(int i = 0; i < P_PREV_ROWS; i++) {
-            for(int j = 0; j < P_PREV_COLS; j++) {
-                axis.P_prev[i][j] = axis.P_next[i][j];
-            }
-        }
+    // save estimates (and log)
+    log_state_l(&x_prev, &P_prev, 0);
 
-        // save estimates
-        //          log(x_next);
-        //          log(P_next);
-        logging_csv(axis.x_prop_log, "%+.10e,%+.10e", axis.x_prev[0][0], axis.x_prev[1][0]);
+    hist.x[hist_head] = x_prev;
+    hist.P[hist_head] = P_prev;
 
-        logging_csv(axis.p_prop_log, "%+.10e,%+.10e,%+.10e,%+.10e",
-                axis.P_prev[0][0], axis.P_prev[0][1], axis.P_prev[1][0], axis.P_prev[1][1]);
+    /* older samples hold estimates from before the fix */
+    hist_count = 1;
+}
 
-        /* Save gyro data, estimated state, and P matrix in history */
-        axis.gyro_hist[hist_index] = gyro_data;
+/* hist_age:
+ * Find the history sample taken nearest to a time.
+ *
+ * input:
+ *      time: CLOCK_MONOTONIC time in nanoseconds
+ *
+ * return:
+ *      the number of samples the found sample is back from the newest, the
+ *      oldest sample if all are later
+ */
+static unsigned int hist_age(long long time){
 
-        for(int ii=0; ii<X_PREV_ROWS; ++ii){
-            axis.x_hist[hist_index][ii] = axis.x_prev[ii][0];
-        }
+    unsigned int lo = 0, hi = hist_count - 1;
 
-        for(int ii=0; ii<P_PREV_ROWS; ++ii){
-            for(int jj=0; jj<P_PREV_COLS; ++jj){
-                axis.p_hist[hist_index][ii][jj] = axis.P_prev[ii][jj];
-            }
+    /* the time of the samples decreases with the age */
+    while(lo < hi){
+        unsigned int mid = (lo + hi) / 2;
+        if(hist_time[(hist_head - mid) & HIST_MASK] <= time){
+            hi = mid;
         }
+        else{
+            lo = mid + 1;
+        }
+    }
 
-        //          printf("x_prev for i = %d", l);
-        //          printarray2D(x_prev, X_PREV_ROWS, X_PREV_COLS);
-        // x_next = Phi * x_prev + Gamma * w_meas;
-        #ifdef KF_DEBUG
-            logging(DEBUG, "Kalman F", "step number: %d", l);
-            logging(DEBUG, "Kalman F", "x_prev:");
-            logging(DEBUG, "Kalman F", "%+.6e", axis.x_prev[0][0]);
-            logging(DEBUG, "Kalman F", "%+.6e", axis.x_prev[1][0]);
+    /* lo is the newest at or before the time, the one after may be nearer */
+    if(lo > 0 && hist_time[(hist_head - lo) & HIST_MASK] <= time &&
+            hist_time[(hist_head - lo + 1) & HIST_MASK] - time <
+            time - hist_time[(hist_head - lo) & HIST_MASK]){
+        lo--;
+    }
 
-            logging(DEBUG, "Kalman F", "P_prev:");
-            logging(DEBUG, "Kalman F", "%+.6e\t%+.6e",
-                    axis.P_prev[0][0], axis.P_prev[0][1]);
-            logging(DEBUG, "Kalman F", "%+.6e\t%+.6e",
-                    axis.P_prev[1][0], axis.P_prev[1][1]);
-        #endif
+    return lo;
+}
 
-    }
+static void log_state(binlog_t* x_log, binlog_t* p_log, const vec2_t* x, const mat2_t* P){
 
-    return SUCCESS;
+    binlog_write(x_log, x->v[0], x->v[1]);
+    binlog_write(p_log, P->m[0][0], P->m[0][1], P->m[1][0], P->m[1][1]);
+}
+
+/* log_state_l:
+ * Log the state of both axes, to the propagation logs if prop is set.
+ */
+static void log_state_l(const vec2_l_t* x, const mat2_l_t* P, int prop){
+
+    axis_context_t* arr[2];
+    arr[ALT_LANE] = &alt;
+    arr[AZ_LANE] = &az;
+
+    for(int ii=0; ii<2; ++ii){
+        vec2_t x_axis = {{lanes_get(x->v[0], ii), lanes_get(x->v[1], ii)}};
+        mat2_t P_axis = {{
+            {lanes_get(P->m[0][0], ii), lanes_get(P->m[0][1], ii)},
+            {lanes_get(P->m[1][0], ii), lanes_get(P->m[1][1], ii)}
+        }};
+
+        if(prop){
+            log_state(arr[ii]->x_prop_log, arr[ii]->p_prop_log, &x_axis, &P_axis);
+        }
+        else{
+            log_state(arr[ii]->x_log, arr[ii]->p_log, &x_axis, &P_axis);
+        }
+    }
 }
 
 /*******************************************************************************
@@ -647,557 +736,548 @@ static int kf_axis(axis_context_t axis, double gyro_data, double* st_data){
 ********************************************************************************
 *******************************************************************************/
 
+static inline vec2_t mat2_vec(const mat2_t* A, const vec2_t* x){
 
-/* x_next = Phi * x_prev + Gamma * w_meas; */
-static void prop_state_vec(axis_context_t axis){
-
-    // definition of mmult1[PHI_ROWS][X_PREV_COLS]
-    double **mmult1;
-    int mmult1_rows = PHI_ROWS;
-    int mmult1_cols = X_PREV_COLS;
-
-    mmult1 = malloc(mmult1_rows * sizeof *mmult1);
-    for (int i = 0; i < mmult1_rows; i++) {
-        mmult1[i] = malloc(mmult1_cols * sizeof *mmult1[i]);
-    }
-    mmult(axis.Phi, axis.x_prev, mmult1, PHI_ROWS, PHI_COLS, X_PREV_ROWS, X_PREV_COLS);
-
-    //      printf("x_prev for i = %d", l);
-    //      printarray2D(x_prev, X_PREV_ROWS, X_PREV_COLS);
-    // definition of mmult2[GAMMA_ROWS][W_MEAS_COLS]
-    double **mmult2;
-    int mmult2_rows = GAMMA_ROWS;
-    int mmult2_cols = W_MEAS_COLS;
-
-    mmult2 = malloc(mmult2_rows * sizeof *mmult2);
-    for (int i = 0; i < mmult2_rows; i++) {
-        mmult2[i] = malloc(mmult2_cols * sizeof *mmult2[i]);
+    vec2_t y;
+    for(int ii=0; ii<2; ++ii){
+        y.v[ii] = A->m[ii][0]*x->v[0] + A->m[ii][1]*x->v[1];
     }
-    mmult(axis.Gamma, axis.w_meas, mmult2, GAMMA_ROWS, GAMMA_COLS, W_MEAS_ROWS, W_MEAS_COLS);
+    return y;
+}
 
-    madd(mmult1, mmult2, axis.x_next, mmult1_rows, mmult1_cols);
-    // x_next = Phi * x_prev + Gamma * w_meas;
-    //      printf("x_next for i = %d", l);
-    //      printarray2D(x_next, X_NEXT_ROWS, X_NEXT_COLS);
+/* A*B */
+static inline mat2_t mat2_mul(const mat2_t* A, const mat2_t* B){
 
-    // free mmult1
-    for (int i = 0; i < mmult1_rows; i++) {
-        free(mmult1[i]);
+    mat2_t C;
+    for(int ii=0; ii<2; ++ii){
+        for(int jj=0; jj<2; ++jj){
+            C.m[ii][jj] = A->m[ii][0]*B->m[0][jj] + A->m[ii][1]*B->m[1][jj];
+        }
     }
-    free(mmult1);
+    return C;
+}
 
-    // free mmult2
-    for (int i = 0; i < mmult2_rows; i++) {
-        free(mmult2[i]);
+/* A*B' */
+static inline mat2_t mat2_mul_t(const mat2_t* A, const mat2_t* B){
+
+    mat2_t C;
+    for(int ii=0; ii<2; ++ii){
+        for(int jj=0; jj<2; ++jj){
+            C.m[ii][jj] = A->m[ii][0]*B->m[jj][0] + A->m[ii][1]*B->m[jj][1];
+        }
     }
-    free(mmult2);
+    return C;
 }
 
-/* P_next = Phi*P_prev*Phi' + Upsilon*Q*Upsilon' + Upsilon2*Q2*Upsilon2'; */
-static void prop_p_next(axis_context_t axis){
+#ifdef KF_BENCH
+/* A^n, by repeated squaring */
+static mat2_t mat2_pow(const mat2_t* A, unsigned int n){
 
-    // propagate P_next
-    // re-definition of mmult1[length(Phi)][length(P_prev[1])];
-    double** mmult1;
-    int mmult1_rows = PHI_ROWS;
-    int mmult1_cols = P_PREV_COLS;
+    mat2_t result = {{{1, 0}, {0, 1}}};
+    mat2_t base = *A;
 
-    mmult1 = malloc(mmult1_rows * sizeof *mmult1);
-    for (int i = 0; i < mmult1_rows; i++) {
-        mmult1[i] = malloc(mmult1_cols * sizeof *mmult1[i]);
-    }
-    mmult(axis.Phi, axis.P_prev, mmult1, PHI_ROWS, PHI_COLS, P_PREV_ROWS, P_PREV_COLS);
-    // definition of trans[length(Phi[0])][length(Phi)];
-    double **trans;
-    int trans_rows = PHI_COLS;
-    int trans_cols = PHI_ROWS;
-
-    trans = malloc(trans_rows * sizeof *trans);
-    for (int i = 0; i < trans_rows; i++) {
-        trans[i] = malloc(trans_cols * sizeof *trans[i]);
+    while(n){
+        if(n & 1){
+            result = mat2_mul(&result, &base);
+        }
+        base = mat2_mul(&base, &base);
+        n >>= 1;
     }
-    transpose(axis.Phi, trans, PHI_ROWS, PHI_COLS);
 
-    // re-definition of mmult2[length(mmult1)][length(Phi)];
-    double **mmult2;
-    int mmult2_rows = mmult1_rows;
-    int mmult2_cols = trans_cols;
+    return result;
+}
 
-    mmult2 = malloc(mmult2_rows * sizeof *mmult2);
-    for (int i = 0; i < mmult2_rows; i++) {
-        mmult2[i] = malloc(mmult2_cols * sizeof *mmult2[i]);
-    }
-    mmult(mmult1, trans, mmult2, mmult1_rows, mmult1_cols, trans_rows, trans_cols);
+/* The filter for one axis, the reference for the functions on both axes in
+ * lanes below.
+ */
 
+/* x_next = Phi * x_prev + Gamma * w_meas;
+ * P_next = Phi*P_prev*Phi' + Upsilon*Q*Upsilon' + Upsilon2*Q2*Upsilon2';
+ */
+static void kf_propagate(const kf_model_t* model, vec2_t* x, mat2_t* P, double w_meas){
 
-    // free mmult1
-    for (int i = 0; i < mmult1_rows; i++) {
-        free(mmult1[i]);
+    vec2_t Phi_x = mat2_vec(&model->Phi, x);
+    for(int ii=0; ii<2; ++ii){
+        x->v[ii] = Phi_x.v[ii] + model->Gamma.v[ii]*w_meas;
     }
-    free(mmult1);
-    // free trans
-    for (int i = 0; i < trans_rows; i++) {
-        free(trans[i]);
+
+    mat2_t Phi_P = mat2_mul(&model->Phi, P);
+    mat2_t Phi_P_Phi = mat2_mul_t(&Phi_P, &model->Phi);
+    for(int ii=0; ii<2; ++ii){
+        for(int jj=0; jj<2; ++jj){
+            P->m[ii][jj] = Phi_P_Phi.m[ii][jj] + model->Qd.m[ii][jj];
+        }
     }
-    free(trans);
+}
 
-    //              printf("Phi*P_prev*Phi for i = %d", l);
-    //              printarray2D(mmult2, mmult2_rows, mmult2_cols);
-    //mmult2 = Phi*P_prev*Phi'
+/* nu_next = t_meas - H*x_est_next;
+ * S_next = H*P_next*H' + R;
+ */
+static void kf_innovate(const kf_model_t* model, const vec2_t* x, const mat2_t* P,
+        double meas, double* nu_next, double* S_next){
 
-    // re-definition of mmult1[length(Upsilon)][length(Q[1])];
-    mmult1_rows = UPSILON_ROWS;
-    mmult1_cols = Q_COLS;
+    const double* H = model->H.v;
 
-    mmult1 = malloc(mmult1_rows * sizeof *mmult1);
-    for (int i = 0; i < mmult1_rows; i++) {
-        mmult1[i] = malloc(mmult1_cols * sizeof *mmult1[i]);
-    }
-    mmult(axis.Upsilon, axis.Q, mmult1, UPSILON_ROWS, UPSILON_COLS, Q_ROWS, Q_COLS);
-    // re-definition of trans[length(Upsilon[0])][length(Upsilon)];
-    trans_rows = UPSILON_COLS;
-    trans_cols = UPSILON_ROWS;
-
-    trans = malloc(trans_rows * sizeof *trans);
-    for (int i = 0; i < trans_rows; i++) {
-        trans[i] = malloc(trans_cols * sizeof *trans[i]);
-    }
-    transpose(axis.Upsilon, trans, UPSILON_ROWS, UPSILON_COLS);
+    //'propagation error' (difference between estimated state and measured state
+    *nu_next = meas - (H[0]*x->v[0] + H[1]*x->v[1]);
 
-    // definition of mmult3[length(mmult1)][length(Q)];
-    double **mmult3;
-    int mmult3_rows = mmult1_rows;
-    int mmult3_cols = trans_cols;
+    double H_P0 = H[0]*P->m[0][0] + H[1]*P->m[1][0];
+    double H_P1 = H[0]*P->m[0][1] + H[1]*P->m[1][1];
+    *S_next = (H_P0*H[0] + H_P1*H[1]) + model->R;
+}
 
-    mmult3 = malloc(mmult3_rows * sizeof *mmult3);
-    for (int i = 0; i < mmult3_rows; i++) {
-        mmult3[i] = malloc(mmult3_cols * sizeof *mmult3[i]);
-    }
-    mmult(mmult1, trans, mmult3, mmult1_rows, mmult1_cols, trans_rows, trans_cols);
+/* K = P_exp*H'/S_next;
+ * x_upd = x_exp + K*nu_next;
+ * P_upd = (eye(2)-K*H)*P_exp;
+ * for the estimate at the exposure, age samples ago, and carried forward to
+ * the current estimate as if x_upd and P_upd were propagated again.
+ *
+ * The update changes the estimate at the exposure by K*nu_next and its
+ * covariance by -K*H*P_exp = -S_next*K*K'. Propagation is linear with a
+ * constant Phi, so after age samples the changes are G*nu_next and
+ * -S_next*G*G' with G = Phi^age*K, whatever the gyro data in between.
+ */
+static void kf_correct_delayed(const kf_model_t* model, vec2_t* x, mat2_t* P,
+        const mat2_t* P_exp, unsigned int age, double nu_next, double S_next){
 
-    // free mmult1
-    for (int i = 0; i < mmult1_rows; i++) {
-        free(mmult1[i]);
-    }
-    free(mmult1);
-    // free trans
-    for (int i = 0; i < trans_rows; i++) {
-        free(trans[i]);
+    const double* H = model->H.v;
+    vec2_t K;
+
+    // K = P_exp*H'/S_next;
+    for(int ii=0; ii<2; ++ii){
+        K.v[ii] = (P_exp->m[ii][0]*H[0] + P_exp->m[ii][1]*H[1]) / S_next;
     }
-    free(trans);
-    //mmult3 = Upsilon*Q*Upsilon'
 
-    // re-definition of mmult1[length(Upsilon2)][length(Q2[1])];
-    mmult1_rows = UPSILON2_ROWS;
-    mmult1_cols = Q2_COLS;
+    mat2_t Phi_age = mat2_pow(&model->Phi, age);
+    vec2_t G = mat2_vec(&Phi_age, &K);
+
+    for(int ii=0; ii<2; ++ii){
+        x->v[ii] = x->v[ii] + G.v[ii]*nu_next;
 
-    mmult1 = malloc(mmult1_rows * sizeof *mmult1);
-    for (int i = 0; i < mmult1_rows; i++) {
-        mmult1[i] = malloc(mmult1_cols * sizeof *mmult1[i]);
+        for(int jj=0; jj<2; ++jj){
+            P->m[ii][jj] = P->m[ii][jj] - S_next*G.v[ii]*G.v[jj];
+        }
     }
-    mmult(axis.Upsilon2, axis.Q2, mmult1, UPSILON2_ROWS, UPSILON2_COLS, Q2_ROWS, Q2_COLS);
+}
 
-    // re-definition of trans[length(Upsilon2[0])][length(Upsilon2)];
-    trans_rows = UPSILON2_COLS;
-    trans_cols = UPSILON2_ROWS;
+#endif
 
-    trans = malloc(trans_rows * sizeof *trans);
-    for (int i = 0; i < trans_rows; i++) {
-        trans[i] = malloc(trans_cols * sizeof *trans[i]);
-    }
-    transpose(axis.Upsilon2, trans, UPSILON2_ROWS, UPSILON2_COLS);
+/* The same for both axes in lanes, operation for operation, so each lane
+ * gets the result of the scalar function for its axis.
+ */
+static void kf_propagate_l(const kf_model_l_t* model, vec2_l_t* x, mat2_l_t* P,
+        lanes_t w_meas){
 
-    // definition of mmult4[length(mmult1)][length(Q2)];
-    double **mmult4;
-    int mmult4_rows = mmult1_rows;
-    int mmult4_cols = trans_cols;
+    const mat2_l_t* Phi = &model->Phi;
 
-    mmult4 = malloc(mmult4_rows * sizeof *mmult4);
-    for (int i = 0; i < mmult4_rows; i++) {
-        mmult4[i] = malloc(mmult4_cols * sizeof *mmult4[i]);
+    vec2_l_t x_in = *x;
+    for(int ii=0; ii<2; ++ii){
+        lanes_t Phi_x = lanes_add(lanes_mul(Phi->m[ii][0], x_in.v[0]),
+                lanes_mul(Phi->m[ii][1], x_in.v[1]));
+        x->v[ii] = lanes_add(Phi_x, lanes_mul(model->Gamma.v[ii], w_meas));
     }
-    mmult(mmult1, trans, mmult4, mmult1_rows, mmult1_cols, trans_rows, trans_cols);
 
-    // free mmult1
-    for (int i = 0; i < mmult1_rows; i++) {
-        free(mmult1[i]);
+    mat2_l_t Phi_P;
+    for(int ii=0; ii<2; ++ii){
+        for(int jj=0; jj<2; ++jj){
+            Phi_P.m[ii][jj] = lanes_add(lanes_mul(Phi->m[ii][0], P->m[0][jj]),
+                    lanes_mul(Phi->m[ii][1], P->m[1][jj]));
+        }
     }
-    free(mmult1);
-    // free trans
-    for (int i = 0; i < trans_rows; i++) {
-        free(trans[i]);
+    for(int ii=0; ii<2; ++ii){
+        for(int jj=0; jj<2; ++jj){
+            lanes_t Phi_P_Phi = lanes_add(lanes_mul(Phi_P.m[ii][0], Phi->m[jj][0]),
+                    lanes_mul(Phi_P.m[ii][1], Phi->m[jj][1]));
+            P->m[ii][jj] = lanes_add(Phi_P_Phi, model->Qd.m[ii][jj]);
+        }
     }
-    free(trans);
-    //mmult4 = Upsilon2*Q2*Upsilon2'
+}
 
-    // definition of madd1[length(mmult2)][length(mmult2[1])];
-    double **madd1;
-    int madd1_rows = mmult2_rows;
-    int madd1_cols = mmult2_cols;
+static void kf_innovate_l(const kf_model_l_t* model, const vec2_l_t* x,
+        const mat2_l_t* P, lanes_t meas, lanes_t* nu_next, lanes_t* S_next){
 
-    madd1 = malloc(madd1_rows * sizeof *madd1);
-    for (int i = 0; i < madd1_rows; i++) {
-        madd1[i] = malloc(madd1_cols * sizeof *madd1[i]);
-    }
-    madd(mmult2, mmult3, madd1, mmult2_rows, mmult2_cols);
+    const lanes_t* H = model->H.v;
 
-    madd(madd1, mmult4, axis.P_next, madd1_rows, madd1_cols);
+    *nu_next = lanes_sub(meas, lanes_add(lanes_mul(H[0], x->v[0]),
+                lanes_mul(H[1], x->v[1])));
 
+    lanes_t H_P0 = lanes_add(lanes_mul(H[0], P->m[0][0]), lanes_mul(H[1], P->m[1][0]));
+    lanes_t H_P1 = lanes_add(lanes_mul(H[0], P->m[0][1]), lanes_mul(H[1], P->m[1][1]));
+    *S_next = lanes_add(lanes_add(lanes_mul(H_P0, H[0]), lanes_mul(H_P1, H[1])),
+            model->R);
+}
 
-    // free mmult2
-    for (int i = 0; i < mmult2_rows; i++) {
-        free(mmult2[i]);
-    }
-    free(mmult2);
+/* Phi_age is the scalar transition from the exposure to the newest sample,
+ * the same for both axes. With the dt of each sample it is the product of
+ * their Phi, which is the Phi of the time between them.
+ */
+static void kf_correct_delayed_l(const kf_model_l_t* model, const mat2_t* Phi_age,
+        vec2_l_t* x, mat2_l_t* P, const mat2_l_t* P_exp, lanes_t nu_next,
+        lanes_t S_next){
 
-    // free mmult3
-    for (int i = 0; i < mmult3_rows; i++) {
-        free(mmult3[i]);
-    }
-    free(mmult3);
+    const lanes_t* H = model->H.v;
+    vec2_l_t K, G;
 
-    // free mmult4
-    for (int i = 0; i < mmult4_rows; i++) {
-        free(mmult4[i]);
+    // K = P_exp*H'/S_next;
+    for(int ii=0; ii<2; ++ii){
+        K.v[ii] = lanes_div(lanes_add(lanes_mul(P_exp->m[ii][0], H[0]),
+                    lanes_mul(P_exp->m[ii][1], H[1])), S_next);
     }
-    free(mmult4);
 
-    // free madd1
-    for (int i = 0; i < madd1_rows; i++) {
-        free(madd1[i]);
+    for(int ii=0; ii<2; ++ii){
+        G.v[ii] = lanes_add(lanes_mul(lanes_dup(Phi_age->m[ii][0]), K.v[0]),
+                lanes_mul(lanes_dup(Phi_age->m[ii][1]), K.v[1]));
     }
-    free(madd1);
-    //      printf("P_next for i = %d", l);
-    //      printarray2D(P_next, P_NEXT_ROWS, P_NEXT_COLS);
-    //P_next = Phi*P_prev*Phi' + Upsilon*Q*Upsilon' + Upsilon2*Q2*Upsilon2';
-}
-
-/* nu_next = t_meas - H*x_est_next; */
-static void innovate_nu_next(axis_context_t axis, double* st_data){
 
-    // re-definition of mmult1[length(H)][length(x_next[1])];
-    double** mmult1;
-    int mmult1_rows = H_ROWS;
-    int mmult1_cols = X_NEXT_COLS;
-
-    mmult1 = malloc(mmult1_rows * sizeof *mmult1);
-    for (int i = 0; i < mmult1_rows; i++) {
-        mmult1[i] = malloc(mmult1_cols * sizeof *mmult1[i]);
-    }
-    mmult(axis.H, axis.x_next, mmult1, H_ROWS, H_COLS, X_NEXT_ROWS, X_NEXT_COLS);
-    // definition of ang as pointer
-    double **ang;
-    int ang_rows = 1;
-    int ang_cols = 1;
-
-    ang = malloc(ang_rows * sizeof *ang);
-    for (int i = 0; i < ang_rows; i++) {
-        ang[i] = malloc(ang_cols * sizeof *ang[i]);
-    }
-    #ifdef KF_TEST
-        ang[0][0] = ang_init;
-    #else
-        ang[0][0] = *st_data;
-    #endif
-
-    msub(ang, mmult1, axis.nu_next, ang_rows, ang_cols);
+    for(int ii=0; ii<2; ++ii){
+        x->v[ii] = lanes_add(x->v[ii], lanes_mul(G.v[ii], nu_next));
 
-    // free mmult1
-    for (int i = 0; i < mmult1_rows; i++) {
-        free(mmult1[i]);
-    }
-    free(mmult1);
-    // free ang
-    for (int i = 0; i < ang_rows; i++) {
-        free(ang[i]);
+        for(int jj=0; jj<2; ++jj){
+            P->m[ii][jj] = lanes_sub(P->m[ii][jj],
+                    lanes_mul(lanes_mul(S_next, G.v[ii]), G.v[jj]));
+        }
     }
-    free(ang);
-
-    // nu_next = t_meas - H*x_est_next;
-    //'propagation error' (difference between estimated state and measured state
 }
 
-/* S_next = H*P_next*H' + R; */
-static void update_s_next(axis_context_t axis){
+#ifdef KF_BENCH
+/* The previous implementation, kept as reference for the benchmark:
+ * general matrices with malloc'ed rows and temporaries allocated for every
+ * product.
+ */
+typedef struct{
+    double** Phi;
+    double** Gamma;
+    double** Upsilon;
+    double** Upsilon2;
+    double** H;
+    double** Q;
+    double** Q2;
+    double** R;
+} bench_model_t;
 
-    // re-definition of mmult1[length(H)][length(P_next[1])];
-    double** mmult1;
-    int mmult1_rows = H_ROWS;
-    int mmult1_cols = P_NEXT_COLS;
+static double** bench_alloc(int rows, int cols){
 
-    mmult1 = malloc(mmult1_rows * sizeof *mmult1);
-    for (int i = 0; i < mmult1_rows; i++) {
-        mmult1[i] = malloc(mmult1_cols * sizeof *mmult1[i]);
+    double** mat = malloc(rows * sizeof *mat);
+    for(int ii=0; ii<rows; ++ii){
+        mat[ii] = malloc(cols * sizeof *mat[ii]);
     }
-    mmult(axis.H, axis.P_next, mmult1, H_ROWS, H_COLS, P_NEXT_ROWS, P_NEXT_COLS);
+    return mat;
+}
 
-    // definition of trans[length(H[0])][length(H)];
-    double** trans;
-    int trans_rows = H_COLS;
-    int trans_cols = H_ROWS;
+static void bench_free(double** mat, int rows){
 
-    trans = malloc(trans_rows * sizeof *trans);
-    for (int i = 0; i < trans_rows; i++) {
-        trans[i] = malloc(trans_cols * sizeof *trans[i]);
+    for(int ii=0; ii<rows; ++ii){
+        free(mat[ii]);
     }
-    transpose(axis.H, trans, H_ROWS, H_COLS);
+    free(mat);
+}
 
-    // re-definition of mmult2[length(mmult1)][length(H)];
-    double** mmult2;
-    int mmult2_rows = mmult1_rows;
-    int mmult2_cols = trans_cols;
+static void bench_mmult(double** matA, double** matB, double** matC,
+        int rows1, int cols1, int cols2){
 
-    mmult2 = malloc(mmult2_rows * sizeof *mmult2);
-    for (int i = 0; i < mmult2_rows; i++) {
-        mmult2[i] = malloc(mmult2_cols * sizeof *mmult2[i]);
+    for(int m=0; m<rows1; m++){
+        for(int k=0; k<cols2; k++){
+            matC[m][k] = 0;
+            for(int n=0; n<cols1; n++){
+                matC[m][k] += matA[m][n]*matB[n][k];
+            }
+        }
     }
-    mmult(mmult1, trans, mmult2, mmult1_rows, mmult1_cols, trans_rows, trans_cols);
+}
 
-    madd(mmult2, axis.R, axis.S_next, mmult2_rows, mmult2_cols);
-    //          printf("S_next for i = %d", l);
-    //          printarray2D(S_next, S_NEXT_ROWS, S_NEXT_COLS);
+static void bench_transpose(double** mat, double** mat2, int rows, int cols){
 
-    // free mmult1
-    for (int i = 0; i < mmult1_rows; i++) {
-        free(mmult1[i]);
+    for(int ii=0; ii<rows; ++ii){
+        for(int jj=0; jj<cols; ++jj){
+            mat2[jj][ii] = mat[ii][jj];
+        }
     }
-    free(mmult1);
+}
 
-    // free mmult2
-    for (int i = 0; i < mmult2_rows; i++) {
-        free(mmult2[i]);
-    }
-    free(mmult2);
+/* matA*matB', allocated */
+static double** bench_mult_t(double** matA, double** matB, int rows, int inner){
 
-    // free trans
-    for (int i = 0; i < trans_rows; i++) {
-        free(trans[i]);
-    }
-    free(trans);
-    //S_next = H*P_next*H' + R;
+    double** trans = bench_alloc(inner, rows);
+    double** prod = bench_alloc(rows, rows);
+    bench_transpose(matB, trans, rows, inner);
+    bench_mmult(matA, trans, prod, rows, inner, rows);
+    bench_free(trans, inner);
+    return prod;
 }
 
-/* K = P_next*H'/S_next; */
-static void comp_k_gain(axis_context_t axis){
-    // re-definition of trans[length(H[0])][length(H)];
-    double** trans;
-    int trans_rows = H_COLS;
-    int trans_cols = H_ROWS;
+static void bench_propagate(bench_model_t* mdl, double** x, double** P, double w){
 
-    trans = malloc(trans_rows * sizeof *trans);
-    for (int i = 0; i < trans_rows; i++) {
-        trans[i] = malloc(trans_cols * sizeof *trans[i]);
-    }
-    transpose(axis.H, trans, H_ROWS, H_COLS);
+    double** w_meas = bench_alloc(1, 1);
+    w_meas[0][0] = w;
 
-    // re-definition of mmult1[length(P_next)][length(H)];
-    double** mmult1;
-    int mmult1_rows = P_NEXT_ROWS;
-    int mmult1_cols = trans_cols;
-
-    mmult1 = malloc(mmult1_rows * sizeof *mmult1);
-    for (int i = 0; i < mmult1_rows; i++) {
-        mmult1[i] = malloc(mmult1_cols * sizeof *mmult1[i]);
+    double** mmult1 = bench_alloc(2, 1);
+    double** mmult2 = bench_alloc(2, 1);
+    bench_mmult(mdl->Phi, x, mmult1, 2, 2, 1);
+    bench_mmult(mdl->Gamma, w_meas, mmult2, 2, 1, 1);
+    for(int ii=0; ii<2; ++ii){
+        x[ii][0] = mmult1[ii][0] + mmult2[ii][0];
     }
-    mmult(axis.P_next, trans, mmult1, P_NEXT_ROWS, P_NEXT_COLS, trans_rows, trans_cols);
-    mdiv(mmult1, axis.S_next[0][0], axis.K, mmult1_rows, mmult1_cols);
+    bench_free(mmult1, 2);
+    bench_free(mmult2, 2);
+    bench_free(w_meas, 1);
 
+    double** phi_p = bench_alloc(2, 2);
+    bench_mmult(mdl->Phi, P, phi_p, 2, 2, 2);
+    double** phi_p_phi = bench_mult_t(phi_p, mdl->Phi, 2, 2);
+    bench_free(phi_p, 2);
 
-    // free mmult1
-    for (int i = 0; i < mmult1_rows; i++) {
-        free(mmult1[i]);
-    }
-    free(mmult1);
+    double** ups_q = bench_alloc(2, 1);
+    bench_mmult(mdl->Upsilon, mdl->Q, ups_q, 2, 1, 1);
+    double** noise1 = bench_mult_t(ups_q, mdl->Upsilon, 2, 1);
+    bench_mmult(mdl->Upsilon2, mdl->Q2, ups_q, 2, 1, 1);
+    double** noise2 = bench_mult_t(ups_q, mdl->Upsilon2, 2, 1);
+    bench_free(ups_q, 2);
 
-    // free trans
-    for (int i = 0; i < trans_rows; i++) {
-        free(trans[i]);
+    for(int ii=0; ii<2; ++ii){
+        for(int jj=0; jj<2; ++jj){
+            P[ii][jj] = phi_p_phi[ii][jj] + noise1[ii][jj] + noise2[ii][jj];
+        }
     }
-    free(trans);
-
-    //          printf("K for i = %d", l);
-    //          printarray2D(K, K_ROWS, K_COLS);
-    // K = P_next*H'/S_next;
+    bench_free(phi_p_phi, 2);
+    bench_free(noise1, 2);
+    bench_free(noise2, 2);
 }
 
-/* x_upd = x_est_next + K*nu_next; */
-static void update_state(axis_context_t axis){
-    //double mmult1[length(K)][length(nu_next[1])];
-    // re-definition of mmult1[length(K)][length(nu_next[1])];
-    double** mmult1;
-    int mmult1_rows = K_ROWS;
-    int mmult1_cols = NU_NEXT_COLS;
-
-    mmult1 = malloc(mmult1_rows * sizeof *mmult1);
-    for (int i = 0; i < mmult1_rows; i++) {
-        mmult1[i] = malloc(mmult1_cols * sizeof *mmult1[i]);
-    }
-    mmult(axis.K, axis.nu_next, mmult1, K_ROWS, K_COLS, NU_NEXT_ROWS, NU_NEXT_COLS);
-    madd(axis.x_next, mmult1, axis.x_upd, X_NEXT_ROWS, X_NEXT_COLS);
+static void bench_update(bench_model_t* mdl, double** x, double** P, double meas){
 
-    // free mmult1
-    for (int i = 0; i < mmult1_rows; i++) {
-        free(mmult1[i]);
-    }
-    free(mmult1);
+    double** h_x = bench_alloc(1, 1);
+    bench_mmult(mdl->H, x, h_x, 1, 2, 1);
+    double nu = meas - h_x[0][0];
+    bench_free(h_x, 1);
 
-    //          printf("x_upd for i = %d", l);
-    //          printarray2D(x_upd, X_UPD_ROWS, X_UPD_COLS);
-    // x_upd = x_est_next + K*nu_next;
-}
+    double** h_p = bench_alloc(1, 2);
+    bench_mmult(mdl->H, P, h_p, 1, 2, 2);
+    double** h_p_h = bench_mult_t(h_p, mdl->H, 1, 2);
+    double S = h_p_h[0][0] + mdl->R[0][0];
+    bench_free(h_p, 1);
+    bench_free(h_p_h, 1);
 
-/* P_upd = (eye(2)-K*H)*P_next; */
-static void update_covar(axis_context_t axis){
-    // re-definition of mmult1[length(K)][length(H[1])];
-    double** mmult1;
-    int mmult1_rows = K_ROWS;
-    int mmult1_cols = H_COLS;
+    double** trans = bench_alloc(2, 1);
+    double** K = bench_alloc(2, 1);
+    bench_transpose(mdl->H, trans, 1, 2);
+    bench_mmult(P, trans, K, 2, 2, 1);
+    bench_free(trans, 2);
 
-    mmult1 = malloc(mmult1_rows * sizeof *mmult1);
-    if(mmult1 == NULL){
-        logging(ERROR, "Kalman F", "malloc: %m");
-    }
-    for (int i = 0; i < mmult1_rows; i++) {
-        mmult1[i] = malloc(mmult1_cols * sizeof *mmult1[i]);
-        if(mmult1[i] == NULL){
-            logging(ERROR, "Kalman F", "malloc: %m");
-        }
-    }
-    mmult(axis.K, axis.H, mmult1, K_ROWS, K_COLS, H_ROWS, H_COLS);
-    //printarray2D(mmult1, mmult1_rows, mmult1_cols);
-    // definition of eye2[2][2];
-    double **eye2;
-    int eye2_rows = 2;
-    int eye2_cols = 2;
-
-    eye2 = malloc(eye2_rows * sizeof *eye2);
-    if(eye2 == NULL){
-        logging(ERROR, "Kalman F", "malloc: %m");
+    double** i_kh = bench_alloc(2, 2);
+    double** P_upd = bench_alloc(2, 2);
+    for(int ii=0; ii<2; ++ii){
+        K[ii][0] /= S;
+        x[ii][0] += K[ii][0]*nu;
     }
-    for (int i = 0; i < eye2_rows; i++) {
-        eye2[i] = malloc(eye2_cols * sizeof *eye2[i]);
-        if(eye2[i] == NULL){
-            logging(ERROR, "Kalman F", "malloc: %m");
+    bench_mmult(K, mdl->H, i_kh, 2, 1, 2);
+    for(int ii=0; ii<2; ++ii){
+        for(int jj=0; jj<2; ++jj){
+            i_kh[ii][jj] = (ii == jj ? 1.0 : 0.0) - i_kh[ii][jj];
         }
     }
-    eye(2, eye2);
-    //printarray2D(eye2, 2, 2);
-
-    //double msub1[2][2];
-    // definition of msub1[2][2];
-    double **msub1;
-    int msub1_rows = 2;
-    int msub1_cols = 2;
-
-    msub1 = malloc(msub1_rows * sizeof *msub1);
-    if(msub1 == NULL){
-        logging(ERROR, "Kalman F", "malloc: %m");
-    }
-    for (int i = 0; i < msub1_rows; i++) {
-        msub1[i] = malloc(msub1_cols * sizeof *msub1[i]);
-        if(msub1[i] == NULL){
-            logging(ERROR, "Kalman F", "malloc: %m");
+    bench_mmult(i_kh, P, P_upd, 2, 2, 2);
+    for(int ii=0; ii<2; ++ii){
+        for(int jj=0; jj<2; ++jj){
+            P[ii][jj] = P_upd[ii][jj];
         }
     }
-    msub(eye2, mmult1, msub1, eye2_rows, eye2_cols);
-    //printarray2D(msub1, msub1_rows, msub1_cols);
-    mmult(msub1, axis.P_next, axis.P_upd, msub1_rows, msub1_cols, P_NEXT_ROWS, P_NEXT_COLS);
-
-    // free mmult1
-    for (int i = 0; i < mmult1_rows; i++) {
-        free(mmult1[i]);
-    }
-    free(mmult1);
-    // free eye2
-    for (int i = 0; i < eye2_rows; i++) {
-        free(eye2[i]);
-    }
-    free(eye2);
-    // free msub1
-    for (int i = 0; i < msub1_rows; i++) {
-        free(msub1[i]);
-    }
-    free(msub1);
-
-    //          printf("P_upd for i = %d", l);
-    //          printarray2D(P_upd, P_UPD_ROWS, P_UPD_COLS);
-    // P_upd = (eye(2)-K*H)*P_next;
+    bench_free(K, 2);
+    bench_free(i_kh, 2);
+    bench_free(P_upd, 2);
 }
 
-/*******************************************************************************
-********************************************************************************
-***********************************MATH*FUNCS***********************************
-********************************************************************************
-*******************************************************************************/
+/* bench_kalman_filter:
+ * Run the implementations on the same simulated gyro and star tracker
+ * data, one measurement per second, and log the time per step and the
+ * largest difference between their estimates: the previous one against
+ * the fixed size one for an axis, and the fixed size one per axis against
+ * both axes in lanes.
+ */
+static void bench_kalman_filter(void){
 
-#if 0
-static void printarray2D(double** array, int rows, int cols) {
-    printf("\nPrint 2D array\n");
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            printf(" %+.11e",array[i][j]);
+    const int steps = 1000000;
+    const kf_model_t* model = &az.model;
+    struct timespec start, stop;
+
+    bench_model_t mdl = {
+        bench_alloc(2, 2), bench_alloc(2, 1), bench_alloc(2, 1), bench_alloc(2, 1),
+        bench_alloc(1, 2), bench_alloc(1, 1), bench_alloc(1, 1), bench_alloc(1, 1)
+    };
+    double dt = (double)GYRO_SAMPLE_TIME/1000000000;
+    for(int ii=0; ii<2; ++ii){
+        for(int jj=0; jj<2; ++jj){
+            mdl.Phi[ii][jj] = model->Phi.m[ii][jj];
+        }
+        mdl.Gamma[ii][0] = model->Gamma.v[ii];
+        mdl.H[0][ii] = model->H.v[ii];
+    }
+    mdl.Upsilon[0][0] = dt;
+    mdl.Upsilon[1][0] = 0;
+    mdl.Upsilon2[0][0] = 0;
+    mdl.Upsilon2[1][0] = dt;
+    mdl.Q[0][0] = model->Qd.m[0][0]/(dt*dt);
+    mdl.Q2[0][0] = model->Qd.m[1][1]/(dt*dt);
+    mdl.R[0][0] = model->R;
+
+    vec2_t x_init = {{lanes_get(x_prev.v[0], AZ_LANE), lanes_get(x_prev.v[1], AZ_LANE)}};
+    mat2_t P_init;
+    for(int ii=0; ii<2; ++ii){
+        for(int jj=0; jj<2; ++jj){
+            P_init.m[ii][jj] = lanes_get(P_prev.m[ii][jj], AZ_LANE);
         }
-        printf("\n");
     }
-}
-#endif
 
-static void eye(int m, double** mat) {
-    for(int ii=0; ii<m; ++ii){
-        for(int jj=0; jj<m; ++jj){
-            if(ii==jj){
-                mat[ii][jj] = 1.0;
-            }
-            else{
-                mat[ii][jj] = 0.0;
-            }
+    double* gyro = malloc(steps * sizeof(*gyro));
+    double* meas = malloc(steps / SENS_FREQ * sizeof(*meas));
+    vec2_t* x_ref = malloc(steps / SENS_FREQ * sizeof(*x_ref));
+    if(gyro == NULL || meas == NULL || x_ref == NULL){
+        logging(ERROR, "Kalman F", "Cannot allocate memory for benchmark");
+        free(gyro);
+        free(meas);
+        free(x_ref);
+        return;
+    }
+
+    /* slow drift with a gyro bias and noise */
+    unsigned int seed = 1;
+    double ang = 0;
+    for(int ii=0; ii<steps; ++ii){
+        double rate = 1e-4 * sin(ii * 1e-4);
+        ang += rate * dt;
+        seed = seed * 1103515245 + 12345;
+        gyro[ii] = rate + 5e-5 + ((seed >> 16) / 65536.0 - 0.5) * 1e-5;
+        if(ii % SENS_FREQ == 0){
+            meas[ii / SENS_FREQ] = ang + ((seed >> 8 & 0xff) / 256.0 - 0.5) * 1e-4;
         }
     }
-}
 
-static void madd(double** matA, double** matB, double** matC, int rows, int cols) {
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            matC[i][j] = matA[i][j] + matB[i][j];
+    /* previous implementation */
+    double** x_old = bench_alloc(2, 1);
+    double** P_old = bench_alloc(2, 2);
+    for(int ii=0; ii<2; ++ii){
+        x_old[ii][0] = x_init.v[ii];
+        for(int jj=0; jj<2; ++jj){
+            P_old[ii][jj] = P_init.m[ii][jj];
         }
     }
-}
 
-static void msub(double** matA, double** matB, double** matC, int rows, int cols) {
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            matC[i][j] = matA[i][j] - matB[i][j];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int ii=0; ii<steps; ++ii){
+        bench_propagate(&mdl, x_old, P_old, gyro[ii]);
+        if(ii % SENS_FREQ == 0){
+            bench_update(&mdl, x_old, P_old, meas[ii / SENS_FREQ]);
+            x_ref[ii / SENS_FREQ] = (vec2_t){{x_old[0][0], x_old[1][0]}};
         }
     }
-}
-
-static void transpose(double** mat, double** mat2, int rows, int cols) {
-    for (int i = 0; i<rows; i++) {
-        for (int j = 0; j<cols; j++) {
-            mat2[j][i] = mat[i][j];
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double old_ns = ((stop.tv_sec - start.tv_sec) * 1e9 +
+        (stop.tv_nsec - start.tv_nsec)) / steps;
+
+    /* fixed size implementation */
+    vec2_t x = x_init;
+    mat2_t P = P_init;
+    double max_diff = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int ii=0; ii<steps; ++ii){
+        kf_propagate(model, &x, &P, gyro[ii]);
+        if(ii % SENS_FREQ == 0){
+            double nu_next, S_next;
+            kf_innovate(model, &x, &P, meas[ii / SENS_FREQ], &nu_next, &S_next);
+            kf_correct_delayed(model, &x, &P, &P, 0, nu_next, S_next);
+
+            for(int jj=0; jj<2; ++jj){
+                double diff = fabs(x.v[jj] - x_ref[ii / SENS_FREQ].v[jj]);
+                max_diff = diff > max_diff ? diff : max_diff;
+            }
         }
     }
-}
-
-static void mdiv(double** matA, double scal, double** matB, int rows, int cols) {
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            matB[i][j] = matA[i][j] / scal;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double new_ns = ((stop.tv_sec - start.tv_sec) * 1e9 +
+        (stop.tv_nsec - start.tv_nsec)) / steps;
+
+    logging(INFO, "Kalman F", "Previous implementation: %.1f ns per step", old_ns);
+    logging(INFO, "Kalman F", "Fixed size implementation: %.1f ns per step", new_ns);
+    logging(INFO, "Kalman F", "Largest state difference: %.3e", max_diff);
+
+    /* both axes, per axis and in lanes, az running the data backwards */
+    vec2_t x_axes[2] = {x_init, x_init};
+    mat2_t P_axes[2] = {P_init, P_init};
+    const kf_model_t* models[2];
+    models[ALT_LANE] = &alt.model;
+    models[AZ_LANE] = &az.model;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int ii=0; ii<steps; ++ii){
+        double w[2] = {gyro[ii], gyro[steps - 1 - ii]};
+        for(int jj=0; jj<2; ++jj){
+            kf_propagate(models[jj], &x_axes[jj], &P_axes[jj], w[jj]);
+        }
+        if(ii % SENS_FREQ == 0){
+            double m[2] = {meas[ii / SENS_FREQ], meas[(steps - 1 - ii) / SENS_FREQ]};
+            for(int jj=0; jj<2; ++jj){
+                double nu_next, S_next;
+                kf_innovate(models[jj], &x_axes[jj], &P_axes[jj], m[jj], &nu_next, &S_next);
+                kf_correct_delayed(models[jj], &x_axes[jj], &P_axes[jj], &P_axes[jj],
+                        0, nu_next, S_next);
+            }
+            x_ref[ii / SENS_FREQ] = x_axes[AZ_LANE];
+            x_ref[ii / SENS_FREQ].v[1] = x_axes[ALT_LANE].v[0];
         }
     }
-}
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double axes_ns = ((stop.tv_sec - start.tv_sec) * 1e9 +
+        (stop.tv_nsec - start.tv_nsec)) / steps;
 
-static void mmult(double** matA, double** matB, double** matC, int rows1, int cols1, int rows2, int cols2) {
-    if (rows2 != cols1) {
-        printf("Rows and columns don't match");
-    } else {
-        for(int m=0;m<rows1;m++){
-            for(int k=0;k<cols2;k++){
-                matC[m][k]=0;
-                for(int n=0;n<cols1;n++){
-                    matC[m][k]+=matA[m][n]*matB[n][k];
-                }
-            }
+    vec2_l_t x_l;
+    mat2_l_t P_l;
+    for(int ii=0; ii<2; ++ii){
+        x_l.v[ii] = lanes_dup(x_init.v[ii]);
+        for(int jj=0; jj<2; ++jj){
+            P_l.m[ii][jj] = lanes_dup(P_init.m[ii][jj]);
+        }
+    }
+    double max_diff_l = 0;
+
+    /* the fixes are fused at the newest sample */
+    const mat2_t eye = {{{1, 0}, {0, 1}}};
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int ii=0; ii<steps; ++ii){
+        kf_propagate_l(&model_l, &x_l, &P_l, lanes_set(gyro[ii], gyro[steps - 1 - ii]));
+        if(ii % SENS_FREQ == 0){
+            lanes_t nu_next, S_next;
+            lanes_t m = lanes_set(meas[ii / SENS_FREQ], meas[(steps - 1 - ii) / SENS_FREQ]);
+            kf_innovate_l(&model_l, &x_l, &P_l, m, &nu_next, &S_next);
+            kf_correct_delayed_l(&model_l, &eye, &x_l, &P_l, &P_l,
+                    nu_next, S_next);
+
+            double diff_az = fabs(lanes_get(x_l.v[0], AZ_LANE) - x_ref[ii / SENS_FREQ].v[0]);
+            double diff_alt = fabs(lanes_get(x_l.v[0], ALT_LANE) - x_ref[ii / SENS_FREQ].v[1]);
+            max_diff_l = diff_az > max_diff_l ? diff_az : max_diff_l;
+            max_diff_l = diff_alt > max_diff_l ? diff_alt : max_diff_l;
         }
     }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double lanes_ns = ((stop.tv_sec - start.tv_sec) * 1e9 +
+        (stop.tv_nsec - start.tv_nsec)) / steps;
+
+    logging(INFO, "Kalman F", "Both axes, per axis: %.1f ns per step", axes_ns);
+    logging(INFO, "Kalman F", "Both axes, in lanes: %.1f ns per step", lanes_ns);
+    logging(INFO, "Kalman F", "Largest angle difference: %.3e", max_diff_l);
+
+    bench_free(x_old, 2);
+    bench_free(P_old, 2);
+    bench_free(mdl.Phi, 2);
+    bench_free(mdl.Gamma, 2);
+    bench_free(mdl.Upsilon, 2);
+    bench_free(mdl.Upsilon2, 2);
+    bench_free(mdl.H, 1);
+    bench_free(mdl.Q, 1);
+    bench_free(mdl.Q2, 1);
+    bench_free(mdl.R, 1);
+    free(gyro);
+    free(meas);
+    free(x_ref);
 }
+#endif
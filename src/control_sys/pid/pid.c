@@ -27,6 +27,7 @@
 #include <math.h>
 
 #include "global_utils.h"
+#include "binlog.h"
 #include "control_sys.h"
 #include "gimbal.h"
 #include "current_target.h"
@@ -34,6 +35,13 @@
 #include "sensors.h"
 #include "telemetry.h"
 
+#ifdef REPLAY
+    #include "replay.h"
+#endif
+
+/* encoder movement for the stall detection is measured over this time */
+#define STALL_WINDOW 40000000   /* unit: nanoseconds */
+
 double get_current_time();
 double motor_control_step(pid_values_t* current_pid_values,
                           pthread_mutex_t* pid_values_mutex,
@@ -91,28 +99,34 @@ static double sim_start = 0;
 
 /* factor for converting from angle to amount of steps */
 static double step_per_deg = 0;
-static encoder_t enc_hist[100];
 static int stall_cntr_az = 100;
 static int stall_cntr_alt = 100;
 
-FILE *pid_az_log;
-FILE *pid_alt_log;
+static binlog_t *pid_az_log;
+static binlog_t *pid_alt_log;
 
 int init_pid(void* args){
     char pid_log_fn[100];
 
+    const binlog_col_t cols[] = {
+        {"current pos", BINLOG_DOUBLE}, {"pos error", BINLOG_DOUBLE},
+        {"target pos", BINLOG_DOUBLE}, {"proportional", BINLOG_DOUBLE},
+        {"integral", BINLOG_DOUBLE}, {"derivative", BINLOG_DOUBLE},
+        {"pid output", BINLOG_DOUBLE}, {"motor steps", BINLOG_INT}
+    };
+
     strcpy(pid_log_fn, get_top_dir());
-    strcat(pid_log_fn, "output/logs/pid_az.log");
+    strcat(pid_log_fn, "output/logs/pid_az.bin");
 
-    pid_az_log = fopen(pid_log_fn, "a");
+    pid_az_log = binlog_open(pid_log_fn, cols, 8);
     if(pid_az_log == NULL){
         logging(ERROR, "PID", "Failed to open log file: %m");
     }
 
     strcpy(pid_log_fn, get_top_dir());
-    strcat(pid_log_fn, "output/logs/pid_alt.log");
+    strcat(pid_log_fn, "output/logs/pid_alt.bin");
 
-    pid_alt_log = fopen(pid_log_fn, "a");
+    pid_alt_log = binlog_open(pid_log_fn, cols, 8);
     if(pid_alt_log == NULL){
         logging(ERROR, "PID", "Failed to open log file: %m");
     }
@@ -168,10 +182,17 @@ void pid_update(telescope_att_t* cur_att, motor_step_t* motor_out) {
     az_current_control_vars.enc = enc.az;
     alt_current_control_vars.enc = enc.alt_ang;
 
-    enc_hist[0] = enc;
-
-    az_prev_control_vars.enc = enc_hist[4].az;
-    alt_prev_control_vars.enc = enc_hist[4].alt_ang;
+    /* the encoder a stall window before its latest sample */
+    encoder_t enc_prev = enc;
+    struct timespec prev_time = enc.time;
+    prev_time.tv_nsec -= STALL_WINDOW;
+    if(prev_time.tv_nsec < 0){
+        prev_time.tv_nsec += 1000000000;
+        prev_time.tv_sec--;
+    }
+    get_encoder_at(&prev_time, &enc_prev);
+    az_prev_control_vars.enc = enc_prev.az;
+    alt_prev_control_vars.enc = enc_prev.alt_ang;
 
     // TODO: This is for simulation only
 //    az_current_control_vars.current_position = az_prev_control_vars.pid_output;
@@ -306,7 +327,7 @@ void pid_update(telescope_att_t* cur_att, motor_step_t* motor_out) {
     motor_out->az = lround(step_per_deg * az_current_control_vars.pid_output);
     motor_out->alt = lround(step_per_deg * alt_current_control_vars.pid_output);
 
-    logging_csv(pid_az_log, "%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,%d,%d",
+    binlog_write(pid_az_log,
             az_current_control_vars.current_position,
             az_current_control_vars.position_error,
             az_current_control_vars.target_position,
@@ -316,23 +337,19 @@ void pid_update(telescope_att_t* cur_att, motor_step_t* motor_out) {
             az_current_control_vars.pid_output,
             motor_out->az);
 
-    logging_csv(pid_alt_log, "%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,%d,%d",
-            az_current_control_vars.current_position,
-            az_current_control_vars.position_error,
-            az_current_control_vars.target_position,
-            az_current_control_vars.position_error*current_az_pid_values.kp,
-            az_current_control_vars.integral*current_az_pid_values.ki,
-            az_current_control_vars.derivative*current_az_pid_values.kd,
-            az_current_control_vars.pid_output,
+    binlog_write(pid_alt_log,
+            alt_current_control_vars.current_position,
+            alt_current_control_vars.position_error,
+            alt_current_control_vars.target_position,
+            alt_current_control_vars.position_error*current_alt_pid_values.kp,
+            alt_current_control_vars.integral*current_alt_pid_values.ki,
+            alt_current_control_vars.derivative*current_alt_pid_values.kd,
+            alt_current_control_vars.pid_output,
             motor_out->alt);
 
     az_prev_control_vars = az_current_control_vars;
     alt_prev_control_vars = alt_current_control_vars;
 
-    for(int ii=99; ii>0; --ii){
-        enc_hist[ii] = enc_hist[ii-1];
-    }
-
     pthread_mutex_unlock(&az_control_vars_mutex);
     pthread_mutex_unlock(&alt_control_vars_mutex);
 
@@ -351,7 +368,14 @@ double get_current_time(){
     double time_in_micros = 0;
     double time_in_seconds = 0;
 
-    gettimeofday(&tv,NULL);
+    #ifdef REPLAY
+        struct timespec ts;
+        replay_time(&ts);
+        tv.tv_sec = ts.tv_sec;
+        tv.tv_usec = ts.tv_nsec / 1000;
+    #else
+        gettimeofday(&tv,NULL);
+    #endif
     time_in_micros = 1000000 * (double)tv.tv_sec + (double)tv.tv_usec;
     time_in_seconds = (double)time_in_micros/(double)1000000;
     return time_in_seconds;
@@ -17,8 +17,10 @@
 #include "gimbal.h"
 #include "pid.h"
 #include "kalman_filter.h"
+#include "control_stats.h"
 
 static void* control_sys_thread(void* args);
+static long long elapsed(const struct timespec* from, const struct timespec* to);
 
 int init_stabilization(void* args){
     return create_thread("control_system", control_sys_thread, 30);
@@ -31,6 +33,7 @@ static void* control_sys_thread(void* args){
     pthread_mutex_lock(&mutex_cond_cont_sys);
 
     struct timespec wake_time;
+    struct timespec t_wake, t_kf, t_pid, t_step;
 
     motor_step_t motor_out;
     telescope_att_t cur_pos;
@@ -45,20 +48,48 @@ static void* control_sys_thread(void* args){
         //for(int ii=0; ii<10; ii++){
         while(get_mode() != RESET){
 
+            clock_gettime(CLOCK_MONOTONIC, &t_wake);
+
             kf_update(&cur_pos);
+            clock_gettime(CLOCK_MONOTONIC, &t_kf);
 
             pid_update(&cur_pos, &motor_out);
+            clock_gettime(CLOCK_MONOTONIC, &t_pid);
 
             step_az_alt(&motor_out);
+            clock_gettime(CLOCK_MONOTONIC, &t_step);
+
+            control_stats_add(STAGE_WAKE, elapsed(&wake_time, &t_wake));
+            control_stats_add(STAGE_KF, elapsed(&t_wake, &t_kf));
+            control_stats_add(STAGE_PID, elapsed(&t_kf, &t_pid));
+            control_stats_add(STAGE_STEP, elapsed(&t_pid, &t_step));
+            control_stats_add(STAGE_TOTAL, elapsed(&t_wake, &t_step));
 
             wake_time.tv_nsec += CONTROL_SYS_WAIT;
             if(wake_time.tv_nsec >= 1000000000){
                 wake_time.tv_sec++;
                 wake_time.tv_nsec -= 1000000000;
             }
+
+            /* done after the next wake up time, that period is lost */
+            control_stats_period(elapsed(&wake_time, &t_step) > 0);
+
             clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_time, NULL);
         }
     }
 
     return NULL;
 }
+
+/* elapsed:
+ * Time from one time stamp to a later one.
+ *
+ * input:
+ *      from, to: the time stamps
+ *
+ * return:
+ *      the difference, unit: nanoseconds
+ */
+static long long elapsed(const struct timespec* from, const struct timespec* to){
+    return (to->tv_sec - from->tv_sec) * 1000000000LL + (to->tv_nsec - from->tv_nsec);
+}
@@ -22,13 +22,20 @@
 #include "mode.h"
 #include "gimbal.h"
 
+#ifdef REPLAY
+    #include "replay.h"
+#endif
+
 static void* sel_track_thread_func(void* arg);
 static int selection();
 static int tracking(int tar_index, char exposing_flag);
 
 static double d_mod(double val, int mod);
+static double sidereal_time(double lon);
 static void angle_calc(double dec, double ha,
         double lat, double* alt, double* az);
+static void equatorial_calc(double az, double alt, double lat,
+        double* ha, double* dec);
 static void fetch_time(double* ut_hours, double* j2000);
 
 static int exp_time = 10, sensor_gain = 200;
@@ -229,20 +236,35 @@ static int tracking(int tar_index, char exposing_flag){
 
 /* Convert ra & dec (ECI) to az & alt (ECEF) */
 void rd_to_aa(double ra, double dec, double* az, double* alt){
-    double ut_hours, j2000;
-    fetch_time(&ut_hours, &j2000);
-
     gps_t gps;
     get_gps(&gps);
 
     /* calculate tracking angles */
-    double lst = 100.46 + 0.985647 * j2000 + gps.lon + 15 * ut_hours;
-    lst = d_mod(lst, 360);
-
-    double ha = lst - 15 * ra;
+    double ha = sidereal_time(gps.lon) - 15 * ra;
     angle_calc(dec, ha, gps.lat, az, alt);
 }
 
+/* Convert az & alt (ECEF) to ra & dec (ECI), the inverse of rd_to_aa */
+void aa_to_rd(double az, double alt, double* ra, double* dec){
+    gps_t gps;
+    get_gps(&gps);
+
+    double ha;
+    equatorial_calc(az, alt, gps.lat, &ha, dec);
+
+    /* ha is within +-180 degrees */
+    *ra = d_mod(sidereal_time(gps.lon) - ha + 360, 360) / 15;
+}
+
+/* Local sidereal time in degrees at a longitude in degrees */
+static double sidereal_time(double lon){
+    double ut_hours, j2000;
+    fetch_time(&ut_hours, &j2000);
+
+    double lst = 100.46 + 0.985647 * j2000 + lon + 15 * ut_hours;
+    return d_mod(lst, 360);
+}
+
 /* Modulo opperation on doubles */
 static double d_mod(double val, int mod){
     return val - mod*(unsigned long)(val/mod);
@@ -265,14 +287,34 @@ static void angle_calc(double dec, double ha, double lat, double* az, double* al
     *az *= 180.0 / M_PI;
 }
 
+/* Calculates hour angle and declination from azimuth, altitude, and latitude */
+static void equatorial_calc(double az, double alt, double lat,
+        double* ha, double* dec){
+    az *= M_PI / 180;
+    alt *= M_PI / 180;
+    lat *= M_PI / 180;
+
+    *dec = asin(sin(alt)*sin(lat) + cos(alt)*cos(lat)*cos(az));
+    *ha = atan2(-sin(az)*cos(alt), sin(alt)*cos(lat) - cos(alt)*sin(lat)*cos(az));
+
+    *dec *= 180.0 / M_PI;
+    *ha *= 180.0 / M_PI;
+}
+
 /* Fetch the current UTC time in hours with decimals and as julian-2000 date */ 
 static void fetch_time(double* ut_hours, double* j2000){
     struct tm date_time;
     time_t epoch_time;
 
-    time(&epoch_time);
+    #ifdef REPLAY
+        struct timespec now;
+        replay_time(&now);
+        epoch_time = now.tv_sec;
+    #else
+        time(&epoch_time);
+    #endif
     gmtime_r(&epoch_time, &date_time);
-    *ut_hours = date_time.tm_hour + date_time.tm_min/60 + date_time.tm_sec/3600;
+    *ut_hours = date_time.tm_hour + date_time.tm_min/60.0 + date_time.tm_sec/3600.0;
     *j2000 = 6938.5f + date_time.tm_yday + 1 + *ut_hours/24;
 }
 
@@ -54,6 +54,9 @@ int init_target_selection(void* args);
 /* Convert ra & dec (ECI) to az & alt (ECEF) */
 void rd_to_aa(double ra, double dec, double* az, double* alt);
 
+/* Convert az & alt (ECEF) to ra & dec (ECI), ra in hours as for rd_to_aa */
+void aa_to_rd(double az, double alt, double* ra, double* dec);
+
 /* Set the error thresholds for when to start exposing camera */
 void set_error_thresholds_az_l(double az);
 void set_error_thresholds_alt_l(double alt_ang);
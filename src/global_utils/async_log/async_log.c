@@ -0,0 +1,697 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Async Log
+ * Parent Component: Global Utils
+ * Author(s): 
+ * Purpose: Take log messages off the calling threads, formatting and writing
+ *          them in a low priority drain thread.
+ * -----------------------------------------------------------------------------
+ */
+
+/**
+ * Every thread that logs gets its own ring of binary records, written only
+ * by that thread and read only by the drain thread, so neither side takes
+ * a lock. A record holds the time, level, module, the format pointer and
+ * the arguments as found by walking the format. The drain thread merges
+ * the rings in time order, prints the records with the same conversions,
+ * writes them to stderr or their csv file and forwards log messages to
+ * telemetry. A full ring drops the record and counts it.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "global_utils.h"
+#include "telemetry.h"
+#include "binlog.h"
+#include "async_log.h"
+
+/* longest formatted message */
+#define LOG_MSG_SIZE 256
+
+/* types of the arguments of a conversion */
+enum {
+    ARG_NONE, ARG_INT, ARG_LONG, ARG_LLONG, ARG_SIZE, ARG_INTMAX,
+    ARG_PTRDIFF, ARG_DOUBLE, ARG_LDOUBLE, ARG_PTR, ARG_STR
+};
+
+typedef struct{
+    const char* start;  /* the '%' of the conversion              */
+    const char* end;    /* past the conversion character          */
+    int type;
+    int stars;          /* width and precision given as arguments */
+} conv_t;
+
+typedef struct{
+    struct timespec time;
+    const char* format;
+    FILE* stream;       /* NULL for log messages                  */
+    int level;
+    int err;            /* errno of the call, for %m              */
+    int n_conv;         /* conversions captured, -1 for all       */
+    char module[11];
+    unsigned char args[LOG_ARG_SIZE];
+} log_record_t;
+
+typedef struct{
+    _Alignas(64) atomic_uint head;  /* next record to write, owner only */
+    _Alignas(64) atomic_uint tail;  /* next record to read, drain only  */
+    atomic_ulong dropped;
+    atomic_ulong truncated;
+    atomic_ulong written;
+    log_record_t records[LOG_RING_SIZE];
+} log_ring_t;
+
+static log_ring_t* get_ring(void);
+static int capture_args(log_record_t* rec, va_list args);
+static int put_arg(unsigned char** pos, const unsigned char* end,
+        const void* value, size_t size);
+static const char* next_conv(const char* p, conv_t* conv);
+static void format_record(const log_record_t* rec, char* msg);
+static size_t append_literal(char* msg, size_t len, const char* p,
+        const char* end);
+static int drain_rings(void);
+static void emit(int level, const char* module, FILE* stream,
+        const struct timespec* time, const char* msg);
+static void* drain_func(void* param);
+
+static const char logging_levels[5][7] =
+        { "DEBUG",
+          "INFO",
+          "WARN",
+          "ERROR",
+          "CRIT"
+        };
+
+static log_ring_t rings[LOG_THREADS];
+static atomic_int n_rings;
+static atomic_int drain_running;
+static atomic_ulong unbuffered;
+
+static _Thread_local log_ring_t* own_ring;
+static _Thread_local int no_ring;
+
+int init_async_log(void){
+
+    int ret = create_thread("log_drain", drain_func, LOG_DRAIN_PRIO);
+    if(ret == SUCCESS){
+        atomic_store_explicit(&drain_running, 1, memory_order_release);
+    }
+
+    return ret;
+}
+
+void log_write(int level, const char* module, FILE* stream,
+        const char* format, va_list args){
+
+    int err = errno;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    log_ring_t* ring = NULL;
+    if(atomic_load_explicit(&drain_running, memory_order_acquire)){
+        ring = get_ring();
+    }
+
+    if(ring == NULL){
+        char msg[LOG_MSG_SIZE];
+
+        errno = err;
+        vsnprintf(msg, LOG_MSG_SIZE, format, args);
+        emit(level, module, stream, &now, msg);
+
+        atomic_fetch_add_explicit(&unbuffered, 1, memory_order_relaxed);
+        return;
+    }
+
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if(head - tail >= LOG_RING_SIZE){
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    log_record_t* rec = &ring->records[head & (LOG_RING_SIZE - 1)];
+    rec->time = now;
+    rec->format = format;
+    rec->stream = stream;
+    rec->level = level;
+    rec->err = err;
+    strncpy(rec->module, module, sizeof(rec->module) - 1);
+    rec->module[sizeof(rec->module) - 1] = '\0';
+
+    if(capture_args(rec, args)){
+        atomic_fetch_add_explicit(&ring->truncated, 1, memory_order_relaxed);
+    }
+
+    /* publish the record to the drain thread */
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void get_log_stats(log_stats_t* stats){
+
+    int count = atomic_load(&n_rings);
+    if(count > LOG_THREADS){
+        count = LOG_THREADS;
+    }
+
+    memset(stats, 0, sizeof(log_stats_t));
+    for(int ii=0; ii<count; ++ii){
+        stats->written += atomic_load_explicit(&rings[ii].written,
+                memory_order_relaxed);
+        stats->dropped += atomic_load_explicit(&rings[ii].dropped,
+                memory_order_relaxed);
+        stats->truncated += atomic_load_explicit(&rings[ii].truncated,
+                memory_order_relaxed);
+    }
+    stats->unbuffered = atomic_load_explicit(&unbuffered, memory_order_relaxed);
+}
+
+/* get_ring:
+ * The ring of the calling thread, claimed on its first message.
+ *
+ * return:
+ *      the ring, NULL if all LOG_THREADS rings are taken
+ */
+static log_ring_t* get_ring(void){
+
+    if(own_ring == NULL && !no_ring){
+        int idx = atomic_fetch_add(&n_rings, 1);
+        if(idx < LOG_THREADS){
+            own_ring = &rings[idx];
+        } else {
+            no_ring = 1;
+        }
+    }
+
+    return own_ring;
+}
+
+/* capture_args:
+ * Copy the arguments of the format of a record into the record, strings
+ * by value.
+ *
+ * return:
+ *      0 if all arguments fit, 1 if the later ones were left out
+ */
+static int capture_args(log_record_t* rec, va_list args){
+
+    unsigned char* pos = rec->args;
+    const unsigned char* end = rec->args + LOG_ARG_SIZE;
+    conv_t conv;
+    int n = 0;
+
+    rec->n_conv = -1;
+
+    for(const char* p=next_conv(rec->format, &conv); p!=NULL;
+            p=next_conv(p, &conv), ++n){
+
+        int ok = 1;
+
+        for(int ii=0; ii<conv.stars && ok; ++ii){
+            int value = va_arg(args, int);
+            ok = put_arg(&pos, end, &value, sizeof(value));
+        }
+
+        if(ok){
+            switch(conv.type){
+                case ARG_INT: {
+                    int value = va_arg(args, int);
+                    ok = put_arg(&pos, end, &value, sizeof(value));
+                    break;
+                }
+                case ARG_LONG: {
+                    long value = va_arg(args, long);
+                    ok = put_arg(&pos, end, &value, sizeof(value));
+                    break;
+                }
+                case ARG_LLONG: {
+                    long long value = va_arg(args, long long);
+                    ok = put_arg(&pos, end, &value, sizeof(value));
+                    break;
+                }
+                case ARG_SIZE: {
+                    size_t value = va_arg(args, size_t);
+                    ok = put_arg(&pos, end, &value, sizeof(value));
+                    break;
+                }
+                case ARG_INTMAX: {
+                    intmax_t value = va_arg(args, intmax_t);
+                    ok = put_arg(&pos, end, &value, sizeof(value));
+                    break;
+                }
+                case ARG_PTRDIFF: {
+                    ptrdiff_t value = va_arg(args, ptrdiff_t);
+                    ok = put_arg(&pos, end, &value, sizeof(value));
+                    break;
+                }
+                case ARG_DOUBLE: {
+                    double value = va_arg(args, double);
+                    ok = put_arg(&pos, end, &value, sizeof(value));
+                    break;
+                }
+                case ARG_LDOUBLE: {
+                    long double value = va_arg(args, long double);
+                    ok = put_arg(&pos, end, &value, sizeof(value));
+                    break;
+                }
+                case ARG_PTR: {
+                    void* value = va_arg(args, void*);
+                    ok = put_arg(&pos, end, &value, sizeof(value));
+                    break;
+                }
+                case ARG_STR: {
+                    const char* value = va_arg(args, const char*);
+                    if(value == NULL){
+                        value = "(null)";
+                    }
+                    size_t len = strlen(value);
+                    size_t room = end - pos;
+                    if(room == 0){
+                        ok = 0;
+                        break;
+                    }
+                    if(len >= room){
+                        /* keep the start of the string, drop what follows */
+                        len = room - 1;
+                        ++n;
+                        ok = 0;
+                    }
+                    memcpy(pos, value, len);
+                    pos[len] = '\0';
+                    pos += len + 1;
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+
+        if(!ok){
+            rec->n_conv = n;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int put_arg(unsigned char** pos, const unsigned char* end,
+        const void* value, size_t size){
+
+    if((size_t)(end - *pos) < size){
+        return 0;
+    }
+
+    memcpy(*pos, value, size);
+    *pos += size;
+
+    return 1;
+}
+
+/* next_conv:
+ * Find the next conversion of a printf format, skipping "%%".
+ *
+ * output:
+ *      conv: the conversion found
+ *
+ * return:
+ *      pointer past the conversion, NULL if there are no more
+ */
+static const char* next_conv(const char* p, conv_t* conv){
+
+    while(1){
+        p = strchr(p, '%');
+        if(p == NULL){
+            return NULL;
+        }
+        if(p[1] != '%'){
+            break;
+        }
+        p += 2;
+    }
+
+    conv->start = p++;
+    conv->stars = 0;
+
+    /* flags, width and precision */
+    p += strspn(p, "-+ #0'I");
+    if(*p == '*'){
+        ++conv->stars;
+        ++p;
+    } else {
+        p += strspn(p, "0123456789");
+    }
+    if(*p == '.'){
+        ++p;
+        if(*p == '*'){
+            ++conv->stars;
+            ++p;
+        } else {
+            p += strspn(p, "0123456789");
+        }
+    }
+
+    /* length modifier */
+    char length = 0;
+    if(*p == 'h'){
+        p += p[1] == 'h' ? 2 : 1;
+    } else if(*p == 'l'){
+        length = p[1] == 'l' ? 'q' : 'l';
+        p += p[1] == 'l' ? 2 : 1;
+    } else if(*p != '\0' && strchr("Lqjzt", *p)){
+        length = *p++;
+    }
+
+    switch(*p){
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            if(length == 'l'){
+                conv->type = ARG_LONG;
+            } else if(length == 'q' || length == 'L'){
+                conv->type = ARG_LLONG;
+            } else if(length == 'z'){
+                conv->type = ARG_SIZE;
+            } else if(length == 'j'){
+                conv->type = ARG_INTMAX;
+            } else if(length == 't'){
+                conv->type = ARG_PTRDIFF;
+            } else {
+                conv->type = ARG_INT;
+            }
+            break;
+        case 'c':
+            conv->type = ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A':
+            conv->type = length == 'L' ? ARG_LDOUBLE : ARG_DOUBLE;
+            break;
+        case 's':
+            conv->type = ARG_STR;
+            break;
+        case 'p': case 'n':
+            conv->type = ARG_PTR;
+            break;
+        case '\0':
+            return NULL;
+        default:
+            /* %m and unknown conversions take no argument */
+            conv->type = ARG_NONE;
+            break;
+    }
+
+    conv->end = p + 1;
+
+    return conv->end;
+}
+
+/* format_record:
+ * Print the message of a record, as vsnprintf would have at the call.
+ *
+ * output:
+ *      msg: at least LOG_MSG_SIZE characters
+ */
+static void format_record(const log_record_t* rec, char* msg){
+
+    const unsigned char* pos = rec->args;
+    const char* p = rec->format;
+    size_t len = 0;
+    char spec[48];
+    conv_t conv;
+
+    msg[0] = '\0';
+    errno = rec->err;
+
+    for(int n=0; ; ++n){
+        const char* next = next_conv(p, &conv);
+
+        len = append_literal(msg, len, p, next != NULL ? conv.start : NULL);
+        if(next == NULL){
+            break;
+        }
+        if(rec->n_conv >= 0 && n >= rec->n_conv){
+            snprintf(&msg[len], LOG_MSG_SIZE - len, "...");
+            break;
+        }
+
+        /* the conversion with any '*' replaced by the captured value */
+        size_t spec_len = 0;
+        for(const char* c=conv.start; c<conv.end && spec_len<sizeof(spec)-12; ++c){
+            if(*c == '*'){
+                int value;
+                memcpy(&value, pos, sizeof(value));
+                pos += sizeof(value);
+                spec_len += sprintf(&spec[spec_len], "%d", value);
+            } else {
+                spec[spec_len++] = *c;
+            }
+        }
+        spec[spec_len] = '\0';
+
+        char* out = &msg[len];
+        size_t room = LOG_MSG_SIZE - len;
+        int ret = 0;
+
+        switch(conv.type){
+            case ARG_INT: {
+                int value;
+                memcpy(&value, pos, sizeof(value));
+                pos += sizeof(value);
+                ret = snprintf(out, room, spec, value);
+                break;
+            }
+            case ARG_LONG: {
+                long value;
+                memcpy(&value, pos, sizeof(value));
+                pos += sizeof(value);
+                ret = snprintf(out, room, spec, value);
+                break;
+            }
+            case ARG_LLONG: {
+                long long value;
+                memcpy(&value, pos, sizeof(value));
+                pos += sizeof(value);
+                ret = snprintf(out, room, spec, value);
+                break;
+            }
+            case ARG_SIZE: {
+                size_t value;
+                memcpy(&value, pos, sizeof(value));
+                pos += sizeof(value);
+                ret = snprintf(out, room, spec, value);
+                break;
+            }
+            case ARG_INTMAX: {
+                intmax_t value;
+                memcpy(&value, pos, sizeof(value));
+                pos += sizeof(value);
+                ret = snprintf(out, room, spec, value);
+                break;
+            }
+            case ARG_PTRDIFF: {
+                ptrdiff_t value;
+                memcpy(&value, pos, sizeof(value));
+                pos += sizeof(value);
+                ret = snprintf(out, room, spec, value);
+                break;
+            }
+            case ARG_DOUBLE: {
+                double value;
+                memcpy(&value, pos, sizeof(value));
+                pos += sizeof(value);
+                ret = snprintf(out, room, spec, value);
+                break;
+            }
+            case ARG_LDOUBLE: {
+                long double value;
+                memcpy(&value, pos, sizeof(value));
+                pos += sizeof(value);
+                ret = snprintf(out, room, spec, value);
+                break;
+            }
+            case ARG_PTR: {
+                void* value;
+                memcpy(&value, pos, sizeof(value));
+                pos += sizeof(value);
+                /* %n would write to memory of the caller, long gone */
+                if(conv.end[-1] != 'n'){
+                    ret = snprintf(out, room, spec, value);
+                }
+                break;
+            }
+            case ARG_STR: {
+                const char* value = (const char*)pos;
+                pos += strlen(value) + 1;
+                ret = snprintf(out, room, spec, value);
+                break;
+            }
+            default:
+                ret = snprintf(out, room, spec, 0);
+                break;
+        }
+
+        if(ret > 0){
+            len += ret;
+        }
+        if(len >= LOG_MSG_SIZE - 1){
+            break;
+        }
+        p = next;
+    }
+}
+
+/* append_literal:
+ * Append the text of a format up to end, or all of it if end is NULL,
+ * with "%%" printed as '%'.
+ *
+ * return:
+ *      length of the message
+ */
+static size_t append_literal(char* msg, size_t len, const char* p,
+        const char* end){
+
+    while(*p != '\0' && p != end && len < LOG_MSG_SIZE - 1){
+        if(p[0] == '%' && p[1] == '%'){
+            ++p;
+        }
+        msg[len++] = *p++;
+    }
+    msg[len] = '\0';
+
+    return len;
+}
+
+/* drain_rings:
+ * Write out all buffered records, oldest first across the rings.
+ *
+ * return:
+ *      number of records written
+ */
+static int drain_rings(void){
+
+    char msg[LOG_MSG_SIZE];
+    int count = 0;
+    int n = atomic_load(&n_rings);
+    if(n > LOG_THREADS){
+        n = LOG_THREADS;
+    }
+
+    while(count < LOG_THREADS*LOG_RING_SIZE){
+        log_ring_t* first = NULL;
+        log_record_t* rec = NULL;
+
+        for(int ii=0; ii<n; ++ii){
+            unsigned int tail = atomic_load_explicit(&rings[ii].tail,
+                    memory_order_relaxed);
+            unsigned int head = atomic_load_explicit(&rings[ii].head,
+                    memory_order_acquire);
+            if(tail == head){
+                continue;
+            }
+
+            log_record_t* cand = &rings[ii].records[tail & (LOG_RING_SIZE - 1)];
+            if(rec == NULL || cand->time.tv_sec < rec->time.tv_sec ||
+                    (cand->time.tv_sec == rec->time.tv_sec &&
+                     cand->time.tv_nsec < rec->time.tv_nsec)){
+                first = &rings[ii];
+                rec = cand;
+            }
+        }
+
+        if(first == NULL){
+            break;
+        }
+
+        format_record(rec, msg);
+        emit(rec->level, rec->module, rec->stream, &rec->time, msg);
+
+        /* hand the slot back to the owner */
+        unsigned int tail = atomic_load_explicit(&first->tail, memory_order_relaxed);
+        atomic_store_explicit(&first->tail, tail + 1, memory_order_release);
+        atomic_fetch_add_explicit(&first->written, 1, memory_order_relaxed);
+        ++count;
+    }
+
+    return count;
+}
+
+/* emit:
+ * Write a formatted message to stderr and telemetry, or to its csv file.
+ */
+static void emit(int level, const char* module, FILE* stream,
+        const struct timespec* time, const char* msg){
+
+    struct tm local;
+    localtime_r(&time->tv_sec, &local);
+
+    if(stream != NULL){
+        fprintf(stream, "%02d:%02d:%02d.%03ld,%s\n",
+                local.tm_hour, local.tm_min, local.tm_sec,
+                time->tv_nsec / 1000000, msg);
+        fflush(stream);
+        return;
+    }
+
+    switch (level) {
+        case 0 :
+        case 1 :
+            fprintf(stderr, "\033[0m");
+            break;
+        case 2 :
+            fprintf(stderr, "\033[0;93m");
+            break;
+        case 3 :
+            fprintf(stderr, "\033[0;91m");
+            break;
+        case 4 :
+            fprintf(stderr, "\033[1;37;101m");
+            break;
+    }
+
+    char sn_buf[4096];
+
+    snprintf(sn_buf, 4096, "%02d:%02d:%02d.%03ld | %5.5s | %10.10s | %s\033[0m\n",
+            local.tm_hour, local.tm_min, local.tm_sec, time->tv_nsec / 1000000,
+            logging_levels[level], module, msg);
+
+    fprintf(stderr, "%s", sn_buf);
+    fflush(stderr);
+
+    send_telemetry(sn_buf, 1, 0, 0);
+}
+
+static void* drain_func(void* param){
+
+    struct timespec wait = {0, LOG_DRAIN_WAIT};
+    unsigned long reported = 0, reported_bin = 0;
+    log_stats_t stats;
+
+    while(1){
+        int count = drain_rings();
+        count += binlog_drain();
+
+        get_log_stats(&stats);
+        if(stats.dropped != reported){
+            logging(WARN, "Log", "%lu log messages dropped, ring full",
+                    stats.dropped - reported);
+            reported = stats.dropped;
+        }
+
+        unsigned long dropped = binlog_dropped();
+        if(dropped != reported_bin){
+            logging(WARN, "Log", "%lu binary log records dropped",
+                    dropped - reported_bin);
+            reported_bin = dropped;
+        }
+
+        if(count == 0){
+            nanosleep(&wait, NULL);
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,63 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Async Log
+ * Parent Component: Global Utils
+ * Author(s): 
+ * Purpose: Take log messages off the calling threads, formatting and writing
+ *          them in a low priority drain thread.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdarg.h>
+
+/* threads that can log without blocking, further threads log synchronously */
+#define LOG_THREADS 32
+
+/* log records buffered per thread, a power of 2 */
+#define LOG_RING_SIZE 128
+
+/* bytes per record for the arguments of the message, strings included */
+#define LOG_ARG_SIZE 192
+
+#define LOG_DRAIN_PRIO 10
+#define LOG_DRAIN_WAIT 10000000 /* unit: nanoseconds */
+
+typedef struct{
+    unsigned long written;      /* records drained and written               */
+    unsigned long dropped;      /* records lost to a full ring               */
+    unsigned long truncated;    /* records with arguments that did not fit   */
+    unsigned long unbuffered;   /* messages written synchronously, before the
+                                   drain thread started or without a ring    */
+} log_stats_t;
+
+/* init_async_log:
+ * Start the drain thread. Until it runs, messages are written synchronously
+ * by the calling thread.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      error code of create_thread otherwise
+ */
+int init_async_log(void);
+
+/* log_write:
+ * Queue a message in the ring of the calling thread. The arguments are
+ * copied, strings included, so only the format must outlive the call,
+ * which holds for string literals. Never blocks and never does I/O once
+ * the drain thread runs.
+ *
+ * input:
+ *      level: DEBUG to CRIT
+ *      module: name of the logging module
+ *      stream: NULL for a log message, otherwise the csv file to write to
+ *      format, args: printf style message
+ */
+void log_write(int level, const char* module, FILE* stream,
+        const char* format, va_list args);
+
+/* get_log_stats:
+ * Get the counters of all log rings.
+ */
+void get_log_stats(log_stats_t* stats);
@@ -0,0 +1,346 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Binlog
+ * Parent Component: Global Utils
+ * Author(s): 
+ * Purpose: Write high rate sensor and filter logs as fixed size binary
+ *          records, converted to csv offline by output/binlog_to_csv.py.
+ * -----------------------------------------------------------------------------
+ */
+
+/**
+ * Each log has two buffers. The writing thread fills one while the other is
+ * written to the file by the log drain thread, the handover is a single
+ * atomic length per buffer. A buffer is handed over when full or when its
+ * oldest record is BINLOG_SYNC_TIME old, and only once the drain thread is
+ * done with the other one, which keeps the buffers in order in the file.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "global_utils.h"
+#include "binlog.h"
+
+#ifdef REPLAY
+    #include "replay.h"
+#endif
+
+#define BINLOG_VERSION 1
+#define BINLOG_HEADER_SIZE 24
+#define BINLOG_COL_SIZE 32
+#define BINLOG_NAME_SIZE 24
+
+struct binlog{
+    int fd;
+    char path[100];
+    int n_cols;
+    char types[BINLOG_MAX_COLS];
+    size_t record_size;
+    unsigned char* buffers[2];
+    int active;                 /* buffer being filled, writer only      */
+    size_t fill;                /* bytes in the active buffer            */
+    struct timespec first;      /* time of its oldest record             */
+    atomic_size_t ready[2];     /* bytes handed to the drain thread      */
+    atomic_ulong dropped;
+    int write_failed;           /* drain thread only                     */
+};
+
+static int open_file(const char* path, const unsigned char* header,
+        size_t header_size, size_t record_size);
+static void hand_over(binlog_t* log);
+
+static struct binlog logs[BINLOG_MAX_LOGS];
+static atomic_int n_logs;
+static pthread_mutex_t open_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+binlog_t* binlog_open(const char* path, const binlog_col_t* cols, int n_cols){
+
+    unsigned char header[BINLOG_HEADER_SIZE + BINLOG_COL_SIZE*BINLOG_MAX_COLS];
+    size_t header_size = BINLOG_HEADER_SIZE + BINLOG_COL_SIZE*n_cols;
+    uint32_t record_size = sizeof(int64_t);
+
+    if(n_cols < 1 || n_cols > BINLOG_MAX_COLS){
+        logging(ERROR, "Binlog", "Invalid number of columns for %s: %d",
+                path, n_cols);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* the header describing the columns */
+    memset(header, 0, sizeof(header));
+    for(int ii=0; ii<n_cols; ++ii){
+        unsigned char* col = &header[BINLOG_HEADER_SIZE + BINLOG_COL_SIZE*ii];
+        strncpy((char*)col, cols[ii].name, BINLOG_NAME_SIZE - 1);
+        col[BINLOG_NAME_SIZE] = cols[ii].type;
+        record_size += cols[ii].type == BINLOG_INT ? sizeof(int32_t) : sizeof(double);
+    }
+
+    uint32_t byte_order = 0x01020304;
+    uint16_t version = BINLOG_VERSION;
+    uint16_t cols16 = n_cols;
+    uint32_t header32 = header_size;
+    memcpy(&header[0], "IRISCBL", 8);
+    memcpy(&header[8], &byte_order, 4);
+    memcpy(&header[12], &version, 2);
+    memcpy(&header[14], &cols16, 2);
+    memcpy(&header[16], &record_size, 4);
+    memcpy(&header[20], &header32, 4);
+
+    pthread_mutex_lock(&open_mutex);
+
+    int idx = atomic_load(&n_logs);
+    if(idx >= BINLOG_MAX_LOGS){
+        pthread_mutex_unlock(&open_mutex);
+        logging(ERROR, "Binlog", "Too many logs open for %s", path);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    binlog_t* log = &logs[idx];
+    log->fd = open_file(path, header, header_size, record_size);
+    if(log->fd < 0){
+        int err = errno;
+        pthread_mutex_unlock(&open_mutex);
+        logging(ERROR, "Binlog", "Failed to open %s: %s", path, strerror(err));
+        errno = err;
+        return NULL;
+    }
+
+    log->buffers[0] = malloc(BINLOG_BUFFER_SIZE);
+    log->buffers[1] = malloc(BINLOG_BUFFER_SIZE);
+    if(log->buffers[0] == NULL || log->buffers[1] == NULL){
+        free(log->buffers[0]);
+        free(log->buffers[1]);
+        close(log->fd);
+        pthread_mutex_unlock(&open_mutex);
+        logging(ERROR, "Binlog", "Failed to allocate buffers for %s", path);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    strncpy(log->path, path, sizeof(log->path) - 1);
+    log->n_cols = n_cols;
+    for(int ii=0; ii<n_cols; ++ii){
+        log->types[ii] = cols[ii].type;
+    }
+    log->record_size = record_size;
+
+    /* the drain thread may look at the log from here on */
+    atomic_store_explicit(&n_logs, idx + 1, memory_order_release);
+
+    pthread_mutex_unlock(&open_mutex);
+
+    return log;
+}
+
+int binlog_write(binlog_t* log, ...){
+
+    if(log == NULL){
+        return SUCCESS;
+    }
+
+    struct timespec now;
+    #ifdef REPLAY
+        replay_time(&now);
+    #else
+        clock_gettime(CLOCK_REALTIME, &now);
+    #endif
+
+    if(log->fill > 0){
+        long long age = (now.tv_sec - log->first.tv_sec) * 1000000000LL +
+            (now.tv_nsec - log->first.tv_nsec);
+
+        if(log->fill + log->record_size > BINLOG_BUFFER_SIZE ||
+                age >= BINLOG_SYNC_TIME * 1000000000LL){
+            hand_over(log);
+        }
+    }
+
+    if(log->fill + log->record_size > BINLOG_BUFFER_SIZE){
+        atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+        return ENOSPC;
+    }
+    if(log->fill == 0){
+        log->first = now;
+    }
+
+    unsigned char* pos = log->buffers[log->active] + log->fill;
+    int64_t time_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    memcpy(pos, &time_ns, sizeof(time_ns));
+    pos += sizeof(time_ns);
+
+    va_list args;
+    va_start(args, log);
+    for(int ii=0; ii<log->n_cols; ++ii){
+        if(log->types[ii] == BINLOG_INT){
+            int32_t value = va_arg(args, int);
+            memcpy(pos, &value, sizeof(value));
+            pos += sizeof(value);
+        } else {
+            double value = va_arg(args, double);
+            memcpy(pos, &value, sizeof(value));
+            pos += sizeof(value);
+        }
+    }
+    va_end(args);
+
+    log->fill += log->record_size;
+
+    return SUCCESS;
+}
+
+int binlog_drain(void){
+
+    int count = 0;
+    int n = atomic_load_explicit(&n_logs, memory_order_acquire);
+
+    for(int ii=0; ii<n; ++ii){
+        binlog_t* log = &logs[ii];
+
+        for(int jj=0; jj<2; ++jj){
+            size_t len = atomic_load_explicit(&log->ready[jj], memory_order_acquire);
+            if(len == 0){
+                continue;
+            }
+
+            /* the output of a replay is not synced, it can be run again */
+            #ifdef REPLAY
+                int failed = write(log->fd, log->buffers[jj], len) != (ssize_t)len;
+            #else
+                int failed = write(log->fd, log->buffers[jj], len) != (ssize_t)len ||
+                    fdatasync(log->fd);
+            #endif
+            if(failed){
+                if(!log->write_failed){
+                    logging(ERROR, "Binlog", "Failed to write %s: %m", log->path);
+                }
+                log->write_failed = 1;
+            } else {
+                log->write_failed = 0;
+            }
+
+            /* hand the buffer back to the writer */
+            atomic_store_explicit(&log->ready[jj], 0, memory_order_release);
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+void binlog_flush(void){
+
+    int n = atomic_load_explicit(&n_logs, memory_order_acquire);
+
+    /* the handed over buffers first, which keeps the records in order */
+    binlog_drain();
+
+    for(int ii=0; ii<n; ++ii){
+        if(logs[ii].fill > 0){
+            hand_over(&logs[ii]);
+        }
+    }
+
+    binlog_drain();
+}
+
+unsigned long binlog_dropped(void){
+
+    unsigned long dropped = 0;
+    int n = atomic_load_explicit(&n_logs, memory_order_acquire);
+
+    for(int ii=0; ii<n; ++ii){
+        dropped += atomic_load_explicit(&logs[ii].dropped, memory_order_relaxed);
+    }
+
+    return dropped;
+}
+
+/* hand_over:
+ * Pass the active buffer to the drain thread and continue in the other
+ * one, unless the drain thread has not written the other one yet.
+ */
+static void hand_over(binlog_t* log){
+
+    int next = !log->active;
+
+    if(atomic_load_explicit(&log->ready[next], memory_order_acquire) != 0){
+        return;
+    }
+
+    atomic_store_explicit(&log->ready[log->active], log->fill, memory_order_release);
+    log->active = next;
+    log->fill = 0;
+}
+
+/* open_file:
+ * Open a log file for appending, writing the header to a new file.
+ *
+ * return:
+ *      file descriptor, -1 on failure with errno set
+ */
+static int open_file(const char* path, const unsigned char* header,
+        size_t header_size, size_t record_size){
+
+    struct stat st;
+    unsigned char old[BINLOG_HEADER_SIZE + BINLOG_COL_SIZE*BINLOG_MAX_COLS];
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0){
+        return -1;
+    }
+    if(fstat(fd, &st)){
+        close(fd);
+        return -1;
+    }
+
+    if(st.st_size > 0){
+        if((size_t)st.st_size < header_size ||
+                pread(fd, old, header_size, 0) != (ssize_t)header_size ||
+                memcmp(old, header, header_size)){
+
+            /* other columns, keep the old log aside */
+            char old_path[110];
+            snprintf(old_path, sizeof(old_path), "%s.old", path);
+            close(fd);
+            rename(path, old_path);
+            logging(WARN, "Binlog", "Columns of %s changed, old log moved to %s",
+                    path, old_path);
+
+            fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if(fd < 0){
+                return -1;
+            }
+            st.st_size = 0;
+        } else {
+            /* drop a record cut short by a power loss */
+            off_t tail = (st.st_size - header_size) % record_size;
+            if(tail && ftruncate(fd, st.st_size - tail)){
+                close(fd);
+                return -1;
+            }
+        }
+    }
+
+    if(st.st_size == 0 && write(fd, header, header_size) != (ssize_t)header_size){
+        close(fd);
+        return -1;
+    }
+
+    if(lseek(fd, 0, SEEK_END) < 0){
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
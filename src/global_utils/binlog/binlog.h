@@ -0,0 +1,101 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Binlog
+ * Parent Component: Global Utils
+ * Author(s): 
+ * Purpose: Write high rate sensor and filter logs as fixed size binary
+ *          records, converted to csv offline by output/binlog_to_csv.py.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+/**
+ * File format, native byte order:
+ *
+ *      char        magic[8]        "IRISCBL"
+ *      uint32      byte_order      0x01020304 as written
+ *      uint16      version         1
+ *      uint16      n_cols
+ *      uint32      record_size     bytes per record, time included
+ *      uint32      header_size     bytes up to the first record
+ *      n_cols times:
+ *          char    name[24]
+ *          char    type            BINLOG_DOUBLE or BINLOG_INT
+ *          char    pad[7]
+ *
+ * followed by records of an int64 time (CLOCK_REALTIME, nanoseconds) and
+ * the columns in order, without padding.
+ */
+
+#define BINLOG_MAX_LOGS 32
+#define BINLOG_MAX_COLS 16
+
+/* records are buffered and handed to the log drain thread when a buffer is
+ * full, or when the oldest record in it is BINLOG_SYNC_TIME old. Handover
+ * happens on a write, so the records after the last handover of a log that
+ * stops being written are not in the file
+ */
+#define BINLOG_BUFFER_SIZE 16384
+#define BINLOG_SYNC_TIME 1 /* unit: seconds */
+
+/* column types, as struct module format characters */
+#define BINLOG_DOUBLE 'd'
+#define BINLOG_INT 'i'
+
+typedef struct{
+    const char* name;
+    char type;
+} binlog_col_t;
+
+typedef struct binlog binlog_t;
+
+/* binlog_open:
+ * Open a binary log for appending. An existing file with the same columns
+ * is continued, a file with other columns is moved to <path>.old first.
+ *
+ * input:
+ *      path: file path, by convention ending in .bin
+ *      cols: the columns of each record, after the time
+ *      n_cols: number of columns, at most BINLOG_MAX_COLS
+ *
+ * return:
+ *      the log, NULL on failure with errno set and a log written
+ */
+binlog_t* binlog_open(const char* path, const binlog_col_t* cols, int n_cols);
+
+/* binlog_write:
+ * Append a record stamped with the current time. Only copies the values
+ * into the buffer of the log, the file is written by the log drain thread.
+ * Each log must be written by one thread only.
+ *
+ * input:
+ *      log: the log, NULL is ignored
+ *      ...: one value per column, double for BINLOG_DOUBLE and int for
+ *           BINLOG_INT
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOSPC: the buffers are full, the record is dropped
+ */
+int binlog_write(binlog_t* log, ...);
+
+/* binlog_drain:
+ * Write the buffers handed over by all logs to their files. Called by the
+ * log drain thread.
+ *
+ * return:
+ *      number of buffers written
+ */
+int binlog_drain(void);
+
+/* binlog_flush:
+ * Write all records buffered by all logs to their files, those not handed
+ * over yet included. Only for when no log is written any more, e.g. at the
+ * end of a replay, as it takes over the buffers from the writing threads.
+ */
+void binlog_flush(void);
+
+/* binlog_dropped:
+ * Total number of records dropped by all logs.
+ */
+unsigned long binlog_dropped(void);
@@ -18,7 +18,6 @@
 #include <errno.h>
 
 #include "global_utils.h"
-#include "telemetry.h"
 
 #define TOP_DIR_S 100
 
@@ -75,7 +74,8 @@ int init_global_utils(void* args){
         top_dir[dir_len - 3] = '\0';
     }
 
-    return SUCCESS;
+    /* from here on messages are written by the log drain thread */
+    return init_async_log();
 }
 
 /* top_dir is the absolute path for the top directory
@@ -111,79 +111,23 @@ int init_submodules(const module_init_t *init_sequence, int module_count) {
     return SUCCESS;
 }
 
-char logging_levels[5][7] =
-        { "DEBUG",
-          "INFO",
-          "WARN",
-          "ERROR",
-          "CRIT"
-        };
-
-int logging(int level, char module_name[12],
+int logging(int level, const char* module_name,
             const char * format, ... ) {
     if (debug_mode == 0 && level == 0) return 0;
 
-    struct timespec now;
-    clock_gettime(CLOCK_REALTIME, &now);
-    struct tm *local = localtime(&now.tv_sec);
-    int hours = local->tm_hour;
-    int minutes = local->tm_min;
-    int seconds = local->tm_sec;
-
-    switch (level) {
-        case 0 :
-        case 1 :
-            fprintf(stderr, "\033[0m");
-            break;
-        case 2 :
-            fprintf(stderr, "\033[0;93m");
-            break;
-        case 3 :
-            fprintf(stderr, "\033[0;91m");
-            break;
-        case 4 :
-            fprintf(stderr, "\033[1;37;101m");
-            break;
-    }
-
-    char buffer[256];
     va_list args;
     va_start (args, format);
-    vsnprintf (buffer, 256, format, args);
-    // perror (buffer);
+    log_write(level, module_name, NULL, format, args);
     va_end (args);
 
-    char sn_buf[4096];
-
-    snprintf(sn_buf, 4096, "%02d:%02d:%02d.%03ld | %5.5s | %10.10s | %s\033[0m\n",
-            hours, minutes, seconds, now.tv_nsec / 1000000,
-            logging_levels[level], module_name, buffer);
-
-    fprintf(stderr, "%s", sn_buf);
-    fflush(stderr);
-
-    send_telemetry(sn_buf, 1, 0, 0);
-
     return SUCCESS;
 }
 
 void logging_csv(FILE* stream, const char* format, ...){
-    struct timespec now;
-    clock_gettime(CLOCK_REALTIME, &now);
-    struct tm *local = localtime(&now.tv_sec);
-    int hours = local->tm_hour;
-    int minutes = local->tm_min;
-    int seconds = local->tm_sec;
-
-    char buffer[256];
     va_list args;
     va_start (args, format);
-    vsnprintf (buffer, 256, format, args);
+    log_write(INFO, "", stream, format, args);
     va_end (args);
-
-    fprintf(stream, "%02d:%02d:%02d.%03ld,%s\n",
-            hours, minutes, seconds, now.tv_nsec / 1000000, buffer);
-    fflush(stream);
 }
 
 /* a call to pthread_create with additional thread attributes,
@@ -237,6 +181,17 @@ int create_thread(char* comp_name, void* (*thread_func)(void*), int prio){
     }
 
     ret = pthread_create(&tid, &attr, thread_func, NULL);
+
+    #ifdef HAL_SIM
+        /* a desktop may not allow real time threads, run without */
+        if(ret == EPERM){
+            logging(WARN, "INIT", "No real time priority for %s component",
+                    comp_name);
+            pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+            ret = pthread_create(&tid, &attr, thread_func, NULL);
+        }
+    #endif
+
     if(ret != 0){
         fprintf(stderr,
             "Failed pthread_create of %s component. "
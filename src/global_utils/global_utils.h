@@ -10,6 +10,8 @@
 
 #include <stdio.h>
 
+#include "async_log.h"
+
 /* int function return values */
 #define SUCCESS 0
 #define FAILURE -1
@@ -22,6 +24,8 @@
 #define SERVER_PORT_BACKUP 420
 
 #define COMPRESSION_LEVEL 3
+#define COMPRESSION_WORKERS 3   /* zstd worker threads, 0 for single threaded */
+#define COMPRESSION_CPUS 0x0E   /* bitmask of cores used for compression      */
 
 #define DEBUG   0
 #define INFO    1
@@ -34,7 +38,9 @@
 #define TEMP_SAMPLE_TIME             1  /* unit: seconds     */
 #define GPS_SAMPLE_TIME              4  /* unit: seconds     */
 #define GYRO_SAMPLE_TIME      10000000  /* unit: nanoseconds */
+#ifndef ENCODER_SAMPLE_TIME        /* time stamped, can go down to 1 ms */
 #define ENCODER_SAMPLE_TIME   10000000  /* unit: nanoseconds */
+#endif
 #define TRACKING_UPDATE_TIME 100000000  /* unit: nanoseconds */
 #define CONTROL_SYS_WAIT      10000000  /* unit: nanoseconds */
 
@@ -72,9 +78,14 @@ const char* const get_top_dir(void);
 
 int init_submodules(const module_init_t init_sequence[], int module_count);
 
-int logging(int level, char module_name[12],
+/* Log a message to stderr and telemetry. Once the global utils component
+ * is initialised the message is queued and written by the log drain
+ * thread, see async_log.h, so format must be a string literal.
+ */
+int logging(int level, const char* module_name,
             const char * format, ... );
 
+/* Write a timestamped csv line to stream, queued like logging */
 void logging_csv(FILE* stream, const char* format, ...);
 
 /* a call to pthread_create with additional thread attributes,
@@ -0,0 +1,238 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Prio Queue
+ * Parent Component: Global Utils
+ * Author(s): 
+ * Purpose: Provide a bounded, thread safe priority queue with preallocated
+ *          storage, shared by the downlink and data queues.
+ * -----------------------------------------------------------------------------
+ */
+
+/**
+ * The queue is a binary min-heap of small entries (priority, sequence
+ * number, slot) kept in an array, while the elements themselves stay in
+ * their slot for their whole time in the queue. Pushing and popping thus
+ * only move entries of a few bytes, O(log n), and never allocate.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef PRIO_QUEUE_BENCH
+    #include <stdlib.h>
+    #include <time.h>
+#endif
+
+#include "global_utils.h"
+#include "prio_queue.h"
+
+static int before(const pq_entry_t* a, const pq_entry_t* b);
+static void sift_up(pq_entry_t* heap, int pos);
+static void sift_down(pq_entry_t* heap, int count, int pos);
+static void take_top(prio_queue_t* q, void* elem, int* priority);
+
+int pq_push(prio_queue_t* q, const void* elem, int priority){
+
+    pthread_mutex_lock(&q->mutex);
+
+    if(q->count >= q->capacity){
+        ++q->stats.dropped;
+        pthread_mutex_unlock(&q->mutex);
+        return ENOSPC;
+    }
+
+    /* reuse a freed slot, or take one that was never used */
+    int slot = q->n_free > 0 ? q->free_slots[--q->n_free] : q->n_used++;
+    memcpy((char*)q->elems + slot*q->elem_size, elem, q->elem_size);
+
+    pq_entry_t* entry = &q->heap[q->count];
+    entry->priority = priority;
+    entry->slot = slot;
+    entry->seq = q->seq++;
+    sift_up(q->heap, q->count++);
+
+    ++q->stats.pushed;
+    if(q->count > q->stats.max_depth){
+        q->stats.max_depth = q->count;
+    }
+
+    pthread_mutex_unlock(&q->mutex);
+    pthread_cond_signal(&q->non_empty);
+
+    return SUCCESS;
+}
+
+void pq_pop(prio_queue_t* q, void* elem, int* priority){
+
+    pthread_mutex_lock(&q->mutex);
+
+    while(q->count == 0){
+        pthread_cond_wait(&q->non_empty, &q->mutex);
+    }
+    take_top(q, elem, priority);
+
+    pthread_mutex_unlock(&q->mutex);
+}
+
+int pq_try_pop(prio_queue_t* q, void* elem, int* priority){
+
+    pthread_mutex_lock(&q->mutex);
+
+    if(q->count == 0){
+        pthread_mutex_unlock(&q->mutex);
+        return EAGAIN;
+    }
+    take_top(q, elem, priority);
+
+    pthread_mutex_unlock(&q->mutex);
+
+    return SUCCESS;
+}
+
+int pq_peek_priority(prio_queue_t* q, int* priority){
+
+    int ret = SUCCESS;
+
+    pthread_mutex_lock(&q->mutex);
+
+    if(q->count == 0){
+        ret = EAGAIN;
+    } else {
+        *priority = q->heap[0].priority;
+    }
+
+    pthread_mutex_unlock(&q->mutex);
+
+    return ret;
+}
+
+void pq_get_stats(prio_queue_t* q, prio_queue_stats_t* stats){
+
+    pthread_mutex_lock(&q->mutex);
+
+    *stats = q->stats;
+    stats->depth = q->count;
+
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/* take_top:
+ * Copy out the top element, free its slot and restore the heap.
+ * The queue must be locked and not empty.
+ */
+static void take_top(prio_queue_t* q, void* elem, int* priority){
+
+    pq_entry_t top = q->heap[0];
+
+    memcpy(elem, (char*)q->elems + top.slot*q->elem_size, q->elem_size);
+    if(priority != NULL){
+        *priority = top.priority;
+    }
+    q->free_slots[q->n_free++] = top.slot;
+
+    q->heap[0] = q->heap[--q->count];
+    sift_down(q->heap, q->count, 0);
+
+    ++q->stats.popped;
+}
+
+/* before:
+ * Order of the entries, lower priority value first and FIFO within
+ * the same priority.
+ */
+static int before(const pq_entry_t* a, const pq_entry_t* b){
+
+    if(a->priority != b->priority){
+        return a->priority < b->priority;
+    }
+    return a->seq < b->seq;
+}
+
+static void sift_up(pq_entry_t* heap, int pos){
+
+    pq_entry_t entry = heap[pos];
+
+    while(pos > 0){
+        int parent = (pos - 1) / 2;
+        if(!before(&entry, &heap[parent])){
+            break;
+        }
+        heap[pos] = heap[parent];
+        pos = parent;
+    }
+    heap[pos] = entry;
+}
+
+static void sift_down(pq_entry_t* heap, int count, int pos){
+
+    pq_entry_t entry = heap[pos];
+
+    while(1){
+        int child = 2*pos + 1;
+        if(child >= count){
+            break;
+        }
+        if(child + 1 < count && before(&heap[child+1], &heap[child])){
+            ++child;
+        }
+        if(!before(&heap[child], &entry)){
+            break;
+        }
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    heap[pos] = entry;
+}
+
+#ifdef PRIO_QUEUE_BENCH
+/* bench_prio_queue:
+ * Fill a queue with elements the size of a downlink message up to a
+ * given depth, then time pushes and pops that keep it at that depth.
+ */
+void bench_prio_queue(void){
+
+    const int depths[] = {0, 100, 1000, 4000, 16000};
+    const int n_depths = sizeof(depths) / sizeof(depths[0]);
+    const int capacity = 16384;
+    const int rounds = 100000;
+
+    char elem[112] = "bench";
+    struct timespec start, stop;
+
+    pq_entry_t* heap = malloc(capacity * sizeof(pq_entry_t));
+    int* free_slots = malloc(capacity * sizeof(int));
+    void* elems = malloc(capacity * sizeof(elem));
+    if(heap == NULL || free_slots == NULL || elems == NULL){
+        logging(ERROR, "Prio Queue", "Benchmark allocation failed");
+        free(heap);
+        free(free_slots);
+        free(elems);
+        return;
+    }
+
+    for(int ii=0; ii<n_depths; ++ii){
+        prio_queue_t q = PRIO_QUEUE_INITIALIZER(heap, free_slots, elems,
+                sizeof(elem), capacity);
+        srand(1);
+
+        for(int jj=0; jj<depths[ii]; ++jj){
+            pq_push(&q, elem, rand() % 10);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int jj=0; jj<rounds; ++jj){
+            pq_push(&q, elem, rand() % 10);
+            pq_try_pop(&q, elem, NULL);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+
+        double ns = (stop.tv_sec - start.tv_sec) * 1e9 +
+            (stop.tv_nsec - start.tv_nsec);
+        logging(INFO, "Prio Queue", "Depth %5d: %6.1f ns per push and pop",
+                depths[ii], ns / rounds);
+    }
+
+    free(heap);
+    free(free_slots);
+    free(elems);
+}
+#endif
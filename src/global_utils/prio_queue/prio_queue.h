@@ -0,0 +1,115 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Prio Queue
+ * Parent Component: Global Utils
+ * Author(s): 
+ * Purpose: Provide a bounded, thread safe priority queue with preallocated
+ *          storage, shared by the downlink and data queues.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* position of an element in the heap, elements of equal priority are
+ * ordered by seq so that they leave the queue in the order they came
+ */
+typedef struct{
+    int priority;
+    int slot;
+    unsigned long long seq;
+} pq_entry_t;
+
+typedef struct{
+    int depth;              /* elements currently in the queue  */
+    int max_depth;          /* most elements ever in the queue  */
+    int capacity;
+    unsigned long pushed;
+    unsigned long popped;
+    unsigned long dropped;  /* pushes refused by a full queue    */
+} prio_queue_stats_t;
+
+/* prio_queue_t:
+ * A queue of fixed size elements, popped lowest priority value first.
+ * All storage is provided by the owner, so a queue can be defined
+ * statically with PRIO_QUEUE_INITIALIZER and used before any init runs:
+ *
+ *      static pq_entry_t heap[N];
+ *      static int free_slots[N];
+ *      static my_elem_t elems[N];
+ *      static prio_queue_t queue =
+ *          PRIO_QUEUE_INITIALIZER(heap, free_slots, elems, sizeof(my_elem_t), N);
+ */
+typedef struct{
+    pthread_mutex_t mutex;
+    pthread_cond_t non_empty;
+    pq_entry_t* heap;
+    int* free_slots;
+    void* elems;
+    size_t elem_size;
+    int capacity;
+    int count;
+    int n_free;             /* slots on the free_slots stack        */
+    int n_used;             /* slots taken at least once            */
+    unsigned long long seq;
+    prio_queue_stats_t stats;
+} prio_queue_t;
+
+#define PRIO_QUEUE_INITIALIZER(heap, free_slots, elems, elem_size, capacity) \
+    {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, heap, free_slots, \
+     elems, elem_size, capacity, 0, 0, 0, 0, {0, 0, capacity, 0, 0, 0}}
+
+/* pq_push:
+ * Copy an element into the queue, O(log n).
+ *
+ * input:
+ *      elem: element of the queue's elem_size
+ *      priority: lower values are popped first
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOSPC: the queue is full, the element is dropped
+ */
+int pq_push(prio_queue_t* q, const void* elem, int priority);
+
+/* pq_pop:
+ * Remove the element with the lowest priority value, the oldest one of
+ * those with equal priority. Blocks until an element is available.
+ *
+ * output:
+ *      elem: the removed element
+ *      priority: its priority, may be NULL
+ */
+void pq_pop(prio_queue_t* q, void* elem, int* priority);
+
+/* pq_try_pop:
+ * Same as pq_pop, but returns immediately if the queue is empty.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EAGAIN: the queue is empty
+ */
+int pq_try_pop(prio_queue_t* q, void* elem, int* priority);
+
+/* pq_peek_priority:
+ * Get the priority of the element that would be popped next.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EAGAIN: the queue is empty
+ */
+int pq_peek_priority(prio_queue_t* q, int* priority);
+
+/* pq_get_stats:
+ * Get the depth and throughput statistics of the queue.
+ */
+void pq_get_stats(prio_queue_t* q, prio_queue_stats_t* stats);
+
+#ifdef PRIO_QUEUE_BENCH
+    /* bench_prio_queue:
+     * Measure the cost of pushing and popping at increasing queue depths
+     * and log the results.
+     */
+    void bench_prio_queue(void);
+#endif
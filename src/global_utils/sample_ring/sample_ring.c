@@ -0,0 +1,211 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Sample Ring
+ * Parent Component: Global Utils
+ * Author(s): 
+ * Purpose: Keep the recent time stamped samples of a sensor, so a consumer
+ *          can take every sample once or look one up by time.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "global_utils.h"
+#include "telemetry.h"
+#include "sample_ring.h"
+
+static int read_slot(sample_ring_t* r, unsigned long n, void* data,
+        struct timespec* time);
+
+static sample_ring_t* rings[SAMPLE_RING_MAX_RINGS];
+static int n_rings = 0;
+static pthread_mutex_t mutex_rings = PTHREAD_MUTEX_INITIALIZER;
+
+int sample_ring_register(sample_ring_t* r){
+
+    pthread_mutex_lock(&mutex_rings);
+
+    for(int ii=0; ii<n_rings; ++ii){
+        if(rings[ii] == r){
+            pthread_mutex_unlock(&mutex_rings);
+            return SUCCESS;
+        }
+    }
+
+    if(n_rings >= SAMPLE_RING_MAX_RINGS){
+        pthread_mutex_unlock(&mutex_rings);
+        logging(ERROR, "Sample Ring", "Too many rings for %s", r->name);
+        return ENOMEM;
+    }
+
+    rings[n_rings++] = r;
+
+    pthread_mutex_unlock(&mutex_rings);
+
+    return SUCCESS;
+}
+
+void sample_ring_push(sample_ring_t* r, const void* data, const struct timespec* time){
+
+    unsigned long n = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned long idx = n & (r->capacity - 1);
+    sample_slot_t* slot = &r->slots[idx];
+    unsigned char* samples = r->data;
+
+    /* readers of the sample overwritten see the odd sequence, or that it
+     * changed during their copy
+     */
+    atomic_store_explicit(&slot->seq, 2*n + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memcpy(&samples[idx * r->size], data, r->size);
+    slot->time = *time;
+
+    atomic_store_explicit(&slot->seq, 2*n + 2, memory_order_release);
+    atomic_store_explicit(&r->head, n + 1, memory_order_release);
+}
+
+int sample_ring_drain(sample_ring_t* r, void* data, seq_sample_t* sample, int max){
+
+    unsigned long head = atomic_load_explicit(&r->head, memory_order_acquire);
+    unsigned long n = r->tail;
+    unsigned char* out = data;
+    int count = 0;
+
+    /* the producer has lapped the consumer */
+    if(head - n > r->capacity){
+        atomic_fetch_add_explicit(&r->lost, head - n - r->capacity,
+                memory_order_relaxed);
+        n = head - r->capacity;
+    }
+
+    for(; n != head && count < max; ++n){
+        struct timespec time;
+
+        /* overwritten while it was copied */
+        if(read_slot(r, n, &out[count * r->size], &time)){
+            atomic_fetch_add_explicit(&r->lost, 1, memory_order_relaxed);
+            continue;
+        }
+
+        if(sample != NULL){
+            sample[count].time = time;
+            sample[count].seq = n + 1;
+        }
+        count++;
+    }
+
+    r->tail = n;
+    atomic_fetch_add_explicit(&r->drained, count, memory_order_relaxed);
+
+    return count;
+}
+
+int sample_ring_at(sample_ring_t* r, const struct timespec* time,
+        void* before, void* after, double* frac){
+
+    long long t = time->tv_sec * 1000000000LL + time->tv_nsec;
+    long long t_after = 0;
+    int have_after = 0;
+
+    unsigned long head = atomic_load_explicit(&r->head, memory_order_acquire);
+    unsigned long oldest = head > r->capacity ? head - r->capacity : 0;
+
+    /* newest first, the time of the samples decreases going back */
+    for(unsigned long n = head; n-- > oldest;){
+        struct timespec time_n;
+
+        /* overwritten, so are all older ones */
+        if(read_slot(r, n, before, &time_n)){
+            break;
+        }
+
+        long long t_n = time_n.tv_sec * 1000000000LL + time_n.tv_nsec;
+        if(t_n <= t){
+            if(!have_after){
+                memcpy(after, before, r->size);
+                *frac = 0;
+            }
+            else{
+                *frac = t_after > t_n ? (double)(t - t_n) / (t_after - t_n) : 0;
+            }
+            return SUCCESS;
+        }
+
+        memcpy(after, before, r->size);
+        t_after = t_n;
+        have_after = 1;
+    }
+
+    if(!have_after){
+        return ENODATA;
+    }
+
+    /* the time is before the oldest sample */
+    memcpy(before, after, r->size);
+    *frac = 0;
+
+    return SUCCESS;
+}
+
+void sample_ring_get_stats(sample_ring_t* r, sample_ring_stats_t* stats){
+
+    stats->pushed = atomic_load_explicit(&r->head, memory_order_relaxed);
+    stats->drained = atomic_load_explicit(&r->drained, memory_order_relaxed);
+    stats->lost = atomic_load_explicit(&r->lost, memory_order_relaxed);
+}
+
+void send_sample_ring_stats(void){
+
+    pthread_mutex_lock(&mutex_rings);
+    int n = n_rings;
+    pthread_mutex_unlock(&mutex_rings);
+
+    for(int ii=0; ii<n; ++ii){
+        sample_ring_stats_t stats;
+        sample_ring_get_stats(rings[ii], &stats);
+
+        char msg[100];
+        snprintf(msg, 100, "ring %s pushed: %lu, drained: %lu, lost: %lu",
+                rings[ii]->name, stats.pushed, stats.drained, stats.lost);
+        send_telemetry(msg, 1, 0, 0);
+    }
+}
+
+/* read_slot:
+ * Copy sample n out of its slot.
+ *
+ * output:
+ *      data: the sample
+ *      time: time of the sample
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: the slot does not hold sample n, or it was overwritten
+ *               during the copy
+ */
+static int read_slot(sample_ring_t* r, unsigned long n, void* data,
+        struct timespec* time){
+
+    unsigned long idx = n & (r->capacity - 1);
+    sample_slot_t* slot = &r->slots[idx];
+    const unsigned char* samples = r->data;
+
+    unsigned long seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if(seq != 2*n + 2){
+        return FAILURE;
+    }
+
+    memcpy(data, &samples[idx * r->size], r->size);
+    *time = slot->time;
+
+    atomic_thread_fence(memory_order_acquire);
+
+    if(atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq){
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,127 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Sample Ring
+ * Parent Component: Global Utils
+ * Author(s): 
+ * Purpose: Keep the recent time stamped samples of a sensor, so a consumer
+ *          can take every sample once or look one up by time.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "seq_store.h"
+
+#define SAMPLE_RING_MAX_RINGS 8
+
+/* a slot of the ring, seq is 2*n+1 while sample n is written to it and
+ * 2*n+2 once it is complete
+ */
+typedef struct{
+    atomic_ulong seq;
+    struct timespec time;
+} sample_slot_t;
+
+typedef struct{
+    unsigned long pushed;
+    unsigned long drained;
+    unsigned long lost;         /* overwritten before they were drained */
+} sample_ring_stats_t;
+
+/* sample_ring_t:
+ * The last capacity samples of a fixed size, written by a single producer.
+ * The producer never waits: when the ring is full the oldest sample is
+ * overwritten. One consumer drains the samples in order, any thread can
+ * look samples up by time. Readers check the slot sequence around their
+ * copy, so a sample overwritten meanwhile is never returned torn.
+ *
+ * Storage is provided by the owner, so a ring can be defined statically
+ * with SAMPLE_RING_INITIALIZER, capacity a power of 2:
+ *
+ *      static my_sample_t samples[N];
+ *      static sample_slot_t slots[N];
+ *      static sample_ring_t ring =
+ *          SAMPLE_RING_INITIALIZER("name", samples, slots, sizeof(my_sample_t), N);
+ */
+typedef struct{
+    const char* name;
+    void* data;                 /* capacity samples of size */
+    sample_slot_t* slots;
+    size_t size;
+    unsigned long capacity;
+    atomic_ulong head;          /* samples pushed */
+    unsigned long tail;         /* next sample to drain, consumer only */
+    atomic_ulong drained, lost;
+} sample_ring_t;
+
+#define SAMPLE_RING_INITIALIZER(name, data, slots, size, capacity) \
+    {name, data, slots, size, capacity, 0, 0, 0, 0}
+
+/* sample_ring_register:
+ * Add a ring to the ones reported by send_sample_ring_stats.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOMEM: SAMPLE_RING_MAX_RINGS are registered already
+ */
+int sample_ring_register(sample_ring_t* r);
+
+/* sample_ring_push:
+ * Add a sample, overwriting the oldest one if the ring is full. Only one
+ * thread may push to a ring.
+ *
+ * input:
+ *      data: the sample, of the size of the ring
+ *      time: CLOCK_MONOTONIC time of the sample
+ */
+void sample_ring_push(sample_ring_t* r, const void* data, const struct timespec* time);
+
+/* sample_ring_drain:
+ * Copy out the samples pushed since the last drain, oldest first. Samples
+ * overwritten before they were drained are skipped and counted as lost.
+ * Only one thread may drain a ring.
+ *
+ * input:
+ *      max: the most samples to copy, the rest are left for the next drain
+ *
+ * output:
+ *      data: the samples
+ *      sample: time and number of the samples, the number counting from 1
+ *
+ * return:
+ *      the number of samples copied
+ */
+int sample_ring_drain(sample_ring_t* r, void* data, seq_sample_t* sample, int max);
+
+/* sample_ring_at:
+ * Find the samples on either side of a time, without draining them.
+ *
+ * input:
+ *      time: CLOCK_MONOTONIC time to look up
+ *
+ * output:
+ *      before, after: the newest sample at or before the time and the one
+ *                     after it, the same sample twice if the time is after
+ *                     the newest or before the oldest sample in the ring
+ *      frac: where the time is between them, 0 at before and 1 at after
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENODATA: no sample has been pushed
+ */
+int sample_ring_at(sample_ring_t* r, const struct timespec* time,
+        void* before, void* after, double* frac);
+
+/* sample_ring_get_stats:
+ * Get the counters of a ring.
+ */
+void sample_ring_get_stats(sample_ring_t* r, sample_ring_stats_t* stats);
+
+/* send_sample_ring_stats:
+ * Send the counters of all registered rings as telemetry, one message per
+ * ring.
+ */
+void send_sample_ring_stats(void);
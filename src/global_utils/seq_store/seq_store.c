@@ -0,0 +1,130 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Seq Store
+ * Parent Component: Global Utils
+ * Author(s): 
+ * Purpose: Hold the latest value of a sensor or estimate behind a sequence
+ *          lock, so readers never block the writer or each other.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "global_utils.h"
+#include "telemetry.h"
+#include "seq_store.h"
+
+static seq_store_t* stores[SEQ_STORE_MAX_STORES];
+static int n_stores = 0;
+static pthread_mutex_t mutex_stores = PTHREAD_MUTEX_INITIALIZER;
+
+int seq_store_register(seq_store_t* s){
+
+    pthread_mutex_lock(&mutex_stores);
+
+    for(int ii=0; ii<n_stores; ++ii){
+        if(stores[ii] == s){
+            pthread_mutex_unlock(&mutex_stores);
+            return SUCCESS;
+        }
+    }
+
+    if(n_stores >= SEQ_STORE_MAX_STORES){
+        pthread_mutex_unlock(&mutex_stores);
+        logging(ERROR, "Seq Store", "Too many stores for %s", s->name);
+        return ENOMEM;
+    }
+
+    stores[n_stores++] = s;
+
+    pthread_mutex_unlock(&mutex_stores);
+
+    return SUCCESS;
+}
+
+void seq_store_write(seq_store_t* s, const void* data, const struct timespec* time){
+
+    if(pthread_mutex_trylock(&s->mutex)){
+        atomic_fetch_add_explicit(&s->contended, 1, memory_order_relaxed);
+        pthread_mutex_lock(&s->mutex);
+    }
+
+    unsigned int seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+
+    /* both copies are equal between writes */
+    seq_sample_t sample = s->sample[0];
+    if(time != NULL){
+        sample.time = *time;
+        sample.seq++;
+    }
+
+    unsigned char* copies = s->data;
+
+    /* readers move to copy 1 while copy 0 is written, then back */
+    for(int ii=0; ii<2; ++ii){
+        atomic_store_explicit(&s->seq, ++seq, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        memcpy(&copies[ii * s->size], data, s->size);
+        s->sample[ii] = sample;
+
+        atomic_thread_fence(memory_order_release);
+    }
+
+    pthread_mutex_unlock(&s->mutex);
+
+    atomic_fetch_add_explicit(&s->writes, 1, memory_order_relaxed);
+}
+
+void seq_store_read(seq_store_t* s, void* data, seq_sample_t* sample){
+
+    const unsigned char* copies = s->data;
+
+    while(1){
+        unsigned int seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        int idx = seq & 1;
+
+        memcpy(data, &copies[idx * s->size], s->size);
+        if(sample != NULL){
+            *sample = s->sample[idx];
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+
+        /* the copy was not written meanwhile */
+        if(atomic_load_explicit(&s->seq, memory_order_relaxed) == seq){
+            break;
+        }
+
+        atomic_fetch_add_explicit(&s->retries, 1, memory_order_relaxed);
+    }
+
+    atomic_fetch_add_explicit(&s->reads, 1, memory_order_relaxed);
+}
+
+void seq_store_get_stats(seq_store_t* s, seq_store_stats_t* stats){
+
+    stats->writes = atomic_load_explicit(&s->writes, memory_order_relaxed);
+    stats->reads = atomic_load_explicit(&s->reads, memory_order_relaxed);
+    stats->retries = atomic_load_explicit(&s->retries, memory_order_relaxed);
+    stats->contended = atomic_load_explicit(&s->contended, memory_order_relaxed);
+}
+
+void send_seq_store_stats(void){
+
+    pthread_mutex_lock(&mutex_stores);
+    int n = n_stores;
+    pthread_mutex_unlock(&mutex_stores);
+
+    for(int ii=0; ii<n; ++ii){
+        seq_store_stats_t stats;
+        seq_store_get_stats(stores[ii], &stats);
+
+        char msg[100];
+        snprintf(msg, 100, "store %s w: %lu, r: %lu, retry: %lu, contended: %lu",
+                stores[ii]->name, stats.writes, stats.reads, stats.retries,
+                stats.contended);
+        send_telemetry(msg, 1, 0, 0);
+    }
+}
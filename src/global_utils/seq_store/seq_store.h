@@ -0,0 +1,100 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Seq Store
+ * Parent Component: Global Utils
+ * Author(s): 
+ * Purpose: Hold the latest value of a sensor or estimate behind a sequence
+ *          lock, so readers never block the writer or each other.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+#define SEQ_STORE_MAX_STORES 16
+
+/* time stamp and number of the value in a store */
+typedef struct{
+    struct timespec time;   /* CLOCK_MONOTONIC time of the sample */
+    unsigned long seq;      /* samples written, 0 before the first */
+} seq_sample_t;
+
+typedef struct{
+    unsigned long writes;
+    unsigned long reads;
+    unsigned long retries;      /* reads repeated over a concurrent write */
+    unsigned long contended;    /* writes that waited for another writer  */
+} seq_store_stats_t;
+
+/* seq_store_t:
+ * The latest value of a fixed size, kept in two copies. A write updates one
+ * copy while readers use the other, so a reader only retries when a write
+ * completes during its copy, and a writer preempted half way never stalls a
+ * reader. Storage for the two copies is provided by the owner, so a store
+ * can be defined statically with SEQ_STORE_INITIALIZER and used before any
+ * init runs:
+ *
+ *      static my_value_t value_local[2] = {{...}, {...}};
+ *      static seq_store_t store =
+ *          SEQ_STORE_INITIALIZER("name", value_local, sizeof(my_value_t));
+ *
+ * Writers are serialised by a mutex, which is only contended if a store has
+ * more than one writer.
+ */
+typedef struct{
+    const char* name;
+    atomic_uint seq;        /* bumped before each copy is written, the
+                             * lowest bit is the copy readers use */
+    pthread_mutex_t mutex;
+    void* data;             /* two values of size */
+    size_t size;
+    seq_sample_t sample[2];
+    atomic_ulong writes, reads, retries, contended;
+} seq_store_t;
+
+#define SEQ_STORE_INITIALIZER(name, data, size) \
+    {name, 0, PTHREAD_MUTEX_INITIALIZER, data, size, \
+     {{{0, 0}, 0}, {{0, 0}, 0}}, 0, 0, 0, 0}
+
+/* seq_store_register:
+ * Add a store to the ones reported by send_seq_store_stats.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOMEM: SEQ_STORE_MAX_STORES are registered already
+ */
+int seq_store_register(seq_store_t* s);
+
+/* seq_store_write:
+ * Replace the value of the store.
+ *
+ * input:
+ *      data: the new value, of the size of the store
+ *      time: time of a new sample, NULL keeps the time and number of the
+ *            current sample, for updating flags on it
+ */
+void seq_store_write(seq_store_t* s, const void* data, const struct timespec* time);
+
+/* seq_store_read:
+ * Copy the latest value out of the store, retrying if a write happens
+ * meanwhile. Never blocks.
+ *
+ * output:
+ *      data: the value
+ *      sample: time and number of the value, may be NULL
+ */
+void seq_store_read(seq_store_t* s, void* data, seq_sample_t* sample);
+
+/* seq_store_get_stats:
+ * Get the access counters of a store.
+ */
+void seq_store_get_stats(seq_store_t* s, seq_store_stats_t* stats);
+
+/* send_seq_store_stats:
+ * Send the access counters of all registered stores as telemetry, one
+ * message per store.
+ */
+void send_seq_store_stats(void);
@@ -9,17 +9,28 @@
 #include <errno.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "gpio.h"
+#include "hal.h"
 #include "global_utils.h"
 
 #define PATH_MAX 40
+#define GPIO_PINS 64
+
+/* pulses up to this width are busy waited, a sleep would add the timer
+ * slack of the kernel to them
+ */
+#define PULSE_SPIN_MAX 100000   /* unit: nanoseconds */
 
 static void close_unlock(int fd, pthread_mutex_t* mutex);
+static int open_value(int pin);
+static void close_value(int pin);
 
 static pthread_mutex_t mutex_export;
 static pthread_mutex_t mutex_unexport;
@@ -27,8 +38,19 @@ static pthread_mutex_t mutex_direction;
 static pthread_mutex_t mutex_read;
 static pthread_mutex_t mutex_write;
 
+/* value files of output pins, kept open from gpio_direction until the pin
+ * is set to input or unexported. gpio_write reads them without a lock, they
+ * are only swapped under mutex_direction. A pin must not be written while
+ * its owner sets it to input or unexports it.
+ */
+static atomic_int value_fds[GPIO_PINS];
+
 int init_gpio(void* args){
 
+    for(int ii=0; ii<GPIO_PINS; ++ii){
+        atomic_init(&value_fds[ii], -1);
+    }
+
     int ret = pthread_mutex_init(&mutex_export, NULL);
     if( ret ){
         logging(ERROR, "GPIO",
@@ -76,7 +98,7 @@ int gpio_export(int pin){
 
     pthread_mutex_lock(&mutex_export);
 
-    int fd = open("/sys/class/gpio/export", O_WRONLY);
+    int fd = hal_open("/sys/class/gpio/export", O_WRONLY);
     if(fd == -1){
         if(errno == EBUSY){
             logging(WARN, "GPIO", "Pin %d already exported", pin);
@@ -91,7 +113,7 @@ int gpio_export(int pin){
 
     char buffer[3];
     size_t count = snprintf(buffer, 3, "%d", pin);
-    int ret = write(fd, buffer, count);
+    int ret = hal_write(fd, buffer, count);
     if(ret == -1){
         if(errno == EBUSY){
             logging(WARN, "GPIO", "Pin %d already exported", pin);
@@ -117,7 +139,11 @@ int gpio_unexport(int pin){
 
     pthread_mutex_lock(&mutex_unexport);
 
-    int fd = open("/sys/class/gpio/unexport", O_WRONLY);
+    pthread_mutex_lock(&mutex_direction);
+    close_value(pin);
+    pthread_mutex_unlock(&mutex_direction);
+
+    int fd = hal_open("/sys/class/gpio/unexport", O_WRONLY);
     if(fd == -1){
         logging(ERROR, "GPIO", "Failed to unexport pin: %d, (%s)",
                 pin, strerror(errno));
@@ -127,7 +153,7 @@ int gpio_unexport(int pin){
 
     char buffer[3];
     size_t count = snprintf(buffer, 3, "%d", pin);
-    int ret = write(fd, buffer, count);
+    int ret = hal_write(fd, buffer, count);
     if(ret == -1){
         logging(ERROR, "GPIO", "Failed to unexport pin: %d, (%s)",
                 pin, strerror(errno));
@@ -152,7 +178,7 @@ int gpio_direction(int pin, int dir){
 
     pthread_mutex_lock(&mutex_direction);
 
-    int fd = open(path, O_WRONLY);
+    int fd = hal_open(path, O_WRONLY);
     if(fd == -1){
         logging(ERROR, "GPIO", "Failed to set direction of pin: %d, (%s)",
                 pin, strerror(errno));
@@ -161,7 +187,7 @@ int gpio_direction(int pin, int dir){
     }
 
     int count = IN == dir ? 2 : 3;
-    int ret = write(fd, &directions[IN == dir ? 0 : 3], count);
+    int ret = hal_write(fd, &directions[IN == dir ? 0 : 3], count);
     if(ret == -1){
         logging(ERROR, "GPIO", "Failed to set direction of pin: %d, (%s)",
                 pin, strerror(errno));
@@ -174,8 +200,18 @@ int gpio_direction(int pin, int dir){
         return FAILURE;
     }
 
-    close_unlock(fd, &mutex_direction);
-    return SUCCESS;
+    hal_close(fd);
+
+    ret = SUCCESS;
+    if(OUT == dir){
+        ret = open_value(pin);
+    }
+    else{
+        close_value(pin);
+    }
+
+    pthread_mutex_unlock(&mutex_direction);
+    return ret;
 }
 
 int gpio_read(int pin, int* val){
@@ -185,7 +221,7 @@ int gpio_read(int pin, int* val){
 
     pthread_mutex_lock(&mutex_read);
 
-    int fd = open(path, O_RDONLY);
+    int fd = hal_open(path, O_RDONLY);
     if(fd == -1){
         logging(ERROR, "GPIO", "Failed to read pin: %d, (%s)",
                 pin, strerror(errno));
@@ -193,7 +229,7 @@ int gpio_read(int pin, int* val){
         return errno;
     }
 
-    int ret = read(fd, &value, 2);
+    int ret = hal_read(fd, &value, 2);
     if(ret == -1){
         logging(ERROR, "GPIO", "Failed to read pin: %d, (%s)",
                 pin, strerror(errno));
@@ -209,12 +245,26 @@ int gpio_read(int pin, int* val){
 int gpio_write(int pin, int val){
 
     const char* values = "01";
+
+    /* output pins are a single write to their open value file */
+    int vfd = pin >= 0 && pin < GPIO_PINS ?
+        atomic_load_explicit(&value_fds[pin], memory_order_acquire) : -1;
+    if(vfd != -1){
+        if(hal_write(vfd, &values[LOW == val ? 0 : 1], 1) == 1){
+            return SUCCESS;
+        }
+        int err = errno;
+        logging(ERROR, "GPIO", "Failed to write to pin: %d, (%s)",
+                pin, strerror(err));
+        return err;
+    }
+
     char path[PATH_MAX];
     snprintf(path, PATH_MAX, "/sys/class/gpio/gpio%d/value", pin);
 
     pthread_mutex_lock(&mutex_write);
 
-    int fd = open(path, O_WRONLY);
+    int fd = hal_open(path, O_WRONLY);
     if(fd == -1){
         logging(ERROR, "GPIO", "Failed to write to pin: %d, (%s)",
                 pin, strerror(errno));
@@ -222,7 +272,7 @@ int gpio_write(int pin, int val){
         return errno;
     }
 
-    int ret = write(fd, &values[LOW == val ? 0 : 1], 1);
+    int ret = hal_write(fd, &values[LOW == val ? 0 : 1], 1);
     if(ret == 1){
         close_unlock(fd, &mutex_write);
         return SUCCESS;
@@ -230,15 +280,95 @@ int gpio_write(int pin, int val){
     else if(ret == -1){
         logging(ERROR, "GPIO", "Failed to write to pin: %d, (%s)",
                 pin, strerror(errno));
-        close_unlock(fd, &mutex_read);
+        close_unlock(fd, &mutex_write);
         return errno;
     }
 
-    close_unlock(fd, &mutex_read);
+    close_unlock(fd, &mutex_write);
     return FAILURE;
 }
 
+int gpio_pulse(int pin, int val, long width){
+
+    int ret = gpio_write(pin, val);
+    if(ret != SUCCESS){
+        return ret;
+    }
+
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    t.tv_nsec += width;
+    while(t.tv_nsec >= 1000000000){
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000;
+    }
+
+    if(width > PULSE_SPIN_MAX){
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+    } else {
+        struct timespec now;
+        do{
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        } while(now.tv_sec < t.tv_sec ||
+                (now.tv_sec == t.tv_sec && now.tv_nsec < t.tv_nsec));
+    }
+
+    return gpio_write(pin, LOW == val ? HIGH : LOW);
+}
+
+/* open_value:
+ * Open the value file of an output pin and keep it for gpio_write, the
+ * caller holds mutex_direction.
+ *
+ * input:
+ *      pin: the pin
+ *
+ * return:
+ *      SUCCESS: the file is open
+ *      errno: failed to open the file, log written
+ */
+static int open_value(int pin){
+
+    if(pin < 0 || pin >= GPIO_PINS ||
+            atomic_load_explicit(&value_fds[pin], memory_order_relaxed) != -1){
+        return SUCCESS;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "/sys/class/gpio/gpio%d/value", pin);
+
+    int fd = hal_open(path, O_WRONLY);
+    if(fd == -1){
+        logging(ERROR, "GPIO", "Failed to open value of pin: %d, (%s)",
+                pin, strerror(errno));
+        return errno;
+    }
+
+    atomic_store_explicit(&value_fds[pin], fd, memory_order_release);
+    return SUCCESS;
+}
+
+/* close_value:
+ * Close the kept value file of a pin, if any, the caller holds
+ * mutex_direction.
+ *
+ * input:
+ *      pin: the pin
+ */
+static void close_value(int pin){
+
+    if(pin < 0 || pin >= GPIO_PINS){
+        return;
+    }
+
+    int fd = atomic_exchange(&value_fds[pin], -1);
+    if(fd != -1){
+        hal_close(fd);
+    }
+}
+
 static void close_unlock(int fd, pthread_mutex_t* mutex){
-    close(fd);
+    hal_close(fd);
     pthread_mutex_unlock(mutex);
 }
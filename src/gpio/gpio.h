@@ -30,3 +30,6 @@ int gpio_read(int pin, int* val);
 
 /* write value to pin */
 int gpio_write(int pin, int val);
+
+/* set pin to val for width nanoseconds, then to the other value */
+int gpio_pulse(int pin, int val, long width);
@@ -0,0 +1,121 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: HAL
+ * Author(s): 
+ * Purpose: Provide the interface to the devices, the spi, i2c and gpio device
+ *          files and the ftdi serial ports. Backed by the hardware in
+ *          irisc-obsw and by simulated devices in irisc-sim.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <ftd2xx.h>
+#include <sys/ioctl.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "global_utils.h"
+#include "hal.h"
+
+struct hal_serial{
+    FT_HANDLE handle;
+};
+
+static void serial_close(hal_serial_t* port);
+
+int init_hal(void* args){
+    return SUCCESS;
+}
+
+int hal_open(const char* path, int flags){
+    return open(path, flags);
+}
+
+ssize_t hal_read(int fd, void* buf, size_t count){
+    return read(fd, buf, count);
+}
+
+ssize_t hal_write(int fd, const void* buf, size_t count){
+    return write(fd, buf, count);
+}
+
+int hal_ioctl(int fd, unsigned long request, void* arg){
+    return ioctl(fd, request, arg);
+}
+
+int hal_close(int fd){
+    return close(fd);
+}
+
+int hal_serial_open(const char* serial_num, int baudrate, int timeout,
+        int latency, hal_serial_t** port){
+
+    hal_serial_t* p = malloc(sizeof(*p));
+    if(p == NULL){
+        logging(ERROR, "HAL", "Failed to allocate serial port %s", serial_num);
+        return FAILURE;
+    }
+
+    FT_STATUS stat;
+
+    stat = FT_OpenEx((char*)serial_num, FT_OPEN_BY_SERIAL_NUMBER, &p->handle);
+    if(stat != FT_OK){
+        logging(ERROR, "HAL",
+                "Failed to initiate UART %s, error: %d", serial_num, stat);
+        free(p);
+        return FAILURE;
+    }
+
+    stat = FT_SetBaudRate(p->handle, baudrate);
+    if(stat != FT_OK){
+        logging(ERROR, "HAL",
+                "Failed to set baudrate for UART %s, error: %d", serial_num, stat);
+        serial_close(p);
+        return FAILURE;
+    }
+
+    stat = FT_SetTimeouts(p->handle, timeout, timeout);
+    if(stat != FT_OK){
+        logging(ERROR, "HAL",
+                "Failed to set timeout for UART %s, error: %d", serial_num, stat);
+        serial_close(p);
+        return FAILURE;
+    }
+
+    stat = FT_SetLatencyTimer(p->handle, latency);
+    if(stat != FT_OK){
+        logging(ERROR, "HAL",
+                "Failed to set latency timer for UART %s, error: %d",
+                serial_num, stat);
+        serial_close(p);
+        return FAILURE;
+    }
+
+    *port = p;
+    return SUCCESS;
+}
+
+int hal_serial_read(hal_serial_t* port, void* buf, unsigned int count,
+        unsigned int* bytes_read){
+
+    DWORD n = 0;
+    int ret = FT_Read(port->handle, buf, count, &n);
+    *bytes_read = n;
+    return ret;
+}
+
+int hal_serial_queue(hal_serial_t* port, unsigned int* bytes_available){
+
+    DWORD n = 0;
+    int ret = FT_GetQueueStatus(port->handle, &n);
+    *bytes_available = n;
+    return ret;
+}
+
+int hal_serial_purge(hal_serial_t* port){
+    return FT_Purge(port->handle, FT_PURGE_RX);
+}
+
+static void serial_close(hal_serial_t* port){
+    FT_Close(port->handle);
+    free(port);
+}
@@ -0,0 +1,86 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: HAL
+ * Author(s): 
+ * Purpose: Provide the interface to the devices, the spi, i2c and gpio device
+ *          files and the ftdi serial ports. Backed by the hardware in
+ *          irisc-obsw and by simulated devices in irisc-sim.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+/**
+ * The cameras are used through the ASI camera library, which irisc-sim
+ * replaces with simulated cameras, see hal/sim/sim_camera.c.
+ */
+
+int init_hal(void* args);
+
+/* hal_open:
+ * Open a device file, e.g. /dev/spidev0.0, /dev/i2c-5 or a file under
+ * /sys/class/gpio. Same as open(2).
+ *
+ * return:
+ *      file descriptor, -1 on failure with errno set
+ */
+int hal_open(const char* path, int flags);
+
+/* same as read(2), write(2), ioctl(2) and close(2) on a device file */
+ssize_t hal_read(int fd, void* buf, size_t count);
+ssize_t hal_write(int fd, const void* buf, size_t count);
+int hal_ioctl(int fd, unsigned long request, void* arg);
+int hal_close(int fd);
+
+typedef struct hal_serial hal_serial_t;
+
+/* hal_serial_open:
+ * Open the serial port of an ftdi usb converter.
+ *
+ * input:
+ *      serial_num: serial number of the converter
+ *      baudrate: baud rate of the port
+ *      timeout: read and write timeout in milliseconds
+ *      latency: latency timer in milliseconds
+ *
+ * output:
+ *      port: the opened port
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: failed to open or set up the port, log written
+ */
+int hal_serial_open(const char* serial_num, int baudrate, int timeout,
+        int latency, hal_serial_t** port);
+
+/* hal_serial_read:
+ * Read up to count bytes, waiting at most the timeout of the port.
+ *
+ * output:
+ *      bytes_read: number of bytes read
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      otherwise the error code of the ftdi driver
+ */
+int hal_serial_read(hal_serial_t* port, void* buf, unsigned int count,
+        unsigned int* bytes_read);
+
+/* hal_serial_queue:
+ * Number of received bytes waiting to be read.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      otherwise the error code of the ftdi driver
+ */
+int hal_serial_queue(hal_serial_t* port, unsigned int* bytes_available);
+
+/* hal_serial_purge:
+ * Drop all received bytes waiting to be read.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      otherwise the error code of the ftdi driver
+ */
+int hal_serial_purge(hal_serial_t* port);
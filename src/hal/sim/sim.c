@@ -0,0 +1,234 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Sim
+ * Parent Component: HAL
+ * Author(s): 
+ * Purpose: Simulate the devices of the gondola for running the flight
+ *          software on a desktop. Built into irisc-sim instead of the
+ *          hardware backend of the HAL.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "global_utils.h"
+#include "hal.h"
+#include "sim.h"
+
+/* simulated files are backed by /dev/null for a unique descriptor */
+#define SIM_MAX_FD 1024
+
+static void advance(double now);
+
+static sim_file_t files[SIM_MAX_FD];
+static pthread_mutex_t mutex_files = PTHREAD_MUTEX_INITIALIZER;
+
+static struct timespec start;
+
+/* the motors run a command over one control period */
+static double motor_az = 0, motor_alt = SIM_START_ALT;
+static double motor_rate_az = 0, motor_rate_alt = 0;
+static double motor_last = 0, motor_end = 0;
+static double step_per_deg;
+static pthread_mutex_t mutex_plant = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int noise_seed = 1;
+static pthread_mutex_t mutex_noise = PTHREAD_MUTEX_INITIALIZER;
+
+int init_hal(void* args){
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    step_per_deg = (double)STEPS_PER_REVOLUTION * MICRO_STEP_FACTOR * GEARBOX_RATIO / 360.0;
+
+    sim_init_devices();
+
+    logging(INFO, "HAL", "Running on simulated devices");
+
+    return SUCCESS;
+}
+
+int hal_open(const char* path, int flags){
+
+    const sim_dev_t* dev = NULL;
+    for(int ii=0; ii<sim_dev_count; ++ii){
+        if(!strncmp(path, sim_devs[ii].path, strlen(sim_devs[ii].path))){
+            dev = &sim_devs[ii];
+            break;
+        }
+    }
+
+    /* anything else is a real file */
+    if(dev == NULL){
+        return open(path, flags);
+    }
+
+    int fd = open("/dev/null", O_RDWR);
+    if(fd == -1){
+        return -1;
+    }
+    if(fd >= SIM_MAX_FD){
+        close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+
+    pthread_mutex_lock(&mutex_files);
+
+    memset(&files[fd], 0, sizeof(files[fd]));
+    files[fd].dev = dev;
+
+    if(dev->open != NULL && dev->open(&files[fd], path)){
+        int err = errno;
+        files[fd].dev = NULL;
+        pthread_mutex_unlock(&mutex_files);
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    pthread_mutex_unlock(&mutex_files);
+
+    return fd;
+}
+
+ssize_t hal_read(int fd, void* buf, size_t count){
+
+    if(fd < 0 || fd >= SIM_MAX_FD || files[fd].dev == NULL){
+        return read(fd, buf, count);
+    }
+    if(files[fd].dev->read == NULL){
+        errno = EINVAL;
+        return -1;
+    }
+    return files[fd].dev->read(&files[fd], buf, count);
+}
+
+ssize_t hal_write(int fd, const void* buf, size_t count){
+
+    if(fd < 0 || fd >= SIM_MAX_FD || files[fd].dev == NULL){
+        return write(fd, buf, count);
+    }
+    if(files[fd].dev->write == NULL){
+        errno = EINVAL;
+        return -1;
+    }
+    return files[fd].dev->write(&files[fd], buf, count);
+}
+
+int hal_ioctl(int fd, unsigned long request, void* arg){
+
+    if(fd < 0 || fd >= SIM_MAX_FD || files[fd].dev == NULL){
+        return ioctl(fd, request, arg);
+    }
+    if(files[fd].dev->ioctl == NULL){
+        errno = ENOTTY;
+        return -1;
+    }
+    return files[fd].dev->ioctl(&files[fd], request, arg);
+}
+
+int hal_close(int fd){
+
+    if(fd >= 0 && fd < SIM_MAX_FD){
+        pthread_mutex_lock(&mutex_files);
+        files[fd].dev = NULL;
+        pthread_mutex_unlock(&mutex_files);
+    }
+    return close(fd);
+}
+
+double sim_time(void){
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void sim_attitude(sim_att_t* att){
+
+    double now = sim_time();
+
+    pthread_mutex_lock(&mutex_plant);
+
+    advance(now);
+
+    att->az = motor_az;
+    att->alt = motor_alt;
+
+    if(now < motor_end){
+        att->rate_az = motor_rate_az;
+        att->rate_alt = motor_rate_alt;
+    } else {
+        att->rate_az = 0;
+        att->rate_alt = 0;
+    }
+
+    pthread_mutex_unlock(&mutex_plant);
+
+    /* the telescope turns with the gondola */
+    double w = 2 * M_PI / SIM_SWAY_PERIOD;
+    att->rate_az += SIM_SWAY_AMP * w * cos(w * now);
+}
+
+void sim_motor_steps(int az, int alt){
+
+    double now = sim_time();
+    double period = (double)CONTROL_SYS_WAIT / 1000000000;
+
+    pthread_mutex_lock(&mutex_plant);
+
+    advance(now);
+
+    motor_rate_az = az / step_per_deg / period;
+    motor_rate_alt = alt / step_per_deg / period;
+    motor_end = now + period;
+
+    pthread_mutex_unlock(&mutex_plant);
+}
+
+void sim_transfer_time(size_t count, unsigned int bits_per_byte,
+        unsigned int speed){
+
+    if(speed == 0){
+        return;
+    }
+
+    long long ns = 1000000000LL * count * bits_per_byte / speed;
+    struct timespec t = {ns / 1000000000, ns % 1000000000};
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &t, NULL);
+}
+
+double sim_noise(double rms){
+
+    /* sum of 12 uniform samples, close enough to a gaussian */
+    double sum = 0;
+
+    pthread_mutex_lock(&mutex_noise);
+    for(int ii=0; ii<12; ++ii){
+        sum += (double)rand_r(&noise_seed) / RAND_MAX;
+    }
+    pthread_mutex_unlock(&mutex_noise);
+
+    return (sum - 6) * rms;
+}
+
+/* advance:
+ * Move the motors up to now, the caller holds mutex_plant.
+ */
+static void advance(double now){
+
+    double end = now < motor_end ? now : motor_end;
+    if(end > motor_last){
+        motor_az += motor_rate_az * (end - motor_last);
+        motor_alt += motor_rate_alt * (end - motor_last);
+    }
+    motor_last = now;
+}
@@ -0,0 +1,84 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Sim
+ * Parent Component: HAL
+ * Author(s): 
+ * Purpose: Simulate the devices of the gondola for running the flight
+ *          software on a desktop. Built into irisc-sim instead of the
+ *          hardware backend of the HAL.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+/* the simulated telescope starts pointing at SIM_START_ALT and the gondola
+ * sways in az with SIM_SWAY_AMP over SIM_SWAY_PERIOD
+ */
+#define SIM_START_ALT 45.0      /* unit: degrees */
+#define SIM_SWAY_AMP 0.5        /* unit: degrees */
+#define SIM_SWAY_PERIOD 20.0    /* unit: seconds */
+
+/* rms noise of the simulated gyroscope */
+#define SIM_GYRO_NOISE 0.002    /* unit: degrees per second */
+
+/* launch site and ascent rate of the simulated gps */
+#define SIM_LAT 67.8925         /* unit: degrees */
+#define SIM_LON 21.1042         /* unit: degrees */
+#define SIM_START_ALTITUDE 330  /* unit: meters */
+#define SIM_ASCENT_RATE 5       /* unit: meters per second */
+#define SIM_FLOAT_ALTITUDE 30000
+
+typedef struct{
+    double az;          /* motor angles relative to the gondola */
+    double alt;
+    double rate_az;     /* inertial angular rates of the telescope */
+    double rate_alt;
+} sim_att_t;
+
+/* a simulated device file, the handlers work like read(2), write(2) and
+ * ioctl(2) on the state of the open file
+ */
+typedef struct sim_file sim_file_t;
+
+typedef struct{
+    const char* path;
+    int (*open)(sim_file_t* file, const char* path);
+    ssize_t (*read)(sim_file_t* file, void* buf, size_t count);
+    ssize_t (*write)(sim_file_t* file, const void* buf, size_t count);
+    int (*ioctl)(sim_file_t* file, unsigned long request, void* arg);
+} sim_dev_t;
+
+struct sim_file{
+    const sim_dev_t* dev;
+    int pin;                /* gpio pin of the file */
+    int addr;               /* i2c slave address, or 1 for the gpio
+                             * export file and 0 for unexport */
+    unsigned int speed;     /* spi clock, unit: Hz */
+};
+
+/* the devices, matched on the start of the path in order */
+extern const sim_dev_t sim_devs[];
+extern const int sim_dev_count;
+
+/* set up the simulated devices, called by init_hal */
+void sim_init_devices(void);
+
+/* seconds since the simulation started */
+double sim_time(void);
+
+/* current attitude of the simulated telescope */
+void sim_attitude(sim_att_t* att);
+
+/* move the gimbal motors, one command per control period */
+void sim_motor_steps(int az, int alt);
+
+/* sleep for the time a bus transfer of count bytes takes */
+void sim_transfer_time(size_t count, unsigned int bits_per_byte,
+        unsigned int speed);
+
+/* gaussian noise with the given rms, deterministic between runs */
+double sim_noise(double rms);
+
+/* the gyroscope sends a datagram on a rising edge of its trigger pin */
+void sim_gyro_trigger(void);
@@ -0,0 +1,321 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Sim Camera
+ * Parent Component: HAL
+ * Author(s): 
+ * Purpose: Simulated guiding and NIR cameras behind the part of the ASI
+ *          camera library used by camera_utils, in place of libASICamera2.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "ASICamera2.h"
+#include "global_utils.h"
+#include "camera_utils.h"
+#include "sim.h"
+
+#define SIM_CAMERAS 2
+
+#define SIM_BACKGROUND 100      /* unit: ADU */
+#define SIM_READ_NOISE 8        /* unit: ADU */
+#define SIM_STARS 40
+#define SIM_STAR_SIGMA 1.5      /* unit: pixels */
+#define SIM_CAMERA_TEMP 200     /* unit: 0.1 degrees celsius */
+
+/* readout over usb 3, roughly 300 MB/s */
+#define SIM_USB_SPEED 2400000000U   /* unit: bits per second */
+
+typedef struct{
+    const char* name;
+    long width, height;
+    int open;
+    ASI_EXPOSURE_STATUS status;
+    long exposure;              /* unit: microseconds */
+    long gain;
+    double exp_start;           /* unit: sim_time seconds */
+    unsigned short* frame;      /* the image read out after every exposure */
+    pthread_mutex_t mutex;
+} sim_camera_t;
+
+static void star_field(sim_camera_t* cam, unsigned int seed);
+
+static sim_camera_t cams[SIM_CAMERAS] = {
+    {"Sim ASI guiding", GUIDE_WIDTH, GUIDE_HEIGHT,
+        .mutex = PTHREAD_MUTEX_INITIALIZER},
+    {"Sim ASI NIR", NIR_WIDTH, NIR_HEIGHT,
+        .mutex = PTHREAD_MUTEX_INITIALIZER}
+};
+
+int ASIGetNumOfConnectedCameras(){
+    return SIM_CAMERAS;
+}
+
+ASI_ERROR_CODE ASIGetCameraProperty(ASI_CAMERA_INFO* pASICameraInfo,
+        int iCameraIndex){
+
+    if(iCameraIndex < 0 || iCameraIndex >= SIM_CAMERAS){
+        return ASI_ERROR_INVALID_INDEX;
+    }
+
+    sim_camera_t* cam = &cams[iCameraIndex];
+
+    memset(pASICameraInfo, 0, sizeof(*pASICameraInfo));
+    strncpy(pASICameraInfo->Name, cam->name, sizeof(pASICameraInfo->Name) - 1);
+    pASICameraInfo->CameraID = iCameraIndex;
+    pASICameraInfo->MaxWidth = cam->width;
+    pASICameraInfo->MaxHeight = cam->height;
+    pASICameraInfo->SupportedBins[0] = 1;
+    pASICameraInfo->SupportedVideoFormat[0] = ASI_IMG_RAW16;
+    pASICameraInfo->SupportedVideoFormat[1] = ASI_IMG_END;
+    pASICameraInfo->PixelSize = 2.4;
+    pASICameraInfo->IsUSB3Host = ASI_TRUE;
+    pASICameraInfo->IsUSB3Camera = ASI_TRUE;
+    pASICameraInfo->BitDepth = 12;
+
+    return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIOpenCamera(int iCameraID){
+
+    if(iCameraID < 0 || iCameraID >= SIM_CAMERAS){
+        return ASI_ERROR_INVALID_ID;
+    }
+
+    cams[iCameraID].open = 1;
+    return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIInitCamera(int iCameraID){
+
+    if(iCameraID < 0 || iCameraID >= SIM_CAMERAS){
+        return ASI_ERROR_INVALID_ID;
+    }
+    if(!cams[iCameraID].open){
+        return ASI_ERROR_CAMERA_CLOSED;
+    }
+
+    return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASISetROIFormat(int iCameraID, int iWidth, int iHeight,
+        int iBin, ASI_IMG_TYPE Img_type){
+
+    if(iCameraID < 0 || iCameraID >= SIM_CAMERAS){
+        return ASI_ERROR_INVALID_ID;
+    }
+
+    sim_camera_t* cam = &cams[iCameraID];
+
+    /* only full frames are simulated */
+    if(iWidth != cam->width || iHeight != cam->height || iBin != 1){
+        return ASI_ERROR_INVALID_SIZE;
+    }
+    if(Img_type != ASI_IMG_RAW16){
+        return ASI_ERROR_INVALID_IMGTYPE;
+    }
+
+    if(cam->frame == NULL){
+        cam->frame = malloc(cam->width * cam->height * sizeof(unsigned short));
+        if(cam->frame == NULL){
+            return ASI_ERROR_GENERAL_ERROR;
+        }
+        star_field(cam, iCameraID + 1);
+    }
+
+    return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASISetControlValue(int iCameraID, ASI_CONTROL_TYPE ControlType,
+        long lValue, ASI_BOOL bAuto){
+
+    if(iCameraID < 0 || iCameraID >= SIM_CAMERAS){
+        return ASI_ERROR_INVALID_ID;
+    }
+
+    sim_camera_t* cam = &cams[iCameraID];
+
+    pthread_mutex_lock(&cam->mutex);
+
+    switch(ControlType){
+        case ASI_EXPOSURE:
+            cam->exposure = lValue;
+            break;
+        case ASI_GAIN:
+            cam->gain = lValue;
+            break;
+        default:
+            break;
+    }
+
+    pthread_mutex_unlock(&cam->mutex);
+
+    return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIGetControlValue(int iCameraID, ASI_CONTROL_TYPE ControlType,
+        long* plValue, ASI_BOOL* pbAuto){
+
+    if(iCameraID < 0 || iCameraID >= SIM_CAMERAS){
+        return ASI_ERROR_INVALID_ID;
+    }
+
+    sim_camera_t* cam = &cams[iCameraID];
+
+    pthread_mutex_lock(&cam->mutex);
+
+    switch(ControlType){
+        case ASI_EXPOSURE:
+            *plValue = cam->exposure;
+            break;
+        case ASI_GAIN:
+            *plValue = cam->gain;
+            break;
+        case ASI_TEMPERATURE:
+            *plValue = SIM_CAMERA_TEMP;
+            break;
+        default:
+            *plValue = 0;
+            break;
+    }
+
+    pthread_mutex_unlock(&cam->mutex);
+
+    *pbAuto = ASI_FALSE;
+    return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIStartExposure(int iCameraID, ASI_BOOL bIsDark){
+
+    if(iCameraID < 0 || iCameraID >= SIM_CAMERAS){
+        return ASI_ERROR_INVALID_ID;
+    }
+
+    sim_camera_t* cam = &cams[iCameraID];
+
+    pthread_mutex_lock(&cam->mutex);
+
+    if(cam->status == ASI_EXP_WORKING){
+        pthread_mutex_unlock(&cam->mutex);
+        return ASI_ERROR_EXPOSURE_IN_PROGRESS;
+    }
+
+    cam->status = ASI_EXP_WORKING;
+    cam->exp_start = sim_time();
+
+    pthread_mutex_unlock(&cam->mutex);
+
+    return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIStopExposure(int iCameraID){
+
+    if(iCameraID < 0 || iCameraID >= SIM_CAMERAS){
+        return ASI_ERROR_INVALID_ID;
+    }
+
+    sim_camera_t* cam = &cams[iCameraID];
+
+    /* an aborted exposure can still be read out */
+    pthread_mutex_lock(&cam->mutex);
+    if(cam->status == ASI_EXP_WORKING){
+        cam->status = ASI_EXP_SUCCESS;
+    }
+    pthread_mutex_unlock(&cam->mutex);
+
+    return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIGetExpStatus(int iCameraID, ASI_EXPOSURE_STATUS* pExpStatus){
+
+    if(iCameraID < 0 || iCameraID >= SIM_CAMERAS){
+        return ASI_ERROR_INVALID_ID;
+    }
+
+    sim_camera_t* cam = &cams[iCameraID];
+
+    pthread_mutex_lock(&cam->mutex);
+
+    if(cam->status == ASI_EXP_WORKING &&
+            sim_time() >= cam->exp_start + cam->exposure / 1e6){
+        cam->status = ASI_EXP_SUCCESS;
+    }
+    *pExpStatus = cam->status;
+
+    pthread_mutex_unlock(&cam->mutex);
+
+    return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIGetDataAfterExp(int iCameraID, unsigned char* pBuffer,
+        long lBuffSize){
+
+    if(iCameraID < 0 || iCameraID >= SIM_CAMERAS){
+        return ASI_ERROR_INVALID_ID;
+    }
+
+    sim_camera_t* cam = &cams[iCameraID];
+    long size = cam->width * cam->height * sizeof(unsigned short);
+
+    if(cam->frame == NULL){
+        return ASI_ERROR_CAMERA_CLOSED;
+    }
+    if(lBuffSize < size){
+        return ASI_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    pthread_mutex_lock(&cam->mutex);
+    ASI_EXPOSURE_STATUS status = cam->status;
+    pthread_mutex_unlock(&cam->mutex);
+
+    if(status != ASI_EXP_SUCCESS){
+        return ASI_ERROR_GENERAL_ERROR;
+    }
+
+    sim_transfer_time(size, 8, SIM_USB_SPEED);
+    memcpy(pBuffer, cam->frame, size);
+
+    return ASI_SUCCESS;
+}
+
+/* star_field:
+ * Fill the frame of a camera with stars on a noisy background, as 12 bit
+ * values in the upper bits like the real cameras.
+ */
+static void star_field(sim_camera_t* cam, unsigned int seed){
+
+    long n_pix = cam->width * cam->height;
+    unsigned short* frame = cam->frame;
+
+    for(long ii=0; ii<n_pix; ++ii){
+        /* triangular noise, cheap and close enough */
+        double noise = (double)rand_r(&seed) / RAND_MAX
+                + (double)rand_r(&seed) / RAND_MAX - 1;
+        frame[ii] = lround(SIM_BACKGROUND + SIM_READ_NOISE * 2.45 * noise);
+    }
+
+    int r = (int)ceil(4 * SIM_STAR_SIGMA);
+    for(int ss=0; ss<SIM_STARS; ++ss){
+        double x = r + (double)rand_r(&seed) / RAND_MAX * (cam->width - 2*r - 1);
+        double y = r + (double)rand_r(&seed) / RAND_MAX * (cam->height - 2*r - 1);
+        double peak = 200 + (double)rand_r(&seed) / RAND_MAX * 3000;
+
+        for(int dy=-r; dy<=r; ++dy){
+            for(int dx=-r; dx<=r; ++dx){
+                long px = (long)x + dx, py = (long)y + dy;
+                double d2 = (px - x)*(px - x) + (py - y)*(py - y);
+                long val = frame[py*cam->width + px] +
+                        lround(peak * exp(-d2 / (2 * SIM_STAR_SIGMA * SIM_STAR_SIGMA)));
+                frame[py*cam->width + px] = val > 4095 ? 4095 : val;
+            }
+        }
+    }
+
+    for(long ii=0; ii<n_pix; ++ii){
+        frame[ii] <<= 4;
+    }
+}
@@ -0,0 +1,471 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Sim Devices
+ * Parent Component: HAL
+ * Author(s): 
+ * Purpose: The simulated gpio pins, gimbal motors on i2c, encoders and gps
+ *          on spi, and the gyroscope on its ftdi serial port.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <stdint.h>
+#include <linux/i2c-dev.h>
+#include <linux/spi/spidev.h>
+
+#include "global_utils.h"
+#include "hal.h"
+#include "sim.h"
+
+#define GPIO_PINS 64
+#define GPIO_DIR "/sys/class/gpio/"
+
+#define I2C_SPEED 100000        /* unit: Hz */
+#define I2C_BUS_MOTORS 5
+#define I2C_ADDR_MOTORS 8
+
+#define GYRO_DATAGRAM_IDENTIFIER 0x94
+#define GYRO_DATAGRAM_SIZE 27
+#define GYRO_TEMP 25.0          /* unit: degrees celsius */
+#define SERIAL_BUFFER_SIZE 4096
+
+#define GPS_SENTENCE_SIZE 100
+#define GPS_PERIOD 1            /* unit: seconds */
+
+struct hal_serial{
+    unsigned char buf[SERIAL_BUFFER_SIZE];
+    unsigned int head, tail;
+    int timeout;                /* unit: milliseconds */
+    unsigned int baudrate;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static int gpio_open(sim_file_t* file, const char* path);
+static ssize_t gpio_read(sim_file_t* file, void* buf, size_t count);
+static ssize_t gpio_write(sim_file_t* file, const void* buf, size_t count);
+static int i2c_open(sim_file_t* file, const char* path);
+static ssize_t i2c_read(sim_file_t* file, void* buf, size_t count);
+static ssize_t i2c_write(sim_file_t* file, const void* buf, size_t count);
+static int i2c_ioctl(sim_file_t* file, unsigned long request, void* arg);
+static int spi_ioctl(sim_file_t* file, unsigned long request, void* arg);
+static ssize_t encoder_az_read(sim_file_t* file, void* buf, size_t count);
+static ssize_t encoder_alt_read(sim_file_t* file, void* buf, size_t count);
+static ssize_t gps_read(sim_file_t* file, void* buf, size_t count);
+static void encoder_frame(double ang, unsigned char frame[2]);
+static int gps_sentence(char* str);
+
+const sim_dev_t sim_devs[] = {
+    {GPIO_DIR, gpio_open, gpio_read, gpio_write, NULL},
+    {"/dev/i2c-", i2c_open, i2c_read, i2c_write, i2c_ioctl},
+    {"/dev/spidev0.0", NULL, encoder_az_read, NULL, spi_ioctl},
+    {"/dev/spidev0.1", NULL, encoder_alt_read, NULL, spi_ioctl},
+    {"/dev/spidev1.2", NULL, gps_read, NULL, spi_ioctl}
+};
+const int sim_dev_count = sizeof(sim_devs) / sizeof(sim_devs[0]);
+
+/* gpio files are the export files (pin -1) or a file of an exported pin */
+static int gpio_exported[GPIO_PINS];
+static int gpio_value[GPIO_PINS];
+static pthread_mutex_t mutex_gpio = PTHREAD_MUTEX_INITIALIZER;
+
+static hal_serial_t gyro_port = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER
+};
+
+static char gps_buf[GPS_SENTENCE_SIZE];
+static int gps_len = 0, gps_pos = 0;
+static double gps_next = 0;
+
+static int gpio_open(sim_file_t* file, const char* path){
+
+    const char* name = &path[strlen(GPIO_DIR)];
+
+    if(!strcmp(name, "export") || !strcmp(name, "unexport")){
+        file->pin = -1;
+        file->addr = !strcmp(name, "export");
+        return SUCCESS;
+    }
+
+    int pin;
+    if(sscanf(name, "gpio%d/", &pin) != 1 || pin < 0 || pin >= GPIO_PINS){
+        errno = ENOENT;
+        return FAILURE;
+    }
+
+    pthread_mutex_lock(&mutex_gpio);
+    int exported = gpio_exported[pin];
+    pthread_mutex_unlock(&mutex_gpio);
+
+    /* the files of a pin only exist once it is exported */
+    if(!exported){
+        errno = ENOENT;
+        return FAILURE;
+    }
+
+    file->pin = pin;
+    return SUCCESS;
+}
+
+static ssize_t gpio_read(sim_file_t* file, void* buf, size_t count){
+
+    if(file->pin < 0 || count < 2){
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&mutex_gpio);
+    int val = gpio_value[file->pin];
+    pthread_mutex_unlock(&mutex_gpio);
+
+    memcpy(buf, val ? "1\n" : "0\n", 2);
+    return 2;
+}
+
+static ssize_t gpio_write(sim_file_t* file, const void* buf, size_t count){
+
+    char str[8] = {0};
+    memcpy(str, buf, count < sizeof(str) - 1 ? count : sizeof(str) - 1);
+
+    /* export or unexport, the pin number is written */
+    if(file->pin < 0){
+        int pin = atoi(str);
+        if(pin < 0 || pin >= GPIO_PINS){
+            errno = EINVAL;
+            return -1;
+        }
+
+        int export = file->addr;
+
+        pthread_mutex_lock(&mutex_gpio);
+        if(gpio_exported[pin] == export){
+            pthread_mutex_unlock(&mutex_gpio);
+            errno = export ? EBUSY : EINVAL;
+            return -1;
+        }
+        gpio_exported[pin] = export;
+        pthread_mutex_unlock(&mutex_gpio);
+
+        return count;
+    }
+
+    /* writes to direction files are accepted as is */
+    if(str[0] != '0' && str[0] != '1'){
+        return count;
+    }
+
+    int val = str[0] == '1';
+
+    pthread_mutex_lock(&mutex_gpio);
+    int rising = val && !gpio_value[file->pin];
+    gpio_value[file->pin] = val;
+    pthread_mutex_unlock(&mutex_gpio);
+
+    if(rising && file->pin == GYRO_TRIG_PIN){
+        sim_gyro_trigger();
+    }
+
+    return count;
+}
+
+static int i2c_open(sim_file_t* file, const char* path){
+
+    /* bus number in pin */
+    file->pin = atoi(&path[strlen("/dev/i2c-")]);
+    return SUCCESS;
+}
+
+static int i2c_ioctl(sim_file_t* file, unsigned long request, void* arg){
+
+    if(request != I2C_SLAVE){
+        errno = ENOTTY;
+        return -1;
+    }
+
+    file->addr = (int)(long)arg;
+    return SUCCESS;
+}
+
+static ssize_t i2c_read(sim_file_t* file, void* buf, size_t count){
+
+    sim_transfer_time(count + 1, 9, I2C_SPEED);
+
+    memset(buf, 0, count);
+    return count;
+}
+
+static ssize_t i2c_write(sim_file_t* file, const void* buf, size_t count){
+
+    sim_transfer_time(count + 1, 9, I2C_SPEED);
+
+    if(file->pin != I2C_BUS_MOTORS || file->addr != I2C_ADDR_MOTORS || count != 2){
+        return count;
+    }
+
+    /* see step_az_alt_local, the direction bits have opposite senses */
+    const unsigned char* msg = buf;
+    int az = msg[0] & 0x3F;
+    int alt = msg[1] & 0x3F;
+
+    sim_motor_steps(msg[0] & 0x80 ? -az : az, msg[1] & 0x80 ? alt : -alt);
+
+    return count;
+}
+
+static int spi_ioctl(sim_file_t* file, unsigned long request, void* arg){
+
+    switch(request){
+        case SPI_IOC_WR_MODE:
+            return SUCCESS;
+        case SPI_IOC_WR_MAX_SPEED_HZ:
+            file->speed = *(__u32*)arg;
+            return SUCCESS;
+        case SPI_IOC_MESSAGE(1): {
+            /* a receive only transfer, read at the speed of the transfer */
+            struct spi_ioc_transfer* xfer = arg;
+            unsigned int speed = file->speed;
+            if(xfer->speed_hz){
+                file->speed = xfer->speed_hz;
+            }
+            ssize_t ret = file->dev->read(file, (void*)(long)xfer->rx_buf, xfer->len);
+            file->speed = speed;
+            return ret;
+        }
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+
+static ssize_t encoder_az_read(sim_file_t* file, void* buf, size_t count){
+
+    sim_transfer_time(count, 8, file->speed);
+
+    sim_att_t att;
+    sim_attitude(&att);
+
+    unsigned char frame[2];
+    encoder_frame(att.az, frame);
+
+    memcpy(buf, frame, count < 2 ? count : 2);
+    return count < 2 ? count : 2;
+}
+
+static ssize_t encoder_alt_read(sim_file_t* file, void* buf, size_t count){
+
+    sim_transfer_time(count, 8, file->speed);
+
+    sim_att_t att;
+    sim_attitude(&att);
+
+    /* the alt encoder counts the other way, see proc in encoder_poller */
+    unsigned char frame[2];
+    encoder_frame(360 - att.alt, frame);
+
+    memcpy(buf, frame, count < 2 ? count : 2);
+    return count < 2 ? count : 2;
+}
+
+/* encoder_frame:
+ * A 14 bit angle with an odd and an even parity bit on top, as checked by
+ * checksum_ctl_enc in encoder_poller.
+ */
+static void encoder_frame(double ang, unsigned char frame[2]){
+
+    ang = fmod(ang, 360);
+    if(ang < 0){
+        ang += 360;
+    }
+
+    unsigned short msg = (unsigned short)(ang * 0x4000 / 360) & 0x3FFF;
+
+    unsigned char even = 1, odd = 1;
+    for(int ii=0; ii<14; ii+=2){
+        even ^= (msg >> ii) & 1;
+        odd ^= (msg >> (ii + 1)) & 1;
+    }
+
+    frame[0] = odd << 7 | even << 6 | msg >> 8;
+    frame[1] = msg & 0xFF;
+}
+
+static ssize_t gps_read(sim_file_t* file, void* buf, size_t count){
+
+    sim_transfer_time(count, 8, file->speed);
+
+    unsigned char* out = buf;
+    for(size_t ii=0; ii<count; ++ii){
+
+        if(gps_pos == gps_len && sim_time() >= gps_next){
+            gps_len = gps_sentence(gps_buf);
+            gps_pos = 0;
+            gps_next += GPS_PERIOD;
+        }
+
+        /* an idle receiver sends 0xFF */
+        out[ii] = gps_pos < gps_len ? gps_buf[gps_pos++] : 0xFF;
+    }
+
+    return count;
+}
+
+/* gps_sentence:
+ * A GGA sentence of the simulated balloon ascending over the launch site.
+ *
+ * return:
+ *      length of the sentence
+ */
+static int gps_sentence(char* str){
+
+    double t = sim_time();
+    double altitude = SIM_START_ALTITUDE + SIM_ASCENT_RATE * t;
+    if(altitude > SIM_FLOAT_ALTITUDE){
+        altitude = SIM_FLOAT_ALTITUDE;
+    }
+
+    time_t now = time(NULL);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+
+    double lat_min = (SIM_LAT - (int)SIM_LAT) * 60;
+    double lon_min = (SIM_LON - (int)SIM_LON) * 60;
+
+    int len = snprintf(str, GPS_SENTENCE_SIZE,
+            "$GPGGA,%02d%02d%02d.00,%02d%08.5f,N,%03d%08.5f,E,1,08,0.9,%.1f,M,0.0,M,,*",
+            utc.tm_hour, utc.tm_min, utc.tm_sec,
+            (int)SIM_LAT, lat_min, (int)SIM_LON, lon_min, altitude);
+
+    unsigned char chksum = 0;
+    for(int ii=1; ii<len-1; ++ii){
+        chksum ^= str[ii];
+    }
+
+    len += snprintf(&str[len], GPS_SENTENCE_SIZE - len, "%02X\r\n", chksum);
+
+    return len;
+}
+
+void sim_init_devices(void){
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&gyro_port.cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+int hal_serial_open(const char* serial_num, int baudrate, int timeout,
+        int latency, hal_serial_t** port){
+
+    gyro_port.timeout = timeout;
+    gyro_port.baudrate = baudrate;
+
+    *port = &gyro_port;
+    return SUCCESS;
+}
+
+int hal_serial_read(hal_serial_t* port, void* buf, unsigned int count,
+        unsigned int* bytes_read){
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += port->timeout * 1000000L;
+    if(deadline.tv_nsec >= 1000000000){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&port->mutex);
+
+    /* wait for all bytes or the timeout, like the ftdi driver */
+    while(port->head - port->tail < count){
+        if(pthread_cond_timedwait(&port->cond, &port->mutex, &deadline)){
+            break;
+        }
+    }
+
+    unsigned int n = port->head - port->tail;
+    if(n > count){
+        n = count;
+    }
+
+    unsigned char* out = buf;
+    for(unsigned int ii=0; ii<n; ++ii){
+        out[ii] = port->buf[port->tail++ % SERIAL_BUFFER_SIZE];
+    }
+
+    pthread_mutex_unlock(&port->mutex);
+
+    *bytes_read = n;
+    return SUCCESS;
+}
+
+int hal_serial_queue(hal_serial_t* port, unsigned int* bytes_available){
+
+    pthread_mutex_lock(&port->mutex);
+    *bytes_available = port->head - port->tail;
+    pthread_mutex_unlock(&port->mutex);
+
+    return SUCCESS;
+}
+
+int hal_serial_purge(hal_serial_t* port){
+
+    pthread_mutex_lock(&port->mutex);
+    port->tail = port->head;
+    pthread_mutex_unlock(&port->mutex);
+
+    return SUCCESS;
+}
+
+/* sim_gyro_trigger:
+ * Queue a datagram with the current rates, the layout decoded by active_m
+ * in gyroscope_poller.
+ */
+void sim_gyro_trigger(void){
+
+    sim_att_t att;
+    sim_attitude(&att);
+
+    /* the kalman filter takes z as the alt rate and the az rate from x and y */
+    double rate[3];
+    rate[0] = att.rate_az * cos(att.alt * M_PI / 180) + sim_noise(SIM_GYRO_NOISE);
+    rate[1] = -att.rate_az * sin(att.alt * M_PI / 180) + sim_noise(SIM_GYRO_NOISE);
+    rate[2] = att.rate_alt + sim_noise(SIM_GYRO_NOISE);
+
+    unsigned char data[GYRO_DATAGRAM_SIZE] = {0};
+    data[0] = GYRO_DATAGRAM_IDENTIFIER;
+
+    /* 24 bit big endian rates */
+    for(int ii=0; ii<3; ++ii){
+        int32_t val = lround(rate[ii] * 16384);
+        data[1+3*ii] = (val >> 16) & 0xFF;
+        data[2+3*ii] = (val >> 8) & 0xFF;
+        data[3+3*ii] = val & 0xFF;
+    }
+
+    int16_t temp = lround(GYRO_TEMP * 256);
+    data[11] = (temp >> 8) & 0xFF;
+    data[12] = temp & 0xFF;
+
+    data[GYRO_DATAGRAM_SIZE-2] = '\r';
+    data[GYRO_DATAGRAM_SIZE-1] = '\n';
+
+    hal_serial_t* port = &gyro_port;
+
+    pthread_mutex_lock(&port->mutex);
+
+    if(port->head - port->tail + GYRO_DATAGRAM_SIZE <= SERIAL_BUFFER_SIZE){
+        for(int ii=0; ii<GYRO_DATAGRAM_SIZE; ++ii){
+            port->buf[port->head++ % SERIAL_BUFFER_SIZE] = data[ii];
+        }
+        pthread_cond_broadcast(&port->cond);
+    }
+
+    pthread_mutex_unlock(&port->mutex);
+}
@@ -13,6 +13,7 @@
 #include <linux/i2c-dev.h>  // for I2C_SLAVE
 
 #include "global_utils.h"   // for logging, SUCCESS,  & FAILURE
+#include "hal.h"            // for hal_open, hal_ioctl, ...
 #include "i2c.h"            // for write_i2c
 
 static int fd_i2c_1 = -1;
@@ -23,13 +24,13 @@ static pthread_mutex_t mutex_i2c_5 = PTHREAD_MUTEX_INITIALIZER;
 
 int init_i2c(void* args){
 
-    fd_i2c_1 = open("/dev/i2c-1", O_RDWR);
+    fd_i2c_1 = hal_open("/dev/i2c-1", O_RDWR);
     if(fd_i2c_1 == -1){
         logging(ERROR, "I2C", "Failed to open i2c-1 device: %m");
         return FAILURE;
     }
 
-    fd_i2c_5 = open("/dev/i2c-5", O_RDWR);
+    fd_i2c_5 = hal_open("/dev/i2c-5", O_RDWR);
     if(fd_i2c_5 == -1){
         logging(ERROR, "I2C", "Failed to open i2c-5 device: %m");
         return FAILURE;
@@ -65,12 +66,12 @@ ssize_t read_i2c(int dev_num, unsigned char addr, void* buf, size_t count){
 
     pthread_mutex_lock(&mutex_i2c);
 
-    if(ioctl(fd, I2C_SLAVE, addr) == -1){
+    if(hal_ioctl(fd, I2C_SLAVE, (void*)(long)addr) == -1){
         pthread_mutex_unlock(&mutex_i2c);
         return FAILURE;
     }
 
-    ssize_t ret = read(fd, buf, count);
+    ssize_t ret = hal_read(fd, buf, count);
 
     pthread_mutex_unlock(&mutex_i2c);
 
@@ -98,12 +99,12 @@ ssize_t write_i2c(int dev_num, unsigned char addr, const void* buf, size_t count
 
     pthread_mutex_lock(&mutex_i2c);
 
-    if(ioctl(fd, I2C_SLAVE, addr) == -1){
+    if(hal_ioctl(fd, I2C_SLAVE, (void*)(long)addr) == -1){
         pthread_mutex_unlock(&mutex_i2c);
         return FAILURE;
     }
 
-    ssize_t ret = write(fd, buf, count);
+    ssize_t ret = hal_write(fd, buf, count);
 
     pthread_mutex_unlock(&mutex_i2c);
 
@@ -141,18 +142,18 @@ int write_read_i2c(int dev_num, unsigned char addr, const void* write_buf,
 
     pthread_mutex_lock(&mutex_i2c);
 
-    if(ioctl(fd, I2C_SLAVE, addr) == -1){
+    if(hal_ioctl(fd, I2C_SLAVE, (void*)(long)addr) == -1){
         pthread_mutex_unlock(&mutex_i2c);
         return FAILURE;
     }
 
-    *write_ret = write(fd, write_buf, write_count);
+    *write_ret = hal_write(fd, write_buf, write_count);
     if(*write_ret != write_count){
         pthread_mutex_unlock(&mutex_i2c);
         return FAILURE;
     }
 
-    *read_ret = read(fd, read_buf, read_count);
+    *read_ret = hal_read(fd, read_buf, read_count);
     if(*read_ret != read_count){
         pthread_mutex_unlock(&mutex_i2c);
         return FAILURE;
@@ -0,0 +1,683 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Centroid
+ * Parent Component: Img Processing
+ * Author(s): 
+ * Purpose: Find the stars of an image held in memory and measure their
+ *          centroids, as input to the star tracker.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    #include <immintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+#include "global_utils.h"
+#include "telemetry.h"
+#include "centroid.h"
+
+/* threshold over the background, unit: noise */
+#define CENTROID_SIGMA 5
+
+/* blobs outside these sizes are hot pixels or not stars, unit: pixels */
+#define CENTROID_MIN_AREA 3
+#define CENTROID_MAX_AREA 2000
+
+/* the background is estimated from every CENTROID_STEP:th pixel of every
+ * CENTROID_STEP:th row
+ */
+#define CENTROID_STEP 4
+
+/* the images hold 12 bit values */
+#define HIST_SIZE 4096
+
+/* runs of pixels over the threshold kept for one image */
+#define MAX_RUNS 16384
+
+/* widest image that can be binned, unit: pixels */
+#define MAX_WIDTH 8192
+
+/* pixels skipped at a time while looking for pixels over the threshold */
+#if defined(__AVX2__)
+    #define CHUNK 16
+#else
+    #define CHUNK 8
+#endif
+
+#ifdef CENTROID_BENCH
+    /* size of the synthetic frame, as the guiding camera */
+    #define BENCH_WIDTH 1936
+    #define BENCH_HEIGHT 1096
+    #define BENCH_STARS 40
+#endif
+
+/* run_t:
+ * Consecutive pixels of a row over the threshold. Runs touching each other
+ * are joined into blobs through parent, the sums of a blob are kept by its
+ * root run.
+ */
+typedef struct{
+    int start, end;         /* first and last column */
+    int parent;
+    int area;
+    double sum, sum_x, sum_y;
+    float peak;
+} run_t;
+
+static int extract(const unsigned short* img, int width, int height,
+        int swap, int binning, int simd, star_list_t* list);
+static void background(const unsigned short* img, int width, int height,
+        int swap, float* bg, float* noise);
+static int skip_dark(const unsigned short* row, int x, int width, int swap,
+        int threshold);
+static void bin_row(const unsigned short* top, const unsigned short* bot,
+        unsigned short* out, int width, int swap);
+static void bin_row_scalar(const unsigned short* top, const unsigned short* bot,
+        unsigned short* out, int start, int width, int swap);
+static int find_root(int run);
+static void join(int a, int b);
+static void add_star(star_list_t* list, const run_t* blob, int binning);
+#ifdef CENTROID_BENCH
+    static void bench_frame(const unsigned short* img, int width, int height,
+            int swap, const char* name);
+#endif
+
+static unsigned int hist[HIST_SIZE];
+static run_t runs[MAX_RUNS];
+static unsigned short binned[MAX_WIDTH];
+
+/* written by the star tracker thread only, the atomics let the command
+ * thread read them
+ */
+static atomic_ulong calls, overflows;
+static atomic_ullong time_sum;      /* unit: nanoseconds */
+static atomic_llong time_max;       /* unit: nanoseconds */
+static atomic_int last_n, last_blobs;
+static _Atomic float last_bg, last_noise;
+
+/* swapped:
+ * Check if pixels of the given byte order must be swapped to host order.
+ */
+static inline int swapped(int big_endian){
+
+    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return big_endian;
+    #else
+        return !big_endian;
+    #endif
+}
+
+/* pixel:
+ * Read a pixel in host byte order.
+ */
+static inline int pixel(const unsigned short* img, long idx, int swap){
+
+    return swap ? __builtin_bswap16(img[idx]) : img[idx];
+}
+
+int find_stars_local(const unsigned short* img, int width, int height,
+        int big_endian, int binning, star_list_t* list){
+
+    if((binning != 1 && binning != 2) || width / binning > MAX_WIDTH){
+        return EINVAL;
+    }
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int swap = swapped(big_endian);
+    background(img, width, height, swap, &list->background, &list->noise);
+    int ret = extract(img, width, height, swap, binning, 1, list);
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    long long ns = (stop.tv_sec - start.tv_sec) * 1000000000LL +
+        (stop.tv_nsec - start.tv_nsec);
+
+    atomic_fetch_add_explicit(&calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&time_sum, ns, memory_order_relaxed);
+    if(ns > atomic_load_explicit(&time_max, memory_order_relaxed)){
+        atomic_store_explicit(&time_max, ns, memory_order_relaxed);
+    }
+    if(ret == EOVERFLOW){
+        atomic_fetch_add_explicit(&overflows, 1, memory_order_relaxed);
+    }
+    atomic_store_explicit(&last_n, list->n, memory_order_relaxed);
+    atomic_store_explicit(&last_blobs, list->blobs, memory_order_relaxed);
+    atomic_store_explicit(&last_bg, list->background, memory_order_relaxed);
+    atomic_store_explicit(&last_noise, list->noise, memory_order_relaxed);
+
+    #ifdef CENTROID_BENCH
+        bench_frame(img, width, height, swap, "recorded");
+    #endif
+
+    return ret;
+}
+
+void send_centroid_stats_local(void){
+
+    char msg[100];
+    unsigned long n = atomic_load_explicit(&calls, memory_order_relaxed);
+    unsigned long long sum = atomic_load_explicit(&time_sum, memory_order_relaxed);
+
+    snprintf(msg, 100, "centroid n: %lu, mean: %llu us, max: %lld us, overflows: %lu",
+            n, n ? sum / n / 1000 : 0,
+            atomic_load_explicit(&time_max, memory_order_relaxed) / 1000,
+            atomic_load_explicit(&overflows, memory_order_relaxed));
+    send_telemetry(msg, 1, 0, 0);
+
+    snprintf(msg, 100, "centroid last stars: %d, blobs: %d, bg: %.1f, noise: %.1f",
+            atomic_load_explicit(&last_n, memory_order_relaxed),
+            atomic_load_explicit(&last_blobs, memory_order_relaxed),
+            atomic_load_explicit(&last_bg, memory_order_relaxed),
+            atomic_load_explicit(&last_noise, memory_order_relaxed));
+    send_telemetry(msg, 1, 0, 0);
+}
+
+/* extract:
+ * Group the pixels over the threshold into blobs and add the stars among
+ * them to the list, which holds the background and noise of the image.
+ * With binning 2 the blobs are found in an image of the sums of 2x2 pixels,
+ * built a row at a time, so faint stars spread over a few pixels stand out
+ * more and there are a quarter of the pixels to scan.
+ *
+ * input:
+ *      swap: set if the pixels are not in host byte order
+ *      simd: set to skip dark pixels and bin with vector instructions, the
+ *            stars found are the same either way
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EOVERFLOW: too many pixels over the threshold
+ */
+static int extract(const unsigned short* img, int width, int height,
+        int swap, int binning, int simd, star_list_t* list){
+
+    float bg = list->background * binning * binning;
+    float noise = list->noise * binning;
+
+    list->blobs = 0;
+    list->n = 0;
+
+    int threshold = (int)(bg + CENTROID_SIGMA * noise);
+    if(threshold > 0xffff){
+        threshold = 0xffff;
+    }
+
+    /* binned rows are in host byte order */
+    int row_swap = binning == 1 ? swap : 0;
+    int stride = width;
+    width /= binning;
+    height /= binning;
+
+    int n_runs = 0;
+
+    /* runs of the previous row are [prev, row_start) */
+    int prev = 0;
+
+    for(int y=0; y<height; ++y){
+        const unsigned short* row;
+        int row_start = n_runs;
+
+        if(binning == 1){
+            row = &img[(long)y*stride];
+        }
+        else{
+            const unsigned short* top = &img[(long)2*y*stride];
+            if(simd){
+                bin_row(top, top + stride, binned, width, swap);
+            }
+            else{
+                bin_row_scalar(top, top + stride, binned, 0, width, swap);
+            }
+            row = binned;
+        }
+
+        int x = 0;
+        while(x < width){
+            int end = width;
+            if(simd){
+                x = skip_dark(row, x, width, row_swap, threshold);
+                end = x + CHUNK < width ? x + CHUNK : width;
+            }
+
+            for(; x<end; ++x){
+                int v = pixel(row, x, row_swap);
+                if(v <= threshold){
+                    continue;
+                }
+
+                if(n_runs == row_start || runs[n_runs-1].end != x-1){
+                    if(n_runs == MAX_RUNS){
+                        return EOVERFLOW;
+                    }
+                    run_t* r = &runs[n_runs];
+                    r->start = x;
+                    r->parent = n_runs;
+                    r->area = 0;
+                    r->sum = r->sum_x = r->sum_y = 0;
+                    r->peak = 0;
+                    n_runs++;
+                }
+
+                run_t* r = &runs[n_runs-1];
+                float w = v - bg;
+                r->end = x;
+                r->area++;
+                r->sum += w;
+                r->sum_x += w * x;
+                if(w > r->peak){
+                    r->peak = w;
+                }
+            }
+        }
+
+        /* join with the runs of the row above touching them, diagonals
+         * included
+         */
+        int p = prev;
+        for(int ii=row_start; ii<n_runs; ++ii){
+            runs[ii].sum_y = runs[ii].sum * y;
+
+            while(p < row_start && runs[p].end < runs[ii].start - 1){
+                p++;
+            }
+            for(int jj=p; jj<row_start && runs[jj].start <= runs[ii].end + 1; ++jj){
+                join(ii, jj);
+            }
+        }
+
+        prev = row_start;
+    }
+
+    /* add up every blob in its root run */
+    for(int ii=0; ii<n_runs; ++ii){
+        int root = find_root(ii);
+        if(root == ii){
+            continue;
+        }
+        run_t* b = &runs[root];
+        b->area += runs[ii].area;
+        b->sum += runs[ii].sum;
+        b->sum_x += runs[ii].sum_x;
+        b->sum_y += runs[ii].sum_y;
+        if(runs[ii].peak > b->peak){
+            b->peak = runs[ii].peak;
+        }
+    }
+
+    for(int ii=0; ii<n_runs; ++ii){
+        if(runs[ii].parent != ii){
+            continue;
+        }
+        list->blobs++;
+
+        if(runs[ii].area >= CENTROID_MIN_AREA &&
+                runs[ii].area <= CENTROID_MAX_AREA){
+            add_star(list, &runs[ii], binning);
+        }
+    }
+
+    return SUCCESS;
+}
+
+/* background:
+ * Estimate the background as the median of a sample of the pixels and the
+ * noise from their median absolute deviation, which stars and hot pixels
+ * hardly move.
+ *
+ * output:
+ *      bg: the background, unit: ADU
+ *      noise: standard deviation of the background, at least 1, unit: ADU
+ */
+static void background(const unsigned short* img, int width, int height,
+        int swap, float* bg, float* noise){
+
+    memset(hist, 0, sizeof(hist));
+    unsigned int count = 0;
+
+    for(int y=0; y<height; y+=CENTROID_STEP){
+        for(int x=0; x<width; x+=CENTROID_STEP){
+            int v = pixel(img, (long)y*width + x, swap);
+            hist[v < HIST_SIZE ? v : HIST_SIZE - 1]++;
+            count++;
+        }
+    }
+
+    unsigned int half = (count + 1) / 2;
+    unsigned int cum = 0;
+    int median = 0;
+    while(median < HIST_SIZE - 1 && cum + hist[median] < half){
+        cum += hist[median++];
+    }
+
+    /* grow a window around the median until it holds half the sample */
+    int mad = 0;
+    cum = hist[median];
+    while(cum < half && mad < HIST_SIZE){
+        mad++;
+        if(median + mad < HIST_SIZE){
+            cum += hist[median + mad];
+        }
+        if(median - mad >= 0){
+            cum += hist[median - mad];
+        }
+    }
+
+    *bg = median;
+    *noise = mad > 0 ? 1.4826f * mad : 1;
+}
+
+/* skip_dark:
+ * Skip whole chunks of CHUNK pixels of a row, none of them over the
+ * threshold, with vector instructions.
+ *
+ * input:
+ *      x: the first pixel to check
+ *      threshold: at most 0xffff
+ *
+ * return:
+ *      the first pixel of the chunk holding a pixel over the threshold, or
+ *      of the last chunk too short to check this way
+ */
+static int skip_dark(const unsigned short* row, int x, int width, int swap,
+        int threshold){
+
+    #if defined(__AVX2__)
+        /* no unsigned compare, flip the sign bits to compare as signed */
+        const __m256i sign = _mm256_set1_epi16((short)0x8000);
+        const __m256i limit = _mm256_set1_epi16((short)(threshold ^ 0x8000));
+
+        for(; x + CHUNK <= width; x += CHUNK){
+            __m256i v = _mm256_loadu_si256((const __m256i*)&row[x]);
+            if(swap){
+                v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+            }
+            v = _mm256_xor_si256(v, sign);
+            if(_mm256_movemask_epi8(_mm256_cmpgt_epi16(v, limit))){
+                break;
+            }
+        }
+    #elif defined(__SSE2__)
+        const __m128i sign = _mm_set1_epi16((short)0x8000);
+        const __m128i limit = _mm_set1_epi16((short)(threshold ^ 0x8000));
+
+        for(; x + CHUNK <= width; x += CHUNK){
+            __m128i v = _mm_loadu_si128((const __m128i*)&row[x]);
+            if(swap){
+                v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            }
+            v = _mm_xor_si128(v, sign);
+            if(_mm_movemask_epi8(_mm_cmpgt_epi16(v, limit))){
+                break;
+            }
+        }
+    #elif defined(__ARM_NEON)
+        const uint16x8_t limit = vdupq_n_u16(threshold);
+
+        for(; x + CHUNK <= width; x += CHUNK){
+            uint16x8_t v = vld1q_u16(&row[x]);
+            if(swap){
+                v = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(v)));
+            }
+            uint64x2_t over = vreinterpretq_u64_u16(vcgtq_u16(v, limit));
+            if(vgetq_lane_u64(over, 0) | vgetq_lane_u64(over, 1)){
+                break;
+            }
+        }
+    #else
+        (void)row;
+        (void)width;
+        (void)swap;
+        (void)threshold;
+    #endif
+
+    return x;
+}
+
+/* bin_row:
+ * Sum 2x2 pixels of two rows into one row in host byte order, saturating
+ * at 0xffff, with vector instructions where available.
+ *
+ * input:
+ *      top, bot: the two rows, 2*width pixels each
+ *      width: pixels of the binned row
+ *
+ * output:
+ *      out: the binned row
+ */
+static void bin_row(const unsigned short* top, const unsigned short* bot,
+        unsigned short* out, int width, int swap){
+
+    int ii = 0;
+
+    #if defined(__AVX2__) || defined(__SSE2__)
+        const __m128i low = _mm_set1_epi32(0xffff);
+        const __m128i bias = _mm_set1_epi32(0x8000);
+        const __m128i sign = _mm_set1_epi16((short)0x8000);
+
+        for(; ii + 8 <= width; ii += 8){
+            __m128i v[4] = {
+                _mm_loadu_si128((const __m128i*)&top[2*ii]),
+                _mm_loadu_si128((const __m128i*)&top[2*ii+8]),
+                _mm_loadu_si128((const __m128i*)&bot[2*ii]),
+                _mm_loadu_si128((const __m128i*)&bot[2*ii+8])
+            };
+            for(int jj=0; jj<4; ++jj){
+                if(swap){
+                    v[jj] = _mm_or_si128(_mm_slli_epi16(v[jj], 8),
+                            _mm_srli_epi16(v[jj], 8));
+                }
+                /* add horizontal pairs as 32 bit */
+                v[jj] = _mm_add_epi32(_mm_and_si128(v[jj], low),
+                        _mm_srli_epi32(v[jj], 16));
+            }
+
+            /* the signed saturating pack is unsigned after the bias */
+            __m128i lo = _mm_sub_epi32(_mm_add_epi32(v[0], v[2]), bias);
+            __m128i hi = _mm_sub_epi32(_mm_add_epi32(v[1], v[3]), bias);
+            _mm_storeu_si128((__m128i*)&out[ii],
+                    _mm_xor_si128(_mm_packs_epi32(lo, hi), sign));
+        }
+    #elif defined(__ARM_NEON)
+        for(; ii + 4 <= width; ii += 4){
+            uint16x8_t a = vld1q_u16(&top[2*ii]);
+            uint16x8_t b = vld1q_u16(&bot[2*ii]);
+            if(swap){
+                a = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(a)));
+                b = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(b)));
+            }
+            uint32x4_t sum = vaddq_u32(vpaddlq_u16(a), vpaddlq_u16(b));
+            vst1_u16(&out[ii], vqmovn_u32(sum));
+        }
+    #endif
+
+    bin_row_scalar(top, bot, out, ii, width, swap);
+}
+
+/* bin_row_scalar:
+ * Plain C version of bin_row, starting at binned pixel start.
+ */
+static void bin_row_scalar(const unsigned short* top, const unsigned short* bot,
+        unsigned short* out, int start, int width, int swap){
+
+    for(int ii=start; ii<width; ++ii){
+        int sum = pixel(top, 2*ii, swap) + pixel(top, 2*ii+1, swap) +
+            pixel(bot, 2*ii, swap) + pixel(bot, 2*ii+1, swap);
+        out[ii] = sum < 0xffff ? sum : 0xffff;
+    }
+}
+
+/* find_root:
+ * Find the first run of the blob a run belongs to, flattening the path on
+ * the way.
+ */
+static int find_root(int run){
+
+    while(runs[run].parent != run){
+        runs[run].parent = runs[runs[run].parent].parent;
+        run = runs[run].parent;
+    }
+    return run;
+}
+
+/* join:
+ * Join the blobs of two runs, keeping the earlier root.
+ */
+static void join(int a, int b){
+
+    a = find_root(a);
+    b = find_root(b);
+
+    if(a < b){
+        runs[b].parent = a;
+    }
+    else if(b < a){
+        runs[a].parent = b;
+    }
+}
+
+/* add_star:
+ * Add a blob to a list kept sorted by flux, dropping the faintest star if
+ * the list is full. The centroid of a binned blob is moved to pixels of the
+ * full image.
+ */
+static void add_star(star_list_t* list, const run_t* blob, int binning){
+
+    float flux = blob->sum;
+    int pos = list->n;
+
+    if(pos == MAX_STARS){
+        if(flux <= list->star[MAX_STARS-1].flux){
+            return;
+        }
+        pos--;
+    }
+    else{
+        list->n++;
+    }
+
+    while(pos > 0 && list->star[pos-1].flux < flux){
+        list->star[pos] = list->star[pos-1];
+        pos--;
+    }
+
+    star_t* s = &list->star[pos];
+    s->x = binning * (blob->sum_x / blob->sum) + 0.5f * (binning - 1);
+    s->y = binning * (blob->sum_y / blob->sum) + 0.5f * (binning - 1);
+    s->flux = flux;
+    s->peak = blob->peak;
+    s->area = blob->area;
+}
+
+#ifdef CENTROID_BENCH
+/* bench_find_stars:
+ * Benchmark the extraction on a synthetic guiding image of BENCH_STARS
+ * stars on a noisy background, stored big-endian as in a FITS file.
+ */
+void bench_find_stars(void){
+
+    unsigned short* img = malloc((size_t)BENCH_WIDTH * BENCH_HEIGHT * 2);
+    if(img == NULL){
+        logging(ERROR, "Centroid", "Cannot allocate memory for benchmark");
+        return;
+    }
+
+    unsigned int seed = 1;
+    for(long ii=0; ii<(long)BENCH_WIDTH*BENCH_HEIGHT; ++ii){
+        /* sum of uniform values, close to a normal distribution */
+        int v = 0;
+        for(int jj=0; jj<4; ++jj){
+            seed = seed * 1103515245 + 12345;
+            v += (seed >> 16) & 0xf;
+        }
+        img[ii] = 170 + v;
+    }
+
+    for(int ii=0; ii<BENCH_STARS; ++ii){
+        seed = seed * 1103515245 + 12345;
+        int cx = 8 + (seed >> 8) % (BENCH_WIDTH - 16);
+        seed = seed * 1103515245 + 12345;
+        int cy = 8 + (seed >> 8) % (BENCH_HEIGHT - 16);
+        seed = seed * 1103515245 + 12345;
+        float amp = 50 + (seed >> 8) % 3000;
+
+        for(int y=cy-6; y<=cy+6; ++y){
+            for(int x=cx-6; x<=cx+6; ++x){
+                float r2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+                int v = img[(long)y*BENCH_WIDTH + x] + amp * expf(-r2 / 4.5f);
+                img[(long)y*BENCH_WIDTH + x] = v < 4095 ? v : 4095;
+            }
+        }
+    }
+
+    for(long ii=0; ii<(long)BENCH_WIDTH*BENCH_HEIGHT; ++ii){
+        img[ii] = __builtin_bswap16(img[ii]);
+    }
+
+    bench_frame(img, BENCH_WIDTH, BENCH_HEIGHT, swapped(1), "synthetic");
+    free(img);
+}
+
+/* bench_frame:
+ * Time the background estimate and the extraction without and with vector
+ * instructions, unbinned and binned, on an image. The vector versions are
+ * checked to find the same stars.
+ */
+static void bench_frame(const unsigned short* img, int width, int height,
+        int swap, const char* name){
+
+    const int n_runs = 10;
+    struct timespec start, stop;
+    double time[5] = {0};
+    star_list_t list[4];
+    int ret[4];
+
+    for(int run=0; run<n_runs; ++run){
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        background(img, width, height, swap, &list[0].background, &list[0].noise);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        time[0] += (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+        for(int ii=0; ii<4; ++ii){
+            list[ii].background = list[0].background;
+            list[ii].noise = list[0].noise;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            ret[ii] = extract(img, width, height, swap, 1 + ii / 2, ii % 2,
+                    &list[ii]);
+            clock_gettime(CLOCK_MONOTONIC, &stop);
+            time[ii+1] += (stop.tv_sec - start.tv_sec) +
+                (stop.tv_nsec - start.tv_nsec) / 1e9;
+        }
+    }
+
+    for(int ii=0; ii<4; ii+=2){
+        if(ret[ii] != ret[ii+1] || list[ii].n != list[ii+1].n ||
+                list[ii].blobs != list[ii+1].blobs ||
+                memcmp(list[ii].star, list[ii+1].star,
+                    list[ii].n * sizeof(star_t))){
+            logging(ERROR, "Centroid", "Vector extraction of %s image "
+                    "differs, binning %d", name, 1 + ii / 2);
+        }
+    }
+
+    logging(INFO, "Centroid", "%s image, %d stars (%d binned), bg: %.1f, "
+            "noise: %.1f", name, list[1].n, list[3].n, list[0].background,
+            list[0].noise);
+    logging(INFO, "Centroid", "background: %.2f ms, scalar: %.2f ms, "
+            "vector: %.2f ms, binned scalar: %.2f ms, binned vector: %.2f ms",
+            time[0] * 1e3 / n_runs, time[1] * 1e3 / n_runs,
+            time[2] * 1e3 / n_runs, time[3] * 1e3 / n_runs,
+            time[4] * 1e3 / n_runs);
+}
+#endif
@@ -0,0 +1,52 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Centroid
+ * Parent Component: Img Processing
+ * Author(s): 
+ * Purpose: Find the stars of an image held in memory and measure their
+ *          centroids, as input to the star tracker.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "img_processing.h"
+
+/* find_stars_local:
+ * Estimate the background and noise of an image, group the pixels over
+ * CENTROID_SIGMA times the noise into 8-connected blobs and return the
+ * flux weighted centroids of the brightest ones. Dark parts of the image
+ * are skipped with vector instructions where available. Only one thread
+ * may call it at a time.
+ *
+ * input:
+ *      img: the pixels, row by row
+ *      width, height: size of the image in pixels
+ *      big_endian: set if the pixels are big-endian, as in the data of a
+ *                  FITS file
+ *      binning: 1, or 2 to find the blobs in 2x2 binned pixels, which is
+ *               faster and finds fainter stars at half the resolution
+ *
+ * output:
+ *      list: the stars, brightest first
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EINVAL: unsupported binning or image too wide to bin
+ *      EOVERFLOW: too many pixels over the threshold, e.g. stray light
+ */
+int find_stars_local(const unsigned short* img, int width, int height,
+        int big_endian, int binning, star_list_t* list);
+
+/* send_centroid_stats_local:
+ * Send the number of images searched, the time taken and the result of the
+ * last one as telemetry.
+ */
+void send_centroid_stats_local(void);
+
+#ifdef CENTROID_BENCH
+/* bench_find_stars:
+ * Benchmark of find_stars on a synthetic image, results are logged. With
+ * CENTROID_BENCH every image searched is benchmarked as well.
+ */
+void bench_find_stars(void);
+#endif
@@ -7,125 +7,67 @@
  * -----------------------------------------------------------------------------
  */
 
+/**
+ * This module holds the images waiting for the image handler in the shared
+ * prio_queue. Images of the same priority are handled in the order they
+ * were queued. At most DATA_QUEUE_SIZE images are held, pushing more
+ * returns ENOSPC.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
 
 #include "global_utils.h"
+#include "prio_queue.h"
 
 #include "data_queue.h"
 
-pthread_mutex_t data_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t data_queue_non_empty_cond = PTHREAD_COND_INITIALIZER;
+static pq_entry_t data_heap[DATA_QUEUE_SIZE];
+static int data_free[DATA_QUEUE_SIZE];
+static data_node data_nodes[DATA_QUEUE_SIZE];
 
-static data_node *data_queue = NULL;
+static prio_queue_t data_queue = PRIO_QUEUE_INITIALIZER(data_heap, data_free,
+        data_nodes, sizeof(data_node), DATA_QUEUE_SIZE);
 
 int init_data_queue(void* args) {
     return SUCCESS;
 }
 
 /**
- * Function to create a new node
+ * Function to push data to the queue according to its priority.
  *
- * @param d     Filepath of data to be sent.
+ * @param f     Filepath of data to be sent.
+ * @param frame Image in memory, NULL if the data is in the file.
+ * @param roi   Region to cut out, NULL if not a cutout.
  * @param p     Priority of the data.
+ * @return      0, ENOSPC if the queue is full
  */
-data_node *new_data_node(char *f, int p, int type){
-    data_node *temp = (data_node *) malloc(sizeof(data_node));
-    strncpy(temp->filepath, f, 100);
-    temp->priority = p;
-    temp->type = type;
-    temp->next = NULL;
+static int push_data(char *f, img_frame_t *frame, img_roi_t *roi,
+        int p, int type) {
 
-    return temp;
-}
+    data_node temp;
 
-/**
- * Function to check if the list is empty
- *
- * @param head  Pointer to the first node of the linked list.
- * @return      1 if the list is empty, 0 if not.
- */
-int is_empty_data(data_node **head) {
-    return (*head) == NULL;
-}
-
-char *peek_data(data_node **head) {
-    if (!is_empty_data(head)) {
-        return (*head)->filepath;
+    if (f != NULL) {
+        strncpy(temp.filepath, f, 100);
     } else {
-        return NULL;
+        temp.filepath[0] = '\0';
     }
-}
-
-/**
- * Removes the element with the highest priority form the list and
- * return it's data value.
- *
- * @param head  Pointer to the first node of the linked list.
- * @return      Data from the popped node.
- */
-struct node pop_data(data_node **head) {
-    pthread_mutex_lock(&data_mutex);
-
-    while (is_empty_data(head)) {
-        pthread_cond_wait(&data_queue_non_empty_cond, &data_mutex);
+    temp.frame = frame;
+    if (roi != NULL) {
+        temp.roi = *roi;
     }
+    temp.priority = p;
+    temp.type = type;
 
-    data_node *temp = *head;
-    (*head) = (*head)->next;
-    struct node ret;
-    strncpy(ret.filepath, temp->filepath, 100);
-    ret.priority = temp->priority;
-    ret.type = temp->type;
-
-    free(temp);
-
-    pthread_mutex_unlock(&data_mutex);
-    return ret;
-}
-
-/**
- * Function to push node to the list according to its priority.
- *
- * @param head  Pointer to the first node of the linked list.
- * @param f     Filepath of data to be sent.
- * @param p     Priority of the data.
- */
-void push_data(data_node **head, char *f, int p, int type) {
-    
-    pthread_mutex_lock(&data_mutex);
-    data_node *start = (*head);
-
-    if (!is_empty_data(head)) {
-        // Create new node
-        data_node *temp = new_data_node(f, p, type);
-        // Special Case: The head of list has lesser
-        // priority than new node. So insert new
-        // node before head node and change head node.
-        if ((*head)->priority > p) {
-            // Insert New Node before head
-            temp->next = *head;
-            (*head) = temp;
-        } else {
-            // Traverse the list and find a
-            // position to insert new node
-            while (start->next != NULL &&
-                   start->next->priority <= p) {
-                start = start->next;
-            }
-            // Either at the ends of the list
-            // or at required position
-            temp->next = start->next;
-            start->next = temp;
-        }
-    } else {
-        *head = new_data_node(f, p, type);
+    int ret = pq_push(&data_queue, &temp, p);
+    if (ret) {
+        logging(ERROR, "data_queue", "Queue full, image %s dropped",
+                f != NULL ? f : "in memory");
     }
 
-    pthread_mutex_unlock(&data_mutex);
-    pthread_cond_signal(&data_queue_non_empty_cond);
+    return ret;
 }
 
 /**
@@ -137,22 +79,50 @@ void push_data(data_node **head, char *f, int p, int type) {
  * @param d     Data to be sent.
  * @param p     Priority of the data (lower `p` indicates higher
  *              priority).
- * @return      0
+ * @return      0, ENOSPC if the queue is full
  */
 int store_data_local(char *f, int p, int type) {
-    push_data(&data_queue, f, p, type);
-    return SUCCESS;
+    return push_data(f, NULL, NULL, p, type);
 }
 
 /**
- * Return the filepath of the oldest message of the highest priority.
- * (This function exists solely for readability purposes, so some-
- * thing like `pop()` or `push()` won't appear somewhere without
- * context.)
+ * Put an image held in memory into the queue. The image handler
+ * releases the frame once it has been stored.
+ *
+ * @param frame Image to be stored.
+ * @param p     Priority of the data (lower `p` indicates higher
+ *              priority).
+ * @return      0, ENOSPC if the queue is full
+ */
+int store_frame_local(img_frame_t *frame, int p, int type) {
+    return push_data(NULL, frame, NULL, p, type);
+}
+
+/**
+ * Put a request for a cutout of a stored image into the queue.
+ *
+ * @param f     File name of the stored image.
+ * @param roi   Region to cut out.
+ * @param p     Priority of the data (lower `p` indicates higher
+ *              priority).
+ * @return      0, ENOSPC if the queue is full
+ */
+int store_cutout_local(char *f, img_roi_t *roi, int p) {
+    return push_data(f, NULL, roi, p, IMAGE_CUTOUT);
+}
+
+/**
+ * Return the data of the oldest image of the highest priority,
+ * waiting for one if the queue is empty.
  *
- * @return      filepath from the first node of the linked list.
+ * @return      the first image of the queue.
  */
 struct node read_data_queue() {
-    struct node temp = pop_data(&data_queue);
+    struct node temp;
+    pq_pop(&data_queue, &temp, NULL);
     return temp;
 }
+
+void data_queue_stats_local(prio_queue_stats_t *stats) {
+    pq_get_stats(&data_queue, stats);
+}
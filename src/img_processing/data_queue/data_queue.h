@@ -9,14 +9,22 @@
 
 #pragma once
 
+#include "camera.h"
+#include "img_processing.h"
+#include "prio_queue.h"
+
+/* most images waiting to be handled */
+#define DATA_QUEUE_SIZE 64
+
 /**
  * Node structure declaration.
  */
 typedef struct node {
     char filepath[100];     // Filepath of data to be compressed.
+    img_frame_t *frame; // Image in memory, NULL if the data is in filepath.
+    img_roi_t roi;      // Region to cut out for IMAGE_CUTOUT
     int priority;       // Lower values indicate higher priority
     int type;           // Type of file
-    struct node *next;  // Pointer to the node next on the list.
 
 } data_node;
 
@@ -26,5 +34,14 @@ int init_data_queue(void* args);
 /* Compress and store file, for type use IMAGE_MAIN or IMAGE_STARTRACKER */
 int store_data_local(char *f, int p, int type);
 
+/* Compress and store an image held in memory, see store_data_local */
+int store_frame_local(img_frame_t *frame, int p, int type);
+
+/* Cut out a region of the stored image f, of type IMAGE_CUTOUT */
+int store_cutout_local(char *f, img_roi_t *roi, int p);
+
 /* Return the data of the oldest message of the highest priority. */
 struct node read_data_queue();
+
+/* Depth, throughput and dropped images of the queue */
+void data_queue_stats_local(prio_queue_stats_t *stats);
@@ -7,6 +7,8 @@
  * -----------------------------------------------------------------------------
  */
 
+#define _GNU_SOURCE
+
 #include "global_utils.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,24 +17,67 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include <sched.h>
 #include <limits.h>
 #include <time.h>
 #include <unistd.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <endian.h>
 
+#include "camera.h"
 #include "data_queue.h"
 #include "img_processing.h"
+#include "image_handler.h"
+#include "rice_codec.h"
 #include "telemetry.h"
 
 int img_main_counter = 0;
 int img_startracker_counter = 0;
 
+/* size of file reads and compressed writes */
+#define IO_BLOCK_SIZE (4 << 20)
+
+/* width and height of the tiles of Rice compressed images */
+#define RICE_TILE 256
+
+/* largest cutout sent to ground, in pixels after binning */
+#define CUTOUT_MAX_PIXELS (1 << 20)
+
+/* header blocks read from a stored image */
+#define MAX_HEADER_BLOCKS 4
+
 /* prototypes declaration */
 static void* thread_func(void*);
+static int compression_setup(void);
+static void compression_affinity(void);
+static int compress_rice(const img_frame_t* frame, const char* file_name_out);
+static void header_card(char* block, int* card, const char* fmt, ...);
+static int make_cutout(const char* name, const img_roi_t* roi,
+        char* file_name_out);
+static int read_header(FILE* file, char* header);
+static const char* find_card(const char* header, int cards, const char* key);
+static long card_value(const char* header, int cards, const char* key);
+#ifdef COMPRESSION_BENCH
+    static void bench_compression(const img_frame_t* frame);
+#endif
 int compression_stream(const char* in_filename, const char* out_filename);
 
 static char st_fp[100];
 static char nir_fp[100];
 
+/* compression context and I/O buffers, reused for every image */
+static ZSTD_CCtx* cctx;
+static void* buff_in;
+static void* buff_out;
+
+/* output format of images held in memory */
+static int img_format = FORMAT_RICE;
+
+/* image cut out of a stored image, to be sent to ground */
+static img_frame_t cutout;
+static int cutout_cntr = 0;
+
 int init_image_handler(void* args) {
 
     strcpy(st_fp, get_top_dir());
@@ -41,88 +86,772 @@ int init_image_handler(void* args) {
     strcpy(nir_fp, get_top_dir());
     strcat(nir_fp, "output/nir/");
 
+    if(compression_setup()){
+        return FAILURE;
+    }
+
     return create_thread("image_handler", thread_func, 19);
 
 }
 
-static size_t fread_return_size(void* buffer, size_t sizeToRead, FILE* file)
-{
-    size_t const readSize = fread(buffer, 1, sizeToRead, file);
-    if (readSize == sizeToRead) return readSize;
-    if (feof(file)) return readSize;
-    logging(ERROR, "image_handler", "fread_return_size failed");
-    return FAILURE;
+/* compression_setup:
+ * Create the compression context used for all images and the buffers used
+ * for file I/O. With COMPRESSION_WORKERS set, zstd compresses each image
+ * in jobs spread over a pool of worker threads, kept within the context.
+ */
+static int compression_setup(void){
+
+    size_t ret;
+
+    cctx = ZSTD_createCCtx();
+    buff_in = malloc(IO_BLOCK_SIZE);
+    buff_out = malloc(IO_BLOCK_SIZE);
+    if(cctx == NULL || buff_in == NULL || buff_out == NULL){
+        logging(ERROR, "Img Handler", "Failed to allocate compression context");
+        return FAILURE;
+    }
+
+    cutout.size = FITS_BLOCK +
+        (2*CUTOUT_MAX_PIXELS + FITS_BLOCK - 1) / FITS_BLOCK * FITS_BLOCK;
+    cutout.fits = malloc(cutout.size);
+    if(cutout.fits == NULL){
+        logging(ERROR, "Img Handler", "Failed to allocate cutout buffer");
+        return FAILURE;
+    }
+
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, COMPRESSION_LEVEL);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+    ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, COMPRESSION_WORKERS);
+    if(ZSTD_isError(ret)){
+        logging(WARN, "Img Handler", "Failed to set %d compression workers, "
+                "compressing single threaded: %s", COMPRESSION_WORKERS,
+                ZSTD_getErrorName(ret));
+    }
+
+    return SUCCESS;
 }
 
-static int compress_file(const char* file_name_in, const char* file_name_out, int c_level) {
+/* compression_affinity:
+ * Restrict the image handler to the cores in COMPRESSION_CPUS. The zstd
+ * worker threads are started by the image handler and inherit this.
+ */
+static void compression_affinity(void){
 
-    size_t ret;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for(int ii=0; ii<CPU_SETSIZE && ii<32; ++ii){
+        if(COMPRESSION_CPUS & (1u << ii)){
+            CPU_SET(ii, &cpus);
+        }
+    }
+
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if(ret != 0){
+        logging(WARN, "Img Handler", "Failed to set core affinity: %s",
+                strerror(ret));
+    }
+}
+
+/* compress_chunk:
+ * Feed a chunk of data to the compression context and write out the
+ * compressed data whenever the output buffer fills up.
+ *
+ * input:
+ * chunk: data to compress
+ * size: size of chunk in bytes
+ * last: non zero if this is the last chunk of the file
+ * file_out: file to write the compressed data to
+ */
+static int compress_chunk(const void* chunk, size_t size, int last,
+        FILE* file_out) {
+
+    ZSTD_EndDirective const mode = last ? ZSTD_e_end : ZSTD_e_continue;
+    ZSTD_inBuffer input = { chunk, size, 0 };
+    int finished;
+
+    do {
+        ZSTD_outBuffer output = { buff_out, IO_BLOCK_SIZE, 0 };
+        size_t const remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+
+        if(ZSTD_isError(remaining)){
+            logging(ERROR, "Img Handler", "compressStream2 failed, %s",
+                    ZSTD_getErrorName(remaining));
+            return FAILURE;
+        }
+
+        if(fwrite(buff_out, 1, output.pos, file_out) != output.pos){
+            logging(ERROR, "Img Handler", "Failed to write out file: %m");
+            return FAILURE;
+        }
+
+        finished = last ? (remaining == 0) : (input.pos == input.size);
+
+    } while (!finished);
+
+    return SUCCESS;
+}
+
+/* open_out:
+ * Open the output file and start a new frame in the compression context.
+ *
+ * input:
+ * file_name_out: filepath for storage location
+ * in_size: size of the uncompressed data in bytes
+ */
+static FILE* open_out(const char* file_name_out, size_t in_size) {
+
+    FILE* file_out = fopen(file_name_out, "wb");
+    if(file_out==NULL){
+        logging(ERROR, "image_handler", "Could not open out file");
+        return NULL;
+    }
+
+    /* data is written in blocks of IO_BLOCK_SIZE, skip the stdio buffer */
+    setvbuf(file_out, NULL, _IONBF, 0);
+
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+    ZSTD_CCtx_setPledgedSrcSize(cctx, in_size);
+
+    return file_out;
+}
+
+static int compress_file(const char* file_name_in, const char* file_name_out) {
+
+    struct stat st;
 
     FILE* file_in = fopen(file_name_in, "rb");
     if(file_in==NULL){
         logging(ERROR, "image_handler", "Could not open in file: %m");
         return FAILURE;
     }
+    if(fstat(fileno(file_in), &st)){
+        logging(ERROR, "image_handler", "Could not stat in file: %m");
+        fclose(file_in);
+        return FAILURE;
+    }
+    setvbuf(file_in, NULL, _IONBF, 0);
+
+    FILE* file_out = open_out(file_name_out, st.st_size);
+    if(file_out==NULL){
+        fclose(file_in);
+        return FAILURE;
+    }
+
+    size_t left = st.st_size;
+    int status = SUCCESS;
+
+    do {
+        size_t const to_read = left < IO_BLOCK_SIZE ? left : IO_BLOCK_SIZE;
+        if(fread(buff_in, 1, to_read, file_in) != to_read){
+            logging(ERROR, "image_handler", "Failed to read in file");
+            status = FAILURE;
+            break;
+        }
+        left -= to_read;
+
+        status = compress_chunk(buff_in, to_read, left == 0, file_out);
+    } while (status == SUCCESS && left > 0);
+
+    if(fclose(file_out)){
+        status = FAILURE;
+    }
+    fclose(file_in);
+
+    return status;
+
+}
+
+/* compress_buffer:
+ * Compresses a file held in memory straight into the output file.
+ *
+ * input:
+ * buff: data to compress
+ * in_size: size of buff in bytes
+ * file_name_out: filepath for storage location
+ */
+static int compress_buffer(const void* buff, size_t in_size,
+        const char* file_name_out) {
+
+    FILE* file_out = open_out(file_name_out, in_size);
+    if(file_out==NULL){
+        return FAILURE;
+    }
+
+    int status = compress_chunk(buff, in_size, 1, file_out);
+
+    if(fclose(file_out)){
+        status = FAILURE;
+    }
+
+    return status;
+}
+
+/* compress_rice:
+ * Stores an image held in memory as a Rice compressed FITS file, using the
+ * FITS tile compression convention with RICE_TILE x RICE_TILE pixel tiles.
+ * The table of compressed tiles doubles as an index, so that parts of the
+ * image can be read without decompressing all of it. The file can be read
+ * directly by cfitsio based software or unpacked with funpack.
+ *
+ * input:
+ * frame: image to store
+ * file_name_out: filepath for storage location
+ */
+static int compress_rice(const img_frame_t* frame, const char* file_name_out) {
+
+    /* keywords of the image header that are renamed in the table header */
+    static const char* const zkeys[][2] = {
+        {"SIMPLE", "ZSIMPLE"}, {"BITPIX", "ZBITPIX"}, {"NAXIS", "ZNAXIS"},
+        {"NAXIS1", "ZNAXIS1"}, {"NAXIS2", "ZNAXIS2"}, {"EXTEND", "ZEXTEND"},
+        {"CHECKSUM", "ZHECKSUM"}, {"DATASUM", "ZDATASUM"}
+    };
+    const int nzkeys = sizeof(zkeys) / sizeof(zkeys[0]);
+
+    const char* header = (const char*)frame->fits;
+    const unsigned char* data = &frame->fits[FITS_BLOCK];
+    char hdr[2*FITS_BLOCK];
+    char* ext = &hdr[FITS_BLOCK];
+    char key[FITS_CARD];
+    long width = 0, height = 0;
+    int card;
+
+    memset(hdr, ' ', sizeof(hdr));
+
+    /* copy the image keywords, the image header ends in the first block */
+    card = 0;
+    header_card(ext, &card, "ZIMAGE  = %20s / extension contains compressed image",
+            "T");
+    for(int ii=0; ii<FITS_BLOCK/FITS_CARD; ++ii){
+        const char* src = &header[FITS_CARD*ii];
+
+        if(!strncmp(src, "END     ", 8)){
+            break;
+        }
+        if(!strncmp(src, "NAXIS1  ", 8)){
+            width = strtol(&src[10], NULL, 10);
+        }
+        if(!strncmp(src, "NAXIS2  ", 8)){
+            height = strtol(&src[10], NULL, 10);
+        }
+
+        memcpy(&ext[FITS_CARD*card], src, FITS_CARD);
+        for(int jj=0; jj<nzkeys; ++jj){
+            snprintf(key, FITS_CARD, "%-8s", zkeys[jj][0]);
+            if(!strncmp(src, key, 8)){
+                snprintf(key, FITS_CARD, "%-8s", zkeys[jj][1]);
+                memcpy(&ext[FITS_CARD*card], key, 8);
+                break;
+            }
+        }
+        ++card;
+    }
+
+    long tiles_x = (width + RICE_TILE - 1) / RICE_TILE;
+    long tiles_y = (height + RICE_TILE - 1) / RICE_TILE;
+    long tiles = tiles_x * tiles_y;
+    size_t table_size = 8 * tiles;
+    if(width <= 0 || height <= 0 ||
+            table_size + 2*RICE_TILE*RICE_TILE > IO_BLOCK_SIZE){
+        logging(ERROR, "Img Handler", "Unsupported image size for Rice "
+                "compression: %ldx%ld", width, height);
+        return FAILURE;
+    }
+
     FILE* file_out = fopen(file_name_out, "wb");
     if(file_out==NULL){
         logging(ERROR, "image_handler", "Could not open out file");
         return FAILURE;
     }
+    setvbuf(file_out, NULL, _IONBF, 0);
+
+    /* the compressed tiles are written to the heap following the table of
+     * tile descriptors, which is filled in once all tiles are compressed
+     */
+    uint32_t* table = buff_in;
+    unsigned char* tile = (unsigned char*)buff_in + table_size;
+    unsigned char* out = buff_out;
+    size_t heap = 0, pos = 0, max_len = 0;
+    int status = SUCCESS;
+
+    if(fseek(file_out, 2*FITS_BLOCK + table_size, SEEK_SET)){
+        status = FAILURE;
+    }
 
-    
-    size_t const buff_in_size = ZSTD_CStreamInSize();
-    void* const buff_in = malloc(buff_in_size);
-    size_t const buff_out_size = ZSTD_CStreamInSize();
-    void* const buff_out = malloc(buff_out_size);
+    for(long ii=0; ii<tiles && status==SUCCESS; ++ii){
+        long x0 = (ii % tiles_x) * RICE_TILE;
+        long y0 = (ii / tiles_x) * RICE_TILE;
+        long tw = width - x0 < RICE_TILE ? width - x0 : RICE_TILE;
+        long th = height - y0 < RICE_TILE ? height - y0 : RICE_TILE;
 
-    ZSTD_CCtx* const cctx = ZSTD_createCCtx();
+        /* gather the rows of the tile */
+        for(long row=0; row<th; ++row){
+            memcpy(&tile[2*tw*row], &data[2*(width*(y0+row) + x0)], 2*tw);
+        }
 
-    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, c_level);
-    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
-    ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, 0);
-    if(ZSTD_isError(ret)){
-        logging(ERROR, "Img Handler", "Failed to set workers to 0, %d", ret);
+        if(pos + RICE_BOUND(tw*th) > IO_BLOCK_SIZE){
+            if(fwrite(out, 1, pos, file_out) != pos){
+                status = FAILURE;
+            }
+            pos = 0;
+        }
+
+        size_t len = rice_encode(tile, tw*th, &out[pos]);
+        table[2*ii] = htobe32(len);
+        table[2*ii+1] = htobe32(heap);
+
+        pos += len;
+        heap += len;
+        if(len > max_len){
+            max_len = len;
+        }
     }
 
-    size_t const to_read = buff_in_size;
-    size_t read;
-    
-    while ((read = fread_return_size(buff_in, to_read, file_in))) {
-        if(read==-1){
-            return FAILURE;
+    /* pad the data unit to a full block */
+    size_t pad = (FITS_BLOCK - (table_size + heap) % FITS_BLOCK) % FITS_BLOCK;
+    if(status == SUCCESS && pos + pad > IO_BLOCK_SIZE){
+        if(fwrite(out, 1, pos, file_out) != pos){
+            status = FAILURE;
         }
+        pos = 0;
+    }
+    memset(&out[pos], 0, pad);
+    pos += pad;
+    if(status == SUCCESS && fwrite(out, 1, pos, file_out) != pos){
+        status = FAILURE;
+    }
 
-        int const last_chunk = (read < to_read);
-        
-        ZSTD_EndDirective const mode = last_chunk ? ZSTD_e_end : ZSTD_e_continue;
-        ZSTD_inBuffer input = { buff_in, read, 0 };
-        int finished;
-        
-        do {
-            ZSTD_outBuffer output = { buff_out, buff_out_size, 0 };
-            size_t const remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+    header_card(ext, &card, "ZTILE1  = %20d / size of tiles to be compressed",
+            RICE_TILE);
+    header_card(ext, &card, "ZTILE2  = %20d / size of tiles to be compressed",
+            RICE_TILE);
+    header_card(ext, &card, "ZCMPTYPE= %-20s / compression algorithm",
+            "'RICE_1'");
+    header_card(ext, &card, "ZNAME1  = %-20s / compression block size",
+            "'BLOCKSIZE'");
+    header_card(ext, &card, "ZVAL1   = %20d / pixels per block", RICE_BLOCK);
+    header_card(ext, &card, "ZNAME2  = %-20s / bytes per pixel (1, 2, 4, or 8)",
+            "'BYTEPIX'");
+    header_card(ext, &card, "ZVAL2   = %20d / bytes per pixel (1, 2, 4, or 8)", 2);
+    header_card(ext, &card, "END");
+
+    /* the table header, followed by the compressed image keywords */
+    int zcards = card;
+    char zimage[FITS_BLOCK];
+    memcpy(zimage, ext, FITS_BLOCK);
+    memset(ext, ' ', FITS_BLOCK);
+
+    card = 0;
+    header_card(ext, &card, "XTENSION= %-20s / binary table extension",
+            "'BINTABLE'");
+    header_card(ext, &card, "BITPIX  = %20d / 8-bit bytes", 8);
+    header_card(ext, &card, "NAXIS   = %20d / 2-dimensional binary table", 2);
+    header_card(ext, &card, "NAXIS1  = %20d / width of table in bytes", 8);
+    header_card(ext, &card, "NAXIS2  = %20ld / number of rows in table", tiles);
+    header_card(ext, &card, "PCOUNT  = %20zu / size of special data area", heap);
+    header_card(ext, &card, "GCOUNT  = %20d / one data group", 1);
+    header_card(ext, &card, "TFIELDS = %20d / number of fields in each row", 1);
+    header_card(ext, &card, "TTYPE1  = %-20s / label for field 1",
+            "'COMPRESSED_DATA'");
+    snprintf(key, FITS_CARD, "'1PB(%zu)'", max_len);
+    header_card(ext, &card, "TFORM1  = %-20s / data format of field: "
+            "variable length array", key);
+
+    if(card + zcards > FITS_BLOCK/FITS_CARD){
+        logging(ERROR, "Img Handler", "Image header too long for Rice file");
+        status = FAILURE;
+    }
+    else{
+        memcpy(&ext[FITS_CARD*card], zimage, FITS_CARD*zcards);
+    }
 
-            if(ZSTD_isError(remaining)){
-                logging(ERROR, "Img Handler", "compressStream2 failed, %d", remaining);
-                return FAILURE;
-            }
+    card = 0;
+    header_card(hdr, &card, "SIMPLE  = %20s / file does conform to FITS standard",
+            "T");
+    header_card(hdr, &card, "BITPIX  = %20d / number of bits per data pixel", 16);
+    header_card(hdr, &card, "NAXIS   = %20d / number of data axes", 0);
+    header_card(hdr, &card, "EXTEND  = %20s / FITS dataset may contain extensions",
+            "T");
+    header_card(hdr, &card, "END");
+
+    if(status == SUCCESS){
+        if(fseek(file_out, 0, SEEK_SET) ||
+                fwrite(hdr, 1, sizeof(hdr), file_out) != sizeof(hdr) ||
+                fwrite(table, 1, table_size, file_out) != table_size){
+            status = FAILURE;
+        }
+    }
+
+    if(status != SUCCESS){
+        logging(ERROR, "Img Handler", "Failed to write out file: %m");
+    }
+
+    if(fclose(file_out)){
+        status = FAILURE;
+    }
 
-            fwrite(buff_out, 1, output.pos, file_out);
+    return status;
+}
+
+/* header_card:
+ * Format a FITS header card into the next card of a header block, the
+ * block has to be filled with spaces in advance.
+ *
+ * input:
+ * block: header block of FITS_BLOCK bytes
+ * card: index of the next free card, incremented
+ * fmt: printf style format of the card
+ */
+static void header_card(char* block, int* card, const char* fmt, ...) {
+
+    char buffer[FITS_CARD + 1];
+    va_list args;
 
-            finished = last_chunk ? (remaining == 0) : (input.pos == input.size);
+    if(*card >= FITS_BLOCK/FITS_CARD){
+        return;
+    }
 
-        } while (!finished);
+    va_start(args, fmt);
+    int len = vsnprintf(buffer, FITS_CARD + 1, fmt, args);
+    va_end(args);
 
+    if(len > FITS_CARD){
+        len = FITS_CARD;
+    }
+
+    memcpy(&block[FITS_CARD * (*card)++], buffer, len);
+}
+
+/* make_cutout:
+ * Cut a region out of a stored Rice compressed image and store it, binned,
+ * as a new Rice compressed image. Only the tiles covering the region are
+ * read and decompressed.
+ *
+ * input:
+ * name: file name of a stored NIR image
+ * roi: region to cut out, clipped to the image
+ *
+ * output:
+ * file_name_out: filepath of the cutout, at least PATH_MAX characters
+ */
+static int make_cutout(const char* name, const img_roi_t* roi,
+        char* file_name_out) {
+
+    char fn[PATH_MAX];
+    char header[MAX_HEADER_BLOCKS*FITS_BLOCK];
+
+    if(strchr(name, '/') != NULL){
+        logging(ERROR, "Img Handler", "Invalid image name for cutout: %s", name);
+        return FAILURE;
+    }
+
+    /* a cut path could name another file */
+    if(snprintf(fn, PATH_MAX, "%s%s", nir_fp, name) >= PATH_MAX ||
+            snprintf(file_name_out, PATH_MAX, "%sCUT%03d_%s", nir_fp,
+                cutout_cntr, name) >= PATH_MAX){
+        logging(ERROR, "Img Handler", "Cutout path too long for %s", name);
+        return FAILURE;
+    }
+    cutout_cntr = (cutout_cntr + 1) % 1000;
+
+    FILE* file_in = fopen(fn, "rb");
+    if(file_in == NULL){
+        logging(ERROR, "Img Handler", "Could not open %s for cutout: %m", name);
+        return FAILURE;
+    }
+    setvbuf(file_in, NULL, _IONBF, 0);
+
+    /* the primary header is skipped, the image is in the first extension */
+    int cards = read_header(file_in, header);
+    if(cards != FAILURE){
+        cards = read_header(file_in, header);
+    }
+
+    const char* cmptype = find_card(header, cards, "ZCMPTYPE");
+    long width = card_value(header, cards, "ZNAXIS1");
+    long height = card_value(header, cards, "ZNAXIS2");
+    long tile_w = card_value(header, cards, "ZTILE1");
+    long tile_h = card_value(header, cards, "ZTILE2");
+    long tiles = card_value(header, cards, "NAXIS2");
+
+    if(cards == FAILURE || cmptype == NULL || strncmp(&cmptype[10], "'RICE_1'", 8) ||
+            card_value(header, cards, "ZBITPIX") != 16 ||
+            card_value(header, cards, "NAXIS1") != 8 ||
+            width <= 0 || height <= 0 || tile_w <= 0 || tile_h <= 0 ||
+            tiles != ((width + tile_w - 1) / tile_w) * ((height + tile_h - 1) / tile_h)){
+        logging(ERROR, "Img Handler", "%s is not a Rice compressed image", name);
+        fclose(file_in);
+        return FAILURE;
+    }
+
+    /* clip the region to the image and to whole bins */
+    long bin = roi->binning > 0 ? roi->binning : 1;
+    long x0 = roi->x, y0 = roi->y;
+    long w = roi->width < width - x0 ? roi->width : width - x0;
+    long h = roi->height < height - y0 ? roi->height : height - y0;
+    long out_w = w > 0 ? w / bin : 0;
+    long out_h = h > 0 ? h / bin : 0;
+
+    if(out_w == 0 || out_h == 0 || out_w * out_h > CUTOUT_MAX_PIXELS){
+        logging(ERROR, "Img Handler", "Invalid cutout region %ux%u+%u+%u bin %u",
+                roi->width, roi->height, roi->x, roi->y, roi->binning);
+        fclose(file_in);
+        return FAILURE;
+    }
+    w = out_w * bin;
+    h = out_h * bin;
+
+    /* tile index, followed by room for one compressed and decompressed tile */
+    size_t table_size = 8 * tiles;
+    uint32_t* table = buff_in;
+    unsigned char* comp = (unsigned char*)buff_in + table_size;
+    unsigned char* pix = comp + RICE_BOUND(tile_w*tile_h);
+    long heap_start = ftell(file_in) + table_size;
+
+    if(table_size + RICE_BOUND(tile_w*tile_h) + 2*tile_w*tile_h > IO_BLOCK_SIZE ||
+            fread(table, 1, table_size, file_in) != table_size){
+        logging(ERROR, "Img Handler", "Failed to read tile index of %s", name);
+        fclose(file_in);
+        return FAILURE;
+    }
+
+    /* sum up the binned pixels */
+    uint32_t* sums = buff_out;
+    memset(sums, 0, 4 * out_w * out_h);
+
+    long tiles_x = (width + tile_w - 1) / tile_w;
+    int status = SUCCESS;
+
+    for(long ty=y0/tile_h; ty<=(y0+h-1)/tile_h && status==SUCCESS; ++ty){
+        for(long tx=x0/tile_w; tx<=(x0+w-1)/tile_w; ++tx){
+            long idx = ty * tiles_x + tx;
+            size_t len = be32toh(table[2*idx]);
+            long offset = be32toh(table[2*idx+1]);
+            long tw = width - tx*tile_w < tile_w ? width - tx*tile_w : tile_w;
+            long th = height - ty*tile_h < tile_h ? height - ty*tile_h : tile_h;
+
+            if(len > RICE_BOUND(tw*th) ||
+                    fseek(file_in, heap_start + offset, SEEK_SET) ||
+                    fread(comp, 1, len, file_in) != len ||
+                    rice_decode(comp, len, pix, tw*th)){
+                logging(ERROR, "Img Handler", "Corrupt tile %ld in %s", idx, name);
+                status = FAILURE;
+                break;
+            }
+
+            /* the part of the tile inside the region */
+            long r0 = ty*tile_h > y0 ? ty*tile_h : y0;
+            long r1 = ty*tile_h + th < y0 + h ? ty*tile_h + th : y0 + h;
+            long c0 = tx*tile_w > x0 ? tx*tile_w : x0;
+            long c1 = tx*tile_w + tw < x0 + w ? tx*tile_w + tw : x0 + w;
+
+            for(long row=r0; row<r1; ++row){
+                const unsigned char* src = &pix[2*(row - ty*tile_h)*tw];
+                uint32_t* dst = &sums[(row - y0) / bin * out_w];
+                for(long col=c0; col<c1; ++col){
+                    long t = col - tx*tile_w;
+                    dst[(col - x0) / bin] += src[2*t] << 8 | src[2*t+1];
+                }
+            }
+        }
     }
 
-    ZSTD_freeCCtx(cctx);
-    fclose(file_out);
     fclose(file_in);
-    free(buff_in);
-    free(buff_out);
+    if(status != SUCCESS){
+        return FAILURE;
+    }
 
-    return SUCCESS;
+    /* build the cutout image, keeping the exposure keywords */
+    char* hdr = (char*)cutout.fits;
+    unsigned char* data = &cutout.fits[FITS_BLOCK];
+    const char* keep[] = {"EXPOINUS", "GAIN", "DATE"};
+    int card = 0;
+
+    memset(hdr, ' ', FITS_BLOCK);
+    header_card(hdr, &card, "SIMPLE  = %20s / file does conform to FITS standard",
+            "T");
+    header_card(hdr, &card, "BITPIX  = %20d / number of bits per data pixel", 16);
+    header_card(hdr, &card, "NAXIS   = %20d / number of data axes", 2);
+    header_card(hdr, &card, "NAXIS1  = %20ld / length of data axis 1", out_w);
+    header_card(hdr, &card, "NAXIS2  = %20ld / length of data axis 2", out_h);
+    for(int ii=0; ii<3; ++ii){
+        const char* src = find_card(header, cards, keep[ii]);
+        if(src != NULL){
+            memcpy(&hdr[FITS_CARD * card++], src, FITS_CARD);
+        }
+    }
+    header_card(hdr, &card, "CUTX    = %20ld / first column of cutout in image", x0);
+    header_card(hdr, &card, "CUTY    = %20ld / first row of cutout in image", y0);
+    header_card(hdr, &card, "BINNING = %20ld / pixels binned along each axis", bin);
+    header_card(hdr, &card, "END");
+
+    for(long ii=0; ii<out_w*out_h; ++ii){
+        unsigned short value = sums[ii] / (bin*bin);
+        data[2*ii] = value >> 8;
+        data[2*ii+1] = value & 0xFF;
+    }
+
+    size_t data_size = 2 * out_w * out_h;
+    size_t pad = (FITS_BLOCK - data_size % FITS_BLOCK) % FITS_BLOCK;
+    memset(&data[data_size], 0, pad);
+
+    img_frame_t frame = {cutout.fits, FITS_BLOCK + data_size + pad, -1,
+        out_w, out_h};
+
+    return compress_rice(&frame, file_name_out);
+}
+
+/* read_header:
+ * Read the header blocks of the next HDU of a FITS file, leaving the file
+ * at the start of its data.
+ *
+ * output:
+ * header: at least MAX_HEADER_BLOCKS*FITS_BLOCK bytes
+ *
+ * return:
+ * number of cards before the END card, FAILURE if there is none
+ */
+static int read_header(FILE* file, char* header) {
+
+    for(int block=0; block<MAX_HEADER_BLOCKS; ++block){
+        char* start = &header[FITS_BLOCK*block];
+        if(fread(start, 1, FITS_BLOCK, file) != FITS_BLOCK){
+            return FAILURE;
+        }
+
+        for(int ii=0; ii<FITS_BLOCK/FITS_CARD; ++ii){
+            if(!strncmp(&start[FITS_CARD*ii], "END     ", 8)){
+                return block * (FITS_BLOCK/FITS_CARD) + ii;
+            }
+        }
+    }
 
+    return FAILURE;
+}
+
+/* find_card:
+ * Find the header card of a keyword.
+ *
+ * return:
+ * pointer to the card, NULL if there is none
+ */
+static const char* find_card(const char* header, int cards, const char* key) {
+
+    char padded[FITS_CARD];
+    snprintf(padded, FITS_CARD, "%-8s", key);
+
+    for(int ii=0; ii<cards; ++ii){
+        if(!strncmp(&header[FITS_CARD*ii], padded, 8)){
+            return &header[FITS_CARD*ii];
+        }
+    }
+
+    return NULL;
+}
+
+/* card_value:
+ * Get the integer value of a keyword.
+ *
+ * return:
+ * the value, FAILURE if the keyword is missing
+ */
+static long card_value(const char* header, int cards, const char* key) {
+
+    char value[FITS_CARD];
+
+    const char* card = find_card(header, cards, key);
+    if(card == NULL){
+        return FAILURE;
+    }
+
+    memcpy(value, &card[10], FITS_CARD - 10);
+    value[FITS_CARD - 10] = '\0';
+
+    return strtol(value, NULL, 10);
+}
+
+#ifdef COMPRESSION_BENCH
+/* bench_compression:
+ * Compress an image with both zstd and the Rice codec and log the
+ * compression ratio and speed of each. The Rice compression is also
+ * checked to decompress to the original image.
+ */
+static void bench_compression(const img_frame_t* frame) {
+
+    char zstd_fn[120], rice_fn[120];
+    struct timespec start, stop;
+    struct stat st;
+    double time[3];
+    size_t size[2] = {0};
+
+    snprintf(zstd_fn, 120, "%sbench.fit.zst", nir_fp);
+    snprintf(rice_fn, 120, "%sbench.fit.fz", nir_fp);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = compress_buffer(frame->fits, frame->size, zstd_fn);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    time[0] = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    if(!ret && !stat(zstd_fn, &st)){
+        size[0] = st.st_size;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = compress_rice(frame, rice_fn);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    time[1] = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    if(!ret && !stat(rice_fn, &st)){
+        size[1] = st.st_size;
+    }
+
+    remove(zstd_fn);
+    remove(rice_fn);
+
+    /* decompress row by row and compare with the original */
+    long width = 0, height = 0;
+    for(int ii=0; ii<FITS_BLOCK/FITS_CARD; ++ii){
+        const char* src = (const char*)&frame->fits[FITS_CARD*ii];
+        if(!strncmp(src, "NAXIS1  ", 8)){
+            width = strtol(&src[10], NULL, 10);
+        }
+        if(!strncmp(src, "NAXIS2  ", 8)){
+            height = strtol(&src[10], NULL, 10);
+        }
+    }
+
+    const unsigned char* data = &frame->fits[FITS_BLOCK];
+    int errors = 0;
+    time[2] = 0;
+    for(long row=0; row<height; ++row){
+        const unsigned char* pix = &data[2*width*row];
+        size_t len = rice_encode(pix, width, buff_out);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(rice_decode(buff_out, len, buff_in, width) ||
+                memcmp(buff_in, pix, 2*width)){
+            errors++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        time[2] += (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) / 1e9;
+    }
+
+    double mb = frame->size / 1e6;
+    logging(INFO, "Img Handler", "zstd: ratio %.3f, %.0f MB/s; "
+            "rice: ratio %.3f, %.0f MB/s, decode %.0f MB/s, %d bad rows",
+            size[0] ? (double)frame->size / size[0] : 0, mb / time[0],
+            size[1] ? (double)frame->size / size[1] : 0, mb / time[1],
+            mb / time[2], errors);
+}
+#endif
+
+/* set_img_format_local:
+ * Select the format images held in memory are stored in.
+ *
+ * input:
+ * format: FORMAT_ZSTD or FORMAT_RICE
+ */
+void set_img_format_local(int format) {
+
+    img_format = format;
 }
 
 /* compression_stream:
@@ -134,37 +863,77 @@ static int compress_file(const char* file_name_in, const char* file_name_out, in
  */
 int compression_stream(const char* in_filename, const char* out_filename) {
 
-    return compress_file(in_filename, out_filename, COMPRESSION_LEVEL);
+    return compress_file(in_filename, out_filename);
 
 }
 
 static void* thread_func(void* param){
 
-    char out_name[100];
+    char out_name[PATH_MAX];
+    const char* ext;
     struct node temp;
 
     struct tm date_time;
     time_t epoch_time;
+    int ret;
+
+    compression_affinity();
 
     while(1){
 
         temp = read_data_queue();
 
+        if(temp.type==IMAGE_CUTOUT){
+            if(make_cutout(temp.filepath, &temp.roi, out_name) == SUCCESS){
+                send_telemetry(out_name, 2, 1, 0);
+            }
+            continue;
+        }
+
         time(&epoch_time);
         localtime_r(&epoch_time, &date_time);
 
+        /* only images held in memory can be stored Rice compressed */
+        int rice = temp.frame != NULL && img_format == FORMAT_RICE;
+        ext = rice ? "fz" : "zst";
+
         if(temp.type==IMAGE_MAIN){
 
-            sprintf(out_name, "%sIMG_MAIN_%02d:%02d:%02d.fit.zst", nir_fp,
-                    date_time.tm_hour, date_time.tm_min, date_time.tm_sec);
+            sprintf(out_name, "%sIMG_MAIN_%02d:%02d:%02d.fit.%s", nir_fp,
+                    date_time.tm_hour, date_time.tm_min, date_time.tm_sec, ext);
 
         } else if (temp.type==IMAGE_STARTRACKER){
 
-            sprintf(out_name, "%sIMG_ST_%02d:%02d:%02d.fit.zst", st_fp,
-                    date_time.tm_hour, date_time.tm_min, date_time.tm_sec);
+            sprintf(out_name, "%sIMG_ST_%02d:%02d:%02d.fit.%s", st_fp,
+                    date_time.tm_hour, date_time.tm_min, date_time.tm_sec, ext);
         }
 
-        if(compression_stream(temp.filepath, out_name)){
+        if(temp.frame != NULL){
+
+            #ifdef COMPRESSION_BENCH
+                bench_compression(temp.frame);
+            #endif
+
+            /* image held in memory, only the compressed file is written */
+            if(rice){
+                ret = compress_rice(temp.frame, out_name);
+            } else {
+                ret = compress_buffer(temp.frame->fits, temp.frame->size,
+                        out_name);
+            }
+
+            if(ret == SUCCESS){
+                if(rice){
+                    logging(INFO, "Img Handler", "Stored %s",
+                            strrchr(out_name, '/') + 1);
+                }
+                release_img_frame(temp.frame);
+            } else if(queue_frame(temp.frame, temp.type)){
+                /* the queue is full, the image can not be retried */
+                release_img_frame(temp.frame);
+            }
+
+        } else if(compression_stream(temp.filepath, out_name)){
             queue_image(temp.filepath, temp.type);
         } else {
             #if 0
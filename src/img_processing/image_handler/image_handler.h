@@ -11,3 +11,6 @@
 
 /* initialise the image handler component */
 int init_image_handler(void* args);
+
+/* select the format images held in memory are stored in */
+void set_img_format_local(int format);
@@ -12,12 +12,15 @@
 #include <pthread.h>
 #include "data_queue.h"
 #include "image_handler.h"
+#include "centroid.h"
 #include "img_processing.h"
 
 #define MODULE_COUNT 2
 
 static int send_st_cmd = 0;
 
+static int img_priority(int type);
+
 /* This list controls the order of initialisation */
 static const module_init_t init_sequence[MODULE_COUNT] = {
     {"data_queue", &init_data_queue},
@@ -26,6 +29,10 @@ static const module_init_t init_sequence[MODULE_COUNT] = {
 
 int init_img_processing(void* args){
 
+    #ifdef CENTROID_BENCH
+        bench_find_stars();
+    #endif
+
     /* init whatever in this module */
     int ret = init_submodules(init_sequence, MODULE_COUNT);
     if( ret != SUCCESS ){
@@ -36,6 +43,16 @@ int init_img_processing(void* args){
 }
 
 int queue_image(char *filepath, int type){
+
+    return store_data_local(filepath, img_priority(type), type);
+}
+
+int queue_frame(img_frame_t *frame, int type){
+
+    return store_frame_local(frame, img_priority(type), type);
+}
+
+static int img_priority(int type){
     int p;
 
     if(type==IMAGE_MAIN){
@@ -47,9 +64,7 @@ int queue_image(char *filepath, int type){
         p = 50;
     }
 
-    store_data_local(filepath, p, type);
-
-    return SUCCESS;
+    return p;
 }
 
 void send_st(void){
@@ -57,3 +72,26 @@ void send_st(void){
 
     return;
 }
+
+int request_cutout(char *name, img_roi_t *roi){
+
+    return store_cutout_local(name, roi, 20);
+}
+
+void set_img_format(int format){
+    set_img_format_local(format);
+
+    return;
+}
+
+int find_stars(const unsigned short* img, int width, int height,
+        int big_endian, int binning, star_list_t* list){
+
+    return find_stars_local(img, width, height, big_endian, binning, list);
+}
+
+void send_centroid_stats(void){
+    send_centroid_stats_local();
+
+    return;
+}
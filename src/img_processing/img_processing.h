@@ -8,8 +8,52 @@
 
 #pragma once
 
+#include "camera.h"
+
 #define IMAGE_MAIN 1
 #define IMAGE_STARTRACKER 2
+#define IMAGE_CUTOUT 3
+
+/* img_roi_t:
+ * A rectangle of a stored image, in pixels of the full image, to be binned
+ * by binning x binning pixels.
+ */
+typedef struct{
+    unsigned short x;
+    unsigned short y;
+    unsigned short width;
+    unsigned short height;
+    unsigned short binning;
+} img_roi_t;
+
+/* the most stars kept of an image */
+#define MAX_STARS 64
+
+/* star_t:
+ * A star found in an image. The centroid is in pixels of the full image,
+ * with the centre of the first pixel at 0.
+ */
+typedef struct{
+    float x, y;
+    float flux;             /* sum over the background, unit: ADU */
+    float peak;             /* highest pixel over the background, unit: ADU */
+    int area;               /* pixels over the threshold */
+} star_t;
+
+/* star_list_t:
+ * The stars of an image, brightest first.
+ */
+typedef struct{
+    float background;       /* unit: ADU */
+    float noise;            /* standard deviation of the background, unit: ADU */
+    int blobs;              /* groups of pixels over the threshold found */
+    int n;                  /* stars in the list */
+    star_t star[MAX_STARS];
+} star_list_t;
+
+/* storage formats of images */
+#define FORMAT_ZSTD 0   /* zstd compressed FITS file, .fit.zst */
+#define FORMAT_RICE 1   /* Rice tile compressed FITS file, .fit.fz */
 
 /* initialise the img processing component */
 int init_img_processing(void* args);
@@ -19,5 +63,33 @@ int init_img_processing(void* args);
  */
 int queue_image( char *filepath, int type);
 
+/* enqueue an image held in memory, see queue_image. The frame is released
+ * once the image has been compressed and stored. Returns ENOSPC if the
+ * queue is full, the frame then remains with the caller.
+ */
+int queue_frame(img_frame_t *frame, int type);
+
 /* Give the next startracker image a higher priority */
 void send_st(void);
+
+/* Select the storage format, FORMAT_ZSTD or FORMAT_RICE, of images held in
+ * memory. Images stored through files are always zstd compressed.
+ */
+void set_img_format(int format);
+
+/* Cut out a region of a stored Rice compressed NIR image and send it to
+ * ground. Only the tiles covering the region are decompressed.
+ * name is the file name of the image, without directory.
+ */
+int request_cutout(char *name, img_roi_t *roi);
+
+/* find_stars:
+ * Find the MAX_STARS brightest stars of an image, see find_stars_local.
+ */
+int find_stars(const unsigned short* img, int width, int height,
+        int big_endian, int binning, star_list_t* list);
+
+/* send_centroid_stats:
+ * Send the statistics of find_stars as telemetry.
+ */
+void send_centroid_stats(void);
@@ -0,0 +1,371 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Rice Codec
+ * Parent Component: Img Processing
+ * Author(s): 
+ * Purpose: Lossless compression of 16 bit images with the Rice algorithm, as
+ *          used by the RICE_1 FITS tile compression.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+#include "global_utils.h"
+#include "rice_codec.h"
+
+/* RICE_1 parameters for 16 bit pixels */
+#define FS_BITS 4
+#define FS_MAX 14
+#define PIX_BITS 16
+
+typedef struct{
+    unsigned char* out;
+    uint64_t acc;
+    int bits;
+} bit_writer_t;
+
+typedef struct{
+    const unsigned char* in;
+    const unsigned char* end;
+    uint64_t acc;
+    int bits;
+    int overrun;
+} bit_reader_t;
+
+static uint32_t residuals(const unsigned char* pix, int cnt,
+        unsigned short last, unsigned short* diff);
+static void put_bits(bit_writer_t* bw, uint32_t value, int n);
+static void put_unary(bit_writer_t* bw, uint32_t value);
+static size_t flush_bits(bit_writer_t* bw, unsigned char* start);
+static void refill(bit_reader_t* br);
+static uint32_t get_bits(bit_reader_t* br, int n);
+static int get_unary(bit_reader_t* br, uint32_t* value);
+
+/* rice_encode:
+ * Compress a tile of pixels. The output is identical to RICE_1 compressed
+ * FITS tiles with BLOCKSIZE 32 and BYTEPIX 2, and can be stored as such.
+ *
+ * input:
+ *      pix: pixels as big-endian 16 bit integers, as in a FITS file
+ *      n: number of pixels
+ *
+ * output:
+ *      out: compressed data, at least RICE_BOUND(n) bytes
+ *
+ * return:
+ *      size of the compressed data in bytes
+ */
+size_t rice_encode(const unsigned char* pix, int n, unsigned char* out){
+
+    bit_writer_t bw = {out, 0, 0};
+    unsigned short diff[RICE_BLOCK];
+
+    if(n <= 0){
+        return 0;
+    }
+
+    /* the first pixel is stored as is and is the start of the differences */
+    unsigned short last = pix[0] << 8 | pix[1];
+    put_bits(&bw, last, PIX_BITS);
+
+    for(int ii=0; ii<n; ii+=RICE_BLOCK){
+        int cnt = n - ii < RICE_BLOCK ? n - ii : RICE_BLOCK;
+
+        uint32_t sum = residuals(&pix[2*ii], cnt, last, diff);
+        last = pix[2*(ii+cnt-1)] << 8 | pix[2*(ii+cnt-1)+1];
+
+        /* number of low bits to split off, from the mean residual */
+        uint32_t mean = 0;
+        if(sum > (uint32_t)cnt/2 + 1){
+            mean = (sum - cnt/2 - 1) / cnt;
+        }
+        int fs = 0;
+        for(uint32_t psum = (unsigned short)mean >> 1; psum > 0; psum >>= 1){
+            ++fs;
+        }
+
+        if(fs >= FS_MAX){
+            /* high entropy, store the residuals as they are */
+            put_bits(&bw, FS_MAX + 1, FS_BITS);
+            for(int jj=0; jj<cnt; ++jj){
+                put_bits(&bw, diff[jj], PIX_BITS);
+            }
+        }
+        else if(fs == 0 && sum == 0){
+            /* constant block */
+            put_bits(&bw, 0, FS_BITS);
+        }
+        else{
+            put_bits(&bw, fs + 1, FS_BITS);
+            uint32_t mask = (1u << fs) - 1;
+            for(int jj=0; jj<cnt; ++jj){
+                put_unary(&bw, diff[jj] >> fs);
+                if(fs > 0){
+                    put_bits(&bw, diff[jj] & mask, fs);
+                }
+            }
+        }
+    }
+
+    return flush_bits(&bw, out);
+}
+
+/* rice_decode:
+ * Decompress a tile compressed with rice_encode.
+ *
+ * input:
+ *      in: compressed data
+ *      size: size of the compressed data in bytes
+ *      n: number of pixels
+ *
+ * output:
+ *      pix: pixels as big-endian 16 bit integers
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: the compressed data is corrupt or truncated
+ */
+int rice_decode(const unsigned char* in, size_t size, unsigned char* pix, int n){
+
+    bit_reader_t br = {in, in + size, 0, 0, 0};
+
+    if(n <= 0){
+        return SUCCESS;
+    }
+    if(size < 2){
+        return FAILURE;
+    }
+
+    unsigned short last = get_bits(&br, PIX_BITS);
+
+    for(int ii=0; ii<n; ii+=RICE_BLOCK){
+        int cnt = n - ii < RICE_BLOCK ? n - ii : RICE_BLOCK;
+        int fs = (int)get_bits(&br, FS_BITS) - 1;
+
+        for(int jj=ii; jj<ii+cnt; ++jj){
+            uint32_t diff = 0;
+
+            if(fs == FS_MAX){
+                diff = get_bits(&br, PIX_BITS);
+            }
+            else if(fs >= 0){
+                if(get_unary(&br, &diff)){
+                    return FAILURE;
+                }
+                diff <<= fs;
+                if(fs > 0){
+                    diff |= get_bits(&br, fs);
+                }
+            }
+
+            /* undo the folding of negative differences to odd numbers */
+            unsigned short d = (diff & 1) ? ~(diff >> 1) : diff >> 1;
+            last += d;
+
+            pix[2*jj] = last >> 8;
+            pix[2*jj+1] = last & 0xFF;
+        }
+    }
+
+    if(br.overrun){
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/* residuals:
+ * Calculate the differences between consecutive pixels of a block, folded
+ * so that small negative differences become small positive numbers
+ * (0, -1, 1, -2, ... to 0, 1, 2, 3, ...). Full blocks are handled with SSE2
+ * or NEON when available, giving the same result as the plain C version.
+ *
+ * input:
+ *      pix: big-endian pixels of the block
+ *      cnt: number of pixels in the block
+ *      last: the pixel preceding the block
+ *
+ * output:
+ *      diff: folded differences
+ *
+ * return:
+ *      sum of the folded differences
+ */
+static uint32_t residuals(const unsigned char* pix, int cnt,
+        unsigned short last, unsigned short* diff){
+
+    int jj = 0;
+    uint32_t sum = 0;
+
+    #if defined(__SSE2__)
+        if(cnt == RICE_BLOCK){
+            __m128i prev = _mm_set1_epi16(last);
+            for(; jj<RICE_BLOCK; jj+=8){
+                __m128i cur = _mm_loadu_si128((const __m128i*)&pix[2*jj]);
+                cur = _mm_or_si128(_mm_slli_epi16(cur, 8), _mm_srli_epi16(cur, 8));
+
+                /* previous pixel of each lane */
+                __m128i shifted = _mm_or_si128(_mm_slli_si128(cur, 2),
+                        _mm_srli_si128(prev, 14));
+                __m128i d = _mm_sub_epi16(cur, shifted);
+                d = _mm_xor_si128(_mm_slli_epi16(d, 1), _mm_srai_epi16(d, 15));
+
+                _mm_storeu_si128((__m128i*)&diff[jj], d);
+                prev = cur;
+            }
+        }
+    #elif defined(__ARM_NEON)
+        if(cnt == RICE_BLOCK){
+            uint16x8_t prev = vdupq_n_u16(last);
+            for(; jj<RICE_BLOCK; jj+=8){
+                uint16x8_t cur = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(&pix[2*jj])));
+
+                /* previous pixel of each lane */
+                uint16x8_t shifted = vextq_u16(prev, cur, 7);
+                int16x8_t d = vreinterpretq_s16_u16(vsubq_u16(cur, shifted));
+                d = veorq_s16(vshlq_n_s16(d, 1), vshrq_n_s16(d, 15));
+
+                vst1q_u16(&diff[jj], vreinterpretq_u16_s16(d));
+                prev = cur;
+            }
+        }
+    #endif
+
+    for(; jj<cnt; ++jj){
+        unsigned short cur = pix[2*jj] << 8 | pix[2*jj+1];
+        short d = (short)(cur - last);
+        diff[jj] = (unsigned short)(((unsigned)d << 1) ^ (d >> 15));
+        last = cur;
+    }
+
+    for(int ii=0; ii<cnt; ++ii){
+        sum += diff[ii];
+    }
+
+    return sum;
+}
+
+/* put_bits:
+ * Append the n, at most 32, lowest bits of value to the output.
+ */
+static void put_bits(bit_writer_t* bw, uint32_t value, int n){
+
+    bw->acc = (bw->acc << n) | value;
+    bw->bits += n;
+
+    if(bw->bits >= 32){
+        bw->bits -= 32;
+        uint32_t word = bw->acc >> bw->bits;
+        bw->out[0] = word >> 24;
+        bw->out[1] = word >> 16;
+        bw->out[2] = word >> 8;
+        bw->out[3] = word;
+        bw->out += 4;
+    }
+}
+
+/* put_unary:
+ * Append value as that many zero bits followed by a one.
+ */
+static void put_unary(bit_writer_t* bw, uint32_t value){
+
+    for(; value >= 32; value -= 32){
+        put_bits(bw, 0, 32);
+    }
+    put_bits(bw, 1, value + 1);
+}
+
+/* flush_bits:
+ * Write out the remaining bits, padded with zeros to a full byte.
+ *
+ * return:
+ *      total number of bytes written since start
+ */
+static size_t flush_bits(bit_writer_t* bw, unsigned char* start){
+
+    while(bw->bits > 0){
+        int shift = bw->bits - 8;
+        *bw->out++ = shift >= 0 ? bw->acc >> shift : bw->acc << -shift;
+        bw->bits -= 8;
+    }
+
+    return bw->out - start;
+}
+
+/* refill:
+ * Read whole bytes into the bit accumulator.
+ */
+static void refill(bit_reader_t* br){
+
+    while(br->bits <= 56){
+        if(br->in < br->end){
+            br->acc = (br->acc << 8) | *br->in++;
+            br->bits += 8;
+        }
+        else{
+            return;
+        }
+    }
+}
+
+/* get_bits:
+ * Read n, at most 32, bits. Past the end of the input zero bits are read
+ * and the overrun is flagged.
+ */
+static uint32_t get_bits(bit_reader_t* br, int n){
+
+    if(br->bits < n){
+        refill(br);
+    }
+
+    if(br->bits < n){
+        uint32_t value = (br->acc << (n - br->bits)) & ((1ull << n) - 1);
+        br->acc = 0;
+        br->bits = 0;
+        br->overrun = 1;
+        return value;
+    }
+
+    br->bits -= n;
+    return (br->acc >> br->bits) & ((1ull << n) - 1);
+}
+
+/* get_unary:
+ * Read a value stored as zero bits followed by a one.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: the input ended before the terminating one
+ */
+static int get_unary(bit_reader_t* br, uint32_t* value){
+
+    *value = 0;
+
+    while(1){
+        if(br->bits <= 0){
+            refill(br);
+            if(br->bits <= 0){
+                return FAILURE;
+            }
+        }
+
+        /* the unread bits, aligned to the top of the word */
+        uint64_t bits = br->acc << (64 - br->bits);
+        if(bits == 0){
+            *value += br->bits;
+            br->bits = 0;
+            continue;
+        }
+
+        int zeros = __builtin_clzll(bits);
+        *value += zeros;
+        br->bits -= zeros + 1;
+
+        return SUCCESS;
+    }
+}
@@ -0,0 +1,51 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Rice Codec
+ * Parent Component: Img Processing
+ * Author(s): 
+ * Purpose: Lossless compression of 16 bit images with the Rice algorithm, as
+ *          used by the RICE_1 FITS tile compression.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/* number of pixels sharing one split position */
+#define RICE_BLOCK 32
+
+/* worst case size in bytes of n compressed pixels */
+#define RICE_BOUND(n) (2*(n) + (n)/RICE_BLOCK + 4)
+
+/* rice_encode:
+ * Compress a tile of pixels. The output is identical to RICE_1 compressed
+ * FITS tiles with BLOCKSIZE 32 and BYTEPIX 2, and can be stored as such.
+ *
+ * input:
+ *      pix: pixels as big-endian 16 bit integers, as in a FITS file
+ *      n: number of pixels
+ *
+ * output:
+ *      out: compressed data, at least RICE_BOUND(n) bytes
+ *
+ * return:
+ *      size of the compressed data in bytes
+ */
+size_t rice_encode(const unsigned char* pix, int n, unsigned char* out);
+
+/* rice_decode:
+ * Decompress a tile compressed with rice_encode.
+ *
+ * input:
+ *      in: compressed data
+ *      size: size of the compressed data in bytes
+ *      n: number of pixels
+ *
+ * output:
+ *      pix: pixels as big-endian 16 bit integers
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: the compressed data is corrupt or truncated
+ */
+int rice_decode(const unsigned char* in, size_t size, unsigned char* pix, int n);
@@ -13,7 +13,6 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <pthread.h>
 #include <fcntl.h>
 #include <math.h>
@@ -23,6 +22,7 @@
 #include "e_link.h"
 #include "global_utils.h"
 #include "gpio.h"
+#include "hal.h"
 #include "i2c.h"
 #include "img_processing.h"
 #include "mode.h"
@@ -33,7 +33,7 @@
 #include "watchdog.h"
 
 /* not including init */
-#define MODULE_COUNT 13
+#define MODULE_COUNT 14
 
 static int init_func(char* const argv[]);
 static void check_flags(void);
@@ -56,6 +56,7 @@ static char stderr_buf[4096];
 static const module_init_t init_sequence[MODULE_COUNT] = {
     {"watchdog", &init_watchdog},
     {"mode", &init_mode},
+    {"hal", &init_hal},
     {"gpio", &init_gpio},
     {"i2c", &init_i2c},
     {"camera", &init_camera},
@@ -85,14 +86,6 @@ static void sigint_handler(int signum){
     close_socket();
     write(STDOUT_FILENO, "elink socket closed\n", 20);
 
-    pid_t st_pid = get_star_tracker_pid();
-    if(st_pid != FAILURE){
-        kill(st_pid, SIGKILL);
-        write(STDOUT_FILENO, "SIGKILL sent to star tracker\n", 29);
-        waitpid(st_pid, NULL, 0);
-        write(STDOUT_FILENO, "exiting\n\n", 9);
-    }
-
     _exit(EXIT_SUCCESS);
 }
 
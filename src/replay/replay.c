@@ -0,0 +1,578 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Replay
+ * Author(s): 
+ * Purpose: Run the kalman filter and pid controller offline on recorded
+ *          sensor logs, as a regression test and benchmark of the control
+ *          chain without hardware. Built as irisc-replay.
+ * -----------------------------------------------------------------------------
+ */
+
+/**
+ * usage: irisc-replay [-o out_dir] [-d YYYY-MM-DD] [-l st_latency] [-v] log_dir
+ *
+ * log_dir holds the logs of a run, as in output/logs/: gyro and encoder as
+ * .bin or .log, star_tracker.log, gps.log and tracking.log. Only the gyro
+ * log is required. Each gyro record is one step of the control loop, as in
+ * flight: the records of the other logs up to its time are applied, then
+ * kf_update and pid_update run. The time of the records is the time of the
+ * components built for the replay, so a replay gives the same output every
+ * time, and runs as fast as the filter and controller allow.
+ *
+ *      -o  directory for the output, default replay/. The logs of the filter
+ *          and controller are written to output/logs/ in it, the same as in
+ *          flight, and output/logs/replay.bin has the estimate, target and
+ *          motor steps of every step.
+ *      -d  local date the csv logs start on. Without it, the date of the
+ *          first record of a binary log is used.
+ *      -l  seconds from the middle of a star tracker exposure to its log
+ *          line, which has no time stamps of the exposure, default 0.
+ *      -v  print debug messages
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "global_utils.h"
+#include "binlog.h"
+#include "mode.h"
+#include "sensors.h"
+#include "control_sys.h"
+#include "current_target.h"
+#include "kalman_filter.h"
+#include "pid.h"
+#include "telemetry.h"
+#include "camera.h"
+#include "replay.h"
+#include "replay_log.h"
+#include "sample_ring.h"
+
+#define SRC_GYRO 0
+#define SRC_ENCODER 1
+#define SRC_ST 2
+#define SRC_GPS 3
+#define SRC_TRACKING 4
+#define SRC_COUNT 5
+
+/* encoder records kept for looking them up by time */
+#define ENCODER_RING_SIZE 64
+
+typedef struct{
+    const char* name;
+    int n_values;           /* values used from each record */
+    replay_log_t* log;
+    long long time;         /* of the record read ahead, -1 at the end */
+    double values[REPLAY_MAX_VALUES];
+} source_t;
+
+static int open_sources(const char* log_dir, long long day_ns);
+static long long day_start(long long time_ns);
+static int read_ahead(source_t* src);
+static void apply(int src_id, const double* values, long long time_ns);
+static int make_dirs(const char* out_dir);
+
+static source_t sources[SRC_COUNT] = {
+    {"gyro", 3},
+    {"encoder", 2},
+    {"star_tracker", 3},
+    {"gps", 3},
+    {"tracking", 2}
+};
+
+static char top_dir[100];
+static struct timespec now;
+static int verbose = 0;
+static double st_latency = 0;
+
+/* the latest sensor data, gyro and st until they are drained */
+static gyro_t gyro = {.out_of_date = 1};
+static encoder_t encoder = {.out_of_date = 1};
+static star_tracker_t st = {.out_of_date = 1};
+static gps_t gps = {.out_of_date = 1};
+static int gyro_new = 0;
+
+static encoder_t encoder_samples[ENCODER_RING_SIZE];
+static sample_slot_t encoder_slots[ENCODER_RING_SIZE];
+static sample_ring_t ring_encoder =
+    SAMPLE_RING_INITIALIZER("encoder", encoder_samples, encoder_slots,
+            sizeof(encoder_t), ENCODER_RING_SIZE);
+
+int main(int argc, char* const argv[]){
+
+    const char* out_dir = "replay";
+    long long day_ns = -1;
+    int opt;
+
+    while((opt = getopt(argc, argv, "o:d:l:v")) != -1){
+        switch(opt){
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 'd': {
+                struct tm date = {.tm_isdst = -1};
+                if(sscanf(optarg, "%d-%d-%d", &date.tm_year, &date.tm_mon,
+                            &date.tm_mday) != 3){
+                    fprintf(stderr, "Invalid date %s, use YYYY-MM-DD\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                date.tm_year -= 1900;
+                date.tm_mon -= 1;
+                day_ns = mktime(&date) * 1000000000LL;
+                break;
+            }
+            case 'l':
+                st_latency = atof(optarg);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-o out_dir] [-d YYYY-MM-DD] "
+                        "[-l st_latency] [-v] log_dir\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(optind != argc - 1){
+        fprintf(stderr, "usage: %s [-o out_dir] [-d YYYY-MM-DD] "
+                "[-l st_latency] [-v] log_dir\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if(open_sources(argv[optind], day_ns)){
+        return EXIT_FAILURE;
+    }
+
+    snprintf(top_dir, sizeof(top_dir), "%s/", out_dir);
+    if(make_dirs(out_dir)){
+        return EXIT_FAILURE;
+    }
+
+    /* the components of the control chain, in flight order */
+    static const module_init_t init_sequence[3] = {
+        {"current_target", &init_current_target},
+        {"kalman_filter", &init_kalman_filter},
+        {"pid", &init_pid}
+    };
+
+    /* the first record sets the time the components start at */
+    now.tv_sec = sources[SRC_GYRO].time / 1000000000;
+    now.tv_nsec = sources[SRC_GYRO].time % 1000000000;
+
+    if(init_submodules(init_sequence, 3)){
+        return EXIT_FAILURE;
+    }
+
+    char out_fn[150];
+    snprintf(out_fn, sizeof(out_fn), "%soutput/logs/replay.bin", top_dir);
+    const binlog_col_t cols[] = {
+        {"az", BINLOG_DOUBLE}, {"alt", BINLOG_DOUBLE},
+        {"target az", BINLOG_DOUBLE}, {"target alt", BINLOG_DOUBLE},
+        {"motor az", BINLOG_INT}, {"motor alt", BINLOG_INT}
+    };
+    binlog_t* out_log = binlog_open(out_fn, cols, 6);
+    if(out_log == NULL){
+        return EXIT_FAILURE;
+    }
+
+    long steps = 0, fixes = 0;
+    double kf_ns = 0, pid_ns = 0, kf_max = 0, pid_max = 0;
+    telescope_att_t att;
+    motor_step_t motor_out;
+
+    source_t* gyro_src = &sources[SRC_GYRO];
+
+    while(gyro_src->time >= 0){
+
+        long long time = gyro_src->time;
+        now.tv_sec = time / 1000000000;
+        now.tv_nsec = time % 1000000000;
+
+        /* the other sensors up to this step */
+        for(int ii=SRC_ENCODER; ii<SRC_COUNT; ++ii){
+            while(sources[ii].time >= 0 && sources[ii].time <= time){
+                apply(ii, sources[ii].values, sources[ii].time);
+                if(ii == SRC_ST){
+                    fixes++;
+                }
+                if(read_ahead(&sources[ii])){
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+
+        apply(SRC_GYRO, gyro_src->values, time);
+        if(read_ahead(gyro_src)){
+            return EXIT_FAILURE;
+        }
+
+        /* the control loop, timed */
+        struct timespec t0, t1, t2;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        kf_update(&att);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        pid_update(&att, &motor_out);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        double kf_step = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+        double pid_step = (t2.tv_sec - t1.tv_sec) * 1e9 + (t2.tv_nsec - t1.tv_nsec);
+        kf_ns += kf_step;
+        pid_ns += pid_step;
+        kf_max = kf_step > kf_max ? kf_step : kf_max;
+        pid_max = pid_step > pid_max ? pid_step : pid_max;
+
+        double target_az, target_alt;
+        get_tracking_angles(&target_az, &target_alt);
+        binlog_write(out_log, att.az, att.alt, target_az, target_alt,
+                motor_out.az, motor_out.alt);
+
+        binlog_drain();
+        steps++;
+    }
+
+    binlog_flush();
+
+    if(steps == 0){
+        logging(ERROR, "Replay", "No gyro records to replay");
+        return EXIT_FAILURE;
+    }
+
+    printf("steps: %ld, star tracker fixes: %ld\n", steps, fixes);
+    printf("kf_update: %.1f ns per step, worst %.0f ns\n", kf_ns / steps, kf_max);
+    printf("pid_update: %.1f ns per step, worst %.0f ns\n", pid_ns / steps, pid_max);
+    printf("final estimate: az %.9f alt %.9f\n", att.az, att.alt);
+    if(binlog_dropped()){
+        printf("records dropped: %lu\n", binlog_dropped());
+    }
+
+    for(int ii=0; ii<SRC_COUNT; ++ii){
+        replay_log_close(sources[ii].log);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+void replay_time(struct timespec* ts){
+    *ts = now;
+}
+
+/* open_sources:
+ * Open the logs in log_dir, binary logs before csv logs of the same sensor,
+ * and read the first record of each.
+ */
+static int open_sources(const char* log_dir, long long day_ns){
+
+    char fn[200];
+
+    /* binary logs first, they give the day of the csv logs */
+    for(int ii=0; ii<SRC_COUNT; ++ii){
+        snprintf(fn, sizeof(fn), "%s/%s.bin", log_dir, sources[ii].name);
+        sources[ii].log = replay_log_open(fn, 0);
+        if(sources[ii].log == NULL && errno != ENOENT){
+            return FAILURE;
+        }
+
+        long long first;
+        if(sources[ii].log != NULL && day_ns < 0 &&
+                replay_log_first_time(sources[ii].log, &first) == SUCCESS){
+            day_ns = day_start(first);
+        }
+    }
+
+    for(int ii=0; ii<SRC_COUNT; ++ii){
+        if(sources[ii].log != NULL){
+            continue;
+        }
+
+        snprintf(fn, sizeof(fn), "%s/%s.log", log_dir, sources[ii].name);
+        if(access(fn, R_OK)){
+            continue;
+        }
+        if(day_ns < 0){
+            logging(ERROR, "Replay", "No date for %s, give it with -d", fn);
+            return FAILURE;
+        }
+
+        sources[ii].log = replay_log_open(fn, day_ns);
+        if(sources[ii].log == NULL){
+            logging(ERROR, "Replay", "Failed to open %s: %m", fn);
+            return FAILURE;
+        }
+    }
+
+    if(sources[SRC_GYRO].log == NULL){
+        logging(ERROR, "Replay", "No gyro log in %s", log_dir);
+        return FAILURE;
+    }
+
+    for(int ii=0; ii<SRC_COUNT; ++ii){
+        sources[ii].time = -1;
+        if(sources[ii].log == NULL){
+            logging(WARN, "Replay", "No %s log, replaying without it",
+                    sources[ii].name);
+            continue;
+        }
+        if(read_ahead(&sources[ii])){
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/* day_start:
+ * CLOCK_REALTIME of the local midnight before a time, unit: nanoseconds
+ */
+static long long day_start(long long time_ns){
+
+    time_t sec = time_ns / 1000000000;
+    struct tm day;
+
+    localtime_r(&sec, &day);
+    day.tm_hour = 0;
+    day.tm_min = 0;
+    day.tm_sec = 0;
+    day.tm_isdst = -1;
+
+    return mktime(&day) * 1000000000LL;
+}
+
+/* read_ahead:
+ * Read the next record of a source, time is -1 at the end of its log.
+ */
+static int read_ahead(source_t* src){
+
+    int n = replay_log_next(src->log, &src->time, src->values);
+    if(n == 0){
+        src->time = -1;
+        return SUCCESS;
+    }
+    if(n < src->n_values){
+        logging(ERROR, "Replay", "%s log has %d values per record, %d needed",
+                src->name, n, src->n_values);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/* apply:
+ * Make a record the latest data of its sensor.
+ */
+static void apply(int src_id, const double* values, long long time_ns){
+
+    switch(src_id){
+        case SRC_GYRO:
+            gyro.x = values[0];
+            gyro.y = values[1];
+            gyro.z = values[2];
+            gyro.time.tv_sec = time_ns / 1000000000;
+            gyro.time.tv_nsec = time_ns % 1000000000;
+            gyro.out_of_date = 0;
+            gyro_new = 1;
+            break;
+        case SRC_ENCODER:
+            encoder.az = values[0];
+            encoder.alt_ang = values[1];
+            encoder.time.tv_sec = time_ns / 1000000000;
+            encoder.time.tv_nsec = time_ns % 1000000000;
+            encoder.out_of_date = 0;
+            sample_ring_push(&ring_encoder, &encoder, &encoder.time);
+            break;
+        case SRC_ST: {
+            long long mid = time_ns - llround(st_latency * 1e9);
+            st.ra = values[0];
+            st.dec = values[1];
+            st.roll = values[2];
+            st.exp_start.tv_sec = mid / 1000000000;
+            st.exp_start.tv_nsec = mid % 1000000000;
+            st.exp_end = st.exp_start;
+            st.out_of_date = 0;
+            st.new_data = 1;
+            break;
+        }
+        case SRC_GPS:
+            gps.lat = values[0];
+            gps.lon = values[1];
+            gps.alt = values[2];
+            gps.out_of_date = 0;
+            break;
+        case SRC_TRACKING:
+            set_tracking_angles(values[0], values[1]);
+            break;
+    }
+}
+
+/* make_dirs:
+ * Create the directories the logs of the components are written to.
+ */
+static int make_dirs(const char* out_dir){
+
+    const char* dirs[] = {"", "output", "output/logs", "output/logs/kf",
+            "output/logs/kf/az", "output/logs/kf/alt"};
+    char path[150];
+
+    for(unsigned int ii=0; ii<sizeof(dirs)/sizeof(dirs[0]); ++ii){
+        snprintf(path, sizeof(path), "%s/%s", out_dir, dirs[ii]);
+        if(mkdir(path, 0755) && errno != EEXIST){
+            logging(ERROR, "Replay", "Failed to create %s: %m", path);
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/*******************************************************************************
+ * The interfaces the control chain uses, in place of the components that are
+ * not part of the replay.
+ ******************************************************************************/
+
+int drain_gyro(gyro_t* samples, int max){
+
+    if(!gyro_new || max < 1){
+        return 0;
+    }
+
+    samples[0] = gyro;
+    gyro_new = 0;
+    return 1;
+}
+
+void get_encoder(encoder_t* data){
+    *data = encoder;
+}
+
+/* the same interpolation as the encoder component, on the records */
+int get_encoder_at(const struct timespec* time, encoder_t* data){
+
+    encoder_t before, after;
+    double frac;
+
+    if(sample_ring_at(&ring_encoder, time, &before, &after, &frac)){
+        data->out_of_date = 1;
+        return ENODATA;
+    }
+
+    *data = before;
+    data->az = before.az + (after.az - before.az) * frac;
+    data->alt_ang = before.alt_ang + (after.alt_ang - before.alt_ang) * frac;
+    if(frac > 0){
+        data->time = *time;
+    }
+
+    return SUCCESS;
+}
+
+void get_gps(gps_t* data){
+    *data = gps;
+}
+
+int drain_star_tracker(star_tracker_t* data, int max){
+
+    if(!st.new_data || max < 1){
+        return 0;
+    }
+
+    data[0] = st;
+    st.new_data = 0;
+    return 1;
+}
+
+const char* const get_top_dir(void){
+    return top_dir;
+}
+
+int init_submodules(const module_init_t* init_sequence, int module_count){
+
+    for(int ii=0; ii<module_count; ++ii){
+        int ret = init_sequence[ii].init(NULL);
+        if(ret != SUCCESS){
+            logging(ERROR, "Replay", "Failed to initialise %s: %d",
+                    init_sequence[ii].name, ret);
+            return ret;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/* messages are written right away, stamped with the replay time */
+int logging(int level, const char* module_name, const char* format, ...){
+
+    static const char* levels[] = {"DEBUG", "INFO", "WARN", "ERROR", "CRIT"};
+
+    if(level == DEBUG && !verbose){
+        return SUCCESS;
+    }
+
+    struct tm local;
+    localtime_r(&now.tv_sec, &local);
+
+    fprintf(stderr, "%02d:%02d:%02d.%03ld | %5.5s | %10.10s | ",
+            local.tm_hour, local.tm_min, local.tm_sec, now.tv_nsec / 1000000,
+            levels[level], module_name);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+
+    fputc('\n', stderr);
+
+    return SUCCESS;
+}
+
+void logging_csv(FILE* stream, const char* format, ...){
+
+    struct tm local;
+    localtime_r(&now.tv_sec, &local);
+
+    fprintf(stream, "%02d:%02d:%02d.%03ld,",
+            local.tm_hour, local.tm_min, local.tm_sec, now.tv_nsec / 1000000);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stream, format, args);
+    va_end(args);
+
+    fputc('\n', stream);
+}
+
+/* nothing runs in threads in the replay */
+int create_thread(char* comp_name, void* (*thread_func)(void*), int prio){
+    logging(ERROR, "Replay", "No threads in the replay, %s not started", comp_name);
+    return ENOSYS;
+}
+
+int send_telemetry(char* filepath, int p, int flag, unsigned short packets_sent){
+    return SUCCESS;
+}
+
+char get_mode(void){
+    return NORMAL;
+}
+
+void move_alt_to(double target){
+}
+
+int expose_nir(int exp, int gain){
+    return ENODEV;
+}
+
+int save_img_nir(void){
+    return ENODEV;
+}
+
+int abort_exp_nir(void){
+    return ENODEV;
+}
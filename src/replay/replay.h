@@ -0,0 +1,19 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Replay
+ * Author(s): 
+ * Purpose: Run the kalman filter and pid controller offline on recorded
+ *          sensor logs, as a regression test and benchmark of the control
+ *          chain without hardware. Built as irisc-replay.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <time.h>
+
+/* replay_time:
+ * The recorded time of the sample being replayed. Components built for the
+ * replay (REPLAY defined) use it in place of CLOCK_REALTIME and
+ * CLOCK_MONOTONIC, which keeps the replay deterministic.
+ */
+void replay_time(struct timespec* ts);
@@ -0,0 +1,239 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Replay Log
+ * Parent Component: Replay
+ * Author(s): 
+ * Purpose: Read recorded sensor logs, binary logs written by binlog or csv
+ *          logs written by logging_csv, as time stamped records.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global_utils.h"
+#include "binlog.h"
+#include "replay_log.h"
+
+/* the binary log header, see binlog.h */
+#define BIN_HEADER_SIZE 24
+#define BIN_COL_SIZE 32
+#define BIN_NAME_SIZE 24
+
+#define DAY_NS (24 * 3600 * 1000000000LL)
+
+struct replay_log{
+    FILE* file;
+    char path[100];
+    int binary;
+
+    /* binary logs */
+    int n_cols;
+    char types[REPLAY_MAX_VALUES];
+    size_t record_size;
+    long header_size;
+
+    /* csv logs */
+    long long day_ns;
+    long long last_tod;
+};
+
+static int read_bin_header(replay_log_t* log);
+static int next_bin(replay_log_t* log, long long* time_ns, double* values);
+static int next_csv(replay_log_t* log, long long* time_ns, double* values);
+
+replay_log_t* replay_log_open(const char* path, long long day_ns){
+
+    replay_log_t* log = calloc(1, sizeof(*log));
+    if(log == NULL){
+        logging(ERROR, "Replay", "Failed to allocate log %s", path);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    log->file = fopen(path, "r");
+    if(log->file == NULL){
+        int err = errno;
+        free(log);
+        errno = err;
+        return NULL;
+    }
+
+    strncpy(log->path, path, sizeof(log->path) - 1);
+    log->day_ns = day_ns;
+
+    size_t len = strlen(path);
+    log->binary = len > 4 && !strcmp(&path[len - 4], ".bin");
+
+    if(log->binary && read_bin_header(log)){
+        fclose(log->file);
+        free(log);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return log;
+}
+
+int replay_log_next(replay_log_t* log, long long* time_ns, double* values){
+
+    if(log->binary){
+        return next_bin(log, time_ns, values);
+    }
+    return next_csv(log, time_ns, values);
+}
+
+int replay_log_first_time(replay_log_t* log, long long* time_ns){
+
+    int64_t time;
+
+    if(!log->binary ||
+            fseek(log->file, log->header_size, SEEK_SET) ||
+            fread(&time, sizeof(time), 1, log->file) != 1 ||
+            fseek(log->file, log->header_size, SEEK_SET)){
+        return FAILURE;
+    }
+
+    *time_ns = time;
+    return SUCCESS;
+}
+
+void replay_log_close(replay_log_t* log){
+
+    if(log == NULL){
+        return;
+    }
+    fclose(log->file);
+    free(log);
+}
+
+static int read_bin_header(replay_log_t* log){
+
+    unsigned char header[BIN_HEADER_SIZE + BIN_COL_SIZE*BINLOG_MAX_COLS];
+    uint32_t byte_order, record_size, header_size;
+    uint16_t version, n_cols;
+
+    if(fread(header, 1, BIN_HEADER_SIZE, log->file) != BIN_HEADER_SIZE ||
+            memcmp(header, "IRISCBL", 8)){
+        logging(ERROR, "Replay", "%s is not a binary log", log->path);
+        return FAILURE;
+    }
+
+    memcpy(&byte_order, &header[8], 4);
+    memcpy(&version, &header[12], 2);
+    memcpy(&n_cols, &header[14], 2);
+    memcpy(&record_size, &header[16], 4);
+    memcpy(&header_size, &header[20], 4);
+
+    if(byte_order != 0x01020304 || version != 1){
+        logging(ERROR, "Replay", "%s has another byte order or version, "
+                "convert it with binlog_to_csv.py", log->path);
+        return FAILURE;
+    }
+    if(n_cols < 1 || n_cols > BINLOG_MAX_COLS || n_cols > REPLAY_MAX_VALUES ||
+            header_size != BIN_HEADER_SIZE + BIN_COL_SIZE*n_cols){
+        logging(ERROR, "Replay", "%s has a corrupt header", log->path);
+        return FAILURE;
+    }
+
+    size_t cols_size = BIN_COL_SIZE*n_cols;
+    if(fread(&header[BIN_HEADER_SIZE], 1, cols_size, log->file) != cols_size){
+        logging(ERROR, "Replay", "%s has a corrupt header", log->path);
+        return FAILURE;
+    }
+
+    size_t size = sizeof(int64_t);
+    for(int ii=0; ii<n_cols; ++ii){
+        char type = header[BIN_HEADER_SIZE + BIN_COL_SIZE*ii + BIN_NAME_SIZE];
+        if(type != BINLOG_DOUBLE && type != BINLOG_INT){
+            logging(ERROR, "Replay", "%s has an unknown column type", log->path);
+            return FAILURE;
+        }
+        log->types[ii] = type;
+        size += type == BINLOG_INT ? sizeof(int32_t) : sizeof(double);
+    }
+
+    if(size != record_size){
+        logging(ERROR, "Replay", "%s has a corrupt header", log->path);
+        return FAILURE;
+    }
+
+    log->n_cols = n_cols;
+    log->record_size = record_size;
+    log->header_size = header_size;
+
+    return SUCCESS;
+}
+
+static int next_bin(replay_log_t* log, long long* time_ns, double* values){
+
+    unsigned char record[sizeof(int64_t) + sizeof(double)*BINLOG_MAX_COLS];
+
+    /* a record cut short ends the log */
+    if(fread(record, 1, log->record_size, log->file) != log->record_size){
+        return 0;
+    }
+
+    int64_t time;
+    memcpy(&time, record, sizeof(time));
+    *time_ns = time;
+
+    unsigned char* pos = record + sizeof(time);
+    for(int ii=0; ii<log->n_cols; ++ii){
+        if(log->types[ii] == BINLOG_INT){
+            int32_t value;
+            memcpy(&value, pos, sizeof(value));
+            values[ii] = value;
+            pos += sizeof(value);
+        } else {
+            memcpy(&values[ii], pos, sizeof(double));
+            pos += sizeof(double);
+        }
+    }
+
+    return log->n_cols;
+}
+
+static int next_csv(replay_log_t* log, long long* time_ns, double* values){
+
+    char line[512];
+
+    while(fgets(line, sizeof(line), log->file) != NULL){
+
+        int hour, min, sec, msec, pos;
+        if(sscanf(line, "%d:%d:%d.%d%n", &hour, &min, &sec, &msec, &pos) != 4){
+            continue;
+        }
+
+        long long tod = ((hour*60LL + min)*60 + sec)*1000000000LL + msec*1000000LL;
+
+        /* past midnight */
+        if(tod < log->last_tod - DAY_NS/2){
+            log->day_ns += DAY_NS;
+        }
+        log->last_tod = tod;
+
+        int n_values = 0;
+        char* field = &line[pos];
+        while(*field == ',' && n_values < REPLAY_MAX_VALUES){
+            char* end;
+            values[n_values] = strtod(field + 1, &end);
+            if(end == field + 1){
+                break;
+            }
+            n_values++;
+            field = end;
+        }
+
+        if(n_values == 0){
+            continue;
+        }
+
+        *time_ns = log->day_ns + tod;
+        return n_values;
+    }
+
+    return 0;
+}
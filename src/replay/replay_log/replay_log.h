@@ -0,0 +1,52 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Replay Log
+ * Parent Component: Replay
+ * Author(s): 
+ * Purpose: Read recorded sensor logs, binary logs written by binlog or csv
+ *          logs written by logging_csv, as time stamped records.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#define REPLAY_MAX_VALUES 16
+
+typedef struct replay_log replay_log_t;
+
+/* replay_log_open:
+ * Open a recorded log. Files ending in .bin are read as binary logs, other
+ * files as csv lines starting with the local time of day.
+ *
+ * input:
+ *      path: the log file
+ *      day_ns: CLOCK_REALTIME of the local midnight starting the day the
+ *              csv log was recorded, unused for binary logs
+ *
+ * return:
+ *      the log, NULL on failure with errno set and a log written
+ */
+replay_log_t* replay_log_open(const char* path, long long day_ns);
+
+/* replay_log_next:
+ * Read the next record. Times of csv logs continue on the next day when
+ * they go back more than 12 hours.
+ *
+ * output:
+ *      time_ns: CLOCK_REALTIME of the record in nanoseconds
+ *      values: the values of the record, at most REPLAY_MAX_VALUES
+ *
+ * return:
+ *      the number of values read, 0 at the end of the log
+ */
+int replay_log_next(replay_log_t* log, long long* time_ns, double* values);
+
+/* replay_log_first_time:
+ * Get the time of the first record of a binary log without consuming it.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: not a binary log or no records
+ */
+int replay_log_first_time(replay_log_t* log, long long* time_ns);
+
+void replay_log_close(replay_log_t* log);
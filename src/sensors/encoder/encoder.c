@@ -8,58 +8,84 @@
  */
 
 #include <pthread.h>
+#include <errno.h>
 
 #include "global_utils.h"
+#include "seq_store.h"
+#include "sample_ring.h"
 #include "sensors.h"
 #include "encoder.h"
 
-static pthread_mutex_t mutex_encoder;
-static encoder_t encoder_local;
+/* samples kept for looking up by time, 0.64 s at 100 Hz */
+#define ENCODER_RING_SIZE 64
 
-int init_encoder(void* args){
+static encoder_t encoder_local[2] = {{.out_of_date = 1}, {.out_of_date = 1}};
+
+static encoder_t encoder_samples[ENCODER_RING_SIZE];
+static sample_slot_t encoder_slots[ENCODER_RING_SIZE];
 
-    encoder_local.az = 0;
-    encoder_local.alt_ang = 0;
-    encoder_local.out_of_date = 1;
+static seq_store_t store_encoder =
+    SEQ_STORE_INITIALIZER("encoder", encoder_local, sizeof(encoder_t));
+static sample_ring_t ring_encoder =
+    SAMPLE_RING_INITIALIZER("encoder", encoder_samples, encoder_slots,
+            sizeof(encoder_t), ENCODER_RING_SIZE);
+
+int init_encoder(void* args){
 
-    int ret = pthread_mutex_init( &mutex_encoder, NULL );
-    if( ret ){
-        logging(ERROR, "INIT",
-                "The initialisation of the encoder mutex failed with code %d.\n",
-                ret);
-        return FAILURE;
+    int ret = seq_store_register(&store_encoder);
+    if(ret != SUCCESS){
+        return ret;
     }
 
-    return SUCCESS;
+    return sample_ring_register(&ring_encoder);
 }
 
 void get_encoder_local(encoder_t* encoder){
 
-    pthread_mutex_lock(&mutex_encoder);
-
-    encoder->az = encoder_local.az;
-    encoder->alt_ang = encoder_local.alt_ang;
-    encoder->out_of_date = encoder_local.out_of_date;
+    seq_sample_t sample;
+    seq_store_read(&store_encoder, encoder, &sample);
 
-    pthread_mutex_unlock(&mutex_encoder);
+    encoder->time = sample.time;
+    encoder->seq = sample.seq;
 }
 
 void set_encoder(encoder_t* encoder){
 
-    pthread_mutex_lock(&mutex_encoder);
+    encoder_t new = *encoder;
+    new.out_of_date = 0;
+
+    /* the sample is stamped with the time of the spi transfers */
+    seq_store_write(&store_encoder, &new, &encoder->time);
+    sample_ring_push(&ring_encoder, &new, &encoder->time);
+}
+
+int get_encoder_at_l(const struct timespec* time, encoder_t* encoder){
 
-    encoder_local.az = encoder->az;
-    encoder_local.alt_ang = encoder->alt_ang;
-    encoder_local.out_of_date = 0;
+    encoder_t before, after;
+    double frac;
+
+    if(sample_ring_at(&ring_encoder, time, &before, &after, &frac)){
+        encoder->out_of_date = 1;
+        return ENODATA;
+    }
 
-    pthread_mutex_unlock(&mutex_encoder);
+    /* the angles are continuous between two samples 10 ms apart */
+    *encoder = before;
+    encoder->az = before.az + (after.az - before.az) * frac;
+    encoder->alt_ang = before.alt_ang + (after.alt_ang - before.alt_ang) * frac;
+    if(frac > 0){
+        encoder->time = *time;
+    }
+
+    return SUCCESS;
 }
 
 void encoder_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_encoder);
+    encoder_t encoder;
+    seq_store_read(&store_encoder, &encoder, NULL);
 
-    encoder_local.out_of_date = 1;
+    encoder.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_encoder);
+    seq_store_write(&store_encoder, &encoder, NULL);
 }
@@ -17,5 +17,8 @@ void get_encoder_local(encoder_t* encoder);
 /* update the encoder data */
 void set_encoder(encoder_t* encoder);
 
+/* interpolate the encoder data to a time */
+int get_encoder_at_l(const struct timespec* time, encoder_t* encoder);
+
 /* set the out of date flag on the encoder data */
 void encoder_out_of_date(void);
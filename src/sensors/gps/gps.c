@@ -9,60 +9,45 @@
 #include <pthread.h>
 
 #include "global_utils.h"
+#include "seq_store.h"
 #include "sensors.h"
 #include "gps.h"
 
-static pthread_mutex_t mutex_gps;
-static gps_t gps_local;
+static gps_t gps_local[2] = {{.out_of_date = 1}, {.out_of_date = 1}};
 
+static seq_store_t store_gps =
+    SEQ_STORE_INITIALIZER("gps", gps_local, sizeof(gps_t));
 
 int init_gps(void* args){
-
-    gps_local.lat = 0;
-    gps_local.lon = 0;
-    gps_local.alt = 0;
-    gps_local.out_of_date = 1;
-
-    int ret = pthread_mutex_init( &mutex_gps, NULL );
-    if( ret ){
-        logging(ERROR, "GPS",
-                "The initialisation of the gps mutex failed with code %d.\n",
-                ret);
-        return FAILURE;
-    }
-
-    return SUCCESS;
+    return seq_store_register(&store_gps);
 }
 
 void get_gps_local(gps_t* gps){
 
-    pthread_mutex_lock(&mutex_gps);
-
-    gps->lat = gps_local.lat;
-    gps->lon = gps_local.lon;
-    gps->alt = gps_local.alt;
-    gps->out_of_date = gps_local.out_of_date;
+    seq_sample_t sample;
+    seq_store_read(&store_gps, gps, &sample);
 
-    pthread_mutex_unlock(&mutex_gps);
+    gps->time = sample.time;
+    gps->seq = sample.seq;
 }
 
 void set_gps(gps_t* gps){
 
-    pthread_mutex_lock(&mutex_gps);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    gps_local.lat = gps->lat;
-    gps_local.lon = gps->lon;
-    gps_local.alt = gps->alt;
-    gps_local.out_of_date = 0;
+    gps_t new = *gps;
+    new.out_of_date = 0;
 
-    pthread_mutex_unlock(&mutex_gps);
+    seq_store_write(&store_gps, &new, &now);
 }
 
 void gps_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_gps);
+    gps_t gps;
+    seq_store_read(&store_gps, &gps, NULL);
 
-    gps_local.out_of_date = 1;
+    gps.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_gps);
+    seq_store_write(&store_gps, &gps, NULL);
 }
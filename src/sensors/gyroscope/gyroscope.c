@@ -11,68 +11,101 @@
 #include <string.h>
 
 #include "global_utils.h"
+#include "seq_store.h"
+#include "sample_ring.h"
 #include "sensors.h"
 #include "gyroscope.h"
 
-static pthread_mutex_t mutex_gyro = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t mutex_gyro_temp = PTHREAD_MUTEX_INITIALIZER;
-static gyro_t gyro_local;
-static double gyro_temp;
+/* samples kept for the kalman filter, 0.64 s at 100 Hz */
+#define GYRO_RING_SIZE 64
+
+static gyro_t gyro_local[2] = {{.out_of_date = 1}, {.out_of_date = 1}};
+static double gyro_temp[2];
+
+static gyro_t gyro_samples[GYRO_RING_SIZE];
+static sample_slot_t gyro_slots[GYRO_RING_SIZE];
+
+static seq_store_t store_gyro =
+    SEQ_STORE_INITIALIZER("gyro", gyro_local, sizeof(gyro_t));
+static seq_store_t store_gyro_temp =
+    SEQ_STORE_INITIALIZER("gyro_temp", gyro_temp, sizeof(double));
+static sample_ring_t ring_gyro =
+    SAMPLE_RING_INITIALIZER("gyro", gyro_samples, gyro_slots, sizeof(gyro_t),
+            GYRO_RING_SIZE);
 
 int init_gyroscope(void* args){
 
-    gyro_local.x = 0;
-    gyro_local.y = 0;
-    gyro_local.z = 0;
-    gyro_local.out_of_date = 1;
+    int ret = seq_store_register(&store_gyro);
+    if(ret != SUCCESS){
+        return ret;
+    }
 
-    return SUCCESS;
+    ret = seq_store_register(&store_gyro_temp);
+    if(ret != SUCCESS){
+        return ret;
+    }
+
+    return sample_ring_register(&ring_gyro);
 }
 
 void get_gyro_local(gyro_t* gyro){
 
-    pthread_mutex_lock(&mutex_gyro);
+    seq_sample_t sample;
+    seq_store_read(&store_gyro, gyro, &sample);
+
+    gyro->time = sample.time;
+    gyro->seq = sample.seq;
+}
 
-    *gyro = gyro_local;
+int drain_gyro_l(gyro_t* samples, int max){
 
-    pthread_mutex_unlock(&mutex_gyro);
+    seq_sample_t sample[GYRO_RING_SIZE];
+    if(max > GYRO_RING_SIZE){
+        max = GYRO_RING_SIZE;
+    }
+
+    int n = sample_ring_drain(&ring_gyro, samples, sample, max);
+    for(int ii=0; ii<n; ++ii){
+        samples[ii].time = sample[ii].time;
+        samples[ii].seq = sample[ii].seq;
+    }
+
+    return n;
 }
 
 void set_gyro(gyro_t* gyro){
 
-    pthread_mutex_lock(&mutex_gyro);
-
-    gyro_local = *gyro;
-    gyro_local.out_of_date = 0;
+    gyro_t new = *gyro;
+    new.out_of_date = 0;
 
-    pthread_mutex_unlock(&mutex_gyro);
+    /* the sample is stamped with the time of the trigger */
+    seq_store_write(&store_gyro, &new, &gyro->time);
+    sample_ring_push(&ring_gyro, &new, &gyro->time);
 }
 
 /* set the out of date flag on the gyro data */
 void gyro_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_gyro);
+    gyro_t gyro;
+    seq_store_read(&store_gyro, &gyro, NULL);
 
-    gyro_local.out_of_date = 1;
+    gyro.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_gyro);
+    seq_store_write(&store_gyro, &gyro, NULL);
 }
 
 double get_gyro_temp_l(void){
-    pthread_mutex_lock(&mutex_gyro_temp);
 
-    double temp = gyro_temp;
-
-    pthread_mutex_unlock(&mutex_gyro_temp);
+    double temp;
+    seq_store_read(&store_gyro_temp, &temp, NULL);
 
     return temp;
 }
 
 void set_gyro_temp_l(double temp){
 
-    pthread_mutex_lock(&mutex_gyro_temp);
-
-    gyro_temp = temp;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    pthread_mutex_unlock(&mutex_gyro_temp);
+    seq_store_write(&store_gyro_temp, &temp, &now);
 }
@@ -13,6 +13,9 @@ int init_gyroscope(void* args);
 
 void get_gyro_local(gyro_t* gyro);
 
+/* take the samples since the last call, oldest first */
+int drain_gyro_l(gyro_t* samples, int max);
+
 void set_gyro(gyro_t* gyro);
 
 /* set the out of date flag on the gyro data */
@@ -17,6 +17,8 @@
 #include <string.h>
 
 #include "global_utils.h"
+#include "hal.h"
+#include "binlog.h"
 #include "sensors.h"
 #include "encoder.h"
 #include "encoder_poller.h"
@@ -27,6 +29,11 @@
 #define AZ 0
 #define ALT_ANG 1
 
+/* a 2 byte transfer takes 320 us per encoder, enough for sampling at above
+ * 1 kHz
+ */
+#define ENCODER_SPI_SPEED 50000     /* unit: Hz */
+
 static int checksum_ctl(unsigned char data[2][2]);
 static int checksum_ctl_enc(unsigned char data[2]);
 static void proc(unsigned char data[2][2], encoder_t* enc);
@@ -41,7 +48,7 @@ static int fd_spi00, fd_spi01;
 
 static double az_offset = 0, alt_offset = 0;
 
-static FILE* encoder_log;
+static binlog_t* encoder_log;
 
 int init_encoder_poller(void* args){
 
@@ -51,9 +58,11 @@ int init_encoder_poller(void* args){
     char log_fn[100];
 
     strcpy(log_fn, get_top_dir());
-    strcat(log_fn, "output/logs/encoder.log");
+    strcat(log_fn, "output/logs/encoder.bin");
+
+    const binlog_col_t cols[] = {{"az", BINLOG_DOUBLE}, {"alt_ang", BINLOG_DOUBLE}};
 
-    encoder_log = fopen(log_fn, "a");
+    encoder_log = binlog_open(log_fn, cols, 2);
     if(encoder_log == NULL){
         logging(ERROR, "Encoder",
                 "Failed to open encoder log file: %m");
@@ -68,44 +77,44 @@ int init_encoder_poller(void* args){
     char* spi00 = "/dev/spidev0.0";
     char* spi01 = "/dev/spidev0.1";
     __u32 spi_mode = SPI_MODE_1;
-    __u32 speed = 50000;
+    __u32 speed = ENCODER_SPI_SPEED;
 
-    fd_spi00 = open(spi00, O_RDONLY);
+    fd_spi00 = hal_open(spi00, O_RDONLY);
     if(fd_spi00 == -1){
         logging(ERROR, "Encoder",
                 "Failed to open spidev0.0: %m");
         return errno;
     }
 
-    fd_spi01 = open(spi01, O_RDONLY);
-    if(fd_spi00 == -1){
+    fd_spi01 = hal_open(spi01, O_RDONLY);
+    if(fd_spi01 == -1){
         logging(ERROR, "Encoder",
                 "Failed to open spidev0.1: %m");
         return errno;
     }
 
-    ret = ioctl(fd_spi00, SPI_IOC_WR_MODE, &spi_mode);
+    ret = hal_ioctl(fd_spi00, SPI_IOC_WR_MODE, &spi_mode);
     if(ret == -1){
         logging(ERROR, "Encoder",
                 "Failed to set spi mode for spidev0.0: %m");
         return errno;
     }
 
-    ret = ioctl(fd_spi01, SPI_IOC_WR_MODE, &spi_mode);
+    ret = hal_ioctl(fd_spi01, SPI_IOC_WR_MODE, &spi_mode);
     if(ret == -1){
         logging(ERROR, "Encoder",
                 "Failed to set spi mode for spidev0.1: %m");
         return errno;
     }
 
-    ret = ioctl(fd_spi00, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
+    ret = hal_ioctl(fd_spi00, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
     if(ret == -1){
         logging(ERROR, "Encoder",
                 "Failed to set spi speed for spidev0.0: %m");
         return errno;
     }
 
-    ret = ioctl(fd_spi01, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
+    ret = hal_ioctl(fd_spi01, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
     if(ret == -1){
         logging(ERROR, "Encoder",
                 "Failed to set spi speed for spidev0.1: %m");
@@ -157,9 +166,30 @@ static int read_offsets(void){
 int enc_single_samp_ll(encoder_t* enc){
 
     unsigned char data[2][2];
+    struct spi_ioc_transfer xfer[2];
+
+    memset(xfer, 0, sizeof(xfer));
+    for(int ii=0; ii<2; ++ii){
+        xfer[ii].rx_buf = (unsigned long)data[ii];
+        xfer[ii].len = 2;
+        xfer[ii].speed_hz = ENCODER_SPI_SPEED;
+    }
+
+    /* the encoders are on separate chip selects, which spidev can not
+     * combine in one message, so one message each
+     */
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if(hal_ioctl(fd_spi00, SPI_IOC_MESSAGE(1), &xfer[AZ]) == -1 ||
+            hal_ioctl(fd_spi01, SPI_IOC_MESSAGE(1), &xfer[ALT_ANG]) == -1){
+        int err = errno;
+        logging(WARN, "Encoder", "Spi transfer failed: %s", strerror(err));
+        errno = err;
+        return FAILURE;
+    }
 
-    read(fd_spi00, data[AZ], 2);
-    read(fd_spi01, data[ALT_ANG], 2);
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
     if(checksum_ctl(data)){
         errno = EIO;
@@ -167,6 +197,13 @@ int enc_single_samp_ll(encoder_t* enc){
     }
 
     proc(data, enc);
+
+    /* the sample is taken as the middle of the transfers */
+    long long mid = ((start.tv_sec + end.tv_sec) * 1000000000LL +
+            start.tv_nsec + end.tv_nsec) / 2;
+    enc->time.tv_sec = mid / 1000000000;
+    enc->time.tv_nsec = mid % 1000000000;
+
     return SUCCESS;
 }
 
@@ -329,5 +366,5 @@ static void proc(unsigned char data[2][2], encoder_t* enc){
     enc->az = ang[AZ] - az_offset;
     enc->alt_ang = 360 - ang[ALT_ANG] - alt_offset;
 
-    logging_csv(encoder_log, "%010.6lf,%010.6lf", enc->az, enc->alt_ang);
+    binlog_write(encoder_log, enc->az, enc->alt_ang);
 }
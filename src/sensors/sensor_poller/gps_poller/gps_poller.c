@@ -18,6 +18,7 @@
 #include <stdio.h>
 
 #include "global_utils.h"
+#include "hal.h"
 #include "sensors.h"
 #include "gps.h"
 #include "telemetry.h"
@@ -60,7 +61,7 @@ int init_gps_poller(void* args){
 
     char* spi12 = "/dev/spidev1.2";
 
-    fd_spi12 = open(spi12, O_RDONLY);
+    fd_spi12 = hal_open(spi12, O_RDONLY);
 
     if(fd_spi12 < 0){
         logging(ERROR, "GPS", "Failed to open spi device, %m");
@@ -68,7 +69,7 @@ int init_gps_poller(void* args){
     }
 
     __u32 speed = 200000;
-    int ret = ioctl(fd_spi12, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
+    int ret = hal_ioctl(fd_spi12, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
     if(ret == -1){
         logging(ERROR, "GPS",
                 "Failed to set spi speed for spidev1.2, (%s)",
@@ -90,13 +91,13 @@ static void* gps_thread_func(void* args){
 
     while(1){
         ii = 1;
-        read(fd_spi12, &ch, 1);
+        hal_read(fd_spi12, &ch, 1);
 
         if(ch == '$'){
 
             do{
                 buffer[ii] = 0xFF;
-                read(fd_spi12, &buffer[ii], 1);
+                hal_read(fd_spi12, &buffer[ii], 1);
             } while(buffer[ii++] != '\r' && ii < BUFFER_S);
 
             buffer[ii-1] = '\0'; /* replace '\r' with '\0' */
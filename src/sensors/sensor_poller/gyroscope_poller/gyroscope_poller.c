@@ -8,7 +8,6 @@
 
 #define _GNU_SOURCE
 
-#include <ftd2xx.h>
 #include <pthread.h>
 #include <string.h>
 #include <unistd.h>
@@ -18,9 +17,11 @@
 #include <math.h>
 
 #include "global_utils.h"
+#include "binlog.h"
 #include "sensors.h"
 #include "gyroscope.h"
 #include "gpio.h"
+#include "hal.h"
 #include "mode.h"
 #include "telemetry.h"
 
@@ -28,12 +29,22 @@
 #define DATAGRAM_IDENTIFIER 0x94
 #define DATAGRAM_SIZE 27
 #define FTDI_BAUDRATE 921600
+#define TRIG_PULSE_WIDTH 1000   /* unit: nanoseconds */
+
+/* blocking reads per cycle to complete a datagram, each waits at most the
+ * ftdi timeout
+ */
+#define GYRO_READS 2
+
+#define RX_BUFFER_SIZE 64       /* power of two, above two datagrams */
 
 static void* thread_func(void* args);
 static void active_m(void);
+static int receive_datagram(void);
+static int parse_datagram(void);
 
-static FT_HANDLE fd;
-static FILE* gyro_log;
+static hal_serial_t* port;
+static binlog_t* gyro_log;
 
 pthread_mutex_t mutex_cond_gyro = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t cond_gyro = PTHREAD_COND_INITIALIZER;
@@ -44,9 +55,12 @@ int init_gyroscope_poller(void* args){
     char log_fn[100];
 
     strcpy(log_fn, get_top_dir());
-    strcat(log_fn, "output/logs/gyro.log");
+    strcat(log_fn, "output/logs/gyro.bin");
+
+    const binlog_col_t cols[] = {{"x", BINLOG_DOUBLE}, {"y", BINLOG_DOUBLE},
+            {"z", BINLOG_DOUBLE}, {"temp", BINLOG_DOUBLE}};
 
-    gyro_log = fopen(log_fn, "a");
+    gyro_log = binlog_open(log_fn, cols, 4);
     if(gyro_log == NULL){
         logging(ERROR, "Gyro",
             "Failed to open gyro log file, (%s)",
@@ -72,33 +86,8 @@ int init_gyroscope_poller(void* args){
      * message time out = 4 ms
      * lowest latency setting (2 ms)
      */
-    FT_STATUS stat;
-
-    stat = FT_OpenEx(SERIAL_NUM, FT_OPEN_BY_SERIAL_NUMBER, &fd);
-    if(stat != FT_OK){
-        logging(ERROR, "GYRO",
-                "Failed to initiate UART, error: %d", stat);
-        return FAILURE;
-    }
-
-    stat = FT_SetBaudRate(fd, FTDI_BAUDRATE);
-    if(stat != FT_OK){
-        logging(ERROR, "GYRO",
-                "Failed to set baudrate for UART, error: %d", stat);
-        return FAILURE;
-    }
-
-    stat = FT_SetTimeouts(fd, 4, 4);
-    if(stat != FT_OK){
-        logging(ERROR, "GYRO",
-                "Failed to set timeout for UART, error: %d", stat);
-        return FAILURE;
-    }
-
-    stat = FT_SetLatencyTimer(fd, 2);
-    if(stat != FT_OK){
-        logging(ERROR, "GYRO",
-                "Failed to set latency timer for UART, error: %d", stat);
+    ret = hal_serial_open(SERIAL_NUM, FTDI_BAUDRATE, 4, 2, &port);
+    if(ret != SUCCESS){
         return FAILURE;
     }
 
@@ -114,8 +103,8 @@ static void* thread_func(void* args){
     struct timespec wake_time;
     int ret;
 
-    ret = FT_Purge(fd, FT_PURGE_RX);
-    if(ret != FT_OK){
+    ret = hal_serial_purge(port);
+    if(ret != SUCCESS){
         logging(WARN, "GYRO",
                 "Failed to purge UART receive buffer: %d", ret);
     }
@@ -149,40 +138,30 @@ static unsigned int bytes_read, bytes_available;
 static double rate[3];
 static int ret;
 
-static void active_m(void){
+/* bytes received from the ftdi, rx_head - rx_tail of them not yet parsed */
+static unsigned char rx_buf[RX_BUFFER_SIZE];
+static unsigned int rx_head, rx_tail;
 
-    /* create trigger pulse */
-    gpio_write(GYRO_TRIG_PIN, LOW);
-    usleep(1);
-    gpio_write(GYRO_TRIG_PIN, HIGH);
+static void active_m(void){
 
-    /* wait for UART conversion */
-    usleep(2000);
-
-    /* find start of datagram */
-    do{
-        FT_Read(fd, &data[0], 1, &bytes_read);
-    } while(data[0] != DATAGRAM_IDENTIFIER);
-
-    /* wait until full datagram is available */
-    do{
-        FT_GetQueueStatus(fd, &bytes_available);
-        usleep(1);
-    } while(bytes_available < DATAGRAM_SIZE-1);
-
-    /* read full datagram */
-    ret = FT_Read(fd, &data[1], DATAGRAM_SIZE-1, &bytes_read);
-    if(ret != FT_OK){
-        logging(WARN, "Gyro", "Reading datagram failed, "
-                "error: %d", ret);
-        return;
+    /* every trigger gives one datagram, anything still queued is from a
+     * late one
+     */
+    ret = hal_serial_queue(port, &bytes_available);
+    if(ret == SUCCESS && bytes_available){
+        logging(WARN, "Gyro", "Dropped %u bytes received before trigger",
+                bytes_available);
+        hal_serial_purge(port);
     }
+    rx_tail = rx_head;
 
-    /* check for datagram termination */
-    if(     data[DATAGRAM_SIZE-2] != '\r' ||
-            data[DATAGRAM_SIZE-1] != '\n'){
+    /* create trigger pulse */
+    gpio_pulse(GYRO_TRIG_PIN, LOW, TRIG_PULSE_WIDTH);
 
-        logging(WARN, "Gyro", "Incorrect datagram received");
+    /* the gyroscope samples on the rising edge at the end of the pulse */
+    clock_gettime(CLOCK_MONOTONIC, &gyro.time);
+
+    if(receive_datagram() != SUCCESS){
         return;
     }
 
@@ -234,8 +213,7 @@ static void active_m(void){
                 data[17]);
     }
 
-    logging_csv(gyro_log, "%+011.6lf,%+011.6lf,%+011.6lf,%+011.6lf",
-            gyro.x, gyro.y, gyro.z, temp);
+    binlog_write(gyro_log, gyro.x, gyro.y, gyro.z, temp);
 
     #if GYRO_DEBUG
         logging(DEBUG, "Gyro",
@@ -243,3 +221,88 @@ static void active_m(void){
                 gyro.x, gyro.y, gyro.z, temp);
     #endif
 }
+
+/* receive_datagram:
+ * Read blocks from the ftdi into the receive ring until a valid datagram is
+ * found, the reads block until the missing bytes of a datagram arrive or the
+ * ftdi timeout, instead of polling the queue.
+ *
+ * return:
+ *      SUCCESS: the datagram is in data
+ *      FAILURE: no valid datagram received, log written
+ */
+static int receive_datagram(void){
+
+    unsigned char block[DATAGRAM_SIZE];
+
+    for(int ii=0; ii<GYRO_READS; ++ii){
+
+        /* the ring holds at most the start of a datagram after parsing */
+        unsigned int count = DATAGRAM_SIZE - (rx_head - rx_tail);
+
+        ret = hal_serial_read(port, block, count, &bytes_read);
+        if(ret != SUCCESS){
+            logging(WARN, "Gyro", "Reading datagram failed, "
+                    "error: %d", ret);
+            return FAILURE;
+        }
+
+        if(bytes_read == 0){
+            break;
+        }
+
+        for(unsigned int jj=0; jj<bytes_read; ++jj){
+            rx_buf[rx_head++ % RX_BUFFER_SIZE] = block[jj];
+        }
+
+        if(parse_datagram() == SUCCESS){
+            return SUCCESS;
+        }
+    }
+
+    logging(WARN, "Gyro", "No datagram received");
+    return FAILURE;
+}
+
+/* parse_datagram:
+ * Take the next valid datagram out of the receive ring. Bytes before an
+ * identifier are dropped, and an identifier without a terminated datagram
+ * after it is taken as part of the data and skipped, so the parser
+ * resynchronises on a misaligned stream.
+ *
+ * return:
+ *      SUCCESS: the datagram is in data
+ *      FAILURE: no complete datagram, the ring is empty or holds the start
+ *               of one
+ */
+static int parse_datagram(void){
+
+    while(rx_head != rx_tail){
+
+        if(rx_buf[rx_tail % RX_BUFFER_SIZE] != DATAGRAM_IDENTIFIER){
+            rx_tail++;
+            continue;
+        }
+
+        if(rx_head - rx_tail < DATAGRAM_SIZE){
+            return FAILURE;
+        }
+
+        for(int ii=0; ii<DATAGRAM_SIZE; ++ii){
+            data[ii] = rx_buf[(rx_tail + ii) % RX_BUFFER_SIZE];
+        }
+
+        /* check for datagram termination */
+        if(     data[DATAGRAM_SIZE-2] == '\r' &&
+                data[DATAGRAM_SIZE-1] == '\n'){
+
+            rx_tail += DATAGRAM_SIZE;
+            return SUCCESS;
+        }
+
+        logging(WARN, "Gyro", "Incorrect datagram received");
+        rx_tail++;
+    }
+
+    return FAILURE;
+}
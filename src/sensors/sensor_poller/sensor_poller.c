@@ -41,11 +41,6 @@ int set_enc_offsets_l(void){
     return set_offsets();
 }
 
-/* return the pid for the star tracker child process */
-pid_t get_st_pid(void){
-    return get_st_pid_local();
-}
-
 /* set the exposure time (in microseconds) and gain for the star tracker */
 void set_st_exp_l(int st_exp){
     set_st_exp_ll(st_exp);
@@ -58,6 +53,10 @@ int get_st_exp_l(void){
     return get_st_exp_ll();
 }
 
+void send_st_stats_l(void){
+    send_st_stats_ll();
+}
+
 /* fetch a single sample from the encoder */
 int enc_single_samp_l(encoder_t* enc){
     return enc_single_samp_ll(enc);
@@ -7,13 +7,12 @@
  * -----------------------------------------------------------------------------
  */
 #include <stdio.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/wait.h>
 #include <errno.h>
-#include <math.h>
 
 #include "global_utils.h"
 #include "sensors.h"
@@ -22,40 +21,76 @@
 #include "mode.h"
 #include "img_processing.h"
 #include "current_target.h"
+#include "target_selection.h"
+#include "telemetry.h"
+#include "tetra.h"
+
+#ifdef ST_TEST
+    #include <fitsio.h>
+#endif
 
 #define ST_WAIT_TIME 10*1000*1000
 
-/* macros used in popen2 */
-#define READ 0
-#define WRITE 1
+/* binning of the guiding image when finding stars, 1 or 2 */
+#define ST_BINNING 1
+
+/* a solution is the hint for tracking the next images for this long, unit:
+ * seconds
+ */
+#define ST_TRACK_AGE 30
 
-static void irisc_tetra(float st_return[]);
-static int call_tetra(float st_return[]);
+/* solver_stats_t:
+ * Attempts of one way of solving images. Only the star tracker thread
+ * writes, the atomics let the command thread read.
+ */
+typedef struct{
+    atomic_ulong tries, solved;
+    atomic_ullong sum;      /* unit: nanoseconds */
+    atomic_llong max;       /* unit: nanoseconds */
+} solver_stats_t;
+
+static int irisc_tetra(const unsigned short* img, int width, int height,
+        int big_endian, float st_return[]);
+static int call_tetra(const unsigned short* img, int width, int height,
+        int big_endian, float st_return[]);
+static int get_hint(tetra_solution_t* hint);
+static void solver_add(solver_stats_t* s, int solved,
+        const struct timespec* start, const struct timespec* stop);
+static void send_solver_stats(const char* name, solver_stats_t* s);
 static void* st_poller_thread(void* args);
-static pid_t popen2(char* const * command, int *infp, int *outfp);
 static void active_m(void);
 
 #ifndef ST_TEST
-    static int capture_image();
+    static int capture_image(img_frame_t** frame);
+#else
+    static int load_test_img(char* fn);
 #endif
 
 pthread_mutex_t mutex_cond_st = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t cond_st = PTHREAD_COND_INITIALIZER;
 
-static pid_t py_pid = -1;
-static char st_running = 0;
-
 /* exposure time in seconds */
 static int exp_time = 2, gain = 300;
 
-/* filenames for images */
-static char st_fn[100], out_fp[100];
+/* filenames for the test image and star database */
+static char st_fn[100], db_fn[100], catalog_fn[100];
 static float st_return[4];
 static FILE* star_tracker_log;
 
-#ifndef ST_TEST
-    static char out_fn[100];
-    static int img_cntr = 0;
+/* exposure of the image being solved, CLOCK_MONOTONIC */
+static struct timespec exp_start, exp_end;
+
+/* the last solution and the end of its exposure, the hint for tracking */
+static tetra_solution_t last_sol;
+static struct timespec last_sol_time;
+static int have_sol = 0;
+
+static solver_stats_t track_stats, lis_stats;
+
+#ifdef ST_TEST
+    /* the test image, solved over and over */
+    static unsigned short* test_img = NULL;
+    static long test_width, test_height;
 #endif
 
 static struct timespec wake;
@@ -81,10 +116,27 @@ int init_star_tracker_poller(void* args){
 
     strcpy(st_fn, get_top_dir());
     strcat(st_fn, "output/guiding/star_tracker/st_img.fit");
-    /* strcat(st_fn, "output/guiding/tmp/st_img.fit"); */
 
-    strcpy(out_fp, get_top_dir());
-    strcat(out_fp, "output/compression/");
+    strcpy(db_fn, get_top_dir());
+    strcat(db_fn, "output/guiding/star_tracker/tetra.db");
+
+    strcpy(catalog_fn, get_top_dir());
+    strcat(catalog_fn, "output/guiding/star_tracker/catalog.csv");
+
+    /* without a database the star tracker stays out of date, the rest of
+     * the system runs on
+     */
+    if(init_tetra(db_fn, catalog_fn) != SUCCESS){
+        logging(ERROR, "Star Tracker",
+                "No star database, star tracker disabled");
+    }
+
+    #ifdef ST_TEST
+        if(load_test_img(st_fn) != SUCCESS){
+            logging(ERROR, "Star Tracker",
+                    "No test image, star tracker disabled");
+        }
+    #endif
 
     return create_thread("st_poller", st_poller_thread, 23);
 }
@@ -109,31 +161,52 @@ static void* st_poller_thread(void* args){
 
 static void active_m(void){
 
+    if(!tetra_ready()){
+        st_out_of_date();
+        return;
+    }
+
     #ifndef ST_TEST
         /* capture image */
-        if(capture_image(st_fn)){
+        img_frame_t* frame;
+        if(capture_image(&frame)){
             st_out_of_date();
             return;
         }
-    #endif
 
-    /* star tracker calculations */
-    if(call_tetra(st_return)){
-        st_out_of_date();
-        return;
-    }
+        /* star tracker calculations, on the FITS data of the frame */
+        int ret = call_tetra((unsigned short*)&frame->fits[FITS_BLOCK],
+                frame->width, frame->height, 1, st_return);
+        if(ret){
+            release_img_frame(frame);
+            st_out_of_date();
+            return;
+        }
 
-    #ifndef ST_TEST
-        /* move image to img queue dir */
-        snprintf(out_fn, 100, "%sst%04d.fit", out_fp, img_cntr++);
-        rename(st_fn, out_fn);
+        /* hand the image over to the image handler in memory */
+        if(queue_frame(frame, IMAGE_STARTRACKER)){
+            release_img_frame(frame);
+        }
+    #else
+        if(test_img == NULL){
+            st_out_of_date();
+            return;
+        }
+
+        /* one solution per exposure time, like with the camera */
+        struct timespec exposure = {exp_time, 0};
+        clock_gettime(CLOCK_MONOTONIC, &exp_start);
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &exposure, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &exp_end);
 
-        queue_image(out_fn, IMAGE_STARTRACKER);
+        if(call_tetra(test_img, test_width, test_height, 0, st_return)){
+            st_out_of_date();
+        }
     #endif
 }
 
 #ifndef ST_TEST
-static int capture_image(char* fn){
+static int capture_image(img_frame_t** frame){
 
     int ret;
 
@@ -146,16 +219,65 @@ static int capture_image(char* fn){
 
     do{
         usleep(10000);
-        ret = save_img_guiding(fn);
+        ret = save_img_guiding_mem(frame);
     } while(ret == EXP_NOT_READY);
 
+    if(ret == SUCCESS){
+        get_exp_window_guiding(&exp_start, &exp_end);
+    }
+
     return ret;
 }
+#else
+/* load_test_img:
+ * Read the image solved in place of camera images.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: the image could not be read, log written to stderr
+ *      ENOMEM: no memory for the image
+ */
+static int load_test_img(char* fn){
+
+    fitsfile* fptr;
+    int status = 0, anynul;
+    long naxes[2];
+
+    fits_open_file(&fptr, fn, READONLY, &status);
+    fits_get_img_size(fptr, 2, naxes, &status);
+    if(status){
+        fits_report_error(stderr, status);
+        return FAILURE;
+    }
+
+    test_img = malloc(naxes[0] * naxes[1] * sizeof(unsigned short));
+    if(test_img == NULL){
+        fits_close_file(fptr, &status);
+        return ENOMEM;
+    }
+
+    fits_read_img(fptr, TUSHORT, 1, naxes[0] * naxes[1], NULL, test_img,
+            &anynul, &status);
+    fits_close_file(fptr, &status);
+    if(status){
+        fits_report_error(stderr, status);
+        free(test_img);
+        test_img = NULL;
+        return FAILURE;
+    }
+
+    test_width = naxes[0];
+    test_height = naxes[1];
+
+    return SUCCESS;
+}
 #endif
 
-static int call_tetra(float st_return[]){
+static int call_tetra(const unsigned short* img, int width, int height,
+        int big_endian, float st_return[]){
 
     star_tracker_t st;
+    int ret;
 
     #ifdef ST_DEBUG
         struct timespec samp_0, samp, diff;
@@ -163,7 +285,7 @@ static int call_tetra(float st_return[]){
 
     #ifdef ST_DEBUG
         clock_gettime(CLOCK_MONOTONIC, &samp_0);
-        irisc_tetra(st_return);
+        ret = irisc_tetra(img, width, height, big_endian, st_return);
         clock_gettime(CLOCK_MONOTONIC, &samp);
 
         diff.tv_sec = samp.tv_sec - samp_0.tv_sec;
@@ -179,17 +301,19 @@ static int call_tetra(float st_return[]){
         logging(DEBUG, "Star Tracker", "Output: %f, %f, %f, %f",
                 st_return[0], st_return[1], st_return[2], st_return[3]);
     #else
-        irisc_tetra(st_return);
+        ret = irisc_tetra(img, width, height, big_endian, st_return);
     #endif
 
-    if(fabs(st_return[3]) < 0.001){
-        logging(WARN, "Star Tracker", "FoV = 0, lost in space failed");
+    if(ret != SUCCESS){
+        logging(WARN, "Star Tracker", "Lost in space failed");
         return FAILURE;
     }
 
     st.ra = st_return[0];
     st.dec = st_return[1];
     st.roll = st_return[2];
+    st.exp_start = exp_start;
+    st.exp_end = exp_end;
 
     logging_csv(star_tracker_log, "%010.6f,%010.7f,%010.6f",
             st.ra, st.dec, st.roll);
@@ -199,153 +323,137 @@ static int call_tetra(float st_return[]){
     return SUCCESS;
 }
 
-/*
- * Purpose: This is the interface to run the Astrometry.net program from the
- *          main OBSW.
- * Usage: A float array of length 4 i passed, and values from the star tracker
- *          is returned in this array in order:
+/* irisc_tetra:
+ * Find the stars of a guiding image and identify them. While the attitude
+ * is known the stars are tracked from the last solution, moved along with
+ * the kalman filter estimate, which takes milliseconds. The slower lost in
+ * space solution is only tried when tracking fails.
+ *
+ * input:
+ *      img: the pixels, row by row
+ *      width, height: size of the image in pixels
+ *      big_endian: set if the pixels are big-endian, as in a FITS file
+ *
+ * output:
+ *      st_return: the attitude of the image in order:
  *          0: RA
  *          1: Dec
  *          2: Roll
  *          3: FoV
  *
- *          The name of the parameter is printed by the star tracker, but then ignored.
- *          If no attitude could be calculated all of these will be 0. This
- *          can obviously not happen if an attitude is calculated, as FoV will
- *          always have a positive non-zero value.
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: no attitude could be found, st_return all 0
  */
-static void irisc_tetra(float st_return[]) {
-
-    char st_img_path[100];
-
-    /*
-    char exe_path[100];
-    strcpy(exe_path, get_top_dir());
-    strcat(exe_path,"usr/local/astrometry/bin/solve-field");
-    */
-    strcpy(st_img_path, get_top_dir());
-    strcat(st_img_path,"output/guiding/star_tracker/st_img.fit");
-
-    /* lisFlag, 1 if we are completely lost in space. 0 for only slightly. */
-    static int lisFlag = 1;
-    static char oldRa[4] = "0";
-    static char oldDec[4] = "0";
-    char* stRad = "15";
-    
-    char* cmd[10] = {
-        "chrt",
-        "-f",
-        "23",
-        "/usr/local/astrometry/bin/solve-field",
-        "-pOo",
-        "none",
-        "--scale-low",
-        "1",
-        st_img_path,
-        NULL
-    };
-
-    char* raDecFlags[7] = {
-        "--ra",
-        oldRa,
-        "--dec",
-        oldDec,
-        "--radius",
-        stRad,
-        NULL 
-    };
-
-    char* raDecCmd[16];
-
-    int out_fd = -1;
-
-    st_running = 1;
-
-    if (!lisFlag) {
-        strcpy((char*)raDecCmd, (char*)cmd);
-        strcat((char*)raDecCmd, (char*)raDecFlags);
-
-        py_pid = popen2(raDecCmd, NULL, &out_fd);
-    } else {
-        py_pid = popen2(cmd, NULL, &out_fd);
-        //lisFlag = 1;
-    }
-    waitpid(py_pid, NULL, 0);
-    st_running = 0;
+static int irisc_tetra(const unsigned short* img, int width, int height,
+        int big_endian, float st_return[]){
 
-    FILE* oFPtr = fdopen(out_fd, "r");
+    star_list_t stars;
+    tetra_solution_t sol, hint;
+    struct timespec start, stop;
+    int ret = FAILURE;
 
-    char buffer[200];
+    memset(st_return, 0, 4 * sizeof(float));
 
-    while (1) {
-        fscanf(oFPtr, "%s", buffer);
-        if (!strcmp(buffer, "IRISC")) {
-            break;
-        }
+    if(find_stars(img, width, height, big_endian, ST_BINNING, &stars) != SUCCESS){
+        return FAILURE;
     }
 
-    for (int i = 0; i < 4; i++) {
-        fscanf( oFPtr, "%*s %f", &st_return[i]);
+    if(get_hint(&hint) == SUCCESS){
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ret = tetra_track(&stars, width, height, &hint, &sol);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        solver_add(&track_stats, ret == SUCCESS, &start, &stop);
+    }
+
+    if(ret != SUCCESS){
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ret = tetra_solve(&stars, width, height, &sol);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        solver_add(&lis_stats, ret == SUCCESS, &start, &stop);
     }
 
-    if(fabs(st_return[3]) < 0.001){
-        //lisFlag = 0;
-    } else {
-        sprintf(oldRa, "%d", (int)st_return[1]);
-        sprintf(oldDec, "%d", (int)st_return[2]);
+    if(ret != SUCCESS){
+        have_sol = 0;
+        return FAILURE;
     }
-    fclose(oFPtr);
-    return;
+
+    last_sol = sol;
+    last_sol_time = exp_end;
+    have_sol = 1;
+
+    st_return[0] = sol.ra;
+    st_return[1] = sol.dec;
+    st_return[2] = sol.roll;
+    st_return[3] = sol.fov;
+
+    return SUCCESS;
 }
 
-static pid_t popen2(char* const * command, int* in_fd, int* out_fd){
-    int p_stdin[2], p_stdout[2];
-    pid_t pid;
+/* get_hint:
+ * Predict the attitude of the image being solved. The boresight is taken
+ * from the kalman filter when it has an estimate, the roll and field of
+ * view from the last solution.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: no recent solution, the image has to be solved lost in space
+ */
+static int get_hint(tetra_solution_t* hint){
 
-    if(pipe(p_stdin) != 0 || pipe(p_stdout) != 0){
+    if(!have_sol || exp_end.tv_sec - last_sol_time.tv_sec > ST_TRACK_AGE){
         return FAILURE;
     }
 
-    pid = fork();
+    *hint = last_sol;
 
-    if(pid < 0){
-        return pid;
-    }
-    else if(pid == 0){
-        close(p_stdin[WRITE]);
-        dup2(p_stdin[READ], READ);
-        close(p_stdout[READ]);
-        dup2(p_stdout[WRITE], WRITE);
-
-        execvp(*command, command);
-        perror("execvp");
-        exit(1);
-    }
+    telescope_att_t att;
+    get_telescope_att(&att);
 
-    if(in_fd == NULL){
-        close(p_stdin[WRITE]);
-    }
-    else{
-        *in_fd = p_stdin[WRITE];
+    if(!att.out_of_date){
+        double ra, dec;
+        aa_to_rd(att.az, att.alt, &ra, &dec);
+        hint->ra = 15 * ra;
+        hint->dec = dec;
     }
 
-    if(out_fd == NULL){
-        close(p_stdout[READ]);
+    return SUCCESS;
+}
+
+static void solver_add(solver_stats_t* s, int solved,
+        const struct timespec* start, const struct timespec* stop){
+
+    long long ns = (stop->tv_sec - start->tv_sec) * 1000000000LL +
+        (stop->tv_nsec - start->tv_nsec);
+
+    atomic_fetch_add_explicit(&s->tries, 1, memory_order_relaxed);
+    if(solved){
+        atomic_fetch_add_explicit(&s->solved, 1, memory_order_relaxed);
     }
-    else{
-        *out_fd = p_stdout[READ];
+    atomic_fetch_add_explicit(&s->sum, ns, memory_order_relaxed);
+    if(ns > atomic_load_explicit(&s->max, memory_order_relaxed)){
+        atomic_store_explicit(&s->max, ns, memory_order_relaxed);
     }
+}
 
-    return pid;
+void send_st_stats_ll(void){
+    send_solver_stats("track", &track_stats);
+    send_solver_stats("lost in space", &lis_stats);
 }
 
-/* return the pid for the star tracker child process */
-pid_t get_st_pid_local(void){
-    if(st_running){
-        return py_pid;
-    }
-    return FAILURE;
+static void send_solver_stats(const char* name, solver_stats_t* s){
+
+    char msg[100];
+    unsigned long tries = atomic_load_explicit(&s->tries, memory_order_relaxed);
+    unsigned long long sum = atomic_load_explicit(&s->sum, memory_order_relaxed);
+
+    snprintf(msg, 100, "st %s tries: %lu, solved: %lu, mean: %llu us, max: %lld us",
+            name, tries, atomic_load_explicit(&s->solved, memory_order_relaxed),
+            tries ? sum / tries / 1000 : 0,
+            atomic_load_explicit(&s->max, memory_order_relaxed) / 1000);
+    send_telemetry(msg, 1, 0, 0);
 }
+
 /* set the exposure time (in microseconds) and gain for the star tracker */
 void set_st_exp_ll(int st_exp){
     exp_time = st_exp;
@@ -11,11 +11,13 @@
 
 int init_star_tracker_poller(void* args);
 
-/* return the pid for the star tracker child process */
-pid_t get_st_pid_local(void);
-
 /* set the exposure time (in microseconds) and gain for the star tracker */
 void set_st_exp_ll(int st_exp);
 void set_st_gain_ll(int st_gain);
 
 int get_st_exp_ll(void);
+
+/* send the number of tracking and lost in space solutions and their times
+ * as telemetry
+ */
+void send_st_stats_ll(void);
@@ -0,0 +1,1297 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Tetra
+ * Parent Component: Star Tracker Poller
+ * Author(s): 
+ * Purpose: Identify the stars of a guiding image by the shape of four star
+ *          patterns, looked up in a database built from a star catalog, and
+ *          find the attitude of the camera from them.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+
+#include "global_utils.h"
+#include "tetra.h"
+
+/* patterns of a star are made of its brightest neighbours */
+#define TETRA_NEIGHBOURS 6
+
+/* each edge ratio of a pattern key is rounded down to 1/TETRA_BINS */
+#define TETRA_BINS 50
+
+/* largest error of an edge ratio of an image pattern */
+#define TETRA_RATIO_TOL 0.005
+
+/* patterns are tried from the brightest image stars */
+#define TETRA_PATTERN_STARS 20
+
+/* the brightest image stars are checked against the catalog */
+#define TETRA_VERIFY_STARS 32
+
+/* an image star and a projected catalog star closer than this are the same
+ * star, unit: pixels
+ */
+#define TETRA_MATCH_PIXELS 3.0
+
+/* identified stars needed to accept a solution, pattern included */
+#define TETRA_MIN_MATCHES 8
+
+/* largest relative error of TETRA_FOV */
+#define TETRA_FOV_TOL 0.2
+
+/* star indices are 16 bit, with the highest marking an empty slot */
+#define TETRA_MAX_STARS 0xffff
+#define EMPTY 0xffff
+
+/* catalog stars projected into the image when verifying a solution */
+#define MAX_PROJ 512
+
+/* largest error of the position of the stars predicted from the hint when
+ * tracking, unit: pixels
+ */
+#define TETRA_TRACK_PIXELS 100
+
+/* offsets between image stars and predicted stars are counted in cells of
+ * this size, unit: pixels
+ */
+#define TETRA_TRACK_CELL 4
+#define TRACK_CELLS (2 * TETRA_TRACK_PIXELS / TETRA_TRACK_CELL + 1)
+
+/* image stars are first paired with the predicted stars within this of the
+ * common offset, allowing for an error of the roll, unit: pixels
+ */
+#define TETRA_TRACK_MATCH 12.0
+
+#define DB_MAGIC "TETRADB"
+#define DB_VERSION 1
+
+#define DEG (M_PI / 180)
+
+/* cat_star_t:
+ * A catalog star, the database holds them sorted by declination.
+ */
+typedef struct{
+    float v[3];             /* unit vector, equatorial */
+    float dec;              /* unit: radians */
+    float mag;
+} cat_star_t;
+
+/* a pattern is the indices of four catalog stars, in increasing order */
+typedef uint16_t pattern_t[4];
+
+/* db_header_t:
+ * Start of the database file, followed by the stars and the pattern table.
+ * The settings are checked against the ones compiled in.
+ */
+typedef struct{
+    char magic[8];
+    int version;
+    float pattern_radius;   /* unit: degrees */
+    float mag_limit;
+    int neighbours;
+    int bins;
+    int n_stars;
+    unsigned int table_size;
+} db_header_t;
+
+static int load_db(const char* fn);
+static int save_db(const char* fn);
+static int build_db(const char* catalog_fn);
+static int read_catalog(const char* fn);
+static int cmp_mag(const void* a, const void* b);
+static int cmp_dec(const void* a, const void* b);
+static int first_star(double dec);
+static void insert_pattern(const int idx[4]);
+static void edge_ratios(double v[4][3], double ratio[5], double* largest);
+static int ratio_bin(double ratio);
+static unsigned int hash_key(const int bin[5]);
+static int lookup_pattern(const star_list_t* list, const int img[4],
+        int width, int height, tetra_solution_t* sol);
+static int try_match(const star_list_t* list, const int img[4],
+        const uint16_t cat[4], int width, int height, tetra_solution_t* sol);
+static void img_vector(const star_t* s, int width, int height, double f,
+        int par, double v[3]);
+static void canonical_order(double v[4][3], int order[4]);
+static double orientation(double v[4][3], const int order[4]);
+static int project(double R[3][3], int width, int height, double f, int par,
+        double margin);
+static int verify(double R[3][3], const star_list_t* list, int width,
+        int height, double f, int par, double cam[][3], double sky[][3],
+        int* img_idx);
+static int track_offset(const star_list_t* list, int n_proj, double* dx,
+        double* dy);
+static double scale(double cam[][3], double sky[][3], int n);
+static void hint_attitude(const tetra_solution_t* hint, double R[3][3]);
+static void attitude(double cam[][3], double sky[][3], int n, double R[3][3]);
+static void largest_eigenvector(double K[4][4], double q[4]);
+static void solution(double R[3][3], int width, double f,
+        tetra_solution_t* sol);
+
+static cat_star_t* stars = NULL;
+static int n_stars = 0;
+
+static pattern_t* table = NULL;
+static unsigned int table_size = 0;
+
+/* -1 if the image is mirrored, found at the first solution */
+static int parity = 1;
+
+/* catalog stars projected into the image */
+static float proj_x[MAX_PROJ], proj_y[MAX_PROJ];
+static int proj_idx[MAX_PROJ];
+static char used[MAX_PROJ];
+
+static inline double dot(const double a[3], const double b[3]){
+    return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+static inline void cat_vector(int idx, double v[3]){
+    v[0] = stars[idx].v[0];
+    v[1] = stars[idx].v[1];
+    v[2] = stars[idx].v[2];
+}
+
+int init_tetra(const char* db_fn, const char* catalog_fn){
+
+    if(load_db(db_fn) == SUCCESS){
+        logging(INFO, "Tetra", "Loaded %d stars and %u pattern slots",
+                n_stars, table_size);
+        return SUCCESS;
+    }
+
+    int ret = build_db(catalog_fn);
+    if(ret != SUCCESS){
+        return ret;
+    }
+
+    logging(INFO, "Tetra", "Built database of %d stars and %u pattern slots",
+            n_stars, table_size);
+
+    if(save_db(db_fn)){
+        logging(WARN, "Tetra", "Failed to save database %s: %m", db_fn);
+    }
+
+    return SUCCESS;
+}
+
+int tetra_ready(void){
+    return table != NULL;
+}
+
+int tetra_solve(const star_list_t* list, int width, int height,
+        tetra_solution_t* sol){
+
+    if(table == NULL){
+        return ENODATA;
+    }
+
+    int n = list->n < TETRA_PATTERN_STARS ? list->n : TETRA_PATTERN_STARS;
+
+    /* patterns of the brightest stars first, the faintest star of the
+     * pattern is l
+     */
+    for(int l=3; l<n; ++l){
+        for(int k=2; k<l; ++k){
+            for(int j=1; j<k; ++j){
+                for(int i=0; i<j; ++i){
+                    int img[4] = {i, j, k, l};
+                    if(lookup_pattern(list, img, width, height, sol) == SUCCESS){
+                        return SUCCESS;
+                    }
+                }
+            }
+        }
+    }
+
+    return FAILURE;
+}
+
+int tetra_track(const star_list_t* list, int width, int height,
+        const tetra_solution_t* hint, tetra_solution_t* sol){
+
+    if(table == NULL){
+        return ENODATA;
+    }
+
+    double f = width / 2.0 / tan(hint->fov / 2 * DEG);
+    double R[3][3];
+    hint_attitude(hint, R);
+
+    int n_proj = project(R, width, height, f, parity, TETRA_TRACK_PIXELS);
+
+    /* the error of the hint moves all stars about the same */
+    double off_x, off_y;
+    if(track_offset(list, n_proj, &off_x, &off_y) != SUCCESS){
+        return FAILURE;
+    }
+
+    double cam[TETRA_VERIFY_STARS][3], sky[TETRA_VERIFY_STARS][3];
+    int img_idx[TETRA_VERIFY_STARS];
+    int n = 0;
+    int n_img = list->n < TETRA_VERIFY_STARS ? list->n : TETRA_VERIFY_STARS;
+
+    for(int ii=0; ii<n_img; ++ii){
+        int best = -1;
+        double best_d = TETRA_TRACK_MATCH * TETRA_TRACK_MATCH;
+
+        for(int jj=0; jj<n_proj; ++jj){
+            double dx = proj_x[jj] + off_x - list->star[ii].x;
+            double dy = proj_y[jj] + off_y - list->star[ii].y;
+            double d = dx*dx + dy*dy;
+            if(d < best_d && !used[jj]){
+                best = jj;
+                best_d = d;
+            }
+        }
+
+        if(best >= 0){
+            used[best] = 1;
+            img_vector(&list->star[ii], width, height, f, parity, cam[n]);
+            cat_vector(proj_idx[best], sky[n]);
+            img_idx[n] = ii;
+            n++;
+        }
+    }
+
+    /* the loose pairs give an attitude and scale close enough to pair the
+     * stars within TETRA_MATCH_PIXELS, the last pass only refines them
+     */
+    for(int ii=0; ii<3; ++ii){
+        if(n < (ii < 2 ? 3 : TETRA_MIN_MATCHES)){
+            return FAILURE;
+        }
+
+        f *= scale(cam, sky, n);
+        for(int jj=0; jj<n; ++jj){
+            img_vector(&list->star[img_idx[jj]], width, height, f, parity,
+                    cam[jj]);
+        }
+
+        attitude(cam, sky, n, R);
+
+        if(ii < 2){
+            n = verify(R, list, width, height, f, parity, cam, sky, img_idx);
+        }
+    }
+
+    solution(R, width, f, sol);
+    sol->matches = n;
+
+    return SUCCESS;
+}
+
+/* lookup_pattern:
+ * Look up the catalog patterns shaped like a pattern of image stars and try
+ * to match them.
+ *
+ * input:
+ *      img: indices of the image stars
+ *
+ * output:
+ *      sol: attitude of the camera
+ *
+ * return:
+ *      SUCCESS: the pattern is identified
+ *      FAILURE: it is not
+ */
+static int lookup_pattern(const star_list_t* list, const int img[4],
+        int width, int height, tetra_solution_t* sol){
+
+    double f = width / 2.0 / tan(TETRA_FOV / 2 * DEG);
+    double max_dist = 2 * sin(TETRA_PATTERN_RADIUS / 2 * DEG)
+            * (1 + TETRA_FOV_TOL);
+    double v[4][3];
+
+    for(int ii=0; ii<4; ++ii){
+        img_vector(&list->star[img[ii]], width, height, f, 1, v[ii]);
+    }
+
+    /* the database only holds patterns of stars around one of them */
+    int centred = 0;
+    for(int ii=0; ii<4 && !centred; ++ii){
+        centred = 1;
+        for(int jj=0; jj<4; ++jj){
+            double d[3] = {v[ii][0] - v[jj][0], v[ii][1] - v[jj][1],
+                v[ii][2] - v[jj][2]};
+            if(sqrt(dot(d, d)) > max_dist){
+                centred = 0;
+                break;
+            }
+        }
+    }
+    if(!centred){
+        return FAILURE;
+    }
+
+    double ratio[5], largest;
+    edge_ratios(v, ratio, &largest);
+
+    /* every key the ratios could have within the tolerance */
+    int lo[5], hi[5], bin[5];
+    for(int ii=0; ii<5; ++ii){
+        lo[ii] = bin[ii] = ratio_bin(ratio[ii] - TETRA_RATIO_TOL);
+        hi[ii] = ratio_bin(ratio[ii] + TETRA_RATIO_TOL);
+    }
+
+    while(1){
+        unsigned int slot = hash_key(bin);
+
+        for(; table[slot][0] != EMPTY; slot = (slot + 1) & (table_size - 1)){
+            double cv[4][3], cat_ratio[5], cat_largest;
+            for(int ii=0; ii<4; ++ii){
+                cat_vector(table[slot][ii], cv[ii]);
+            }
+            edge_ratios(cv, cat_ratio, &cat_largest);
+
+            int close = 1;
+            for(int ii=0; ii<5 && close; ++ii){
+                close = fabs(cat_ratio[ii] - ratio[ii]) < TETRA_RATIO_TOL;
+            }
+
+            if(close && try_match(list, img, table[slot], width, height,
+                        sol) == SUCCESS){
+                return SUCCESS;
+            }
+        }
+
+        /* next key */
+        int ii = 0;
+        while(ii < 5 && bin[ii] == hi[ii]){
+            bin[ii] = lo[ii];
+            ii++;
+        }
+        if(ii == 5){
+            return FAILURE;
+        }
+        bin[ii]++;
+    }
+}
+
+/* load_db:
+ * Read a database saved by save_db.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOENT: the file could not be opened
+ *      EINVAL: the file is damaged or built with other settings
+ *      ENOMEM: no memory for the database
+ */
+static int load_db(const char* fn){
+
+    FILE* fp = fopen(fn, "rb");
+    if(fp == NULL){
+        return ENOENT;
+    }
+
+    db_header_t h;
+    if(fread(&h, sizeof(h), 1, fp) != 1 ||
+            memcmp(h.magic, DB_MAGIC, sizeof(DB_MAGIC)) ||
+            h.version != DB_VERSION ||
+            h.pattern_radius != (float)TETRA_PATTERN_RADIUS ||
+            h.mag_limit != (float)TETRA_MAG_LIMIT ||
+            h.neighbours != TETRA_NEIGHBOURS ||
+            h.bins != TETRA_BINS ||
+            h.n_stars <= 0 || h.n_stars > TETRA_MAX_STARS ||
+            h.table_size == 0 || (h.table_size & (h.table_size - 1))){
+        fclose(fp);
+        logging(WARN, "Tetra", "Database %s is outdated, rebuilding it", fn);
+        return EINVAL;
+    }
+
+    stars = malloc(h.n_stars * sizeof(cat_star_t));
+    table = malloc(h.table_size * sizeof(pattern_t));
+    if(stars == NULL || table == NULL){
+        fclose(fp);
+        free(stars);
+        free(table);
+        stars = NULL;
+        table = NULL;
+        return ENOMEM;
+    }
+
+    if(fread(stars, sizeof(cat_star_t), h.n_stars, fp) != (size_t)h.n_stars ||
+            fread(table, sizeof(pattern_t), h.table_size, fp) != h.table_size){
+        fclose(fp);
+        free(stars);
+        free(table);
+        stars = NULL;
+        table = NULL;
+        logging(WARN, "Tetra", "Database %s is truncated, rebuilding it", fn);
+        return EINVAL;
+    }
+
+    fclose(fp);
+
+    n_stars = h.n_stars;
+    table_size = h.table_size;
+
+    return SUCCESS;
+}
+
+/* save_db:
+ * Write the database to a file.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: the file could not be written, errno set
+ */
+static int save_db(const char* fn){
+
+    db_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DB_MAGIC, sizeof(DB_MAGIC));
+    h.version = DB_VERSION;
+    h.pattern_radius = TETRA_PATTERN_RADIUS;
+    h.mag_limit = TETRA_MAG_LIMIT;
+    h.neighbours = TETRA_NEIGHBOURS;
+    h.bins = TETRA_BINS;
+    h.n_stars = n_stars;
+    h.table_size = table_size;
+
+    FILE* fp = fopen(fn, "wb");
+    if(fp == NULL){
+        return FAILURE;
+    }
+
+    int ret = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+            fwrite(stars, sizeof(cat_star_t), n_stars, fp) == (size_t)n_stars &&
+            fwrite(table, sizeof(pattern_t), table_size, fp) == table_size;
+
+    if(fclose(fp) || !ret){
+        remove(fn);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/* build_db:
+ * Read the catalog and store every pattern of a star and three of its
+ * TETRA_NEIGHBOURS brightest neighbours within TETRA_PATTERN_RADIUS, under
+ * the key of its edge ratios.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOENT: the catalog could not be read
+ *      EINVAL: no stars in the catalog
+ *      ENOMEM: no memory for the database
+ */
+static int build_db(const char* catalog_fn){
+
+    int ret = read_catalog(catalog_fn);
+    if(ret != SUCCESS){
+        return ret;
+    }
+
+    /* at most half full, with every combination of neighbours */
+    const int combinations = TETRA_NEIGHBOURS * (TETRA_NEIGHBOURS - 1)
+            * (TETRA_NEIGHBOURS - 2) / 6;
+    table_size = 1;
+    while(table_size < 2UL * n_stars * combinations){
+        table_size <<= 1;
+    }
+
+    table = malloc(table_size * sizeof(pattern_t));
+    if(table == NULL){
+        free(stars);
+        stars = NULL;
+        logging(ERROR, "Tetra", "No memory for the pattern table");
+        return ENOMEM;
+    }
+    memset(table, 0xff, table_size * sizeof(pattern_t));
+
+    double radius = TETRA_PATTERN_RADIUS * DEG;
+    double cos_radius = cos(radius);
+
+    for(int ii=0; ii<n_stars; ++ii){
+        double v[3];
+        cat_vector(ii, v);
+
+        /* brightest neighbours first */
+        int nb[TETRA_NEIGHBOURS];
+        int n_nb = 0;
+
+        for(int jj=first_star(stars[ii].dec - radius);
+                jj<n_stars && stars[jj].dec <= stars[ii].dec + radius; ++jj){
+
+            double u[3];
+            cat_vector(jj, u);
+            if(jj == ii || dot(u, v) < cos_radius){
+                continue;
+            }
+
+            int pos = n_nb < TETRA_NEIGHBOURS ? n_nb++ : TETRA_NEIGHBOURS;
+            while(pos > 0 && stars[nb[pos-1]].mag > stars[jj].mag){
+                if(pos < TETRA_NEIGHBOURS){
+                    nb[pos] = nb[pos-1];
+                }
+                pos--;
+            }
+            if(pos < TETRA_NEIGHBOURS){
+                nb[pos] = jj;
+            }
+        }
+
+        for(int a=0; a<n_nb; ++a){
+            for(int b=a+1; b<n_nb; ++b){
+                for(int c=b+1; c<n_nb; ++c){
+                    int idx[4] = {ii, nb[a], nb[b], nb[c]};
+                    insert_pattern(idx);
+                }
+            }
+        }
+    }
+
+    return SUCCESS;
+}
+
+/* read_catalog:
+ * Read the stars of a csv catalog of ra, dec and magnitude, keeping the
+ * TETRA_MAX_STARS brightest up to TETRA_MAG_LIMIT sorted by declination.
+ * Lines that are not three numbers, like a header, are skipped.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOENT: the catalog could not be opened
+ *      EINVAL: no stars in the catalog
+ *      ENOMEM: no memory for the stars
+ */
+static int read_catalog(const char* fn){
+
+    FILE* fp = fopen(fn, "r");
+    if(fp == NULL){
+        logging(ERROR, "Tetra", "Failed to open star catalog %s: %m", fn);
+        return ENOENT;
+    }
+
+    int capacity = 1024;
+    n_stars = 0;
+    stars = malloc(capacity * sizeof(cat_star_t));
+
+    char line[200];
+    while(stars != NULL && fgets(line, sizeof(line), fp) != NULL){
+        double ra, dec, mag;
+        if(sscanf(line, "%lf,%lf,%lf", &ra, &dec, &mag) != 3 ||
+                mag > TETRA_MAG_LIMIT){
+            continue;
+        }
+
+        if(n_stars == capacity){
+            capacity *= 2;
+            cat_star_t* tmp = realloc(stars, capacity * sizeof(cat_star_t));
+            if(tmp == NULL){
+                free(stars);
+            }
+            stars = tmp;
+            if(stars == NULL){
+                break;
+            }
+        }
+
+        cat_star_t* s = &stars[n_stars++];
+        s->v[0] = cos(dec * DEG) * cos(ra * DEG);
+        s->v[1] = cos(dec * DEG) * sin(ra * DEG);
+        s->v[2] = sin(dec * DEG);
+        s->dec = dec * DEG;
+        s->mag = mag;
+    }
+
+    fclose(fp);
+
+    if(stars == NULL){
+        logging(ERROR, "Tetra", "No memory for the star catalog");
+        return ENOMEM;
+    }
+    if(n_stars == 0){
+        free(stars);
+        stars = NULL;
+        logging(ERROR, "Tetra", "No stars in catalog %s", fn);
+        return EINVAL;
+    }
+
+    if(n_stars > TETRA_MAX_STARS){
+        qsort(stars, n_stars, sizeof(cat_star_t), cmp_mag);
+        n_stars = TETRA_MAX_STARS;
+    }
+    qsort(stars, n_stars, sizeof(cat_star_t), cmp_dec);
+
+    return SUCCESS;
+}
+
+static int cmp_mag(const void* a, const void* b){
+    float ma = ((const cat_star_t*)a)->mag, mb = ((const cat_star_t*)b)->mag;
+    return (ma > mb) - (ma < mb);
+}
+
+static int cmp_dec(const void* a, const void* b){
+    float da = ((const cat_star_t*)a)->dec, db = ((const cat_star_t*)b)->dec;
+    return (da > db) - (da < db);
+}
+
+/* first_star:
+ * Find the first catalog star at or north of a declination.
+ *
+ * input:
+ *      dec: unit: radians
+ */
+static int first_star(double dec){
+
+    int lo = 0, hi = n_stars;
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        if(stars[mid].dec < dec){
+            lo = mid + 1;
+        }
+        else{
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* insert_pattern:
+ * Add a pattern of catalog stars to the table, unless it is there already
+ * from another of its stars.
+ */
+static void insert_pattern(const int idx[4]){
+
+    uint16_t p[4];
+    double v[4][3];
+
+    /* sorted, so the same stars make the same pattern */
+    for(int ii=0; ii<4; ++ii){
+        int pos = ii;
+        while(pos > 0 && p[pos-1] > idx[ii]){
+            p[pos] = p[pos-1];
+            pos--;
+        }
+        p[pos] = idx[ii];
+    }
+
+    for(int ii=0; ii<4; ++ii){
+        cat_vector(p[ii], v[ii]);
+    }
+
+    double ratio[5], largest;
+    edge_ratios(v, ratio, &largest);
+
+    int bin[5];
+    for(int ii=0; ii<5; ++ii){
+        bin[ii] = ratio_bin(ratio[ii]);
+    }
+
+    unsigned int slot = hash_key(bin);
+    for(; table[slot][0] != EMPTY; slot = (slot + 1) & (table_size - 1)){
+        if(!memcmp(table[slot], p, sizeof(pattern_t))){
+            return;
+        }
+    }
+
+    memcpy(table[slot], p, sizeof(pattern_t));
+}
+
+/* edge_ratios:
+ * Find the shape of a pattern, independent of its size and orientation.
+ *
+ * input:
+ *      v: unit vectors of the stars
+ *
+ * output:
+ *      ratio: the five shortest distances between the stars, smallest first,
+ *             over the largest
+ *      largest: the largest distance, a chord of the unit sphere
+ */
+static void edge_ratios(double v[4][3], double ratio[5], double* largest){
+
+    double e[6];
+    int n = 0;
+
+    for(int ii=0; ii<4; ++ii){
+        for(int jj=ii+1; jj<4; ++jj){
+            double d[3] = {v[ii][0] - v[jj][0], v[ii][1] - v[jj][1],
+                v[ii][2] - v[jj][2]};
+            double len = sqrt(dot(d, d));
+
+            int pos = n++;
+            while(pos > 0 && e[pos-1] > len){
+                e[pos] = e[pos-1];
+                pos--;
+            }
+            e[pos] = len;
+        }
+    }
+
+    for(int ii=0; ii<5; ++ii){
+        ratio[ii] = e[ii] / e[5];
+    }
+    *largest = e[5];
+}
+
+static int ratio_bin(double ratio){
+
+    int bin = (int)floor(ratio * TETRA_BINS);
+    if(bin < 0){
+        return 0;
+    }
+    return bin < TETRA_BINS ? bin : TETRA_BINS - 1;
+}
+
+static unsigned int hash_key(const int bin[5]){
+
+    uint64_t key = 0;
+    for(int ii=0; ii<5; ++ii){
+        key = key * TETRA_BINS + bin[ii];
+    }
+
+    return (unsigned int)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (table_size - 1);
+}
+
+/* try_match:
+ * Check if an image pattern is a catalog pattern of the same shape. The
+ * stars are paired by their distance from the centre of the pattern, the
+ * attitude fitted to them is accepted if enough of the other image stars
+ * fall on catalog stars.
+ *
+ * input:
+ *      img: indices of the image stars
+ *      cat: indices of the catalog stars
+ *
+ * output:
+ *      sol: attitude of the camera
+ *
+ * return:
+ *      SUCCESS: the pattern is identified
+ *      FAILURE: it is not
+ */
+static int try_match(const star_list_t* list, const int img[4],
+        const uint16_t cat[4], int width, int height, tetra_solution_t* sol){
+
+    double iv[4][3], cv[4][3];
+    double ratio[5], img_largest, cat_largest;
+
+    double f = width / 2.0 / tan(TETRA_FOV / 2 * DEG);
+    int par = parity;
+
+    for(int ii=0; ii<4; ++ii){
+        img_vector(&list->star[img[ii]], width, height, f, par, iv[ii]);
+        cat_vector(cat[ii], cv[ii]);
+    }
+
+    /* the scale of the image from the size of the pattern */
+    edge_ratios(iv, ratio, &img_largest);
+    edge_ratios(cv, ratio, &cat_largest);
+    f *= img_largest / cat_largest;
+
+    double fov = 2 * atan(width / 2.0 / f) / DEG;
+    if(fabs(fov / TETRA_FOV - 1) > TETRA_FOV_TOL){
+        return FAILURE;
+    }
+
+    for(int ii=0; ii<4; ++ii){
+        img_vector(&list->star[img[ii]], width, height, f, par, iv[ii]);
+    }
+
+    int img_order[4], cat_order[4];
+    canonical_order(iv, img_order);
+    canonical_order(cv, cat_order);
+
+    /* a mirror image has the opposite turn */
+    if((orientation(iv, img_order) > 0) != (orientation(cv, cat_order) > 0)){
+        par = -par;
+        for(int ii=0; ii<4; ++ii){
+            img_vector(&list->star[img[ii]], width, height, f, par, iv[ii]);
+        }
+    }
+
+    double cam[TETRA_VERIFY_STARS][3], sky[TETRA_VERIFY_STARS][3];
+    for(int ii=0; ii<4; ++ii){
+        memcpy(cam[ii], iv[img_order[ii]], sizeof(cam[ii]));
+        memcpy(sky[ii], cv[cat_order[ii]], sizeof(sky[ii]));
+    }
+
+    double R[3][3];
+    attitude(cam, sky, 4, R);
+
+    /* every star of the pattern has to fit */
+    double cos_tol = cos(TETRA_MATCH_PIXELS / f);
+    for(int ii=0; ii<4; ++ii){
+        double r[3];
+        for(int jj=0; jj<3; ++jj){
+            r[jj] = dot(R[jj], cam[ii]);
+        }
+        if(dot(r, sky[ii]) < cos_tol){
+            return FAILURE;
+        }
+    }
+
+    int img_idx[TETRA_VERIFY_STARS];
+    int n = verify(R, list, width, height, f, par, cam, sky, img_idx);
+    if(n < TETRA_MIN_MATCHES){
+        return FAILURE;
+    }
+
+    /* refine the scale with every identified star */
+    f *= scale(cam, sky, n);
+
+    for(int ii=0; ii<n; ++ii){
+        img_vector(&list->star[img_idx[ii]], width, height, f, par, cam[ii]);
+    }
+
+    attitude(cam, sky, n, R);
+
+    parity = par;
+    solution(R, width, f, sol);
+    sol->matches = n;
+
+    return SUCCESS;
+}
+
+/* img_vector:
+ * Find the direction of an image star in the camera frame, x along the
+ * rows, y along the columns and z out through the centre of the image.
+ *
+ * input:
+ *      f: focal length, unit: pixels
+ *      par: -1 to mirror the image
+ */
+static void img_vector(const star_t* s, int width, int height, double f,
+        int par, double v[3]){
+
+    double x = par * (s->x - (width - 1) / 2.0);
+    double y = s->y - (height - 1) / 2.0;
+    double norm = sqrt(x*x + y*y + f*f);
+
+    v[0] = x / norm;
+    v[1] = y / norm;
+    v[2] = f / norm;
+}
+
+/* canonical_order:
+ * Order the stars of a pattern by their distance from its centre.
+ */
+static void canonical_order(double v[4][3], int order[4]){
+
+    double centre[3] = {0}, dist[4];
+
+    for(int ii=0; ii<4; ++ii){
+        for(int jj=0; jj<3; ++jj){
+            centre[jj] += v[ii][jj] / 4;
+        }
+    }
+
+    for(int ii=0; ii<4; ++ii){
+        double d[3] = {v[ii][0] - centre[0], v[ii][1] - centre[1],
+            v[ii][2] - centre[2]};
+        double len = dot(d, d);
+
+        int pos = ii;
+        while(pos > 0 && dist[pos-1] > len){
+            dist[pos] = dist[pos-1];
+            order[pos] = order[pos-1];
+            pos--;
+        }
+        dist[pos] = len;
+        order[pos] = ii;
+    }
+}
+
+/* orientation:
+ * Find which way the first three stars of a pattern turn, seen from the
+ * centre of the sphere.
+ */
+static double orientation(double v[4][3], const int order[4]){
+
+    const double* a = v[order[0]];
+    const double* b = v[order[1]];
+    const double* c = v[order[2]];
+
+    double ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    double ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    double n[3] = {ab[1]*ac[2] - ab[2]*ac[1], ab[2]*ac[0] - ab[0]*ac[2],
+        ab[0]*ac[1] - ab[1]*ac[0]};
+
+    return dot(n, a);
+}
+
+/* verify:
+ * Project the catalog stars in the field of view into the image and pair
+ * them with the brightest image stars.
+ *
+ * input:
+ *      R: rotation from the camera frame to the equatorial frame
+ *      f: focal length, unit: pixels
+ *      par: -1 to mirror the image
+ *
+ * output:
+ *      cam, sky: unit vectors of the paired stars in the camera and the
+ *                equatorial frame, TETRA_VERIFY_STARS long
+ *      img_idx: index of the paired image stars
+ *
+ * return:
+ *      the number of pairs
+ */
+static int verify(double R[3][3], const star_list_t* list, int width,
+        int height, double f, int par, double cam[][3], double sky[][3],
+        int* img_idx){
+
+    int n_proj = project(R, width, height, f, par, TETRA_MATCH_PIXELS);
+
+    int n = 0;
+    int n_img = list->n < TETRA_VERIFY_STARS ? list->n : TETRA_VERIFY_STARS;
+    double tol = TETRA_MATCH_PIXELS * TETRA_MATCH_PIXELS;
+
+    for(int ii=0; ii<n_img; ++ii){
+        int best = -1;
+        double best_d = tol;
+
+        for(int jj=0; jj<n_proj; ++jj){
+            double dx = proj_x[jj] - list->star[ii].x;
+            double dy = proj_y[jj] - list->star[ii].y;
+            double d = dx*dx + dy*dy;
+            if(d < best_d && !used[jj]){
+                best = jj;
+                best_d = d;
+            }
+        }
+
+        if(best >= 0){
+            used[best] = 1;
+            img_vector(&list->star[ii], width, height, f, par, cam[n]);
+            cat_vector(proj_idx[best], sky[n]);
+            img_idx[n] = ii;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/* project:
+ * Project the catalog stars in the field of view into the image, as
+ * proj_x, proj_y and proj_idx, none of them used.
+ *
+ * input:
+ *      R: rotation from the camera frame to the equatorial frame
+ *      f: focal length, unit: pixels
+ *      par: -1 to mirror the image
+ *      margin: stars this far outside the image are included, unit: pixels
+ *
+ * return:
+ *      the number of stars projected, at most MAX_PROJ
+ */
+static int project(double R[3][3], int width, int height, double f, int par,
+        double margin){
+
+    int n_proj = 0;
+
+    double cx = (width - 1) / 2.0, cy = (height - 1) / 2.0;
+    double boresight[3] = {R[0][2], R[1][2], R[2][2]};
+    double dec = asin(boresight[2]);
+    double radius = atan(sqrt(cx*cx + cy*cy) / f) + margin / f;
+    double cos_radius = cos(radius);
+
+    for(int ii=first_star(dec - radius);
+            ii<n_stars && stars[ii].dec <= dec + radius && n_proj < MAX_PROJ;
+            ++ii){
+
+        double s[3];
+        cat_vector(ii, s);
+        if(dot(s, boresight) < cos_radius){
+            continue;
+        }
+
+        /* R is orthonormal, its transpose takes the star to the camera */
+        double c[3];
+        for(int jj=0; jj<3; ++jj){
+            c[jj] = R[0][jj]*s[0] + R[1][jj]*s[1] + R[2][jj]*s[2];
+        }
+
+        proj_x[n_proj] = cx + par * f * c[0] / c[2];
+        proj_y[n_proj] = cy + f * c[1] / c[2];
+        proj_idx[n_proj] = ii;
+        used[n_proj] = 0;
+        n_proj++;
+    }
+
+    return n_proj;
+}
+
+/* track_offset:
+ * Find the offset between the image stars and the projected catalog stars
+ * shared by most pairs of them, the cell of TETRA_TRACK_CELL pixels with the
+ * most pairs together with its neighbours.
+ *
+ * output:
+ *      dx, dy: mean offset of the pairs around that cell, unit: pixels
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: less than 3 pairs share an offset
+ */
+static int track_offset(const star_list_t* list, int n_proj, double* dx,
+        double* dy){
+
+    static unsigned short votes[TRACK_CELLS][TRACK_CELLS];
+    memset(votes, 0, sizeof(votes));
+
+    int n_img = list->n < TETRA_VERIFY_STARS ? list->n : TETRA_VERIFY_STARS;
+
+    for(int ii=0; ii<n_img; ++ii){
+        for(int jj=0; jj<n_proj; ++jj){
+            double ox = list->star[ii].x - proj_x[jj] + TETRA_TRACK_PIXELS;
+            double oy = list->star[ii].y - proj_y[jj] + TETRA_TRACK_PIXELS;
+            if(ox >= 0 && oy >= 0 && ox < TRACK_CELLS * TETRA_TRACK_CELL &&
+                    oy < TRACK_CELLS * TETRA_TRACK_CELL){
+                votes[(int)oy / TETRA_TRACK_CELL][(int)ox / TETRA_TRACK_CELL]++;
+            }
+        }
+    }
+
+    int best = 0, best_x = 0, best_y = 0;
+    for(int y=1; y<TRACK_CELLS-1; ++y){
+        for(int x=1; x<TRACK_CELLS-1; ++x){
+            int sum = 0;
+            for(int ii=-1; ii<=1; ++ii){
+                sum += votes[y+ii][x-1] + votes[y+ii][x] + votes[y+ii][x+1];
+            }
+            if(sum > best){
+                best = sum;
+                best_x = x;
+                best_y = y;
+            }
+        }
+    }
+
+    if(best < 3){
+        return FAILURE;
+    }
+
+    double sum_x = 0, sum_y = 0;
+    int n = 0;
+    for(int ii=0; ii<n_img; ++ii){
+        for(int jj=0; jj<n_proj; ++jj){
+            double ox = list->star[ii].x - proj_x[jj];
+            double oy = list->star[ii].y - proj_y[jj];
+            int cx = (int)floor((ox + TETRA_TRACK_PIXELS) / TETRA_TRACK_CELL);
+            int cy = (int)floor((oy + TETRA_TRACK_PIXELS) / TETRA_TRACK_CELL);
+            if(abs(cx - best_x) <= 1 && abs(cy - best_y) <= 1){
+                sum_x += ox;
+                sum_y += oy;
+                n++;
+            }
+        }
+    }
+
+    *dx = sum_x / n;
+    *dy = sum_y / n;
+
+    return SUCCESS;
+}
+
+/* scale:
+ * Find the correction of the focal length from the spread of identified
+ * stars around their centre, in the camera and in the catalog.
+ *
+ * input:
+ *      cam, sky: unit vectors of n paired stars
+ *
+ * return:
+ *      the factor to multiply the focal length with
+ */
+static double scale(double cam[][3], double sky[][3], int n){
+
+    double img_mean[3] = {0}, cat_mean[3] = {0};
+    for(int ii=0; ii<n; ++ii){
+        for(int jj=0; jj<3; ++jj){
+            img_mean[jj] += cam[ii][jj] / n;
+            cat_mean[jj] += sky[ii][jj] / n;
+        }
+    }
+
+    double img_spread = 0, cat_spread = 0;
+    for(int ii=0; ii<n; ++ii){
+        double di[3], dc[3];
+        for(int jj=0; jj<3; ++jj){
+            di[jj] = cam[ii][jj] - img_mean[jj];
+            dc[jj] = sky[ii][jj] - cat_mean[jj];
+        }
+        img_spread += sqrt(dot(di, di));
+        cat_spread += sqrt(dot(dc, dc));
+    }
+
+    return img_spread / cat_spread;
+}
+
+/* hint_attitude:
+ * Find the rotation from the camera frame to the equatorial frame of an
+ * attitude, the inverse of solution.
+ */
+static void hint_attitude(const tetra_solution_t* hint, double R[3][3]){
+
+    double ra = hint->ra * DEG, dec = hint->dec * DEG, roll = hint->roll * DEG;
+
+    double boresight[3] = {cos(dec) * cos(ra), cos(dec) * sin(ra), sin(dec)};
+    double north[3] = {-sin(dec) * cos(ra), -sin(dec) * sin(ra), cos(dec)};
+    double east[3] = {-sin(ra), cos(ra), 0};
+
+    double up[3];
+    for(int ii=0; ii<3; ++ii){
+        up[ii] = cos(roll) * north[ii] + sin(roll) * east[ii];
+    }
+
+    /* the rows complete a right handed frame */
+    double x[3] = {up[1]*boresight[2] - up[2]*boresight[1],
+        up[2]*boresight[0] - up[0]*boresight[2],
+        up[0]*boresight[1] - up[1]*boresight[0]};
+
+    for(int ii=0; ii<3; ++ii){
+        R[ii][0] = x[ii];
+        R[ii][1] = up[ii];
+        R[ii][2] = boresight[ii];
+    }
+}
+
+/* attitude:
+ * Find the rotation that best takes star directions in the camera frame to
+ * the catalog directions, with Davenport's q-method.
+ *
+ * input:
+ *      cam, sky: unit vectors of n paired stars
+ *
+ * output:
+ *      R: rotation from the camera frame to the equatorial frame
+ */
+static void attitude(double cam[][3], double sky[][3], int n, double R[3][3]){
+
+    double B[3][3] = {{0}};
+    for(int kk=0; kk<n; ++kk){
+        for(int ii=0; ii<3; ++ii){
+            for(int jj=0; jj<3; ++jj){
+                B[ii][jj] += cam[kk][ii] * sky[kk][jj];
+            }
+        }
+    }
+
+    double sigma = B[0][0] + B[1][1] + B[2][2];
+    double K[4][4];
+    for(int ii=0; ii<3; ++ii){
+        for(int jj=0; jj<3; ++jj){
+            K[ii][jj] = B[ii][jj] + B[jj][ii] - (ii == jj ? sigma : 0);
+        }
+    }
+    K[0][3] = K[3][0] = B[1][2] - B[2][1];
+    K[1][3] = K[3][1] = B[2][0] - B[0][2];
+    K[2][3] = K[3][2] = B[0][1] - B[1][0];
+    K[3][3] = sigma;
+
+    double q[4];
+    largest_eigenvector(K, q);
+
+    /* the quaternion takes the equatorial frame to the camera frame */
+    double s = q[3]*q[3] - q[0]*q[0] - q[1]*q[1] - q[2]*q[2];
+    double A[3][3] = {
+        {s + 2*q[0]*q[0], 2*q[0]*q[1] + 2*q[3]*q[2], 2*q[0]*q[2] - 2*q[3]*q[1]},
+        {2*q[1]*q[0] - 2*q[3]*q[2], s + 2*q[1]*q[1], 2*q[1]*q[2] + 2*q[3]*q[0]},
+        {2*q[2]*q[0] + 2*q[3]*q[1], 2*q[2]*q[1] - 2*q[3]*q[0], s + 2*q[2]*q[2]}
+    };
+
+    for(int ii=0; ii<3; ++ii){
+        for(int jj=0; jj<3; ++jj){
+            R[ii][jj] = A[jj][ii];
+        }
+    }
+}
+
+/* largest_eigenvector:
+ * Find the eigenvector of the largest eigenvalue of a symmetric matrix with
+ * Jacobi rotations. K is destroyed.
+ */
+static void largest_eigenvector(double K[4][4], double q[4]){
+
+    double V[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+
+    for(int sweep=0; sweep<50; ++sweep){
+        double off = 0;
+        for(int ii=0; ii<4; ++ii){
+            for(int jj=ii+1; jj<4; ++jj){
+                off += K[ii][jj] * K[ii][jj];
+            }
+        }
+        if(off < 1e-24){
+            break;
+        }
+
+        for(int p=0; p<4; ++p){
+            for(int r=p+1; r<4; ++r){
+                if(K[p][r] == 0){
+                    continue;
+                }
+
+                double theta = (K[r][r] - K[p][p]) / (2 * K[p][r]);
+                double t = (theta >= 0 ? 1 : -1) /
+                        (fabs(theta) + sqrt(theta*theta + 1));
+                double c = 1 / sqrt(t*t + 1);
+                double s = t * c;
+
+                for(int k=0; k<4; ++k){
+                    double kp = K[k][p], kr = K[k][r];
+                    K[k][p] = c*kp - s*kr;
+                    K[k][r] = s*kp + c*kr;
+                }
+                for(int k=0; k<4; ++k){
+                    double pk = K[p][k], rk = K[r][k];
+                    K[p][k] = c*pk - s*rk;
+                    K[r][k] = s*pk + c*rk;
+                }
+                for(int k=0; k<4; ++k){
+                    double vp = V[k][p], vr = V[k][r];
+                    V[k][p] = c*vp - s*vr;
+                    V[k][r] = s*vp + c*vr;
+                }
+            }
+        }
+    }
+
+    int best = 0;
+    for(int ii=1; ii<4; ++ii){
+        if(K[ii][ii] > K[best][best]){
+            best = ii;
+        }
+    }
+
+    for(int ii=0; ii<4; ++ii){
+        q[ii] = V[ii][best];
+    }
+}
+
+/* solution:
+ * Express the attitude of the camera as the direction of the image centre
+ * and the roll of the rows about it.
+ *
+ * input:
+ *      R: rotation from the camera frame to the equatorial frame
+ *      f: focal length, unit: pixels
+ */
+static void solution(double R[3][3], int width, double f,
+        tetra_solution_t* sol){
+
+    double boresight[3] = {R[0][2], R[1][2], R[2][2]};
+    double up[3] = {R[0][1], R[1][1], R[2][1]};
+
+    double ra = atan2(boresight[1], boresight[0]);
+    double dec = asin(boresight[2]);
+
+    double north[3] = {-sin(dec) * cos(ra), -sin(dec) * sin(ra), cos(dec)};
+    double east[3] = {-sin(ra), cos(ra), 0};
+    double roll = atan2(dot(up, east), dot(up, north));
+
+    sol->ra = ra >= 0 ? ra / DEG : ra / DEG + 360;
+    sol->dec = dec / DEG;
+    sol->roll = roll >= 0 ? roll / DEG : roll / DEG + 360;
+    sol->fov = 2 * atan(width / 2.0 / f) / DEG;
+}
@@ -0,0 +1,99 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Tetra
+ * Parent Component: Star Tracker Poller
+ * Author(s): 
+ * Purpose: Identify the stars of a guiding image by the shape of four star
+ *          patterns, looked up in a database built from a star catalog, and
+ *          find the attitude of the camera from them.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "img_processing.h"
+
+/* horizontal field of view of the guiding camera, unit: degrees */
+#define TETRA_FOV 9.0
+
+/* the stars of a pattern are all within this distance of one of them, less
+ * than half the vertical field of view, unit: degrees
+ */
+#define TETRA_PATTERN_RADIUS 2.2
+
+/* the faintest catalog stars used */
+#define TETRA_MAG_LIMIT 7.5
+
+/* tetra_solution_t:
+ * Attitude of the guiding camera.
+ */
+typedef struct{
+    double ra, dec;         /* of the image centre, unit: degrees */
+    double roll;            /* direction of increasing rows, east of north,
+                             * unit: degrees */
+    double fov;             /* horizontal, unit: degrees */
+    int matches;            /* image stars identified */
+} tetra_solution_t;
+
+/* init_tetra:
+ * Load the pattern database. If it is missing, or was built with other
+ * settings, it is built from the star catalog and saved for the next start.
+ *
+ * input:
+ *      db_fn: the pattern database
+ *      catalog_fn: csv file of ra, dec (degrees) and magnitude of the stars
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOENT: neither database nor catalog could be read
+ *      ENOMEM: no memory for the database
+ *      EINVAL: no stars in the catalog
+ */
+int init_tetra(const char* db_fn, const char* catalog_fn);
+
+/* tetra_ready:
+ * Check if the database is loaded.
+ */
+int tetra_ready(void);
+
+/* tetra_solve:
+ * Identify the stars of an image without any prior attitude. Patterns of
+ * the brightest stars are tried until one is confirmed by the other stars
+ * of the image. Only one thread may call it at a time.
+ *
+ * input:
+ *      stars: the stars of the image, brightest first
+ *      width, height: size of the image in pixels
+ *
+ * output:
+ *      sol: attitude of the camera
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENODATA: the database is not loaded
+ *      FAILURE: no pattern could be identified
+ */
+int tetra_solve(const star_list_t* stars, int width, int height,
+        tetra_solution_t* sol);
+
+/* tetra_track:
+ * Identify the stars of an image from an attitude close to it, by pairing
+ * them with the catalog stars predicted around the hint. Much faster than
+ * tetra_solve, the error of the hint has to be within about 100 pixels and
+ * the image parity is the one of the last tetra_solve. Only one thread may
+ * call it at a time.
+ *
+ * input:
+ *      stars: the stars of the image, brightest first
+ *      width, height: size of the image in pixels
+ *      hint: the expected attitude of the camera
+ *
+ * output:
+ *      sol: attitude of the camera
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENODATA: the database is not loaded
+ *      FAILURE: the stars do not match the hint
+ */
+int tetra_track(const star_list_t* stars, int width, int height,
+        const tetra_solution_t* hint, tetra_solution_t* sol);
@@ -45,11 +45,21 @@ void get_encoder(encoder_t* encoder){
     get_encoder_local(encoder);
 }
 
+/* interpolate the encoder data to a time */
+int get_encoder_at(const struct timespec* time, encoder_t* encoder){
+    return get_encoder_at_l(time, encoder);
+}
+
 /* fetch the latest gyro data */
 void get_gyro(gyro_t* gyro){
     get_gyro_local(gyro);
 }
 
+/* take the gyro samples since the last call */
+int drain_gyro(gyro_t* samples, int max){
+    return drain_gyro_l(samples, max);
+}
+
 /* set offsets for the azimuth and altitude angle encoders */
 int set_enc_offsets(void){
     return set_enc_offsets_l();
@@ -60,9 +70,9 @@ void get_star_tracker(star_tracker_t* st){
     get_star_tracker_local(st);
 }
 
-/* return the pid for the star tracker child process */
-pid_t get_star_tracker_pid(void){
-    return get_st_pid();
+/* take the star tracker fixes since the last call */
+int drain_star_tracker(star_tracker_t* st, int max){
+    return drain_star_tracker_l(st, max);
 }
 
 /* set the exposure time (in microseconds) and gain for the star tracker */
@@ -78,6 +88,10 @@ int get_st_exp(void){
     return get_st_exp_l();
 }
 
+void send_st_stats(void){
+    send_st_stats_l();
+}
+
 /* fetch a single sample from the encoder */
 int enc_single_samp(encoder_t* enc){
     return enc_single_samp_l(enc);
@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <time.h>
+
 extern pthread_mutex_t mutex_cond_st;
 extern pthread_cond_t cond_st;
 
@@ -20,25 +22,38 @@ extern pthread_cond_t cond_gyro;
 /* The out_of_date flag shows if the available data is the latest (value: 0)
  * or if an error occured in the respective module while updating (value: 1).
  * If an error has occured, the data in the struct is the latest valid data.
+ *
+ * time is the CLOCK_MONOTONIC time of the sample and seq its number, 0 before
+ * the first one, both filled in by the get functions.
  */
 
 typedef struct{
     float lat, lon, alt;
+    struct timespec time;
+    unsigned long seq;
     char out_of_date;
 } gps_t;
 
 typedef struct{
     double x, y, z;
+    struct timespec time;
+    unsigned long seq;
     char out_of_date;
 } gyro_t;
 
 typedef struct{
     double az, alt_ang;
+    struct timespec time;   /* middle of the spi transfers */
+    unsigned long seq;
     char out_of_date;
 } encoder_t;
 
 typedef struct{
     double ra, dec, roll;
+    struct timespec exp_start, exp_end; /* CLOCK_MONOTONIC exposure of the
+                                           image solved */
+    struct timespec time;
+    unsigned long seq;
     char out_of_date, new_data;
 } star_tracker_t;
 
@@ -59,6 +74,8 @@ typedef struct{
             nir,
             guiding,
             cpu;
+    struct timespec time;
+    unsigned long seq;
     char out_of_date;
 } temp_t;
 
@@ -71,17 +88,31 @@ void get_gps(gps_t* gps);
 /* fetch the latest encoder data */
 void get_encoder(encoder_t* encoder);
 
+/* interpolate the encoder data to a CLOCK_MONOTONIC time, clamped to the
+ * samples kept, returns ENODATA before the first sample
+ */
+int get_encoder_at(const struct timespec* time, encoder_t* encoder);
+
 /* fetch the latest gyro data */
 void get_gyro(gyro_t* gyro);
 
+/* take every gyro sample since the last call, at most max, oldest first and
+ * each with the time it was taken. For a single consumer, the kalman filter.
+ * Returns the number of samples.
+ */
+int drain_gyro(gyro_t* samples, int max);
+
 /* set offsets for the azimuth and altitude angle encoders */
 int set_enc_offsets(void);
 
 /* fetch the latest star tracker data */
 void get_star_tracker(star_tracker_t* st);
 
-/* return the pid for the star tracker child process */
-pid_t get_star_tracker_pid(void);
+/* take every star tracker fix since the last call, at most max, oldest
+ * first. For a single consumer, the kalman filter. Returns the number of
+ * fixes.
+ */
+int drain_star_tracker(star_tracker_t* st, int max);
 
 /* set the exposure time (in microseconds) and gain for the star tracker */
 void set_st_exp(int st_exp);
@@ -89,6 +120,9 @@ void set_st_gain(int st_gain);
 
 int get_st_exp(void);
 
+/* send the statistics of the star tracker solutions as telemetry */
+void send_st_stats(void);
+
 /* fetch a single sample from the encoder */
 int enc_single_samp(encoder_t* enc);
 
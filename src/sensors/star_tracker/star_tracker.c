@@ -8,66 +8,88 @@
  */
 
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include "global_utils.h"
+#include "seq_store.h"
+#include "sample_ring.h"
 #include "sensors.h"
 #include "star_tracker.h"
 
-static pthread_mutex_t mutex_st;
-static star_tracker_t st_local;
+/* fixes kept for the kalman filter, a fix takes a second or more */
+#define ST_RING_SIZE 8
+
+static star_tracker_t st_local[2] = {{.out_of_date = 1}, {.out_of_date = 1}};
+
+static star_tracker_t st_samples[ST_RING_SIZE];
+static sample_slot_t st_slots[ST_RING_SIZE];
+
+static seq_store_t store_st =
+    SEQ_STORE_INITIALIZER("star_tracker", st_local, sizeof(star_tracker_t));
+static sample_ring_t ring_st =
+    SAMPLE_RING_INITIALIZER("star_tracker", st_samples, st_slots,
+            sizeof(star_tracker_t), ST_RING_SIZE);
+
+/* number of the last sample fetched, for the new_data flag */
+static atomic_ulong st_fetched;
 
 int init_star_tracker(void* args){
 
-    st_local.ra = 0;
-    st_local.dec = 0;
-    st_local.roll = 0;
-    st_local.out_of_date = 1;
-    st_local.new_data = 0;
-
-    int ret = pthread_mutex_init( &mutex_st, NULL );
-    if( ret ){
-        logging(ERROR, "INIT",
-                "The initialisation of the star tracker"
-                " mutex failed with code %d.\n", ret);
-        return FAILURE;
+    int ret = seq_store_register(&store_st);
+    if(ret != SUCCESS){
+        return ret;
     }
 
-    return SUCCESS;
+    return sample_ring_register(&ring_st);
 }
 
 void get_star_tracker_local(star_tracker_t* st){
 
-    pthread_mutex_lock(&mutex_st);
-
-    st->ra = st_local.ra;
-    st->dec = st_local.dec;
-    st->roll = st_local.roll;
-    st->out_of_date = st_local.out_of_date;
-    st->new_data = st_local.new_data;
+    seq_sample_t sample;
+    seq_store_read(&store_st, st, &sample);
 
-    st_local.new_data = 0;
+    st->time = sample.time;
+    st->seq = sample.seq;
 
-    pthread_mutex_unlock(&mutex_st);
+    /* a sample is new to the first fetch only */
+    st->new_data = atomic_exchange(&st_fetched, sample.seq) != sample.seq;
 }
 
 void set_star_tracker(star_tracker_t* st){
 
-    pthread_mutex_lock(&mutex_st);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    star_tracker_t new = *st;
+    new.out_of_date = 0;
 
-    st_local.ra = st->ra;
-    st_local.dec = st->dec;
-    st_local.roll = st->roll;
-    st_local.out_of_date = 0;
-    st_local.new_data = 1;
+    seq_store_write(&store_st, &new, &now);
+    sample_ring_push(&ring_st, &new, &now);
+}
+
+int drain_star_tracker_l(star_tracker_t* st, int max){
+
+    seq_sample_t sample[ST_RING_SIZE];
+    if(max > ST_RING_SIZE){
+        max = ST_RING_SIZE;
+    }
+
+    int n = sample_ring_drain(&ring_st, st, sample, max);
+    for(int ii=0; ii<n; ++ii){
+        st[ii].time = sample[ii].time;
+        st[ii].seq = sample[ii].seq;
+        st[ii].new_data = 1;
+    }
 
-    pthread_mutex_unlock(&mutex_st);
+    return n;
 }
 
 void st_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_st);
+    star_tracker_t st;
+    seq_store_read(&store_st, &st, NULL);
 
-    st_local.out_of_date = 1;
+    st.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_st);
+    seq_store_write(&store_st, &st, NULL);
 }
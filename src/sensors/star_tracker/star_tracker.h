@@ -14,6 +14,9 @@ int init_star_tracker(void* args);
 /* fetch the latest star tracker data */
 void get_star_tracker_local(star_tracker_t* st);
 
+/* take the fixes since the last call, oldest first */
+int drain_star_tracker_l(star_tracker_t* st, int max);
+
 /* update the star trackar data */
 void set_star_tracker(star_tracker_t* st);
 
@@ -10,40 +10,45 @@
 #include <pthread.h>
 
 #include "global_utils.h"
+#include "seq_store.h"
 #include "sensors.h"
 
-static temp_t temp_local = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
-static pthread_mutex_t mutex_temp = PTHREAD_MUTEX_INITIALIZER;
+static temp_t temp_local[2] = {{.out_of_date = 1}, {.out_of_date = 1}};
+
+static seq_store_t store_temp =
+    SEQ_STORE_INITIALIZER("temp", temp_local, sizeof(temp_t));
 
 int init_temperature(void* args){
-    return SUCCESS;
+    return seq_store_register(&store_temp);
 }
 
 void get_temp_l(temp_t* temp){
 
-    pthread_mutex_lock(&mutex_temp);
-
-    *temp = temp_local;
+    seq_sample_t sample;
+    seq_store_read(&store_temp, temp, &sample);
 
-    pthread_mutex_unlock(&mutex_temp);
+    temp->time = sample.time;
+    temp->seq = sample.seq;
 }
 
 void set_temp(temp_t* temp){
 
-    pthread_mutex_lock(&mutex_temp);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    temp_local = *temp;
-    temp_local.out_of_date = 0;
+    temp_t new = *temp;
+    new.out_of_date = 0;
 
-    pthread_mutex_unlock(&mutex_temp);
+    seq_store_write(&store_temp, &new, &now);
 }
 
 /* set the out of date flag on the temp data */
 void temp_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_temp);
+    temp_t temp;
+    seq_store_read(&store_temp, &temp, NULL);
 
-    temp_local.out_of_date = 1;
+    temp.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_temp);
+    seq_store_write(&store_temp, &temp, NULL);
 }
@@ -9,6 +9,11 @@
 
 #pragma once
 
+#include "prio_queue.h"
+
+/* most messages waiting to be sent, further messages are dropped */
+#define DOWNLINK_QUEUE_SIZE 4096
+
 /**
  * Node structure declaration.
  */
@@ -17,7 +22,6 @@ typedef struct node {
     int priority;       // Lower values indicate higher priority
     int flag;           // If 1 data is in a file, if 0 data as a string.
     unsigned short packets_sent;
-    struct node *next;  // Pointer to the node next on the list.
 
 } downlink_node;
 
@@ -34,4 +38,7 @@ struct node read_downlink_queue();
 /* Return the highest priority in the queue */
 int queue_priority();
 
+/* Depth, throughput and dropped messages of the queue */
+void downlink_queue_stats_local(prio_queue_stats_t *stats);
+
 void check_downlink_list_local(void);
@@ -33,7 +33,7 @@ int init_telemetry(void* args){
  *              priority).
  * @param flag  Indicate if data is a filepath(1) or string(0)
  *
- * @return      0
+ * @return      0, ENOSPC if the queue is full
  */
 int send_telemetry(char *filepath, int p, int flag, unsigned short packets_sent) {
     return send_telemetry_local(filepath, p, flag, packets_sent);